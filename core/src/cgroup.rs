@@ -0,0 +1,384 @@
+//! ROCKER 的 cgroup(v2) 资源限制.
+//!
+//! 请求中带有任一资源限制时, JM 在 `ROCKER_CGROUP_ROOT`(默认 /sys/fs/cgroup/rocker)之下
+//! 为该 ROCKER 创建一个 cgroup 并写入各项限制, 然后以 clone3(CLONE_INTO_CGROUP)
+//! 直接在其中创建 JG, 限制自 JG 的第一条指令起即生效, 不存在先创建再迁移的时间窗口.
+//!
+//! App 进程位于其子 cgroup `app` 中, 由 JC 在创建 App 进程时直接置入, 各项限制作用于整个子树;
+//! JG 经由 `app/cgroup.events` 中的 populated 字段获知所有 App 进程均已退出.
+//! ROCKER 的 cgroup 自身不向下开放任何控制器, 故 JG 可与子 cgroup 并存.
+//!
+//! 不带资源限制的请求不创建 cgroup, 行为与此前一致.
+
+use crate::{
+    _info, alt, d,
+    err::*,
+    errgen, errgen_sys,
+    master::{FD, PID},
+};
+use lazy_static::lazy_static;
+use nix::{errno::Errno, fcntl::OFlag, sched::CloneFlags, sys::stat::Mode};
+use std::{
+    env, fs, mem,
+    path::{Path, PathBuf},
+};
+
+const ENV_CGROUP_ROOT: &str = "ROCKER_CGROUP_ROOT";
+const CGROUP_ROOT: &str = "/sys/fs/cgroup/rocker";
+
+// 需要向各 ROCKER 的 cgroup 开放的控制器
+const CONTROLLERS: [&str; 4] = ["memory", "cpu", "io", "pids"];
+
+// App 进程所在的子 cgroup
+const APP_CGROUP: &str = "app";
+
+// `man clone3(2)`, libc 尚未提供此常量
+const SYS_CLONE3: libc::c_long = 435;
+const CLONE_INTO_CGROUP: u64 = 0x2_0000_0000;
+
+lazy_static! {
+    // 为 None 时, cgroup v2 不可用, 带有资源限制的请求均失败
+    static ref ROOT: Option<PathBuf> = root_init();
+}
+
+/// 资源限制, 各项为 None(或空)时不限制
+#[derive(Clone, Debug, Default, PartialEq)]
+pub struct CgroupLimits {
+    /// memory.max, 单位: 字节
+    pub memory_max: Option<u64>,
+    /// memory.high, 单位: 字节
+    pub memory_high: Option<u64>,
+    /// cpu.max: (每个周期内可用的 CPU 时间, 周期), 单位: 微秒
+    pub cpu_max: Option<(u32, u32)>,
+    /// cpu.weight, 取值范围 [1, 10000]
+    pub cpu_weight: Option<u32>,
+    /// io.max, 每项对应一个设备, 如 "8:0 rbps=1048576 wiops=120"
+    pub io_max: Vec<String>,
+    /// pids.max
+    pub pids_max: Option<u32>,
+}
+
+impl CgroupLimits {
+    /// 是否不含任何限制
+    pub fn is_empty(&self) -> bool {
+        *self == CgroupLimits::default()
+    }
+
+    /// 检查各项取值的合法性, 取值范围与内核一致
+    pub fn check(&self) -> Result<()> {
+        let ok = self.cpu_max.map_or(true, |(quota, period)| {
+            1000 <= quota && 1000 <= period && 1_000_000 >= period
+        }) && self.cpu_weight.map_or(true, |w| 1 <= w && 10000 >= w)
+            && self.io_max.iter().all(|l| io_max_valid(l));
+
+        alt!(ok, Ok(()), Err(errgen!(CgroupLimitInvalid)))
+    }
+
+    // 依次写入的 (控制文件, 内容), io.max 每个设备写入一次
+    fn entries(&self) -> Vec<(&'static str, String)> {
+        let mut res = vec![];
+        if let Some(v) = self.memory_high {
+            res.push(("memory.high", v.to_string()));
+        }
+        if let Some(v) = self.memory_max {
+            res.push(("memory.max", v.to_string()));
+        }
+        if let Some((quota, period)) = self.cpu_max {
+            res.push(("cpu.max", format!("{} {}", quota, period)));
+        }
+        if let Some(v) = self.cpu_weight {
+            res.push(("cpu.weight", v.to_string()));
+        }
+        self.io_max
+            .iter()
+            .for_each(|l| res.push(("io.max", l.to_owned())));
+        if let Some(v) = self.pids_max {
+            res.push(("pids.max", v.to_string()));
+        }
+        res
+    }
+}
+
+// io.max 的单行格式: "MAJ:MIN" + 若干 "rbps|wbps|riops|wiops=数值|max"
+fn io_max_valid(line: &str) -> bool {
+    let is_num =
+        |s: &str| !s.is_empty() && s.bytes().all(|b| b.is_ascii_digit());
+
+    let mut items = line.split(' ');
+    let dev_ok = items
+        .next()
+        .and_then(|dev| {
+            let mut mm = dev.splitn(2, ':');
+            Some(is_num(mm.next()?) && is_num(mm.next()?))
+        })
+        .unwrap_or(false);
+
+    let mut cnt = 0;
+    let kv_ok = items.all(|kv| {
+        cnt += 1;
+        let mut kv = kv.splitn(2, '=');
+        match (kv.next(), kv.next()) {
+            (Some(k), Some(v)) => {
+                ["rbps", "wbps", "riops", "wiops"].contains(&k)
+                    && ("max" == v || is_num(v))
+            }
+            _ => false,
+        }
+    });
+
+    dev_ok && kv_ok && 0 < cnt
+}
+
+fn root_init() -> Option<PathBuf> {
+    let root = PathBuf::from(
+        env::var(ENV_CGROUP_ROOT)
+            .map(|r| r.trim().to_owned())
+            .unwrap_or_else(|_| CGROUP_ROOT.to_owned()),
+    );
+
+    // 上级目录须为 cgroup v2 的挂载点或其中的 cgroup
+    let parent = root.parent()?;
+    fs::metadata(parent.join("cgroup.controllers")).ok()?;
+
+    if !root.is_dir() {
+        _info!(fs::create_dir(&root));
+    }
+    fs::metadata(root.join("cgroup.controllers")).ok()?;
+
+    subtree_enable(parent);
+    subtree_enable(&root);
+
+    Some(root)
+}
+
+// 向 dir 的子 cgroup 开放 CONTROLLERS 中 dir 可用的各项控制器,
+// 逐项开放, 个别控制器不可用不影响其余各项
+fn subtree_enable(dir: &Path) {
+    if let Ok(avail) = fs::read_to_string(dir.join("cgroup.controllers")) {
+        avail
+            .split_whitespace()
+            .filter(|c| CONTROLLERS.contains(c))
+            .for_each(|c| {
+                _info!(fs::write(
+                    dir.join("cgroup.subtree_control"),
+                    format!("+{}", c)
+                ));
+            });
+    }
+}
+
+fn dir_open(path: &Path) -> Result<FD> {
+    nix::fcntl::open(
+        path,
+        OFlag::O_RDONLY | OFlag::O_DIRECTORY | OFlag::O_CLOEXEC,
+        Mode::empty(),
+    )
+    .c(d!())
+}
+
+/// 一个 ROCKER 的 cgroup, 释放时删除
+pub(crate) struct Cgroup {
+    path: PathBuf,
+    // cgroup 目录, 用于 clone3(CLONE_INTO_CGROUP), JG 创建之后关闭
+    fd: Option<FD>,
+    // App 子 cgroup 的 cgroup.events, 由 JG 继承, JG 创建之后关闭
+    events_fd: Option<FD>,
+    // App 子 cgroup 的目录, 经应答交给 JC
+    app_fd: Option<FD>,
+}
+
+impl Cgroup {
+    /// 创建名为 name 的 cgroup 及其 App 子 cgroup, 并写入各项限制
+    pub(crate) fn create(name: &str, limits: &CgroupLimits) -> Result<Cgroup> {
+        let root = ROOT.as_ref().ok_or_else(|| errgen!(CgroupUnavailable))?;
+
+        let path = root.join(name);
+        fs::create_dir(&path).c(d!())?;
+
+        // 此后出错时, 由 Drop 删除已创建的目录
+        let mut cg = Cgroup {
+            path,
+            fd: None,
+            events_fd: None,
+            app_fd: None,
+        };
+
+        for (file, val) in limits.entries() {
+            fs::write(cg.path.join(file), val).c(d!(file))?;
+        }
+
+        let app = cg.path.join(APP_CGROUP);
+        fs::create_dir(&app).c(d!())?;
+
+        cg.fd = Some(dir_open(&cg.path).c(d!())?);
+        cg.app_fd = Some(dir_open(&app).c(d!())?);
+        cg.events_fd = Some(
+            nix::fcntl::open(
+                app.join("cgroup.events").as_path(),
+                OFlag::O_RDONLY | OFlag::O_CLOEXEC,
+                Mode::empty(),
+            )
+            .c(d!())?,
+        );
+
+        Ok(cg)
+    }
+
+    /// 创建 JG 所需的描述符: (cgroup 目录, App 子 cgroup 的 cgroup.events)
+    pub(crate) fn guard_fds(&self) -> Option<(FD, FD)> {
+        Some((self.fd?, self.events_fd?))
+    }
+
+    /// JG 创建之后, JM 不再需要 guard_fds
+    pub(crate) fn guard_fds_close(&mut self) {
+        for fd in self.fd.take().into_iter().chain(self.events_fd.take()) {
+            _info!(nix::unistd::close(fd));
+        }
+    }
+
+    /// 取出 App 子 cgroup 的目录描述符, 此后由调用方负责关闭
+    pub(crate) fn take_app_fd(&mut self) -> Option<FD> {
+        self.app_fd.take()
+    }
+
+    /// 将已创建的进程迁入此 cgroup, 用于不支持 clone3(CLONE_INTO_CGROUP) 的内核
+    pub(crate) fn attach(&self, pid: PID) -> Result<()> {
+        fs::write(self.path.join("cgroup.procs"), pid.to_string()).c(d!())
+    }
+}
+
+// JG 被回收时, PID namespace 中的所有进程均已被回收, cgroup 为空, 可以直接删除
+impl Drop for Cgroup {
+    fn drop(&mut self) {
+        self.guard_fds_close();
+        if let Some(fd) = self.app_fd.take() {
+            _info!(nix::unistd::close(fd));
+        }
+
+        let app = self.path.join(APP_CGROUP);
+        if app.exists() {
+            _info!(fs::remove_dir(app));
+        }
+        _info!(fs::remove_dir(&self.path));
+    }
+}
+
+/// App 子 cgroup 中是否仍有进程, events_fd 为其 cgroup.events 的描述符
+pub(crate) fn populated(events_fd: FD) -> Result<bool> {
+    let mut buf = [0u8; 256];
+    let n = nix::sys::uio::pread(events_fd, &mut buf, 0).c(d!())?;
+    events_populated(&String::from_utf8_lossy(&buf[..n]))
+        .ok_or_else(|| errgen!(OptionNone))
+}
+
+// cgroup.events 中的 populated 字段
+fn events_populated(events: &str) -> Option<bool> {
+    events
+        .lines()
+        .find(|l| l.starts_with("populated "))
+        .map(|l| "0" != l["populated ".len()..].trim())
+}
+
+// `struct clone_args`, 截至 CLONE_ARGS_SIZE_VER2
+#[repr(C)]
+#[derive(Default)]
+struct CloneArgs {
+    flags: u64,
+    pidfd: u64,
+    child_tid: u64,
+    parent_tid: u64,
+    exit_signal: u64,
+    stack: u64,
+    stack_size: u64,
+    tls: u64,
+    set_tid: u64,
+    set_tid_size: u64,
+    cgroup: u64,
+}
+
+/// 以 clone3(CLONE_INTO_CGROUP) 在 cgroup_fd 所指的 cgroup 中创建子进程,
+/// 语义同 fork(子进程持有地址空间的副本, 自 clone3 返回处继续执行, 返回值为 0);
+/// 内核不支持 clone3 或 CLONE_INTO_CGROUP(Linux 5.7 之前)时返回 None.
+pub(crate) fn clone_into(
+    flags: CloneFlags,
+    cgroup_fd: FD,
+) -> Result<Option<PID>> {
+    let args = CloneArgs {
+        flags: flags.bits() as u64 | CLONE_INTO_CGROUP,
+        exit_signal: libc::SIGCHLD as u64,
+        cgroup: cgroup_fd as u64,
+        ..Default::default()
+    };
+
+    let pid = unsafe {
+        libc::syscall(
+            SYS_CLONE3,
+            &args as *const CloneArgs,
+            mem::size_of::<CloneArgs>(),
+        )
+    };
+
+    if 0 > pid {
+        return match Errno::last() {
+            // 不认识 clone3, 或不认识 cgroup 字段
+            Errno::ENOSYS | Errno::E2BIG => Ok(None),
+            _ => Err(errgen_sys!(Unknown)),
+        };
+    }
+
+    Ok(Some(pid as PID))
+}
+
+#[cfg(test)]
+#[allow(non_snake_case)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn TEST_limits_check() {
+        assert!(CgroupLimits::default().is_empty());
+        assert!(CgroupLimits::default().check().is_ok());
+
+        let mut l = CgroupLimits {
+            memory_max: Some(256 << 20),
+            cpu_max: Some((50_000, 100_000)),
+            io_max: vec!["8:0 rbps=1048576 wiops=max".to_owned()],
+            ..Default::default()
+        };
+        assert!(!l.is_empty());
+        assert!(l.check().is_ok());
+        assert_eq!(
+            vec![
+                ("memory.max", (256u64 << 20).to_string()),
+                ("cpu.max", "50000 100000".to_owned()),
+                ("io.max", "8:0 rbps=1048576 wiops=max".to_owned()),
+            ],
+            l.entries()
+        );
+
+        l.cpu_weight = Some(0);
+        assert!(l.check().is_err());
+        l.cpu_weight = Some(100);
+        l.cpu_max = Some((50_000, 10));
+        assert!(l.check().is_err());
+        l.cpu_max = None;
+
+        for bad in &[
+            "8:0",
+            "8 rbps=1",
+            "8:0 rbps=",
+            "8:0 foo=1",
+            "8:0 rbps=1\n8:1 rbps=1",
+        ] {
+            l.io_max = vec![(*bad).to_owned()];
+            assert!(l.check().is_err(), "{}", bad);
+        }
+    }
+
+    #[test]
+    fn TEST_events_populated() {
+        assert_eq!(Some(true), events_populated("populated 1\nfrozen 0\n"));
+        assert_eq!(Some(false), events_populated("populated 0\nfrozen 0\n"));
+        assert_eq!(None, events_populated("frozen 0\n"));
+    }
+}
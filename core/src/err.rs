@@ -22,5 +22,7 @@ error_chain! {
         OptionNone
         InvalidPath
         GuardDup
+        CgroupLimitInvalid
+        CgroupUnavailable
     }
 }
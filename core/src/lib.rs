@@ -3,11 +3,31 @@
 
 //! Rocker 核心逻辑实现
 
+mod cgroup;
 mod err;
+mod logger;
 mod r#loop;
 mod master;
+mod pkg_cache;
+mod pool;
+mod reaper;
+mod stack;
+mod stats_page;
+mod trace;
 mod utils;
 
+pub use cgroup::CgroupLimits;
 pub use err::*;
-pub use master::{RockerCfg, ResourceHdr};
+pub use logger::{json_escape, log_init};
+pub use master::{Registry, ResourceHdr, RockerCfg};
+pub use pkg_cache::{pkg_cache_init, pkg_cache_loops};
+pub use pool::WarmPool;
+pub use r#loop::{loop_stats, LoopStats};
+pub use reaper::reaper_run;
+pub use stats_page::{
+    stats_count_launch, stats_count_reject, stats_counters, stats_page_fd,
+    stats_page_init, StatsCounters, STATS_PAGE_MAGIC, STATS_PAGE_VERSION,
+    STATS_SLOT_NUM,
+};
+pub use trace::{now as trace_now, Span, Stage, Trace, STAGE_NUM};
 pub use utils::{get_errdesc, p, pdie, sleep};
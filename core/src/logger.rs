@@ -0,0 +1,387 @@
+//! 错误日志.
+//!
+//! 服务端调用 `log_init` 之后, 各线程只需格式化错误链并投递到有界队列中,
+//! 由唯一的写出线程成批写出, 队列已满时丢弃并计数, 打印日志的线程永不阻塞.
+//! 同一错误在短时间内反复出现时(如 loop 设备耗尽), 超出限额的部分只计数,
+//! 在时间窗口结束后以一条汇总记录代替.
+//!
+//! JG 等由 clone 创建的子进程中不存在写出线程, 此时直接以单次 write 写出.
+//!
+//! 输出格式由环境变量 `ROCKER_LOG_FORMAT` 指定: `text`(默认) 或 `json`(每行一条记录).
+
+use crate::alt;
+use error_chain::ChainedError;
+use lazy_static::lazy_static;
+use std::{
+    cell::RefCell,
+    collections::{hash_map::DefaultHasher, HashMap},
+    env,
+    hash::{Hash, Hasher},
+    process,
+    sync::{
+        atomic::{AtomicU32, AtomicUsize, Ordering},
+        mpsc::{
+            sync_channel, Receiver, RecvTimeoutError, SyncSender, TrySendError,
+        },
+        Mutex,
+    },
+    thread,
+    time::{Duration, Instant, SystemTime, UNIX_EPOCH},
+};
+
+const ENV_FORMAT: &str = "ROCKER_LOG_FORMAT";
+
+// 队列中最多积压的记录数量
+const QUEUE_CAP: usize = 4096;
+
+// 同一错误在每个时间窗口内最多输出的次数
+const RATE_WINDOW: Duration = Duration::from_secs(1);
+const RATE_BURST: u32 = 10;
+
+// 写出线程所在的进程, 为 0 表示尚未启动
+static WRITER_PID: AtomicU32 = AtomicU32::new(0);
+
+// 因队列已满而丢弃的记录数量
+static DROPPED: AtomicUsize = AtomicUsize::new(0);
+
+lazy_static! {
+    static ref TX: Mutex<Option<SyncSender<Record>>> = Mutex::new(None);
+}
+
+thread_local! {
+    // 每个线程持有一个发送端, 只在首次使用时锁定 TX
+    static LOCAL_TX: RefCell<Option<SyncSender<Record>>> = RefCell::new(None);
+
+    // 缓存的 pid namespace 名称, 进程变化(clone 出的 JG)时重新读取
+    static PIDNS: RefCell<(u32, String)> = RefCell::new((0, String::new()));
+}
+
+// 一条错误记录, 在调用方线程中生成
+struct Record {
+    sec: i64,
+    nsec: i32,
+    pid: u32,
+    pidns: String,
+    // 错误链中各层的描述, 由外到内
+    chain: Vec<String>,
+    // 用于限流, 相同的错误链取值相同
+    key: u64,
+}
+
+impl Record {
+    fn new<E: ChainedError>(e: &E) -> Record {
+        let ts = SystemTime::now()
+            .duration_since(UNIX_EPOCH)
+            .unwrap_or_else(|_| Duration::from_secs(0));
+        let pid = process::id();
+        let chain = e.iter().map(|c| c.to_string()).collect::<Vec<_>>();
+
+        let mut hasher = DefaultHasher::new();
+        chain.hash(&mut hasher);
+
+        Record {
+            sec: ts.as_secs() as i64,
+            nsec: ts.subsec_nanos() as i32,
+            pid,
+            pidns: pidns(pid),
+            chain,
+            key: hasher.finish(),
+        }
+    }
+
+    fn render(&self, json: bool, out: &mut String) {
+        if json {
+            out.push_str(&format!(
+                "{{\"ts\":{}.{:03},\"pid\":{},\"pidns\":\"{}\",\"level\":\"error\",\"chain\":[",
+                self.sec,
+                self.nsec / 1_000_000,
+                self.pid,
+                json_escape(&self.pidns)
+            ));
+            self.chain.iter().enumerate().for_each(|(i, c)| {
+                if 0 < i {
+                    out.push(',');
+                }
+                out.push('"');
+                out.push_str(&json_escape(c));
+                out.push('"');
+            });
+            out.push_str("]}\n");
+        } else {
+            let tm = time::at(time::Timespec::new(self.sec, self.nsec));
+            out.push_str(&format!(
+                "\n\x1b[31;01m{}[{}] {}\x1b[00m\n",
+                self.pidns,
+                self.pid,
+                time::strftime("%m-%d %H:%M:%S", &tm).unwrap_or_default()
+            ));
+            self.chain.iter().enumerate().for_each(|(i, c)| {
+                out.push_str(alt!(0 == i, "Error: ", "Caused by: "));
+                out.push_str(c);
+                out.push('\n');
+            });
+        }
+    }
+}
+
+// 内部不能再调用`p`, 否则可能无限循环
+fn pidns(pid: u32) -> String {
+    PIDNS.with(|ns| {
+        let mut ns = ns.borrow_mut();
+        if pid != ns.0 {
+            ns.1 = std::fs::read_link(format!("/proc/{}/ns/pid", pid))
+                .map(|p| p.to_string_lossy().into_owned())
+                .unwrap_or_default();
+            ns.0 = pid;
+        }
+        ns.1.clone()
+    })
+}
+
+/// 转义字符串, 以便作为 JSON 字符串的内容
+pub fn json_escape(s: &str) -> String {
+    let mut res = String::with_capacity(s.len());
+    s.chars().for_each(|c| match c {
+        '"' => res.push_str("\\\""),
+        '\\' => res.push_str("\\\\"),
+        '\n' => res.push_str("\\n"),
+        c if (c as u32) < 0x20 => {
+            res.push_str(&format!("\\u{:04x}", c as u32))
+        }
+        c => res.push(c),
+    });
+    res
+}
+
+fn json_mode() -> bool {
+    env::var(ENV_FORMAT)
+        .map(|v| "json" == v.trim())
+        .unwrap_or(false)
+}
+
+// 以尽量少的 write 调用写出, 不经过 std::io::stderr 的锁
+fn write_stderr(mut data: &[u8]) {
+    while !data.is_empty() {
+        match nix::unistd::write(libc::STDERR_FILENO, data) {
+            Ok(n) => data = &data[n..],
+            Err(nix::Error::Sys(nix::errno::Errno::EINTR)) => {}
+            Err(_) => return,
+        }
+    }
+}
+
+/// 启动写出线程, 此后当前进程中的错误日志均异步写出; 重复调用时不做任何操作.
+/// 新线程继承调用方的信号掩码.
+pub fn log_init() {
+    let mut tx = TX.lock().unwrap();
+    if tx.is_some() {
+        return;
+    }
+
+    let (sender, receiver) = sync_channel(QUEUE_CAP);
+    let json = json_mode();
+    thread::spawn(move || writer(receiver, json));
+
+    *tx = Some(sender);
+    WRITER_PID.store(process::id(), Ordering::Release);
+}
+
+/// 输出一条错误链, 写出线程不可用时同步写出
+pub(crate) fn log_error<E: ChainedError>(e: &E) {
+    let rec = Record::new(e);
+
+    if process::id() != WRITER_PID.load(Ordering::Acquire) {
+        return log_sync(&rec);
+    }
+
+    let unsent = LOCAL_TX.with(|tx| {
+        let mut tx = tx.borrow_mut();
+        if tx.is_none() {
+            *tx = TX.lock().unwrap().clone();
+        }
+        match tx.as_ref() {
+            Some(tx) => match tx.try_send(rec) {
+                Ok(()) => None,
+                Err(TrySendError::Full(_)) => {
+                    DROPPED.fetch_add(1, Ordering::Relaxed);
+                    None
+                }
+                // 写出线程已退出
+                Err(TrySendError::Disconnected(rec)) => Some(rec),
+            },
+            None => Some(rec),
+        }
+    });
+
+    if let Some(rec) = unsent {
+        log_sync(&rec);
+    }
+}
+
+/// 同步写出一条错误链, 用于进程即将退出等不能等待写出线程的场景
+pub(crate) fn log_error_sync<E: ChainedError>(e: &E) {
+    log_sync(&Record::new(e));
+}
+
+fn log_sync(rec: &Record) {
+    let mut out = String::new();
+    rec.render(json_mode(), &mut out);
+    write_stderr(out.as_bytes());
+}
+
+// 写出线程自身产生的提示信息
+fn notice(json: bool, msg: &str, out: &mut String) {
+    if json {
+        out.push_str(&format!(
+            "{{\"level\":\"warn\",\"msg\":\"{}\"}}\n",
+            json_escape(msg)
+        ));
+    } else {
+        out.push_str(&format!("\n\x1b[33;01m[rocker log] {}\x1b[00m\n", msg));
+    }
+}
+
+// 一个错误在当前时间窗口内的限流状态
+struct Rate {
+    start: Instant,
+    cnt: u32,
+    // 错误链的最外层描述, 用于汇总信息
+    head: String,
+}
+
+type RateState = HashMap<u64, Rate>;
+
+// 返回 false 表示此记录应被抑制
+fn rate_admit(state: &mut RateState, rec: &Record, now: Instant) -> bool {
+    let ent = state.entry(rec.key).or_insert_with(|| Rate {
+        start: now,
+        cnt: 0,
+        head: rec.chain.first().cloned().unwrap_or_default(),
+    });
+    ent.cnt += 1;
+    RATE_BURST >= ent.cnt
+}
+
+// 汇总已结束的时间窗口中被抑制的记录, 并清理过期的限流状态
+fn rate_report(
+    state: &mut RateState,
+    now: Instant,
+    json: bool,
+    out: &mut String,
+) {
+    state.retain(|_, r| {
+        if RATE_WINDOW > now.duration_since(r.start) {
+            return true;
+        }
+        if RATE_BURST < r.cnt {
+            notice(
+                json,
+                &format!(
+                    "{} repeats suppressed: {}",
+                    r.cnt - RATE_BURST,
+                    r.head
+                ),
+                out,
+            );
+        }
+        false
+    });
+}
+
+fn writer(rx: Receiver<Record>, json: bool) {
+    let mut state = RateState::new();
+    let mut out = String::with_capacity(64 * 1024);
+
+    loop {
+        let first = match rx.recv_timeout(RATE_WINDOW) {
+            Ok(rec) => Some(rec),
+            Err(RecvTimeoutError::Timeout) => None,
+            Err(RecvTimeoutError::Disconnected) => return,
+        };
+
+        let now = Instant::now();
+        out.clear();
+
+        // 先结束过期的窗口, 新到达的记录计入新窗口
+        rate_report(&mut state, now, json, &mut out);
+
+        first
+            .into_iter()
+            .chain(rx.try_iter().take(QUEUE_CAP))
+            .for_each(|rec| {
+                if rate_admit(&mut state, &rec, now) {
+                    rec.render(json, &mut out);
+                }
+            });
+
+        let dropped = DROPPED.swap(0, Ordering::Relaxed);
+        if 0 < dropped {
+            notice(
+                json,
+                &format!("{} records dropped, queue full", dropped),
+                &mut out,
+            );
+        }
+
+        write_stderr(out.as_bytes());
+    }
+}
+
+#[cfg(test)]
+#[allow(non_snake_case)]
+mod tests {
+    use super::*;
+
+    fn record(head: &str) -> Record {
+        let mut hasher = DefaultHasher::new();
+        head.hash(&mut hasher);
+        Record {
+            sec: 0,
+            nsec: 0,
+            pid: 1,
+            pidns: "pid:[1]".to_owned(),
+            chain: vec![head.to_owned(), "root \"cause\"".to_owned()],
+            key: hasher.finish(),
+        }
+    }
+
+    #[test]
+    fn TEST_rate_limit() {
+        let mut state = RateState::new();
+        let now = Instant::now();
+        let (r1, r2) = (record("loop busy"), record("other"));
+
+        (0..RATE_BURST)
+            .for_each(|_| assert!(rate_admit(&mut state, &r1, now)));
+        assert!(!rate_admit(&mut state, &r1, now));
+        assert!(!rate_admit(&mut state, &r1, now));
+        assert!(rate_admit(&mut state, &r2, now));
+
+        // 窗口结束之前不汇总
+        let mut out = String::new();
+        rate_report(&mut state, now, false, &mut out);
+        assert!(out.is_empty());
+
+        let later = now + RATE_WINDOW;
+        rate_report(&mut state, later, false, &mut out);
+        assert!(out.contains("2 repeats suppressed: loop busy"));
+        assert!(state.is_empty());
+
+        assert!(rate_admit(&mut state, &r1, later));
+    }
+
+    #[test]
+    fn TEST_render_json() {
+        let mut out = String::new();
+        record("a\nb").render(true, &mut out);
+        assert_eq!(
+            "{\"ts\":0.000,\"pid\":1,\"pidns\":\"pid:[1]\",\"level\":\"error\",\"chain\":[\"a\\nb\",\"root \\\"cause\\\"\"]}\n",
+            out
+        );
+    }
+
+    #[test]
+    fn TEST_json_escape() {
+        assert_eq!(r#"a\"b\\c\nd\u0001"#, json_escape("a\"b\\c\nd\u{1}"));
+    }
+}
@@ -1,6 +1,36 @@
 use crate::{d, err::*, master::FD, r#loop::LoopId};
-use nix::{ioctl_none_bad, ioctl_write_int_bad};
-use std::{fs::OpenOptions, os::unix::io::IntoRawFd};
+use nix::{
+    errno::Errno, ioctl_none_bad, ioctl_read_bad, ioctl_write_int_bad,
+    ioctl_write_ptr_bad,
+};
+use std::{fs::OpenOptions, mem, os::unix::io::IntoRawFd};
+
+// `struct loop_info64`, 参见 /usr/include/linux/loop.h
+#[repr(C)]
+pub struct LoopInfo64 {
+    lo_device: u64,
+    lo_inode: u64,
+    lo_rdevice: u64,
+    lo_offset: u64,
+    lo_sizelimit: u64,
+    lo_number: u32,
+    lo_encrypt_type: u32,
+    lo_encrypt_key_size: u32,
+    lo_flags: u32,
+    lo_file_name: [u8; 64],
+    lo_crypt_name: [u8; 64],
+    lo_encrypt_key: [u8; 32],
+    lo_init: [u64; 2],
+}
+
+// `struct loop_config`, 参见 /usr/include/linux/loop.h
+#[repr(C)]
+pub struct LoopConfig {
+    fd: u32,
+    block_size: u32,
+    info: LoopInfo64,
+    reserved: [u64; 8],
+}
 
 // App 进程结束时,会被自动关闭掉
 #[inline(always)]
@@ -30,17 +60,84 @@ pub fn loop_open(id: LoopId) -> Result<File> {
 }
 
 // 可以与任意文件绑定, 但后续能否挂载成功,取决于内核的支持
+#[cfg(features = "unused")]
 #[inline(always)]
 pub fn loop_bind(loop_fd: FD, backing_fd: FD) -> Result<()> {
     unsafe { __loop_bind(loop_fd, backing_fd).c(d!()).map(|_| ()) }
 }
 
+// 绑定并配置 loop 设备: 只读, 最后一个引用释放时自动解绑, 使用 direct I/O
+// 以免页面在 backing file 与 loop 设备中各缓存一份;
+// block_size 为 0 时使用内核默认值.
+// 设备已被占用(EBUSY)时返回 Ok(false), 内核保证同一设备只会被绑定一次,
+// 调用方据此重新选择设备即可.
+//
+// 优先使用 LOOP_CONFIGURE(Linux 5.8+) 一次完成, 旧内核上退回到
+// LOOP_SET_FD 之后逐项设置的方式, 其中的配置项均为优化, 失败时忽略.
+pub fn loop_try_bind(
+    loop_fd: FD,
+    backing_fd: FD,
+    block_size: u32,
+) -> Result<bool> {
+    let mut cfg: LoopConfig = unsafe { mem::zeroed() };
+    cfg.fd = backing_fd as u32;
+    cfg.block_size = block_size;
+    cfg.info.lo_flags = const_def::LO_FLAGS_READ_ONLY
+        | const_def::LO_FLAGS_AUTOCLEAR
+        | const_def::LO_FLAGS_DIRECT_IO;
+
+    match unsafe { __loop_configure(loop_fd, &cfg) } {
+        Ok(_) => return Ok(true),
+        Err(nix::Error::Sys(Errno::EBUSY)) => return Ok(false),
+        // 内核不支持 LOOP_CONFIGURE, 或不接受其中的某项配置
+        Err(nix::Error::Sys(Errno::EINVAL))
+        | Err(nix::Error::Sys(Errno::ENOTTY)) => {}
+        Err(e) => return Err(e).c(d!()),
+    }
+
+    match unsafe { __loop_bind(loop_fd, backing_fd) } {
+        Ok(_) => {}
+        Err(nix::Error::Sys(Errno::EBUSY)) => return Ok(false),
+        Err(e) => return Err(e).c(d!()),
+    }
+
+    // backing file 以只读方式打开, 设备随之只读
+    let mut info: LoopInfo64 = unsafe { mem::zeroed() };
+    info.lo_flags = const_def::LO_FLAGS_AUTOCLEAR;
+    let _ = unsafe { __loop_set_status64(loop_fd, &info) };
+    if 0 < block_size {
+        let _ = unsafe { __loop_set_block_size(loop_fd, block_size as i32) };
+    }
+    let _ = unsafe { __loop_set_direct_io(loop_fd, 1) };
+
+    Ok(true)
+}
+
 // 解除绑定
 #[inline(always)]
 pub fn loop_unbind(loop_fd: FD) -> Result<()> {
     unsafe { __loop_unbind(loop_fd).c(d!()).map(|_| ()) }
 }
 
+// 解除绑定, 并确认设备已可复用: 设备本就未绑定(ENXIO)时同样返回 Ok(true).
+// 设备仍被其它持有者打开时, 内核只设置 AUTOCLEAR 并返回成功, 或返回 EBUSY,
+// 其解绑推迟到最后一个引用释放之后, 此时返回 Ok(false).
+pub fn loop_try_unbind(loop_fd: FD) -> Result<bool> {
+    match unsafe { __loop_unbind(loop_fd) } {
+        Ok(_) | Err(nix::Error::Sys(Errno::ENXIO)) => {}
+        Err(nix::Error::Sys(Errno::EBUSY)) => return Ok(false),
+        Err(e) => return Err(e).c(d!()),
+    }
+
+    // 未绑定的设备查询状态时返回 ENXIO
+    let mut info: LoopInfo64 = unsafe { mem::zeroed() };
+    match unsafe { __loop_get_status64(loop_fd, &mut info) } {
+        Err(nix::Error::Sys(Errno::ENXIO)) => Ok(true),
+        Ok(_) => Ok(false),
+        Err(e) => Err(e).c(d!()),
+    }
+}
+
 // 删除 loop 设备
 #[inline(always)]
 pub fn loop_ctl_remove(loop_ctl_fd: FD, id: LoopId) -> Result<()> {
@@ -53,6 +150,19 @@ pub fn loop_ctl_remove(loop_ctl_fd: FD, id: LoopId) -> Result<()> {
 
 ioctl_none_bad!(__loop_ctl_get_free, const_def::LOOP_CTL_GET_FREE);
 ioctl_write_int_bad!(__loop_bind, const_def::LOOP_SET_FD);
+ioctl_write_ptr_bad!(__loop_configure, const_def::LOOP_CONFIGURE, LoopConfig);
+ioctl_write_ptr_bad!(
+    __loop_set_status64,
+    const_def::LOOP_SET_STATUS64,
+    LoopInfo64
+);
+ioctl_read_bad!(
+    __loop_get_status64,
+    const_def::LOOP_GET_STATUS64,
+    LoopInfo64
+);
+ioctl_write_int_bad!(__loop_set_direct_io, const_def::LOOP_SET_DIRECT_IO);
+ioctl_write_int_bad!(__loop_set_block_size, const_def::LOOP_SET_BLOCK_SIZE);
 ioctl_none_bad!(__loop_unbind, const_def::LOOP_CLR_FD);
 ioctl_write_int_bad!(__loop_ctl_remove, const_def::LOOP_CTL_REMOVE);
 
@@ -65,9 +175,16 @@ pub(self) mod const_def {
     pub const LOOP_CLR_FD: u32 = 19457;
     pub const LOOP_CTL_GET_FREE: u32 = 19586;
     pub const LOOP_CTL_REMOVE: u32 = 19585;
+    pub const LOOP_SET_STATUS64: u32 = 19460;
+    pub const LOOP_GET_STATUS64: u32 = 19461;
+    pub const LOOP_SET_DIRECT_IO: u32 = 19464;
+    pub const LOOP_SET_BLOCK_SIZE: u32 = 19465;
+    pub const LOOP_CONFIGURE: u32 = 19466;
     // pub const LOOP_CHANGE_FD: u32 = 19462;
     // pub const LOOP_SET_CAPACITY: u32 = 19463;
-    // pub const LOOP_SET_DIRECT_IO: u32 = 19464;
-    // pub const LOOP_SET_BLOCK_SIZE: u32 = 19465;
     // pub const LOOP_CTL_ADD: u32 = 19584;
+
+    pub const LO_FLAGS_READ_ONLY: u32 = 1;
+    pub const LO_FLAGS_AUTOCLEAR: u32 = 4;
+    pub const LO_FLAGS_DIRECT_IO: u32 = 16;
 }
@@ -1,17 +1,106 @@
+//! loop 设备管理.
+//!
+//! JM 维护一个有界的空闲列表, 存放已解除绑定的 loop 设备以供复用,
+//! 避免每次启动 App 都创建并删除一个 /dev/loopN 设备节点.
+//!
+//! 空闲列表中的设备只是"提示": 绑定时若遇到 EBUSY(已被其它进程占用),
+//! 会通过 LOOP_CTL_GET_FREE 重新获取, 绑定操作本身由内核保证原子性.
+
 pub(self) mod metal;
 
-use crate::{d, err::*, master::FD, pnk};
+use crate::{_info, alt, d, err::*, errgen, master::FD, pnk};
 use lazy_static::lazy_static;
+use nix::sys::uio::pread;
+use std::{
+    env, fs,
+    os::unix::io::IntoRawFd,
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        Mutex,
+    },
+};
 
 lazy_static! {
     static ref LOOP_MASTER: FD = { pnk!(metal::loop_ctl_open()) };
+    static ref LOOP_POOL: LoopPool = LoopPool::from_env();
 }
 
 pub(crate) type LoopId = i32;
 
-#[inline(always)]
-pub fn bind_pkg(loop_fd: FD, backing_fd: FD) -> Result<()> {
-    metal::loop_bind(loop_fd, backing_fd).c(d!())
+// 空闲列表的容量, 超出的设备将被删除
+const ENV_POOL_SIZE: &str = "ROCKER_LOOP_POOL_SIZE";
+const DEFAULT_POOL_SIZE: usize = 8;
+
+// 绑定时遇到 EBUSY 的最大重试次数
+const ATTACH_RETRY: usize = 16;
+
+struct LoopPool {
+    cap: usize,
+    free: Mutex<Vec<LoopId>>,
+    hits: AtomicUsize,
+    misses: AtomicUsize,
+    recycled: AtomicUsize,
+    destroyed: AtomicUsize,
+    deferred: AtomicUsize,
+}
+
+impl LoopPool {
+    fn from_env() -> LoopPool {
+        let cap = env::var(ENV_POOL_SIZE)
+            .ok()
+            .and_then(|v| v.trim().parse::<usize>().ok())
+            .unwrap_or(DEFAULT_POOL_SIZE);
+
+        LoopPool {
+            cap,
+            free: Mutex::new(Vec::with_capacity(cap)),
+            hits: AtomicUsize::new(0),
+            misses: AtomicUsize::new(0),
+            recycled: AtomicUsize::new(0),
+            destroyed: AtomicUsize::new(0),
+            deferred: AtomicUsize::new(0),
+        }
+    }
+
+    // 放回空闲列表, 列表已满时返回 false
+    fn put(&self, id: LoopId) -> bool {
+        let mut free = self.free.lock().unwrap();
+        if free.len() < self.cap && !free.contains(&id) {
+            free.push(id);
+            true
+        } else {
+            false
+        }
+    }
+}
+
+/// loop 设备池的统计数据
+#[derive(Clone, Copy, Debug, Default)]
+pub struct LoopStats {
+    /// 复用空闲列表中的设备的次数
+    pub hits: usize,
+    /// 空闲列表为空或设备被占用, 转而向内核申请的次数
+    pub misses: usize,
+    /// 解除绑定后放回空闲列表的次数
+    pub recycled: usize,
+    /// 空闲列表已满而被删除的设备数量
+    pub destroyed: usize,
+    /// 回收时仍被引用, 留待内核自动解绑(AUTOCLEAR)而未放回空闲列表的次数
+    pub deferred: usize,
+    /// 当前空闲列表中的设备数量
+    pub idle: usize,
+}
+
+/// 获取 loop 设备池的统计数据
+pub fn loop_stats() -> LoopStats {
+    LoopStats {
+        hits: LOOP_POOL.hits.load(Ordering::Relaxed),
+        misses: LOOP_POOL.misses.load(Ordering::Relaxed),
+        recycled: LOOP_POOL.recycled.load(Ordering::Relaxed),
+        destroyed: LOOP_POOL.destroyed.load(Ordering::Relaxed),
+        deferred: LOOP_POOL.deferred.load(Ordering::Relaxed),
+        idle: LOOP_POOL.free.lock().unwrap().len(),
+    }
 }
 
 #[inline(always)]
@@ -20,6 +109,135 @@ pub fn get_loop_dev() -> Result<(String, LoopId)> {
     Ok((format!("/dev/loop{}", loop_id), loop_id))
 }
 
+/// 从空闲列表中取出一个设备, 作为绑定时的首选
+#[inline(always)]
+pub fn loop_reserve() -> Option<LoopId> {
+    LOOP_POOL.free.lock().unwrap().pop()
+}
+
+/// 根据实际绑定的设备, 记录空闲列表的命中情况.
+/// 未能完成绑定时, 首选设备被放回空闲列表;
+/// 首选设备被占用时, 将其丢弃, 由其持有者负责.
+pub fn loop_settle(hint: Option<LoopId>, got: Option<LoopId>) {
+    match (hint, got) {
+        (Some(h), Some(g)) if h == g => {
+            LOOP_POOL.hits.fetch_add(1, Ordering::Relaxed);
+        }
+        (Some(h), None) => {
+            LOOP_POOL.put(h);
+        }
+        (_, Some(_)) => {
+            LOOP_POOL.misses.fetch_add(1, Ordering::Relaxed);
+        }
+        (None, None) => {}
+    }
+}
+
+/// 将 App 包绑定到 loop 设备, 返回设备路径, ID 及描述符, 描述符需要调用方关闭.
+/// 优先使用 hint 指定的设备, 其不可用或已被占用时, 向内核申请空闲设备并重试.
+pub fn attach_pkg(
+    hint: Option<LoopId>,
+    pkg_fd: FD,
+) -> Result<(String, LoopId, FD)> {
+    let block_size = pkg_block_size(pkg_fd);
+
+    let mut hint = hint;
+    let mut loop_id;
+    let mut loop_dev;
+    for _ in 0..ATTACH_RETRY {
+        if let Some(id) = hint.take() {
+            loop_id = id;
+            loop_dev = format!("/dev/loop{}", id);
+        } else {
+            let (dev, id) = get_loop_dev().c(d!())?;
+            loop_dev = dev;
+            loop_id = id;
+        }
+
+        let loop_fd = match fs::File::open(&loop_dev) {
+            Ok(f) => f.into_raw_fd(),
+            // 空闲列表中的设备可能已被外部删除
+            Err(_) => continue,
+        };
+
+        if metal::loop_try_bind(loop_fd, pkg_fd, block_size).c(d!())? {
+            return Ok((loop_dev, loop_id, loop_fd));
+        }
+
+        _info!(nix::unistd::close(loop_fd));
+    }
+
+    Err(errgen!(MntLoop, "all loop devices busy!"))
+}
+
+// loop 设备的逻辑块大小取 squashfs 的块大小, 但不超过页大小(内核的上限);
+// 非 squashfs 格式或读取失败时返回 0, 即使用内核默认值.
+// squashfs 超级块: magic(offset 0) ... block_size(offset 12), 均为小端序
+fn pkg_block_size(pkg_fd: FD) -> u32 {
+    const SQUASHFS_MAGIC: u32 = 0x7371_7368;
+    const SECTOR_SIZ: u32 = 512;
+
+    let mut sb = [0u8; 16];
+    match pread(pkg_fd, &mut sb, 0) {
+        Ok(n) if n == sb.len() => {}
+        _ => return 0,
+    }
+
+    let le_u32 = |i: usize| {
+        let mut bytes = [0u8; 4];
+        bytes.copy_from_slice(&sb[i..i + 4]);
+        u32::from_le_bytes(bytes)
+    };
+
+    if SQUASHFS_MAGIC != le_u32(0) {
+        return 0;
+    }
+
+    let page_siz = unsafe { libc::sysconf(libc::_SC_PAGESIZE) };
+    let page_siz = alt!(0 < page_siz, page_siz as u32, 4096);
+
+    let block_size = le_u32(12).min(page_siz);
+    alt!(
+        SECTOR_SIZ <= block_size && block_size.is_power_of_two(),
+        block_size,
+        0
+    )
+}
+
+/// 解除设备与 App 包的绑定, 放回空闲列表;
+/// 空闲列表已满时删除该设备.
+/// 设备仍被引用(如 MNT_DETACH 之后超级块尚未释放)时, 内核会在最后一个引用释放后
+/// 自动解绑, 此时既不放回也不删除, 只计入 deferred.
+pub fn loop_recycle(id: LoopId) {
+    let loop_dev = format!("/dev/loop{}", id);
+    let loop_fd = match fs::File::open(&loop_dev) {
+        Ok(f) => f.into_raw_fd(),
+        Err(_) => return,
+    };
+    let idle = metal::loop_try_unbind(loop_fd).c(d!());
+    _info!(nix::unistd::close(loop_fd));
+
+    match idle {
+        Ok(true) => {}
+        Ok(false) => {
+            LOOP_POOL.deferred.fetch_add(1, Ordering::Relaxed);
+            return;
+        }
+        Err(e) => {
+            _info!(Err::<(), _>(e));
+            LOOP_POOL.deferred.fetch_add(1, Ordering::Relaxed);
+            return;
+        }
+    }
+
+    if LOOP_POOL.put(id) {
+        LOOP_POOL.recycled.fetch_add(1, Ordering::Relaxed);
+    } else {
+        _info!(loop_destroy(id));
+        LOOP_POOL.destroyed.fetch_add(1, Ordering::Relaxed);
+    }
+}
+
 #[inline(always)]
 pub fn loop_unbind(loop_fd: FD) -> Result<()> {
     metal::loop_unbind(loop_fd).c(d!())
@@ -84,7 +302,7 @@ mod tests {
         let pkg_path = "/tmp/.xxxxPKGxxxx";
         let pkg_fd = create_fake_pkg(pkg_path);
 
-        pnk!(bind_pkg(loop_fd, pkg_fd));
+        assert!(pnk!(metal::loop_try_bind(loop_fd, pkg_fd, 0)));
         pnk!(loop_unbind(loop_fd));
 
         nix::unistd::close(loop_fd).unwrap();
@@ -96,4 +314,50 @@ mod tests {
 
         pnk!(fs::remove_file(pkg_path));
     }
+
+    #[test]
+    fn TEST_pkg_block_size() {
+        let pkg_path = "/tmp/.xxxxSQFSxxxx";
+
+        // 非 squashfs 格式
+        nix::unistd::close(create_fake_pkg(pkg_path)).unwrap();
+        let pkg_fd = pnk!(fs::File::open(pkg_path)).into_raw_fd();
+        assert_eq!(0, pkg_block_size(pkg_fd));
+        nix::unistd::close(pkg_fd).unwrap();
+        pnk!(fs::remove_file(pkg_path));
+
+        let mut sb = vec![0u8; 96];
+        sb[..4].copy_from_slice(&0x7371_7368u32.to_le_bytes());
+        sb[12..16].copy_from_slice(&(128 * 1024u32).to_le_bytes());
+        pnk!(fs::write(pkg_path, &sb));
+
+        let pkg_fd = pnk!(fs::File::open(pkg_path)).into_raw_fd();
+        let page_siz = unsafe { libc::sysconf(libc::_SC_PAGESIZE) } as u32;
+        assert_eq!(page_siz, pkg_block_size(pkg_fd));
+        nix::unistd::close(pkg_fd).unwrap();
+
+        pnk!(fs::remove_file(pkg_path));
+    }
+
+    #[test]
+    fn TEST_loop_settle() {
+        let before = loop_stats();
+
+        // 命中
+        loop_settle(Some(1000), Some(1000));
+        // 首选设备被占用, 计为未命中, 且不放回空闲列表
+        loop_settle(Some(1001), Some(7));
+        // 空闲列表为空
+        loop_settle(None, Some(8));
+        // 未完成绑定, 首选设备放回空闲列表
+        loop_settle(Some(1002), None);
+
+        let after = loop_stats();
+        assert!(after.hits >= before.hits + 1);
+        assert!(after.misses >= before.misses + 2);
+
+        let free = LOOP_POOL.free.lock().unwrap();
+        assert!(free.contains(&1002));
+        assert!(!free.contains(&1001));
+    }
 }
@@ -4,36 +4,227 @@
 //! - JC: RockerClient
 
 use crate::{
-    _info, alt, d,
+    _info, alt,
+    cgroup::{self, Cgroup, CgroupLimits},
+    d,
     err::*,
-    errgen, errgen_sys, pnk,
+    errgen, errgen_sys,
+    pkg_cache::{self, PkgKey},
+    pnk,
+    pool::PoolKey,
     r#loop::{self, LoopId},
+    reaper,
+    stack::Stack,
+    stats_page::{Record, StatsSlot},
+    trace::{self, Stage, Trace},
     utils,
 };
 use nix::{
-    mount::MsFlags,
+    fcntl::OFlag,
+    mount::{umount2, MntFlags, MsFlags},
+    poll::{poll, PollFd, PollFlags},
     sched::{clone, unshare, CloneFlags},
-    sys::socket,
+    sys::{
+        signal::{SigSet, Signal},
+        signalfd::{SfdFlags, SignalFd},
+        socket,
+        wait::{waitpid, WaitPidFlag, WaitStatus},
+    },
+    unistd::{pipe2, Pid},
 };
 use std::{
-    collections::HashMap,
+    collections::{HashMap, HashSet},
     ffi::CString,
     fs,
     io::Write,
-    os::unix::io::{IntoRawFd, RawFd},
+    os::unix::io::{AsRawFd, IntoRawFd, RawFd},
     path::PathBuf,
+    process,
     sync::{
         atomic::{AtomicUsize, Ordering},
         Arc, Mutex,
     },
+    time::Duration,
 };
 
 /// JG 资源管理
-pub type ResourceHdr = Arc<Mutex<HashMap<libc::pid_t, RockerCfg>>>;
+pub type ResourceHdr = Arc<Registry>;
+
+// 资源登记处的分片数量, 须为 2 的幂
+const SHARD_NUM: usize = 16;
+
+/// JG 资源登记处, 以 JG 的 PID 为键.
+///
+/// 按 PID 分片, 每个分片各自加锁: 登记, 认领与释放只锁定对应的分片;
+/// 每个分片另行维护按 app_id 及 App 包建立的二级索引, 随登记与取出同步更新,
+/// 按 app_id 或 App 包查找时逐个锁定分片, 只访问命中的条目.
+pub struct Registry {
+    shards: Vec<Mutex<Shard>>,
+}
+
+// 登记处的一个分片
+#[derive(Default)]
+struct Shard {
+    cfgs: HashMap<libc::pid_t, RockerCfg>,
+    by_app: HashMap<u32, HashSet<libc::pid_t>>,
+    by_pkg: HashMap<String, HashSet<libc::pid_t>>,
+}
 
-// 创建新进程时指定的栈空间大小
-const _STACK_SIZ: usize = 2 * 1024 * 1024;
-const STACK_SIZ: usize = _STACK_SIZ / 16 * 16;
+impl Shard {
+    fn insert(
+        &mut self,
+        pid: libc::pid_t,
+        cfg: RockerCfg,
+    ) -> Option<RockerCfg> {
+        let old = self.remove(pid);
+        index_add(&mut self.by_app, cfg.app_id, pid);
+        index_add(&mut self.by_pkg, cfg.app_pkg_path.clone(), pid);
+        self.cfgs.insert(pid, cfg);
+        old
+    }
+
+    fn remove(&mut self, pid: libc::pid_t) -> Option<RockerCfg> {
+        let cfg = self.cfgs.remove(&pid)?;
+        index_del(&mut self.by_app, &cfg.app_id, pid);
+        index_del(&mut self.by_pkg, &cfg.app_pkg_path, pid);
+        Some(cfg)
+    }
+}
+
+fn index_add<K: Eq + std::hash::Hash>(
+    idx: &mut HashMap<K, HashSet<libc::pid_t>>,
+    key: K,
+    pid: libc::pid_t,
+) {
+    idx.entry(key).or_insert_with(HashSet::new).insert(pid);
+}
+
+// 移除之后为空的键一并删除, 以免索引随历史上出现过的 app_id 无限增长
+fn index_del<K: Eq + std::hash::Hash>(
+    idx: &mut HashMap<K, HashSet<libc::pid_t>>,
+    key: &K,
+    pid: libc::pid_t,
+) {
+    if let Some(pids) = idx.get_mut(key) {
+        pids.remove(&pid);
+        if pids.is_empty() {
+            idx.remove(key);
+        }
+    }
+}
+
+impl Default for Registry {
+    fn default() -> Self {
+        Registry::new()
+    }
+}
+
+impl Registry {
+    /// 创建一个空的登记处
+    pub fn new() -> Registry {
+        Registry {
+            shards: (0..SHARD_NUM)
+                .map(|_| Mutex::new(Shard::default()))
+                .collect(),
+        }
+    }
+
+    #[inline(always)]
+    fn shard(&self, pid: libc::pid_t) -> &Mutex<Shard> {
+        &self.shards[pid as usize & (SHARD_NUM - 1)]
+    }
+
+    /// 登记, 返回同一 PID 下原有的条目;
+    /// 同时在状态页中写入其记录, 条目被释放时清除
+    pub fn insert(
+        &self,
+        pid: libc::pid_t,
+        mut cfg: RockerCfg,
+    ) -> Option<RockerCfg> {
+        cfg.stats_slot = Some(StatsSlot::new(&cfg.stats_record(pid as PID)));
+        self.shard(pid).lock().unwrap().insert(pid, cfg)
+    }
+
+    /// 取出条目, 调用方在锁外完成后续的清理
+    pub fn remove(&self, pid: libc::pid_t) -> Option<RockerCfg> {
+        self.shard(pid).lock().unwrap().remove(pid)
+    }
+
+    /// 在持有分片锁的情况下访问条目, 不存在时返回 None;
+    /// ops 改变 app_id 时(如激活预热池中的 JG)同步更新索引,
+    /// App 包在登记之后不再改变
+    pub fn with<F, R>(&self, pid: libc::pid_t, ops: F) -> Option<R>
+    where
+        F: FnOnce(&mut RockerCfg) -> R,
+    {
+        let mut shard = self.shard(pid).lock().unwrap();
+        let shard = &mut *shard;
+        let cfg = shard.cfgs.get_mut(&pid)?;
+
+        let app_id = cfg.app_id;
+        let ret = ops(cfg);
+        if app_id != cfg.app_id {
+            index_del(&mut shard.by_app, &app_id, pid);
+            index_add(&mut shard.by_app, cfg.app_id, pid);
+        }
+
+        Some(ret)
+    }
+
+    /// 已登记的 JG 数量
+    pub fn len(&self) -> usize {
+        self.shards
+            .iter()
+            .map(|s| s.lock().unwrap().cfgs.len())
+            .sum()
+    }
+
+    /// 是否为空
+    pub fn is_empty(&self) -> bool {
+        0 == self.len()
+    }
+
+    /// 逐个分片遍历所有条目
+    pub fn for_each<F>(&self, mut ops: F)
+    where
+        F: FnMut(libc::pid_t, &RockerCfg),
+    {
+        self.shards.iter().for_each(|s| {
+            s.lock()
+                .unwrap()
+                .cfgs
+                .iter()
+                .for_each(|(&pid, cfg)| ops(pid, cfg))
+        });
+    }
+
+    /// 运行指定 App 的所有 JG 的 PID
+    pub fn pids_by_app(&self, app_id: u32) -> Vec<libc::pid_t> {
+        self.pids_by(|s| s.by_app.get(&app_id))
+    }
+
+    /// 使用指定 App 包的所有 JG 的 PID
+    pub fn pids_by_pkg(&self, app_pkg_path: &str) -> Vec<libc::pid_t> {
+        self.pids_by(|s| s.by_pkg.get(app_pkg_path))
+    }
+
+    // 逐个分片查询二级索引, 汇总命中的 PID
+    fn pids_by<F>(&self, lookup: F) -> Vec<libc::pid_t>
+    where
+        F: Fn(&Shard) -> Option<&HashSet<libc::pid_t>>,
+    {
+        let mut pids = vec![];
+        self.shards.iter().for_each(|s| {
+            if let Some(hit) = lookup(&s.lock().unwrap()) {
+                pids.extend(hit.iter().copied());
+            }
+        });
+        pids
+    }
+}
+
+// 创建新进程时指定的栈空间大小, 由 Stack 对齐到页大小
+const STACK_SIZ: usize = 2 * 1024 * 1024;
 
 // Namespaces 配置.
 // NOTE: user 必须置于最后, 否则将过早失去权限, 导制无法进入后续的命名空间
@@ -49,9 +240,55 @@ const EUNSHARE_USER: i32 = -4;
 const ESET_PROCNAME: i32 = -5;
 const EMAKE_PRIVATE: i32 = -6;
 
+// 生命线断开之后仍有 App 进程存活时(如关闭了所有描述符的守护进程),
+// JG 退回到定时检查的方式, 单位: 秒
+const GUARD_RECHECK_SECS: i32 = 20;
+
 pub(crate) type FD = RawFd;
 pub(crate) type PID = u32;
 
+// JG 中依次执行的步骤, 其名称用于时间线
+const GUARD_STEP_NUM: usize = 6;
+const GUARD_STEPS: [&str; GUARD_STEP_NUM] = [
+    "mount_make_rprivate",
+    "guard_set_self_name",
+    "mount_dynfs_proc",
+    "guard_mnt_loop",
+    "guard_mnt_overlay",
+    "unshare_user",
+];
+
+// JG 中的时刻: 开始执行的时刻, 及 GUARD_STEPS 中各步骤结束的时刻
+type GuardStamps = [u64; 1 + GUARD_STEP_NUM];
+
+// JG 回报的最终结果: [错误码: i32][各时刻(CLOCK_MONOTONIC, 纳秒): u64 ...],
+// 出错时只发送错误码, 接收方缓冲区中其余部分保持为 0
+const GUARD_MSG_SIZ: usize = 4 + 8 * (1 + GUARD_STEP_NUM);
+
+fn guard_msg_encode(errno: i32, ts: &GuardStamps) -> [u8; GUARD_MSG_SIZ] {
+    let mut msg = [0u8; GUARD_MSG_SIZ];
+    msg[..4].copy_from_slice(&errno.to_ne_bytes());
+    msg[4..]
+        .chunks_mut(8)
+        .zip(ts.iter())
+        .for_each(|(m, t)| m.copy_from_slice(&t.to_ne_bytes()));
+    msg
+}
+
+fn guard_msg_decode(msg: &[u8; GUARD_MSG_SIZ]) -> (i32, GuardStamps) {
+    let mut errno = [0u8; 4];
+    errno.copy_from_slice(&msg[..4]);
+
+    let mut ts = GuardStamps::default();
+    let mut t = [0u8; 8];
+    msg[4..].chunks(8).zip(ts.iter_mut()).for_each(|(m, ts)| {
+        t.copy_from_slice(m);
+        *ts = u64::from_ne_bytes(t);
+    });
+
+    (i32::from_ne_bytes(errno), ts)
+}
+
 /// 调用方需要提供的信息,
 /// 其中 guard_pname 字段由 JM 自动生成
 pub struct RockerCfg {
@@ -69,11 +306,21 @@ pub struct RockerCfg {
     pub app_data_dir: String,
     /// 需要为哪些顶层目录的 Overlay, 如: /usr 等
     pub app_overlay_dirs: Vec<String>,
+    /// cgroup 资源限制, 为空时不创建 cgroup
+    pub cgroup_limits: CgroupLimits,
 
     guard_pid: Option<PID>,
     guard_pname: u128,
-    guard_stack: Option<Vec<u8>>,
     guard_loop_id: Option<r#loop::LoopId>,
+    master_fd: Option<FD>,
+    pkg_key: Option<PkgKey>,
+    pkg_mnt: Option<String>,
+    lifeline: Option<FD>,
+    guard_pidfd: Option<FD>,
+    guard_born: Option<u64>,
+    stats_slot: Option<StatsSlot>,
+    cgroup: Option<Cgroup>,
+    trace: Trace,
 }
 
 impl RockerCfg {
@@ -104,12 +351,21 @@ impl RockerCfg {
             app_exec_dir,
             app_data_dir,
             app_overlay_dirs,
+            cgroup_limits: CgroupLimits::default(),
 
             guard_pid: None,
             guard_pname: GUARD_PROCNAME.fetch_sub(1, Ordering::Relaxed)
                 as u128,
-            guard_stack: None,
             guard_loop_id: None,
+            master_fd: None,
+            pkg_key: None,
+            pkg_mnt: None,
+            lifeline: None,
+            guard_pidfd: None,
+            guard_born: None,
+            stats_slot: None,
+            cgroup: None,
+            trace: Trace::default(),
         };
 
         cfg.check_uid().c(d!())?;
@@ -124,10 +380,69 @@ impl RockerCfg {
     /// 启动 App, 过程若发生任何错误, 将自动清理已创建的 JG 进程.
     #[must_use]
     pub fn init(&mut self) -> Result<()> {
-        let (master_fd, guard_fd) = utils::unix_dgram_socketpair().c(d!())?;
+        self.prepare().c(d!())?;
+        self.activate().c(d!())
+    }
 
-        let guard_pid = self.start_guard(guard_fd).c(d!())?;
+    /// 创建 JG 并完成所有挂载操作, 之后 JG 阻塞等待激活通知;
+    /// 预热池中的 JG 停留在此状态, 直到被某个请求认领.
+    #[must_use]
+    pub(crate) fn prepare(&mut self) -> Result<()> {
+        // App 包由 JM 统一挂载, 同一 App 包的所有 JG 共用一个挂载点;
+        // 出错时由 Drop 释放引用
+        let (pkg_key, pkg_mnt, loop_id) =
+            pkg_cache::acquire(&self.app_pkg_path, &mut self.trace).c(d!())?;
+        self.pkg_key = Some(pkg_key);
+        self.pkg_mnt = Some(pkg_mnt);
+        self.guard_loop_id = Some(loop_id);
+
+        // 带有资源限制时, JG 将直接创建于此 cgroup 中; 出错时由 Drop 删除
+        if !self.cgroup_limits.is_empty() {
+            let t = trace::now();
+            self.cgroup_limits.check().c(d!())?;
+            self.cgroup = Some(
+                Cgroup::create(
+                    &format!("{}_{:x}", process::id(), self.guard_pname),
+                    &self.cgroup_limits,
+                )
+                .c(d!())?,
+            );
+            self.trace.span("cgroup_create", t, trace::now());
+        }
+
+        let (master_fd, guard_fd) = utils::unix_dgram_socketpair().c(d!())?;
+        self.master_fd = Some(master_fd);
+
+        // 生命线: 读端归 JG, 写端经 JC 交给 App 进程持有
+        let (lifeline_r, lifeline_w) = pipe2(OFlag::O_CLOEXEC).c(d!())?;
+        self.lifeline = Some(lifeline_w);
+
+        let t = trace::now();
+        let guard_pid = self.start_guard(guard_fd, lifeline_r).c(d!());
+        self.trace.add(Stage::GuardClone, t);
+        _info!(nix::unistd::close(guard_fd));
+        _info!(nix::unistd::close(lifeline_r));
+        if let Some(cg) = self.cgroup.as_mut() {
+            cg.guard_fds_close();
+        }
+        let guard_pid = guard_pid?;
         self.guard_pid = Some(guard_pid);
+        self.guard_born = Some(trace::now());
+
+        // 创建过程中出错时, 由 Drop 经此 pidfd 终止并回收 JG
+        if reaper::pidfd_enabled() {
+            match reaper::pidfd_open(guard_pid).c(d!()) {
+                Ok(fd) => self.guard_pidfd = Some(fd),
+                Err(e) => {
+                    utils::kill_SIGKILL(guard_pid);
+                    _info!(waitpid(
+                        Pid::from_raw(guard_pid as libc::pid_t),
+                        None
+                    ));
+                    return Err(e);
+                }
+            }
+        }
 
         macro_rules! check_err {
             ($errno: expr) => {
@@ -170,46 +485,115 @@ impl RockerCfg {
         let loop_id = i32::from_ne_bytes(loop_id);
         if 0 > loop_id {
             check_err!(loop_id);
-        } else {
-            self.guard_loop_id = Some(loop_id as LoopId);
         }
 
-        // 接收 guard 返回的错误码
-        let mut errno = 0i32.to_ne_bytes();
-        utils::recv_timed(master_fd, &mut errno[..], 2)
+        // 接收 guard 返回的错误码, 成功时其后附带各步骤的时刻
+        let mut msg = [0u8; GUARD_MSG_SIZ];
+        utils::recv_timed(master_fd, &mut msg[..], 2)
             .c(d!())
             .map_err(|e| {
                 utils::kill_SIGKILL(guard_pid);
                 e
             })?;
 
-        check_err!(i32::from_ne_bytes(errno));
+        let (errno, ts) = guard_msg_decode(&msg);
+        check_err!(errno);
+        GUARD_STEPS
+            .iter()
+            .enumerate()
+            .for_each(|(i, &name)| self.trace.span(name, ts[i], ts[i + 1]));
+        // guard_mnt_loop 与 guard_mnt_overlay 两步
+        self.trace.add_at(Stage::OverlayMount, ts[3], ts[5]);
+
+        Ok(())
+    }
 
+    /// 写入 uid/gid 映射, 然后通知 JG 开始正常运行.
+    #[must_use]
+    pub(crate) fn activate(&mut self) -> Result<()> {
+        let guard_pid = self.get_guard_pid().c(d!())?;
+        let master_fd = self.master_fd.ok_or_else(|| errgen!(OptionNone))?;
+
+        let t = trace::now();
         self.write_uidmap(guard_pid).c(d!()).map_err(|e| {
             utils::kill_SIGKILL(guard_pid);
             e
         })?;
 
+        let t_gid = trace::now();
         self.write_gidmap(guard_pid).c(d!()).map_err(|e| {
             utils::kill_SIGKILL(guard_pid);
             e
         })?;
+        self.trace.add(Stage::IdMap, t);
+        self.trace.span("write_uidmap", t, t_gid);
+        self.trace.span("write_gidmap", t_gid, trace::now());
+
+        socket::send(
+            master_fd,
+            &SUCCESS.to_ne_bytes(),
+            socket::MsgFlags::empty(),
+        )
+        .c(d!())
+        .map_err(|e| {
+            utils::kill_SIGKILL(guard_pid);
+            e
+        })?;
+
+        self.master_fd = None;
+        _info!(nix::unistd::close(master_fd));
+
+        if let Some(slot) = self.stats_slot.as_ref() {
+            slot.put(&self.stats_record(guard_pid));
+        }
 
         Ok(())
     }
 
+    /// 以 req 的身份信息激活预热池中的 JG.
+    /// 预热时已完成的阶段不在本次请求的关键路径上, 不计入其耗时.
+    #[must_use]
+    pub(crate) fn activate_as(&mut self, req: &RockerCfg) -> Result<()> {
+        self.trace = Trace::default();
+        self.app_id = req.app_id;
+        self.uid = req.uid;
+        self.gid = req.gid;
+        self.activate().c(d!())
+    }
+
+    /// 是否为尚未被激活的 JG, 且 pname 与预热池中的记录一致, 用以排除 PID 被重用的情况.
+    #[inline(always)]
+    pub(crate) fn is_idle(&self, pname: u128) -> bool {
+        self.master_fd.is_some() && pname == self.guard_pname
+    }
+
+    /// 预热池以 App 包相关的路径作为索引, 不含 app_id/uid/gid,
+    /// 这些字段只影响激活阶段.
+    pub(crate) fn pool_key(&self) -> PoolKey {
+        (
+            self.app_pkg_path.clone(),
+            self.app_exec_dir.clone(),
+            self.app_data_dir.clone(),
+            self.app_overlay_dirs.clone(),
+        )
+    }
+
     /// 在创建 JG 进程的过程中发生任何错误,
     /// JG 进程会在通知调用方之后立即自行退出.
     ///
     /// # 参数
     /// - guard_fd: 调用方传入的 `socketpair` 的其中一端
+    /// - lifeline: 生命线的读端
+    ///
+    /// 带有 cgroup 时, JG 以 clone3(CLONE_INTO_CGROUP) 直接创建于其中;
+    /// 内核不支持时, 退回到 clone 之后立即迁入的方式.
     ///
     /// # 返回值
     /// 新创建的 JG 进程的 PID
     ///
     /// # Panic Condition(Any)
     /// - 与调用方基于 `socketpair` 的通信失败
-    fn start_guard(&mut self, guard_fd: FD) -> Result<PID> {
+    fn start_guard(&mut self, guard_fd: FD, lifeline: FD) -> Result<PID> {
         macro_rules! inform_master {
             ($msg: expr) => {
                 pnk!(socket::send(
@@ -240,34 +624,76 @@ impl RockerCfg {
             };
         }
 
-        let guard_ops = || -> isize {
+        let cgroup_fds = self.cgroup.as_ref().and_then(|cg| cg.guard_fds());
+        let events = cgroup_fds.map(|(_, events)| events);
+
+        let mut guard_ops = || -> isize {
+            // 继承自 JM 的其它描述符(如其它 JG 的生命线写端)会干扰生命线的判断
+            let mut keep = vec![guard_fd, lifeline];
+            keep.extend(events);
+            _info!(utils::close_fds_except(&keep));
+
+            // 依次对应 GUARD_STEPS 中的各步骤
+            let mut ts = GuardStamps::default();
+            ts[0] = trace::now();
             err_checker!(EMAKE_PRIVATE, mount_make_rprivate("/"));
+            ts[1] = trace::now();
             err_checker!(ESET_PROCNAME, self.guard_set_self_name());
+            ts[2] = trace::now();
             err_checker!(EMNT_PROC, utils::mount_dynfs_proc());
+            ts[3] = trace::now();
             err_checker!(EMNT_LOOP, self.guard_mnt_loop(), _);
+            ts[4] = trace::now();
             err_checker!(EMNT_OVERLAY, self.guard_mnt_overlay());
+            ts[5] = trace::now();
             err_checker!(EUNSHARE_USER, unshare(CloneFlags::CLONE_NEWUSER));
-            inform_master!(SUCCESS);
-
-            loop {
-                utils::sleep(20);
-                if guard_running_alone() {
-                    break;
+            ts[6] = trace::now();
+            pnk!(socket::send(
+                guard_fd,
+                &guard_msg_encode(SUCCESS, &ts),
+                socket::MsgFlags::empty(),
+            ));
+
+            // 等待 JM 写完 uid/gid 映射后发来的激活通知,
+            // 预热池中的 JG 在被认领之前一直阻塞于此
+            let mut activated = 0i32.to_ne_bytes();
+            pnk!(socket::recv(
+                guard_fd,
+                &mut activated,
+                socket::MsgFlags::empty()
+            ));
+            _info!(nix::unistd::close(guard_fd));
+
+            if let Err(e) = guard_wait_apps(lifeline, events).c(d!()) {
+                utils::p(e);
+                loop {
+                    utils::sleep(GUARD_RECHECK_SECS as u64);
+                    guard_reap_all();
+                    if guard_running_alone() {
+                        break;
+                    }
                 }
             }
 
             0
         };
 
-        let mut stack = Vec::<u8>::with_capacity(STACK_SIZ);
-        unsafe {
-            stack.set_len(STACK_SIZ);
-        }
-
         let mut flags = CloneFlags::empty();
         flags.insert(CloneFlags::CLONE_NEWNS);
         flags.insert(CloneFlags::CLONE_NEWPID);
 
+        // clone3 的语义同 fork, 无需另备栈空间
+        if let Some((cg_fd, _)) = cgroup_fds {
+            match cgroup::clone_into(flags, cg_fd).c(d!())? {
+                Some(0) => unsafe { libc::_exit(guard_ops() as libc::c_int) },
+                Some(pid) => return Ok(pid),
+                None => {}
+            }
+        }
+
+        // clone 返回之后 JG 持有栈空间的副本, 原栈空间随即归还以供复用
+        let mut stack = Stack::get(STACK_SIZ).c(d!())?;
+
         let pid = clone(
             Box::new(guard_ops),
             stack.as_mut_slice(),
@@ -275,11 +701,17 @@ impl RockerCfg {
             Some(libc::SIGCHLD),
         )
         .c(d!())?
-        .as_raw();
+        .as_raw() as PID;
 
-        self.guard_stack.replace(stack);
+        if let Some(cg) = self.cgroup.as_ref() {
+            if let Err(e) = cg.attach(pid).c(d!()) {
+                utils::kill_SIGKILL(pid);
+                _info!(waitpid(Pid::from_raw(pid as libc::pid_t), None));
+                return Err(e);
+            }
+        }
 
-        Ok(pid as PID)
+        Ok(pid)
     }
 
     // 检查 UID 是否存在
@@ -369,60 +801,49 @@ impl RockerCfg {
         Ok(())
     }
 
-    // 清除 loop 设备与 App 包的关联, 使之可以被复用
-    fn loop_unbind(&self) -> Result<()> {
-        let loop_dev = format!(
-            "/dev/loop{}",
-            self.guard_loop_id.ok_or_else(|| errgen!(OptionNone))?
-        );
-
-        let loop_fd = fs::File::open(loop_dev).c(d!())?.into_raw_fd();
-        r#loop::loop_unbind(loop_fd).c(d!())?;
-        _info!(nix::unistd::close(loop_fd));
-
-        Ok(())
-    }
-
-    // 清理 JG 进程的资源占用
+    // 清理 JG 进程的资源占用, 释放对 App 包挂载点的引用,
+    // 最后一个使用者释放时, loop 设备被放回空闲列表以供复用
     fn resource_clean(&mut self) -> Result<()> {
-        self.guard_stack = None;
-        self.loop_unbind().c(d!())?;
+        if let Some(fd) = self.master_fd.take() {
+            _info!(nix::unistd::close(fd));
+        }
+        if let Some(fd) = self.lifeline.take() {
+            _info!(nix::unistd::close(fd));
+        }
+        if let Some(fd) = self.guard_pidfd.take() {
+            _info!(nix::unistd::close(fd));
+        }
 
-        Ok(())
-    }
+        // JG 已被回收, 其 cgroup 为空
+        self.cgroup = None;
+        self.guard_loop_id = None;
+        self.pkg_mnt = None;
+        pkg_cache::release(
+            self.pkg_key.take().ok_or_else(|| errgen!(OptionNone))?,
+        );
 
-    // 销毁 loop 设备, 通常无需调用
-    #[inline(always)]
-    fn loop_destroy(&self) -> Result<()> {
-        r#loop::loop_destroy(
-            self.guard_loop_id.ok_or_else(|| errgen!(OptionNone))?,
-        )
-        .c(d!())
+        Ok(())
     }
 
-    // 获取可用的 /dev/loopN 设备, 将 App 程序包绑定到此设备, 然后挂载到指定位置;
-    // 描述符不必手动关闭, 与 JG 的生命周期一致即可.
+    // 将 JM 挂载好的 App 包 bind 到 app_exec_dir,
+    // 然后在 JG 的 mount namespace 中隐藏整个缓存目录.
     fn guard_mnt_loop(&self) -> Result<LoopId> {
-        let (loop_dev, loop_id) = r#loop::get_loop_dev().c(d!())?;
-
-        let loop_fd =
-            fs::File::open(&loop_dev).map(|f| f.into_raw_fd()).c(d!())?;
-        let pkg_fd = fs::File::open(&self.app_pkg_path)
-            .map(|f| f.into_raw_fd())
-            .c(d!())?;
-
-        r#loop::bind_pkg(loop_fd, pkg_fd).c(d!())?;
+        let pkg_mnt =
+            self.pkg_mnt.as_ref().ok_or_else(|| errgen!(OptionNone))?;
 
         utils::mountx(
-            Some(&loop_dev),
+            Some(pkg_mnt),
             &self.app_exec_dir,
-            Some("squashfs"),
-            MsFlags::MS_RDONLY,
+            None,
+            MsFlags::MS_BIND,
             None,
         )
         .c(d!())?;
 
-        Ok(loop_id)
+        // JM 未调用 pkg_cache_init 时, 缓存目录不是挂载点, 忽略错误即可
+        let _ = umount2(pkg_cache::CACHE_ROOT, MntFlags::MNT_DETACH);
+
+        self.guard_loop_id.ok_or_else(|| errgen!(OptionNone))
     }
 
     // 对 JG 进程可见的所有根下顶层目录, 进行原地 overlay 读写隔离
@@ -475,24 +896,24 @@ impl RockerCfg {
         Ok(())
     }
 
-    /// 注册 ROCKER 资源
+    /// 注册 ROCKER 资源, JG 退出后由回收线程释放
     pub fn registe_resource(
         self,
         hdr: &ResourceHdr,
         guard_pid: libc::pid_t,
     ) -> Result<()> {
-        hdr.lock()
-            .unwrap()
-            .insert(guard_pid, self)
+        let pidfd = self.guard_pidfd;
+
+        hdr.insert(guard_pid, self)
             .and_then(|_| Some(Err(errgen!(Unknown))))
-            .unwrap_or(Ok(()))
+            .unwrap_or(Ok(()))?;
+
+        reaper::watch(guard_pid as PID, pidfd).c(d!())
     }
 
     /// 释放 ROCKER 资源
     pub fn release_resource(mut self) {
         _info!(self.resource_clean());
-        utils::sleep(2);
-        _info!(self.loop_destroy());
     }
 
     /// 调用方通过此接口获取 JG 进程的 PID
@@ -507,11 +928,52 @@ impl RockerCfg {
         self.guard_pname
     }
 
-    /// 为 namespace 创建关联描述符
-    /// NOTE: 返回的 fdset 中的所有描述符, 需要调用方显式关闭
-    pub fn get_namespace_fds(&self) -> Result<Vec<FD>> {
+    /// 调用方通过此接口获取创建过程中各阶段的耗时
+    #[inline(always)]
+    pub fn get_trace(&self) -> Trace {
+        self.trace.clone()
+    }
+
+    /// 调用方通过此接口获取 JG 所用 App 包绑定的 loop 设备编号
+    #[inline(always)]
+    pub fn get_loop_id(&self) -> Option<i32> {
+        self.guard_loop_id
+    }
+
+    /// 调用方通过此接口获取 JG 自创建至今的时长, 尚未创建时为 0
+    #[inline(always)]
+    pub fn get_age(&self) -> Duration {
+        self.guard_born
+            .map(|t| Duration::from_nanos(trace::now().saturating_sub(t)))
+            .unwrap_or_else(|| Duration::from_secs(0))
+    }
+
+    /// JG 是否已被激活, 预热池中尚未被认领的 JG 为 false
+    #[inline(always)]
+    pub fn is_activated(&self) -> bool {
+        self.guard_pid.is_some() && self.master_fd.is_none()
+    }
+
+    // 状态页中的 JG 记录
+    fn stats_record(&self, guard_pid: PID) -> Record {
+        Record {
+            pid: guard_pid as u64,
+            app_id: self.app_id as u64,
+            uid: self.uid as u64,
+            gid: self.gid.map(|g| g as u64),
+            loop_id: self.guard_loop_id.map(|l| l as u64),
+            born_ns: self.guard_born.unwrap_or(0),
+            activated: self.is_activated(),
+        }
+    }
+
+    /// 为 namespace 创建关联描述符, 生命线的写端附于其后(仅首次调用时),
+    /// 带有 cgroup 时, 其 App 子 cgroup 的目录描述符再附于生命线之后.
+    /// NOTE: 返回的 fdset 中的所有描述符, 需要调用方显式关闭;
+    /// JM 不再持有生命线, 此后其生死完全取决于 App 进程
+    pub fn get_namespace_fds(&mut self) -> Result<Vec<FD>> {
         let pid = self.get_guard_pid().c(d!())?;
-        let mut fdset = Vec::with_capacity(NS.len());
+        let mut fdset = Vec::with_capacity(NS.len() + 2);
 
         for ns_name in &NS {
             fs::File::open(format!("/proc/{}/ns/{}", pid, ns_name))
@@ -523,10 +985,42 @@ impl RockerCfg {
                 })?;
         }
 
+        if let Some(fd) = self.lifeline.take() {
+            fdset.push(fd);
+            if let Some(fd) =
+                self.cgroup.as_mut().and_then(|cg| cg.take_app_fd())
+            {
+                fdset.push(fd);
+            }
+        }
+
         Ok(fdset)
     }
 }
 
+// 未能注册为 ROCKER 资源的实例(创建过程中出错), 在此释放其对 App 包的引用
+impl Drop for RockerCfg {
+    fn drop(&mut self) {
+        if let Some(fd) = self.master_fd.take() {
+            _info!(nix::unistd::close(fd));
+        }
+        if let Some(fd) = self.lifeline.take() {
+            _info!(nix::unistd::close(fd));
+        }
+        // 未登记的 JG 不会被回收线程处理, 在此终止并回收
+        if let Some(fd) = self.guard_pidfd.take() {
+            if let Some(pid) = self.guard_pid {
+                utils::kill_SIGKILL(pid);
+                _info!(waitpid(Pid::from_raw(pid as libc::pid_t), None));
+            }
+            _info!(nix::unistd::close(fd));
+        }
+        if let Some(key) = self.pkg_key.take() {
+            pkg_cache::release(key);
+        }
+    }
+}
+
 fn mount_make_rprivate(path: &str) -> Result<()> {
     utils::mountx(
         None,
@@ -540,10 +1034,94 @@ fn mount_make_rprivate(path: &str) -> Result<()> {
     .c(d!())
 }
 
+// JG 作为其 PID namespace 的 1 号进程, 等待所有 App 进程退出:
+// 经由 signalfd 接收 SIGCHLD, 回收所有被托孤给自己的子进程;
+// App 进程并非 JG 的子进程, 故以生命线判断其存续: 所有写端关闭之后,
+// 读端收到 POLLHUP, 再扫描一次 /proc 确认.
+//
+// 生命线断开而仍有 App 进程存活时, 转为每 GUARD_RECHECK_SECS 秒检查一次,
+// 期间任一子进程退出亦会触发检查.
+//
+// 带有 cgroup 时(events 为 App 子 cgroup 的 cgroup.events), 所有 App 进程均位于该子 cgroup 中,
+// 生命线断开之后以其 populated 字段判断, 该字段变化时产生 POLLPRI, 无需定时扫描 /proc.
+fn guard_wait_apps(lifeline: FD, events: Option<FD>) -> Result<()> {
+    let mut mask = SigSet::empty();
+    mask.add(Signal::SIGCHLD);
+    mask.thread_block().c(d!())?;
+
+    let mut sfd = SignalFd::with_flags(
+        &mask,
+        SfdFlags::SFD_NONBLOCK | SfdFlags::SFD_CLOEXEC,
+    )
+    .c(d!())?;
+
+    // 生命线断开之后, 由 cgroup.events(若有)取代其位置;
+    // 读取 cgroup.events 之后 POLLPRI 才会复位, 故生命线存续期间不监视
+    let mut fds = vec![
+        PollFd::new(sfd.as_raw_fd(), PollFlags::POLLIN),
+        PollFd::new(lifeline, PollFlags::POLLIN),
+    ];
+    let mut lifeline_alive = true;
+
+    loop {
+        // 屏蔽 SIGCHLD 之前退出的子进程, 同样在此回收
+        guard_reap_all();
+
+        if !lifeline_alive && guard_apps_exited(events) {
+            return Ok(());
+        }
+
+        let timeout = alt!(
+            lifeline_alive || events.is_some(),
+            -1,
+            GUARD_RECHECK_SECS * 1000
+        );
+        match poll(&mut fds, timeout) {
+            Ok(_) | Err(nix::Error::Sys(nix::errno::Errno::EINTR)) => {}
+            Err(e) => return Err(e).c(d!()),
+        }
+
+        while let Ok(Some(_)) = sfd.read_signal() {}
+
+        if lifeline_alive
+            && fds[1]
+                .revents()
+                .map(|ev| {
+                    ev.intersects(
+                        PollFlags::POLLHUP
+                            | PollFlags::POLLERR
+                            | PollFlags::POLLNVAL,
+                    )
+                })
+                .unwrap_or(false)
+        {
+            lifeline_alive = false;
+            fds.pop();
+            fds.extend(events.map(|fd| PollFd::new(fd, PollFlags::POLLPRI)));
+            _info!(nix::unistd::close(lifeline));
+        }
+    }
+}
+
+// 所有 App 进程均已退出; 读取 cgroup.events 出错时退回到扫描 /proc 的方式
+fn guard_apps_exited(events: Option<FD>) -> bool {
+    events
+        .and_then(|fd| cgroup::populated(fd).ok())
+        .map(|populated| !populated)
+        .unwrap_or_else(guard_running_alone)
+}
+
+// 回收所有已退出的子进程, 不阻塞
+fn guard_reap_all() {
+    while let Ok(st) = waitpid(Pid::from_raw(-1), Some(WaitPidFlag::WNOHANG)) {
+        if WaitStatus::StillAlive == st {
+            break;
+        }
+    }
+}
+
 /// 检测是否只剩 JG 一个进程在运行, 即所有的 App 进程已退出.
-///
-/// # NOTE
-/// JG 刚创建时, 需要等待几秒, 让 App 进程有充分的时间启动.
+/// 父进程位于 ROCKER 之外的僵尸进程, JG 无法回收, 视同已退出.
 fn guard_running_alone() -> bool {
     let mut res = true;
 
@@ -560,7 +1138,7 @@ fn guard_running_alone() -> bool {
                 .unwrap()
                 .parse::<u32>()
             {
-                if 1 != pid {
+                if 1 != pid && !proc_exited(pid) {
                     res = false;
                     return;
                 }
@@ -570,6 +1148,18 @@ fn guard_running_alone() -> bool {
     res
 }
 
+// 进程已退出: 处于僵尸状态, 或已被回收
+fn proc_exited(pid: u32) -> bool {
+    fs::read_to_string(format!("/proc/{}/stat", pid))
+        .ok()
+        .and_then(|stat| {
+            // comm 字段可能包含空格及括号, 状态字段位于最后一个 ')' 之后
+            stat.rfind(')')
+                .map(|i| stat[i + 1..].trim_start().starts_with('Z'))
+        })
+        .unwrap_or(true)
+}
+
 #[cfg(test)]
 #[allow(non_snake_case)]
 mod tests {
@@ -656,7 +1246,189 @@ mod tests {
         utils::kill_SIGKILL(guard_pid);
 
         pnk!(cfg.resource_clean());
-        utils::sleep(1);
-        pnk!(cfg.loop_destroy());
+        let stats = r#loop::loop_stats();
+        assert!(0 < stats.recycled + stats.destroyed + stats.deferred);
+    }
+
+    #[test]
+    fn TEST_registry() {
+        let reg = Registry::new();
+        let cfg = |app_id| {
+            pnk!(RockerCfg::new(
+                app_id,
+                0,
+                None,
+                "/etc/passwd".to_owned(),
+                "/tmp".to_owned(),
+                "/tmp".to_owned(),
+                vec![],
+            ))
+        };
+
+        (0..64).for_each(|pid| {
+            assert!(reg.insert(pid, cfg(pid as u32 % 4)).is_none())
+        });
+        assert!(reg.insert(1, cfg(1)).is_some());
+        assert_eq!(64, reg.len());
+
+        assert_eq!(16, reg.pids_by_app(3).len());
+        assert_eq!(64, reg.pids_by_pkg("/etc/passwd").len());
+        assert!(reg.pids_by_pkg("/etc/shadow").is_empty());
+        assert_eq!(Some(2), reg.with(2, |c| c.app_id));
+        assert!(reg.with(64, |c| c.app_id).is_none());
+
+        // 经由 with 改变 app_id 之后, 索引随之更新
+        assert_eq!(Some(()), reg.with(3, |c| c.app_id = 7));
+        assert_eq!(15, reg.pids_by_app(3).len());
+        assert_eq!(vec![3], reg.pids_by_app(7));
+
+        (0..32).for_each(|pid| assert!(reg.remove(pid).is_some()));
+        assert_eq!(8, reg.pids_by_app(2).len());
+        assert!(reg.pids_by_app(7).is_empty());
+        assert_eq!(32, reg.pids_by_pkg("/etc/passwd").len());
+
+        (32..64).for_each(|pid| assert!(reg.remove(pid).is_some()));
+        assert!(reg.is_empty());
+        assert!(reg.pids_by_pkg("/etc/passwd").is_empty());
+        assert!(reg.shards.iter().all(|s| {
+            let s = s.lock().unwrap();
+            s.by_app.is_empty() && s.by_pkg.is_empty()
+        }));
+    }
+
+    // 对比分片登记处与单一全局锁在 8/16/32 个并发线程下的吞吐量,
+    // 每次操作包含一次登记, 一次访问及一次取出
+    #[test]
+    #[ignore]
+    fn TEST_registry_contention() {
+        use std::{sync::Barrier, thread, time::Instant};
+
+        const OPS: usize = 10_000;
+
+        fn run<I, W, R>(
+            name: &str,
+            workers: usize,
+            insert: I,
+            with: W,
+            remove: R,
+        ) where
+            I: Fn(libc::pid_t, RockerCfg) + Sync,
+            W: Fn(libc::pid_t) + Sync,
+            R: Fn(libc::pid_t) + Sync,
+        {
+            let cfgs = (0..workers)
+                .map(|_| {
+                    (0..OPS)
+                        .map(|_| {
+                            pnk!(RockerCfg::new(
+                                0,
+                                0,
+                                None,
+                                "/etc/passwd".to_owned(),
+                                "/tmp".to_owned(),
+                                "/tmp".to_owned(),
+                                vec![],
+                            ))
+                        })
+                        .collect::<Vec<_>>()
+                })
+                .collect::<Vec<_>>();
+
+            let barrier = Barrier::new(workers + 1);
+            let elapsed = thread::scope(|s| {
+                cfgs.into_iter().enumerate().for_each(|(idx, cfgs)| {
+                    let (insert, with, remove, barrier) =
+                        (&insert, &with, &remove, &barrier);
+                    s.spawn(move || {
+                        barrier.wait();
+                        cfgs.into_iter().enumerate().for_each(|(i, cfg)| {
+                            let pid = (idx * OPS + i) as libc::pid_t;
+                            insert(pid, cfg);
+                            with(pid);
+                            remove(pid);
+                        });
+                    });
+                });
+
+                barrier.wait();
+                Instant::now()
+            })
+            .elapsed();
+
+            println!(
+                "{{\"registry\":\"{}\",\"workers\":{},\"ops\":{},\"mops_per_sec\":{:.3}}}",
+                name,
+                workers,
+                workers * OPS,
+                (workers * OPS) as f64 / elapsed.as_secs_f64() / 1e6
+            );
+        }
+
+        for &workers in &[8, 16, 32] {
+            let global = Mutex::new(HashMap::new());
+            run(
+                "global_mutex",
+                workers,
+                |pid, cfg| {
+                    global.lock().unwrap().insert(pid, cfg);
+                },
+                |pid| {
+                    let _ =
+                        global.lock().unwrap().get_mut(&pid).map(|c| c.app_id);
+                },
+                |pid| {
+                    global.lock().unwrap().remove(&pid);
+                },
+            );
+
+            let reg = Registry::new();
+            run(
+                "sharded",
+                workers,
+                |pid, cfg| {
+                    reg.insert(pid, cfg);
+                },
+                |pid| {
+                    let _ = reg.with(pid, |c| c.app_id);
+                },
+                |pid| {
+                    reg.remove(pid);
+                },
+            );
+        }
+    }
+
+    #[test]
+    fn TEST_proc_exited() {
+        assert!(!proc_exited(std::process::id()));
+
+        // 未被回收的子进程处于僵尸状态
+        let child = pnk!(Command::new("true").spawn());
+        let pid = child.id();
+        while !proc_exited(pid) {
+            std::thread::yield_now();
+        }
+        assert!(fs::metadata(format!("/proc/{}", pid)).is_ok());
+
+        drop(child);
+        pnk!(waitpid(Pid::from_raw(pid as libc::pid_t), None));
+        assert!(proc_exited(pid));
+    }
+
+    #[test]
+    fn TEST_guard_msg() {
+        let ts = [1, 2, 3, 4, 5, 6, u64::max_value()];
+        let (errno, decoded) =
+            guard_msg_decode(&guard_msg_encode(SUCCESS, &ts));
+        assert_eq!(SUCCESS, errno);
+        assert_eq!(ts, decoded);
+
+        // 出错时只发送错误码
+        let mut msg = [0u8; GUARD_MSG_SIZ];
+        msg[..4].copy_from_slice(&EMNT_LOOP.to_ne_bytes());
+        assert_eq!(
+            (EMNT_LOOP, GuardStamps::default()),
+            guard_msg_decode(&msg)
+        );
     }
 }
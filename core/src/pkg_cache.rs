@@ -0,0 +1,208 @@
+//! App 包挂载缓存.
+//!
+//! 同一个 App 包(以设备号与 inode 标识)只挂载一次: 第一个使用者在 JM 私有的
+//! mount namespace 中将其挂载到缓存目录下, 之后的 JG 继承该挂载点,
+//! 并将其 bind 到各自的 app_exec_dir. 最后一个使用者退出时, 卸载并回收 loop 设备.
+//!
+//! 由此, 同一 App 的多个实例共用一个 loop 设备, 一个超级块及一份页缓存.
+//!
+//! 挂载与卸载均在锁外进行: 期间该 App 包的条目处于 Busy 状态,
+//! 同一 App 包的其它请求在条件变量上等待, 其它 App 包的请求及回收不受影响.
+
+use crate::{
+    _info, d,
+    err::*,
+    r#loop::{self, LoopId},
+    trace::{self, Stage, Trace},
+    utils,
+};
+use lazy_static::lazy_static;
+use nix::{
+    mount::{umount2, MntFlags, MsFlags},
+    sched::{unshare, CloneFlags},
+};
+use std::{
+    collections::HashMap,
+    fs,
+    os::unix::{fs::MetadataExt, io::IntoRawFd},
+    sync::{Condvar, Mutex},
+};
+
+/// 缓存目录, JM 启动时在其私有的 mount namespace 中挂载为 tmpfs,
+/// 对宿主系统不可见
+pub(crate) const CACHE_ROOT: &str = "/tmp/.rocker_pkg____";
+
+/// App 包的标识: (st_dev, st_ino)
+pub(crate) type PkgKey = (u64, u64);
+
+struct Entry {
+    refs: usize,
+    loop_id: LoopId,
+    mnt_path: String,
+}
+
+enum Slot {
+    // 正在挂载或卸载, 完成之后唤醒等待者
+    Busy,
+    Ready(Entry),
+}
+
+lazy_static! {
+    static ref CACHE: Mutex<HashMap<PkgKey, Slot>> =
+        Mutex::new(HashMap::new());
+
+    // Busy 状态的条目完成挂载或卸载时通知
+    static ref SETTLED: Condvar = Condvar::new();
+}
+
+/// 为 JM 创建私有的 mount namespace, 并在其中挂载缓存目录.
+/// 之后新增的宿主挂载点仍然可见(slave), 但 JM 的挂载操作不会传播到宿主.
+///
+/// # NOTE
+/// 必须在创建任何线程之前调用, 否则 unshare 会返回 EINVAL.
+pub fn pkg_cache_init() -> Result<()> {
+    unshare(CloneFlags::CLONE_NEWNS).c(d!())?;
+
+    utils::mountx(None, "/", None, MsFlags::MS_REC | MsFlags::MS_SLAVE, None)
+        .c(d!())?;
+
+    fs::create_dir_all(CACHE_ROOT).c(d!())?;
+    utils::mountx(
+        Some("tmpfs"),
+        CACHE_ROOT,
+        Some("tmpfs"),
+        MsFlags::MS_NODEV | MsFlags::MS_NOEXEC | MsFlags::MS_NOSUID,
+        Some("mode=0700"),
+    )
+    .c(d!())
+}
+
+/// 获取 App 包的挂载点, 首次使用时完成挂载, 引用计数加一;
+/// 挂载过程中 loop 设备的绑定及 squashfs 挂载的耗时记入 trace.
+///
+/// # 返回值
+/// (App 包的标识, 挂载点路径, 所用的 loop 设备 ID)
+pub(crate) fn acquire(
+    pkg_path: &str,
+    trace: &mut Trace,
+) -> Result<(PkgKey, String, LoopId)> {
+    let meta = fs::metadata(pkg_path).c(d!())?;
+    let key = (meta.dev(), meta.ino());
+
+    let mut cache = CACHE.lock().unwrap();
+    loop {
+        match cache.get_mut(&key) {
+            Some(Slot::Ready(e)) => {
+                e.refs += 1;
+                return Ok((key, e.mnt_path.clone(), e.loop_id));
+            }
+            Some(Slot::Busy) => cache = SETTLED.wait(cache).unwrap(),
+            None => break,
+        }
+    }
+    cache.insert(key, Slot::Busy);
+    drop(cache);
+
+    let mnt_path = format!("{}/{:x}_{:x}", CACHE_ROOT, key.0, key.1);
+    let mounted = mount_pkg(pkg_path, &mnt_path, trace).c(d!());
+
+    // 挂载失败时移除条目, 等待者随后自行重试
+    let mut cache = CACHE.lock().unwrap();
+    match mounted {
+        Ok(loop_id) => cache.insert(
+            key,
+            Slot::Ready(Entry {
+                refs: 1,
+                loop_id,
+                mnt_path: mnt_path.clone(),
+            }),
+        ),
+        Err(_) => cache.remove(&key),
+    };
+    drop(cache);
+    SETTLED.notify_all();
+
+    mounted.map(|loop_id| (key, mnt_path, loop_id))
+}
+
+/// 当前已挂载的各 App 包所用的 loop 设备编号及其引用计数(使用中的 JG 数量),
+/// 按 loop 设备编号排序
+pub fn pkg_cache_loops() -> Vec<(i32, usize)> {
+    let mut loops = CACHE
+        .lock()
+        .unwrap()
+        .values()
+        .filter_map(|s| match s {
+            Slot::Ready(e) => Some((e.loop_id, e.refs)),
+            Slot::Busy => None,
+        })
+        .collect::<Vec<_>>();
+    loops.sort_unstable();
+    loops
+}
+
+/// 引用计数减一, 最后一个使用者释放时卸载 App 包并回收 loop 设备.
+/// 卸载完成之前条目保持 Busy, 以免新的请求在同一路径上重新挂载之后被一并卸载.
+pub(crate) fn release(key: PkgKey) {
+    let mut cache = CACHE.lock().unwrap();
+    match cache.get_mut(&key) {
+        Some(Slot::Ready(e)) if 1 < e.refs => {
+            e.refs -= 1;
+            return;
+        }
+        Some(Slot::Ready(_)) => {}
+        _ => return,
+    }
+
+    let e = match cache.insert(key, Slot::Busy) {
+        Some(Slot::Ready(e)) => e,
+        _ => unreachable!(),
+    };
+    drop(cache);
+
+    // 已退出的 JG 持有的挂载点副本可能尚未完全释放, 故使用 MNT_DETACH;
+    // loop 设备设置了 AUTOCLEAR, 会在最后一个引用释放后自动解绑
+    _info!(umount2(e.mnt_path.as_str(), MntFlags::MNT_DETACH));
+    _info!(fs::remove_dir(&e.mnt_path));
+    r#loop::loop_recycle(e.loop_id);
+
+    CACHE.lock().unwrap().remove(&key);
+    SETTLED.notify_all();
+}
+
+// 将 App 包绑定到 loop 设备, 并挂载到 mnt_path;
+// 挂载完成之后 loop 设备由挂载点持有, 描述符随即关闭.
+fn mount_pkg(
+    pkg_path: &str,
+    mnt_path: &str,
+    trace: &mut Trace,
+) -> Result<LoopId> {
+    fs::create_dir_all(mnt_path).c(d!())?;
+
+    let t = trace::now();
+    let pkg_fd = fs::File::open(pkg_path).map(|f| f.into_raw_fd()).c(d!())?;
+
+    let hint = r#loop::loop_reserve();
+    let attached = r#loop::attach_pkg(hint, pkg_fd).c(d!());
+    _info!(nix::unistd::close(pkg_fd));
+    r#loop::loop_settle(hint, attached.as_ref().ok().map(|a| a.1));
+    let (loop_dev, loop_id, loop_fd) = attached?;
+    trace.add(Stage::LoopAttach, t);
+
+    let t = trace::now();
+    let mounted = utils::mountx(
+        Some(&loop_dev),
+        mnt_path,
+        Some("squashfs"),
+        MsFlags::MS_RDONLY,
+        None,
+    )
+    .c(d!());
+    trace.add(Stage::SquashfsMount, t);
+    _info!(nix::unistd::close(loop_fd));
+
+    mounted.map(|_| loop_id).map_err(|e| {
+        r#loop::loop_recycle(loop_id);
+        e
+    })
+}
@@ -0,0 +1,272 @@
+//! JG 预热池.
+//!
+//! 为近期被请求过的 App 包预先创建若干已完成挂载的 JG,
+//! 请求到达时只需认领其中一个, 写入 uid/gid 映射即可使用.
+//! 空闲超过 TTL 的 JG 会被清理, 以免长期占用 loop 设备与内存.
+//!
+//! NOTE: 预热池只索引空闲 JG 的 PID, JG 的资源始终登记在 ResourceHdr 中,
+//! 由服务端统一回收.
+
+use crate::{
+    alt, d,
+    err::*,
+    master::{ResourceHdr, RockerCfg, FD, PID},
+    trace::Trace,
+    utils::{self, p},
+};
+use std::{
+    collections::{HashMap, VecDeque},
+    env,
+    sync::{Arc, Condvar, Mutex},
+    thread,
+    time::{Duration, Instant},
+};
+
+/// (app_pkg_path, app_exec_dir, app_data_dir, app_overlay_dirs)
+pub(crate) type PoolKey = (String, String, String, Vec<String>);
+
+// 每个 App 包保持的空闲 JG 数量, 0 表示关闭预热池
+const ENV_SIZE: &str = "ROCKER_WARM_POOL_SIZE";
+// 空闲 JG 及 App 包热度的有效期, 单位: 秒
+const ENV_TTL: &str = "ROCKER_WARM_POOL_TTL";
+const DEFAULT_TTL: u64 = 60;
+
+// 一个空闲的 JG
+struct Idle {
+    pid: PID,
+    pname: u128,
+    born: Instant,
+}
+
+// 一个 App 包的预热状态,
+// uid/gid 取自最近一次请求, 仅用于创建 JG 时的合法性检查
+struct Slot {
+    uid: u32,
+    gid: Option<u32>,
+    last_used: Instant,
+    idle: VecDeque<Idle>,
+}
+
+/// JG 预热池
+pub struct WarmPool {
+    hdr: ResourceHdr,
+    size: usize,
+    ttl: Duration,
+    slots: Mutex<HashMap<PoolKey, Slot>>,
+    cond: Condvar,
+}
+
+impl WarmPool {
+    /// 创建预热池并启动后台维护线程
+    ///
+    /// # 参数
+    /// - hdr: JG 资源的登记处, 与服务端回收资源所用的是同一个
+    /// - size: 每个 App 包保持的空闲 JG 数量
+    /// - ttl: 空闲 JG 的存活时间, 亦是 App 包被视为"热点"的时长
+    pub fn new(hdr: ResourceHdr, size: usize, ttl: Duration) -> Arc<WarmPool> {
+        let pool = Arc::new(WarmPool {
+            hdr,
+            size,
+            ttl,
+            slots: Mutex::new(HashMap::new()),
+            cond: Condvar::new(),
+        });
+
+        let hdl = Arc::clone(&pool);
+        thread::spawn(move || hdl.maintain());
+
+        pool
+    }
+
+    /// 按环境变量 `ROCKER_WARM_POOL_SIZE` 与 `ROCKER_WARM_POOL_TTL` 创建预热池,
+    /// 未设置或 size 为 0 时返回 None
+    pub fn from_env(hdr: ResourceHdr) -> Option<Arc<WarmPool>> {
+        let parse = |name: &str| {
+            env::var(name)
+                .ok()
+                .and_then(|v| v.trim().parse::<u64>().ok())
+        };
+
+        let size = parse(ENV_SIZE).unwrap_or(0) as usize;
+        let ttl = parse(ENV_TTL).unwrap_or(DEFAULT_TTL).max(1);
+
+        alt!(
+            0 == size,
+            None,
+            Some(WarmPool::new(hdr, size, Duration::from_secs(ttl)))
+        )
+    }
+
+    /// 为 req 认领一个同一 App 包的空闲 JG, 以 req 的身份信息激活,
+    /// 返回 JG 的 PID, 进程名称, namespace 描述符及激活过程的耗时,
+    /// 描述符需要调用方显式关闭.
+    /// 没有可用的 JG 时返回 None, 调用方应自行创建.
+    /// 预热的 JG 不属于任何 cgroup, 带有资源限制的请求同样返回 None.
+    pub fn claim(
+        &self,
+        req: &RockerCfg,
+    ) -> Result<Option<(libc::pid_t, u128, Vec<FD>, Trace)>> {
+        if !req.cgroup_limits.is_empty() {
+            return Ok(None);
+        }
+
+        loop {
+            let idle = match self.take(req) {
+                Some(i) => i,
+                None => {
+                    // 唤醒维护线程, 为此 App 包补充 JG
+                    self.cond.notify_one();
+                    return Ok(None);
+                }
+            };
+
+            let (fds, trace) =
+                match self.hdr.with(idle.pid as libc::pid_t, |g| {
+                    alt!(
+                        g.is_idle(idle.pname),
+                        Some(
+                            g.activate_as(req)
+                                .and_then(|_| g.get_namespace_fds())
+                                .map(|fds| (fds, g.get_trace()))
+                        ),
+                        None
+                    )
+                }) {
+                    Some(Some(ret)) => ret.c(d!())?,
+                    // 已退出的 JG, 其资源由服务端回收
+                    _ => continue,
+                };
+
+            self.cond.notify_one();
+
+            return Ok(Some((
+                idle.pid as libc::pid_t,
+                idle.pname,
+                fds,
+                trace,
+            )));
+        }
+    }
+
+    // 记录 App 包的使用时间, 并取出一个空闲 JG
+    fn take(&self, req: &RockerCfg) -> Option<Idle> {
+        let mut slots = self.slots.lock().unwrap();
+        let slot = slots.entry(req.pool_key()).or_insert_with(|| Slot {
+            uid: req.uid,
+            gid: req.gid,
+            last_used: Instant::now(),
+            idle: VecDeque::with_capacity(self.size),
+        });
+
+        slot.uid = req.uid;
+        slot.gid = req.gid;
+        slot.last_used = Instant::now();
+        slot.idle.pop_front()
+    }
+
+    // 后台维护: 清理过期的 JG, 为热点 App 包补足空闲 JG.
+    // 创建 JG 期间不持有锁, 以免阻塞请求路径上的认领操作.
+    fn maintain(&self) {
+        let tick = self.ttl.min(Duration::from_secs(1));
+
+        let mut slots = self.slots.lock().unwrap();
+        loop {
+            slots = self.cond.wait_timeout(slots, tick).unwrap().0;
+
+            let now = Instant::now();
+            let ttl = self.ttl;
+            let size = self.size;
+            let mut expired = vec![];
+            let mut todo = vec![];
+
+            slots.retain(|key, slot| {
+                while slot
+                    .idle
+                    .front()
+                    .map(|i| now.duration_since(i.born) >= ttl)
+                    .unwrap_or(false)
+                {
+                    expired.push(slot.idle.pop_front().unwrap());
+                }
+
+                // 不再是热点, 清理其所有 JG
+                if now.duration_since(slot.last_used) >= ttl {
+                    expired.extend(slot.idle.drain(..));
+                    return false;
+                }
+
+                (slot.idle.len()..size).for_each(|_| {
+                    todo.push((key.clone(), slot.uid, slot.gid))
+                });
+
+                true
+            });
+
+            drop(slots);
+
+            expired.iter().for_each(|i| self.evict(i));
+
+            let built = todo
+                .into_iter()
+                .filter_map(|(key, uid, gid)| {
+                    self.prepare(&key, uid, gid)
+                        .c(d!())
+                        .map_err(p)
+                        .ok()
+                        .map(|i| (key, i))
+                })
+                .collect::<Vec<_>>();
+
+            slots = self.slots.lock().unwrap();
+            for (key, idle) in built {
+                match slots.get_mut(&key) {
+                    Some(slot) if slot.idle.len() < size => {
+                        slot.idle.push_back(idle)
+                    }
+                    _ => self.evict(&idle),
+                }
+            }
+        }
+    }
+
+    // 创建一个空闲 JG 并登记其资源
+    fn prepare(
+        &self,
+        key: &PoolKey,
+        uid: u32,
+        gid: Option<u32>,
+    ) -> Result<Idle> {
+        let mut cfg = RockerCfg::new(
+            0,
+            uid,
+            gid,
+            key.0.clone(),
+            key.1.clone(),
+            key.2.clone(),
+            key.3.clone(),
+        )
+        .c(d!())?;
+
+        cfg.prepare().c(d!())?;
+
+        let pid = cfg.get_guard_pid().c(d!())?;
+        let pname = cfg.get_guard_pname();
+        cfg.registe_resource(&self.hdr, pid as libc::pid_t)
+            .c(d!())?;
+
+        Ok(Idle {
+            pid,
+            pname,
+            born: Instant::now(),
+        })
+    }
+
+    // 终止空闲 JG, 其资源由服务端在回收子进程时释放
+    fn evict(&self, idle: &Idle) {
+        self.hdr.with(idle.pid as libc::pid_t, |g| {
+            if g.is_idle(idle.pname) {
+                utils::kill_SIGKILL(idle.pid);
+            }
+        });
+    }
+}
@@ -0,0 +1,187 @@
+//! JG 回收器.
+//!
+//! 每个已登记的 JG 持有一个 pidfd(Linux 5.3+), 统一注册到一个 epoll 实例中,
+//! JG 退出时其 pidfd 变为可读, 回收线程随即回收该进程并释放其资源.
+//! 资源登记处的锁只在取出条目时短暂持有, 卸载挂载点, 回收 loop 设备等操作
+//! 均在锁外完成, 不会阻塞新 JG 的登记.
+//!
+//! 内核不支持 pidfd 时, 退回到阻塞于 waitpid 的方式.
+
+use crate::{
+    _info, d,
+    err::*,
+    errgen_sys,
+    master::{ResourceHdr, FD, PID},
+    stats_page,
+};
+use lazy_static::lazy_static;
+use nix::{
+    errno::Errno,
+    sys::{
+        epoll::{
+            epoll_create1, epoll_ctl, epoll_wait, EpollCreateFlags,
+            EpollEvent, EpollFlags, EpollOp,
+        },
+        wait::{waitpid, WaitPidFlag, WaitStatus},
+    },
+    unistd::Pid,
+};
+use std::{
+    sync::{Condvar, Mutex},
+    time::Duration,
+};
+
+// `man pidfd_open(2)`, libc 尚未提供此常量
+const SYS_PIDFD_OPEN: libc::c_long = 434;
+
+// 单次 epoll_wait 最多处理的事件数量
+const EVENT_BATCH: usize = 64;
+
+lazy_static! {
+    // 为 None 时, 使用 waitpid 方式回收
+    static ref EPFD: Option<FD> = epoll_new();
+
+    // waitpid 方式下, 没有子进程时在此等待新 JG 登记
+    static ref NEW_GUARD: (Mutex<bool>, Condvar) =
+        (Mutex::new(false), Condvar::new());
+}
+
+fn epoll_new() -> Option<FD> {
+    // 以自身 PID 探测内核是否支持 pidfd
+    let fd = pidfd_open(std::process::id()).ok()?;
+    _info!(nix::unistd::close(fd));
+
+    epoll_create1(EpollCreateFlags::EPOLL_CLOEXEC).ok()
+}
+
+/// 为 pid 创建 pidfd, 内核不支持时返回错误.
+/// pidfd 存续期间, 未被回收的 pid 不会被重用.
+pub(crate) fn pidfd_open(pid: PID) -> Result<FD> {
+    let fd = unsafe {
+        libc::syscall(SYS_PIDFD_OPEN, pid as libc::pid_t, 0 as libc::c_uint)
+    };
+
+    if 0 > fd {
+        return Err(errgen_sys!(Unknown));
+    }
+
+    Ok(fd as FD)
+}
+
+/// 是否使用 pidfd 方式回收, 为 false 时调用方无需创建 pidfd
+#[inline(always)]
+pub(crate) fn pidfd_enabled() -> bool {
+    EPFD.is_some()
+}
+
+/// 开始监视一个已登记的 JG, pidfd 为 None 时仅唤醒 waitpid 方式的回收线程.
+/// pidfd 由 JG 的资源条目持有, 关闭时自动从 epoll 中移除.
+pub(crate) fn watch(pid: PID, pidfd: Option<FD>) -> Result<()> {
+    match (*EPFD, pidfd) {
+        (Some(epfd), Some(fd)) => {
+            let mut ev = EpollEvent::new(EpollFlags::EPOLLIN, pid as u64);
+            epoll_ctl(epfd, EpollOp::EpollCtlAdd, fd, &mut ev).c(d!())
+        }
+        _ => {
+            *NEW_GUARD.0.lock().unwrap() = true;
+            NEW_GUARD.1.notify_one();
+            Ok(())
+        }
+    }
+}
+
+/// 回收线程的主循环, 永不返回
+pub fn reaper_run(hdr: &ResourceHdr) -> ! {
+    match *EPFD {
+        Some(epfd) => reap_by_pidfd(epfd, hdr),
+        None => reap_by_waitpid(hdr),
+    }
+}
+
+fn reap_by_pidfd(epfd: FD, hdr: &ResourceHdr) -> ! {
+    let mut events = [EpollEvent::empty(); EVENT_BATCH];
+    loop {
+        let n = match epoll_wait(epfd, &mut events, -1) {
+            Ok(n) => n,
+            Err(nix::Error::Sys(Errno::EINTR)) => continue,
+            ret => {
+                _info!(ret);
+                continue;
+            }
+        };
+
+        events[..n].iter().for_each(|ev| {
+            let pid = ev.data() as PID;
+            match waitpid(
+                Pid::from_raw(pid as libc::pid_t),
+                Some(WaitPidFlag::WNOHANG),
+            ) {
+                Ok(WaitStatus::StillAlive) => {}
+                // 出错时同样释放资源, 否则其 pidfd 将一直可读
+                _ => release(hdr, pid),
+            }
+        });
+    }
+}
+
+fn reap_by_waitpid(hdr: &ResourceHdr) -> ! {
+    loop {
+        match waitpid(Pid::from_raw(-1), None) {
+            Ok(st) => {
+                if let Some(pid) = st.pid() {
+                    release(hdr, pid.as_raw() as PID);
+                }
+            }
+            // 不存在子进程
+            Err(nix::Error::Sys(Errno::ECHILD)) => {
+                let mut new = NEW_GUARD.0.lock().unwrap();
+                if !*new {
+                    new = NEW_GUARD
+                        .1
+                        .wait_timeout(new, Duration::from_secs(1))
+                        .unwrap()
+                        .0;
+                }
+                *new = false;
+            }
+            ret => {
+                _info!(ret);
+            }
+        }
+    }
+}
+
+// 取出 JG 的资源条目之后立即释放分片锁, 再清理资源
+fn release(hdr: &ResourceHdr, pid: PID) {
+    let cfg = hdr.remove(pid as libc::pid_t);
+    if let Some(cfg) = cfg {
+        cfg.release_resource();
+        stats_page::stats_count_reap();
+    }
+}
+
+#[cfg(test)]
+#[allow(non_snake_case)]
+mod tests {
+    use super::*;
+    use crate::pnk;
+    use std::process::Command;
+
+    #[test]
+    fn TEST_pidfd_open() {
+        if !pidfd_enabled() {
+            return;
+        }
+
+        let child = pnk!(Command::new("true").spawn());
+        let pidfd = pnk!(pidfd_open(child.id()));
+
+        // 子进程退出后 pidfd 变为可读
+        let mut fds =
+            [nix::poll::PollFd::new(pidfd, nix::poll::PollFlags::POLLIN)];
+        assert_eq!(1, pnk!(nix::poll::poll(&mut fds, 5000)));
+
+        pnk!(waitpid(Pid::from_raw(child.id() as libc::pid_t), None));
+        pnk!(nix::unistd::close(pidfd));
+    }
+}
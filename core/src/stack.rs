@@ -0,0 +1,209 @@
+//! JG 的 clone 栈空间.
+//!
+//! 栈空间以 mmap(MAP_STACK|MAP_NORESERVE) 方式分配, 只有实际写入的页才计入内存用量,
+//! 最低处的一页设为不可访问, 栈溢出时触发 SIGSEGV, 而不是静默地改写相邻内存.
+//!
+//! JG 创建时不带 CLONE_VM, clone 返回之后其持有栈空间的副本,
+//! 原栈空间随即被归还到缓存中, 供后续的 JG 复用, 不再随 JG 的生命周期长期占用.
+
+use crate::{d, err::*, errgen_sys};
+use lazy_static::lazy_static;
+use std::{ptr, slice, sync::Mutex};
+
+// 缓存的空闲栈空间的最大数量, 超出的部分直接 munmap
+const POOL_MAX: usize = 16;
+
+lazy_static! {
+    static ref POOL: Mutex<Vec<Stack>> =
+        Mutex::new(Vec::with_capacity(POOL_MAX));
+}
+
+/// 一块 clone 栈空间, drop 时归还到缓存中
+pub(crate) struct Stack {
+    // 映射区的起始地址, 即保护页
+    addr: usize,
+    // 映射区的总长度, 含保护页
+    len: usize,
+}
+
+impl Stack {
+    /// 取得一块可用的栈空间, 优先复用已归还的空间
+    ///
+    /// # 参数
+    /// - siz: 可用的栈空间大小, 向上对齐到页大小, 不含保护页
+    pub(crate) fn get(siz: usize) -> Result<Stack> {
+        let pagesiz = page_size();
+        let len = (siz + pagesiz - 1) / pagesiz * pagesiz + pagesiz;
+
+        {
+            let mut pool = POOL.lock().unwrap();
+            if let Some(idx) = pool.iter().rposition(|s| len == s.len) {
+                return Ok(pool.swap_remove(idx));
+            }
+        }
+
+        let addr = unsafe {
+            libc::mmap(
+                ptr::null_mut(),
+                len,
+                libc::PROT_READ | libc::PROT_WRITE,
+                libc::MAP_PRIVATE
+                    | libc::MAP_ANONYMOUS
+                    | libc::MAP_STACK
+                    | libc::MAP_NORESERVE,
+                -1,
+                0,
+            )
+        };
+        if libc::MAP_FAILED == addr {
+            return Err(errgen_sys!(Unknown));
+        }
+
+        // 此后出错时, 由 drop 负责 munmap
+        let stack = Stack {
+            addr: addr as usize,
+            len,
+        };
+
+        if 0 > unsafe { libc::mprotect(addr, pagesiz, libc::PROT_NONE) } {
+            return Err(errgen_sys!(Unknown));
+        }
+
+        Ok(stack)
+    }
+
+    /// 保护页之上的可用部分, 作为 clone 的栈参数
+    pub(crate) fn as_mut_slice(&mut self) -> &mut [u8] {
+        let pagesiz = page_size();
+        unsafe {
+            slice::from_raw_parts_mut(
+                (self.addr + pagesiz) as *mut u8,
+                self.len - pagesiz,
+            )
+        }
+    }
+}
+
+impl Drop for Stack {
+    fn drop(&mut self) {
+        if 0 == self.addr {
+            return;
+        }
+
+        {
+            let mut pool = POOL.lock().unwrap();
+            if POOL_MAX > pool.len() {
+                pool.push(Stack {
+                    addr: self.addr,
+                    len: self.len,
+                });
+                self.addr = 0;
+                return;
+            }
+        }
+
+        unsafe {
+            libc::munmap(self.addr as *mut libc::c_void, self.len);
+        }
+        self.addr = 0;
+    }
+}
+
+fn page_size() -> usize {
+    unsafe { libc::sysconf(libc::_SC_PAGESIZE) as usize }
+}
+
+#[cfg(test)]
+#[allow(non_snake_case)]
+mod tests {
+    use super::*;
+    use crate::pnk;
+    use nix::{
+        sched::{clone, CloneFlags},
+        sys::wait::waitpid,
+        unistd::{pipe2, read, Pid},
+    };
+    use std::fs;
+
+    // 进程的 VmRSS 与 VmSize, 单位: KB
+    fn mem_kb() -> (usize, usize) {
+        let status = pnk!(fs::read_to_string("/proc/self/status"));
+        let get = |name: &str| -> usize {
+            status
+                .lines()
+                .find(|l| l.starts_with(name))
+                .and_then(|l| l.split_whitespace().nth(1))
+                .and_then(|v| v.parse().ok())
+                .unwrap_or(0)
+        };
+        (get("VmRSS:"), get("VmSize:"))
+    }
+
+    #[test]
+    fn TEST_stack_reuse() {
+        let pagesiz = page_size();
+
+        let mut s = pnk!(Stack::get(64 * 1024 - 1));
+        assert_eq!(64 * 1024 + pagesiz, s.len);
+        assert_eq!(64 * 1024, s.as_mut_slice().len());
+
+        // 保护页不可访问
+        let maps = pnk!(fs::read_to_string("/proc/self/maps"));
+        let guard = format!("{:x}-{:x} ---p", s.addr, s.addr + pagesiz);
+        assert!(maps.lines().any(|l| l.starts_with(&guard)));
+
+        let addr = s.addr;
+        drop(s);
+
+        // 长度相同的空间被复用, 长度不同的则不会
+        let s = pnk!(Stack::get(64 * 1024));
+        assert_eq!(addr, s.addr);
+        let s2 = pnk!(Stack::get(64 * 1024 + pagesiz));
+        assert_ne!(addr, s2.addr);
+    }
+
+    // 以 200 个存活的子进程模拟 200 个 JG, 观察 clone 栈空间对 RSS/VSZ 的影响:
+    // 栈空间在 clone 返回后即被复用, VSZ 的增量应远小于 200 x 2MB.
+    // `cargo test -- --ignored --nocapture TEST_stack_mem_200`
+    #[test]
+    #[ignore]
+    fn TEST_stack_mem_200() {
+        const NUM: usize = 200;
+        const SIZ: usize = 2 * 1024 * 1024;
+
+        let (rfd, wfd) = pnk!(pipe2(nix::fcntl::OFlag::O_CLOEXEC));
+        let (rss0, vsz0) = mem_kb();
+
+        let pids = (0..NUM)
+            .map(|_| {
+                let mut stack = pnk!(Stack::get(SIZ));
+                let ops = move || -> isize {
+                    // 阻塞至父进程关闭写端
+                    let _ = nix::unistd::close(wfd);
+                    let mut b = [0u8; 1];
+                    let _ = read(rfd, &mut b);
+                    0
+                };
+                pnk!(clone(
+                    Box::new(ops),
+                    stack.as_mut_slice(),
+                    CloneFlags::empty(),
+                    Some(libc::SIGCHLD)
+                ))
+            })
+            .collect::<Vec<Pid>>();
+
+        let (rss1, vsz1) = mem_kb();
+        println!(
+            "{} live children: VmRSS {} KB -> {} KB, VmSize {} KB -> {} KB",
+            NUM, rss0, rss1, vsz0, vsz1
+        );
+        assert!(vsz1.saturating_sub(vsz0) * 1024 < NUM * SIZ / 10);
+
+        pnk!(nix::unistd::close(wfd));
+        pids.into_iter().for_each(|pid| {
+            pnk!(waitpid(pid, None));
+        });
+        pnk!(nix::unistd::close(rfd));
+    }
+}
@@ -0,0 +1,459 @@
+//! 共享内存状态页.
+//!
+//! 各项计数及已登记 JG 的记录存放于一块 memfd 共享内存中, 客户端经由
+//! `ROCKER_stats_map` 取得其只读描述符并映射之后, 无需任何系统调用即可读取,
+//! 不经过请求队列, 也不受服务端繁忙程度的影响.
+//!
+//! 布局(本机字节序, 各字段均为 u64), 须与 librocker_client 中的
+//! `RockerStatsHdr`/`RockerStatsGuard` 保持一致:
+//! - [0, HDR_SIZ): 页头, 见 Header
+//! - 其后为 STATS_SLOT_NUM 个 JG 记录, 每个 SLOT_SIZ 字节, 见 Slot
+//!
+//! 计数器各自为独立的原子变量, 由处理请求的多个线程以 fetch_add 更新, 不加锁.
+//! 每个 JG 记录带有各自的序号(seqlock), 同一时刻只有一个写者:
+//! 登记时由登记线程写入, 激活时在分片锁内更新, 条目被释放时清除;
+//! 写者先将序号置为奇数, 写完所有字段后再置为偶数,
+//! 读者在前后两次读到的序号相同且为偶数时, 得到的记录是一致的.
+//!
+//! 内核不支持 memfd 时, 页面位于进程私有的内存中, 计数照常进行, 只是无法与客户端共享.
+
+use crate::{err::*, errgen_sys, utils};
+use lazy_static::lazy_static;
+use std::{
+    ffi::CString,
+    mem,
+    os::unix::io::RawFd,
+    ptr,
+    sync::atomic::{fence, AtomicBool, AtomicU64, AtomicUsize, Ordering},
+};
+
+// `man memfd_create(2)`, `man fcntl(2)`, libc 尚未提供这些常量
+const MFD_CLOEXEC: libc::c_uint = 0x1;
+const MFD_ALLOW_SEALING: libc::c_uint = 0x2;
+const F_ADD_SEALS: libc::c_int = 1033;
+const F_SEAL_SEAL: libc::c_int = 0x1;
+const F_SEAL_SHRINK: libc::c_int = 0x2;
+const F_SEAL_GROW: libc::c_int = 0x4;
+
+/// 页头中的标识, 即 "RKSTATS1"
+pub const STATS_PAGE_MAGIC: u64 = 0x524b_5354_4154_5331;
+
+/// 布局的版本号, 布局变化时递增
+pub const STATS_PAGE_VERSION: u64 = 1;
+
+/// JG 记录的数量; 超出时只计入 overflow, 这些 JG 只能经由 stats 请求查看
+pub const STATS_SLOT_NUM: usize = 1024;
+
+// 页头的长度, 预留了扩充计数器的空间
+const HDR_SIZ: usize = 128;
+
+// 单个 JG 记录的长度, 即一个缓存行
+const SLOT_SIZ: usize = 64;
+
+// 整个页面的长度
+const PAGE_SIZ: usize = HDR_SIZ + STATS_SLOT_NUM * SLOT_SIZ;
+
+// 记录中的 gid/loop_id 不存在时的取值
+const NONE: u64 = std::u64::MAX;
+
+// 记录中 flags 字段的位: JG 已被激活
+const FLAG_ACTIVATED: u64 = 0x1;
+
+lazy_static! {
+    static ref PAGE: Page = Page::new();
+}
+
+#[repr(C)]
+struct Header {
+    magic: AtomicU64,
+    version: AtomicU64,
+    slot_num: AtomicU64,
+    slot_siz: AtomicU64,
+    // 创建成功的 ROCKER 数量
+    launched: AtomicU64,
+    // 创建失败的 ROCKER 数量
+    failed: AtomicU64,
+    // 格式错误或校验失败的请求数量
+    rejected: AtomicU64,
+    // 已回收并释放资源的 JG 数量
+    reaped: AtomicU64,
+    // 当前已登记的 JG 数量, 含预热池中尚未被认领的部分
+    live: AtomicU64,
+    // 已登记但未能分得记录的 JG 数量
+    overflow: AtomicU64,
+}
+
+#[repr(C)]
+struct Slot {
+    // 奇数表示正在写入
+    seq: AtomicU64,
+    // 为 0 表示空闲
+    pid: AtomicU64,
+    app_id: AtomicU64,
+    uid: AtomicU64,
+    gid: AtomicU64,
+    loop_id: AtomicU64,
+    // JG 的创建时刻, 取自 CLOCK_MONOTONIC, 单位: 纳秒
+    born_ns: AtomicU64,
+    flags: AtomicU64,
+}
+
+impl Slot {
+    // 只能由该记录当前唯一的写者调用
+    fn write(&self, rec: &Record) {
+        let seq = self.seq.load(Ordering::Relaxed);
+        self.seq.store(seq + 1, Ordering::Relaxed);
+        fence(Ordering::Release);
+
+        self.pid.store(rec.pid, Ordering::Relaxed);
+        self.app_id.store(rec.app_id, Ordering::Relaxed);
+        self.uid.store(rec.uid, Ordering::Relaxed);
+        self.gid.store(rec.gid.unwrap_or(NONE), Ordering::Relaxed);
+        self.loop_id
+            .store(rec.loop_id.unwrap_or(NONE), Ordering::Relaxed);
+        self.born_ns.store(rec.born_ns, Ordering::Relaxed);
+        self.flags.store(
+            if rec.activated { FLAG_ACTIVATED } else { 0 },
+            Ordering::Relaxed,
+        );
+
+        self.seq.store(seq + 2, Ordering::Release);
+    }
+
+    // 读取一份一致的记录, 空闲时返回 None
+    #[cfg(test)]
+    fn read(&self) -> Option<Record> {
+        loop {
+            let seq = self.seq.load(Ordering::Acquire);
+            if 1 == seq & 1 {
+                continue;
+            }
+            let rec = Record {
+                pid: self.pid.load(Ordering::Relaxed),
+                app_id: self.app_id.load(Ordering::Relaxed),
+                uid: self.uid.load(Ordering::Relaxed),
+                gid: Some(self.gid.load(Ordering::Relaxed))
+                    .filter(|&g| NONE != g),
+                loop_id: Some(self.loop_id.load(Ordering::Relaxed))
+                    .filter(|&l| NONE != l),
+                born_ns: self.born_ns.load(Ordering::Relaxed),
+                activated: 0
+                    != FLAG_ACTIVATED & self.flags.load(Ordering::Relaxed),
+            };
+            fence(Ordering::Acquire);
+            if seq == self.seq.load(Ordering::Relaxed) {
+                return Some(rec).filter(|r| 0 != r.pid);
+            }
+        }
+    }
+}
+
+struct Page {
+    // 映射区的起始地址
+    base: usize,
+    // 只读描述符, 发送给客户端; 不支持 memfd 时为 None
+    ro_fd: Option<RawFd>,
+    // 各记录的占用状态, 只存在于本进程中
+    used: Vec<AtomicBool>,
+    // 下一次分配时开始查找的位置
+    hint: AtomicUsize,
+}
+
+impl Page {
+    fn new() -> Page {
+        let (base, ro_fd) = match memfd_map() {
+            Ok((base, fd)) => (base, Some(fd)),
+            Err(e) => {
+                utils::p(e);
+                let mem = vec![0u64; PAGE_SIZ / mem::size_of::<u64>()];
+                (
+                    Box::leak(mem.into_boxed_slice()).as_mut_ptr() as usize,
+                    None,
+                )
+            }
+        };
+
+        let page = Page {
+            base,
+            ro_fd,
+            used: (0..STATS_SLOT_NUM)
+                .map(|_| AtomicBool::new(false))
+                .collect(),
+            hint: AtomicUsize::new(0),
+        };
+
+        let hdr = page.hdr();
+        hdr.version.store(STATS_PAGE_VERSION, Ordering::Relaxed);
+        hdr.slot_num.store(STATS_SLOT_NUM as u64, Ordering::Relaxed);
+        hdr.slot_siz.store(SLOT_SIZ as u64, Ordering::Relaxed);
+        hdr.magic.store(STATS_PAGE_MAGIC, Ordering::Release);
+
+        page
+    }
+
+    fn hdr(&self) -> &Header {
+        unsafe { &*(self.base as *const Header) }
+    }
+
+    fn slot(&self, idx: usize) -> &Slot {
+        unsafe { &*((self.base + HDR_SIZ + idx * SLOT_SIZ) as *const Slot) }
+    }
+
+    // 以 CAS 抢占一个空闲记录, 不加锁
+    fn claim(&self) -> Option<usize> {
+        let start = self.hint.load(Ordering::Relaxed);
+        (0..STATS_SLOT_NUM)
+            .map(|i| (start + i) % STATS_SLOT_NUM)
+            .find(|&i| {
+                self.used[i]
+                    .compare_exchange(
+                        false,
+                        true,
+                        Ordering::Acquire,
+                        Ordering::Relaxed,
+                    )
+                    .is_ok()
+            })
+            .map(|i| {
+                self.hint.store(i + 1, Ordering::Relaxed);
+                i
+            })
+    }
+
+    fn free(&self, idx: usize) {
+        self.used[idx].store(false, Ordering::Release);
+    }
+}
+
+// 映射区只在进程退出时释放, 可以在线程间共享
+unsafe impl Sync for Page {}
+unsafe impl Send for Page {}
+
+// 创建 memfd 并以读写方式映射, 之后经由 /proc 以只读方式重新打开, 供客户端使用;
+// 长度被封印(seal), 客户端无法通过 ftruncate 使服务端的访问越界
+fn memfd_map() -> Result<(usize, RawFd)> {
+    let name = CString::new("rocker_stats").unwrap();
+    let fd = unsafe {
+        libc::syscall(
+            libc::SYS_memfd_create,
+            name.as_ptr(),
+            MFD_CLOEXEC | MFD_ALLOW_SEALING,
+        )
+    } as RawFd;
+    if 0 > fd {
+        return Err(errgen_sys!(Unknown));
+    }
+
+    let res = memfd_setup(fd);
+    unsafe {
+        libc::close(fd);
+    }
+    res
+}
+
+fn memfd_setup(fd: RawFd) -> Result<(usize, RawFd)> {
+    unsafe {
+        if 0 > libc::ftruncate(fd, PAGE_SIZ as libc::off_t)
+            || 0 > libc::fcntl(
+                fd,
+                F_ADD_SEALS,
+                F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL,
+            )
+        {
+            return Err(errgen_sys!(Unknown));
+        }
+
+        let addr = libc::mmap(
+            ptr::null_mut(),
+            PAGE_SIZ,
+            libc::PROT_READ | libc::PROT_WRITE,
+            libc::MAP_SHARED,
+            fd,
+            0,
+        );
+        if libc::MAP_FAILED == addr {
+            return Err(errgen_sys!(Unknown));
+        }
+
+        let path = CString::new(format!("/proc/self/fd/{}", fd)).unwrap();
+        let ro_fd =
+            libc::open(path.as_ptr(), libc::O_RDONLY | libc::O_CLOEXEC);
+        if 0 > ro_fd {
+            libc::munmap(addr, PAGE_SIZ);
+            return Err(errgen_sys!(Unknown));
+        }
+
+        Ok((addr as usize, ro_fd))
+    }
+}
+
+/// 状态页中的一条 JG 记录
+pub(crate) struct Record {
+    pub(crate) pid: u64,
+    pub(crate) app_id: u64,
+    pub(crate) uid: u64,
+    pub(crate) gid: Option<u64>,
+    pub(crate) loop_id: Option<u64>,
+    pub(crate) born_ns: u64,
+    pub(crate) activated: bool,
+}
+
+/// 已登记的 JG 在状态页中占用的记录, drop 时清除;
+/// 持有者即该记录唯一的写者
+pub(crate) struct StatsSlot(Option<usize>);
+
+impl StatsSlot {
+    /// 分得一个记录并写入, 记录用尽时只计入 overflow
+    pub(crate) fn new(rec: &Record) -> StatsSlot {
+        let hdr = PAGE.hdr();
+        hdr.live.fetch_add(1, Ordering::Relaxed);
+
+        let idx = PAGE.claim();
+        match idx {
+            Some(idx) => PAGE.slot(idx).write(rec),
+            None => {
+                hdr.overflow.fetch_add(1, Ordering::Relaxed);
+            }
+        }
+
+        StatsSlot(idx)
+    }
+
+    /// 更新记录, 如 JG 被激活之后
+    pub(crate) fn put(&self, rec: &Record) {
+        if let Some(idx) = self.0 {
+            PAGE.slot(idx).write(rec);
+        }
+    }
+}
+
+impl Drop for StatsSlot {
+    fn drop(&mut self) {
+        let hdr = PAGE.hdr();
+        hdr.live.fetch_sub(1, Ordering::Relaxed);
+
+        match self.0 {
+            Some(idx) => {
+                PAGE.slot(idx).write(&Record {
+                    pid: 0,
+                    app_id: 0,
+                    uid: 0,
+                    gid: None,
+                    loop_id: None,
+                    born_ns: 0,
+                    activated: false,
+                });
+                PAGE.free(idx);
+            }
+            None => {
+                hdr.overflow.fetch_sub(1, Ordering::Relaxed);
+            }
+        }
+    }
+}
+
+/// 各项计数的当前值, 字段含义同状态页的页头
+#[derive(Clone, Copy, Debug, Default)]
+pub struct StatsCounters {
+    /// 创建成功的 ROCKER 数量
+    pub launched: u64,
+    /// 创建失败的 ROCKER 数量
+    pub failed: u64,
+    /// 格式错误或校验失败的请求数量
+    pub rejected: u64,
+    /// 已回收并释放资源的 JG 数量
+    pub reaped: u64,
+    /// 当前已登记的 JG 数量
+    pub live: u64,
+    /// 已登记但未出现在状态页中的 JG 数量
+    pub overflow: u64,
+}
+
+/// 创建状态页, 启动时调用, 以免首个请求承担其开销
+pub fn stats_page_init() {
+    lazy_static::initialize(&PAGE);
+}
+
+/// 状态页的只读描述符, 不支持 memfd 时为 None;
+/// 描述符归状态页所有, 调用方不得关闭
+pub fn stats_page_fd() -> Option<RawFd> {
+    PAGE.ro_fd
+}
+
+/// 记录一次 ROCKER 创建的结果
+pub fn stats_count_launch(ok: bool) {
+    let hdr = PAGE.hdr();
+    if ok {
+        hdr.launched.fetch_add(1, Ordering::Relaxed);
+    } else {
+        hdr.failed.fetch_add(1, Ordering::Relaxed);
+    }
+}
+
+/// 记录一个格式错误或校验失败的请求
+pub fn stats_count_reject() {
+    PAGE.hdr().rejected.fetch_add(1, Ordering::Relaxed);
+}
+
+/// 记录一个已回收的 JG
+pub(crate) fn stats_count_reap() {
+    PAGE.hdr().reaped.fetch_add(1, Ordering::Relaxed);
+}
+
+/// 各项计数的当前值
+pub fn stats_counters() -> StatsCounters {
+    let hdr = PAGE.hdr();
+    StatsCounters {
+        launched: hdr.launched.load(Ordering::Relaxed),
+        failed: hdr.failed.load(Ordering::Relaxed),
+        rejected: hdr.rejected.load(Ordering::Relaxed),
+        reaped: hdr.reaped.load(Ordering::Relaxed),
+        live: hdr.live.load(Ordering::Relaxed),
+        overflow: hdr.overflow.load(Ordering::Relaxed),
+    }
+}
+
+#[cfg(test)]
+#[allow(non_snake_case)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn TEST_layout() {
+        assert!(HDR_SIZ >= mem::size_of::<Header>());
+        assert_eq!(SLOT_SIZ, mem::size_of::<Slot>());
+        assert_eq!(STATS_PAGE_MAGIC, PAGE.hdr().magic.load(Ordering::Relaxed));
+    }
+
+    #[test]
+    fn TEST_stats_slot() {
+        let rec = Record {
+            pid: 9,
+            app_id: 3,
+            uid: 1,
+            gid: None,
+            loop_id: Some(7),
+            born_ns: 11,
+            activated: false,
+        };
+
+        let slot = StatsSlot::new(&rec);
+        let idx = slot.0.unwrap();
+        let r = PAGE.slot(idx).read().unwrap();
+        assert_eq!(
+            (9, 3, None, Some(7), false),
+            (r.pid, r.app_id, r.gid, r.loop_id, r.activated)
+        );
+
+        slot.put(&Record {
+            activated: true,
+            ..rec
+        });
+        assert!(PAGE.slot(idx).read().unwrap().activated);
+        assert_eq!(0, PAGE.slot(idx).seq.load(Ordering::Relaxed) & 1);
+
+        drop(slot);
+        assert!(PAGE.slot(idx).read().is_none());
+        assert!(!PAGE.used[idx].load(Ordering::Relaxed));
+    }
+}
@@ -0,0 +1,210 @@
+//! 启动过程的阶段计时.
+//!
+//! 各阶段的耗时以 CLOCK_MONOTONIC 计量, 单位为纳秒, 随应答一并返回给客户端;
+//! 阶段的顺序即应答中的排列顺序, 须与 librocker_client 中
+//! `ROCKER_STAGE_loop_attach` 起的各项保持一致.
+//!
+//! 除各阶段的累计耗时之外, 同时记录每个步骤的起止时刻(时间线),
+//! JG 中的步骤由 JG 自行取时, 经 guard_fd 回报 JM; CLOCK_MONOTONIC 在各进程之间可直接比较.
+//! 设置环境变量 `ROCKER_TRACE_FILE` 时, 时间线以 Chrome trace 格式追加写入该文件,
+//! 可由 chrome://tracing 或 Perfetto 直接打开.
+
+use lazy_static::lazy_static;
+use std::{
+    env,
+    fs::{File, OpenOptions},
+    io::Write,
+    process,
+    sync::Mutex,
+};
+
+const ENV_TRACE_FILE: &str = "ROCKER_TRACE_FILE";
+
+lazy_static! {
+    // 未设置 ROCKER_TRACE_FILE 或无法打开时为 None
+    static ref TRACE_FILE: Option<Mutex<File>> = trace_file_open();
+}
+
+/// JM/JG 中的启动阶段
+#[derive(Clone, Copy, Debug)]
+pub enum Stage {
+    /// 将 App 包绑定到 loop 设备
+    LoopAttach = 0,
+    /// 将 loop 设备挂载为 squashfs
+    SquashfsMount,
+    /// clone 出 JG
+    GuardClone,
+    /// JG 中 App 包的 bind 挂载及各目录的 overlay 挂载
+    OverlayMount,
+    /// 写入 uid/gid 映射
+    IdMap,
+}
+
+impl Stage {
+    /// 阶段的名称, 与 librocker_client 中 `ROCKER_STAGE_` 之后的部分一致
+    pub fn name(self) -> &'static str {
+        match self {
+            Stage::LoopAttach => "loop_attach",
+            Stage::SquashfsMount => "squashfs_mount",
+            Stage::GuardClone => "guard_clone",
+            Stage::OverlayMount => "overlay_mount",
+            Stage::IdMap => "idmap",
+        }
+    }
+}
+
+/// 阶段的数量
+pub const STAGE_NUM: usize = 5;
+
+/// 时间线上的一个步骤, 起止时刻取自 CLOCK_MONOTONIC, 单位: 纳秒
+#[derive(Clone, Debug)]
+pub struct Span {
+    /// 步骤名称
+    pub name: &'static str,
+    /// 开始时刻
+    pub begin: u64,
+    /// 结束时刻
+    pub end: u64,
+}
+
+/// 各阶段的耗时及各步骤的时间线;
+/// 未经历的阶段(如 App 包已被其它 JG 挂载)耗时为 0, 且不出现在时间线中
+#[derive(Clone, Debug, Default)]
+pub struct Trace {
+    stages: [u64; STAGE_NUM],
+    spans: Vec<Span>,
+}
+
+impl Trace {
+    /// 累加自 since(由 `now` 取得) 至今的耗时
+    pub(crate) fn add(&mut self, stage: Stage, since: u64) {
+        self.add_at(stage, since, now());
+    }
+
+    /// 累加 [begin, end) 的耗时, 用于由 JG 自行取时的阶段
+    pub(crate) fn add_at(&mut self, stage: Stage, begin: u64, end: u64) {
+        self.stages[stage as usize] += end.saturating_sub(begin);
+        self.span(stage.name(), begin, end);
+    }
+
+    /// 在时间线上记录一个步骤, 不计入任何阶段
+    pub fn span(&mut self, name: &'static str, begin: u64, end: u64) {
+        self.spans.push(Span { name, begin, end });
+    }
+
+    /// 某阶段的耗时
+    pub fn get(&self, stage: Stage) -> u64 {
+        self.stages[stage as usize]
+    }
+
+    /// 按记录顺序排列的时间线
+    pub fn spans(&self) -> &[Span] {
+        &self.spans
+    }
+
+    /// 按阶段顺序排列的本机字节序表示, 用于附加在应答中
+    pub fn to_ne_bytes(&self) -> Vec<u8> {
+        self.stages
+            .iter()
+            .flat_map(|ns| ns.to_ne_bytes().to_vec())
+            .collect()
+    }
+
+    /// 时间线的 Chrome trace 表示: 每个步骤一个 "X" 事件, 每行一个, 均以逗号结尾;
+    /// 以服务端 PID 为 pid, 以 guard_pid 为 tid, 每个 rocker 在查看器中各占一行
+    pub fn to_chrome(&self, guard_pid: i32, app_id: u32) -> String {
+        let pid = process::id();
+        self.spans
+            .iter()
+            .map(|s| {
+                let dur = s.end.saturating_sub(s.begin);
+                format!(
+                    "{{\"name\":\"{}\",\"cat\":\"rocker\",\"ph\":\"X\",\"ts\":{}.{:03},\"dur\":{}.{:03},\"pid\":{},\"tid\":{},\"args\":{{\"app_id\":{}}}}},\n",
+                    s.name,
+                    s.begin / 1000,
+                    s.begin % 1000,
+                    dur / 1000,
+                    dur % 1000,
+                    pid,
+                    guard_pid,
+                    app_id
+                )
+            })
+            .collect()
+    }
+
+    /// 将时间线追加写入 ROCKER_TRACE_FILE, 未设置时不做任何操作
+    pub fn export(&self, guard_pid: i32, app_id: u32) {
+        if let Some(f) = TRACE_FILE.as_ref() {
+            let events = self.to_chrome(guard_pid, app_id);
+            let _ = f.lock().unwrap().write_all(events.as_bytes());
+        }
+    }
+}
+
+// Chrome trace 的 JSON 数组格式允许省略末尾的 ']',
+// 新文件只需写入开头的 '[', 之后的事件可以不断追加
+fn trace_file_open() -> Option<Mutex<File>> {
+    let path = env::var(ENV_TRACE_FILE).ok()?;
+    let mut f = OpenOptions::new()
+        .create(true)
+        .append(true)
+        .open(path.trim())
+        .ok()?;
+    if 0 == f.metadata().ok()?.len() {
+        f.write_all(b"[\n").ok()?;
+    }
+    Some(Mutex::new(f))
+}
+
+/// CLOCK_MONOTONIC 时间, 单位: 纳秒; 各进程取值可直接比较
+pub fn now() -> u64 {
+    let mut ts = libc::timespec {
+        tv_sec: 0,
+        tv_nsec: 0,
+    };
+    unsafe {
+        libc::clock_gettime(libc::CLOCK_MONOTONIC, &mut ts);
+    }
+    ts.tv_sec as u64 * 1_000_000_000 + ts.tv_nsec as u64
+}
+
+#[cfg(test)]
+#[allow(non_snake_case)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn TEST_trace() {
+        let mut t = Trace::default();
+        let since = now();
+        t.add(Stage::GuardClone, since);
+        t.add_at(Stage::OverlayMount, 10, 17);
+
+        assert!(0 < t.get(Stage::GuardClone));
+        assert_eq!(0, t.get(Stage::LoopAttach));
+
+        let bytes = t.to_ne_bytes();
+        assert_eq!(8 * STAGE_NUM, bytes.len());
+        assert_eq!(
+            7u64.to_ne_bytes(),
+            bytes[8 * Stage::OverlayMount as usize..][..8]
+        );
+
+        assert_eq!(2, t.spans().len());
+        assert_eq!("overlay_mount", t.spans()[1].name);
+    }
+
+    #[test]
+    fn TEST_to_chrome() {
+        let mut t = Trace::default();
+        t.span("mount_dynfs_proc", 1_234_567, 1_236_000);
+        assert_eq!(
+            format!(
+                "{{\"name\":\"mount_dynfs_proc\",\"cat\":\"rocker\",\"ph\":\"X\",\"ts\":1234.567,\"dur\":1.433,\"pid\":{},\"tid\":9,\"args\":{{\"app_id\":3}}}},\n",
+                process::id()
+            ),
+            t.to_chrome(9, 3)
+        );
+    }
+}
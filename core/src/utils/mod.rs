@@ -10,8 +10,6 @@ use crate::{
     master::{FD, PID},
 };
 use error_chain::ChainedError;
-use lazy_static::lazy_static;
-use libc::{sem_open, sem_post, sem_timedwait, O_CREAT, O_RDWR, S_IRWXU};
 use nix::{
     errno::Errno,
     mount::{self, MsFlags},
@@ -19,11 +17,7 @@ use nix::{
     sys::{signal, socket},
     unistd,
 };
-use std::{ffi::CString, fs, marker::Send, marker::Sync};
-
-struct SemT(*mut libc::sem_t);
-unsafe impl Send for SemT {}
-unsafe impl Sync for SemT {}
+use std::fs;
 
 /// easy-use wrapper
 #[macro_export]
@@ -49,27 +43,6 @@ macro_rules! d_sys {
     };
 }
 
-lazy_static! {
-    static ref SEM_LOG: SemT = {
-        const SEM_NAME: &str = "A_0_3_6_0_8_2_1_9_0_1_              ";
-        let n = unsafe {
-            sem_open(
-                pnk!(CString::new(SEM_NAME)).as_ptr() as *const libc::c_char,
-                O_CREAT | O_RDWR,
-                S_IRWXU,
-                1,
-            )
-        };
-
-        if libc::SEM_FAILED == n {
-            perror("sem_open");
-            pdie(errgen_sys!(Unknown));
-        }
-
-        SemT(n)
-    };
-}
-
 #[inline(always)]
 fn get_errno() -> Errno {
     Errno::last()
@@ -81,46 +54,6 @@ pub fn get_errdesc() -> &'static str {
     Errno::last().desc()
 }
 
-#[inline(always)]
-fn reset_errno() {
-    unsafe {
-        Errno::clear();
-    }
-}
-
-fn get_clocktime() -> libc::timespec {
-    let mut ts = libc::timespec {
-        tv_sec: 0,
-        tv_nsec: 0,
-    };
-
-    if 0 > unsafe { libc::clock_gettime(libc::CLOCK_REALTIME, &mut ts) } {
-        p(errgen_sys!(Unknown));
-    }
-
-    ts
-}
-
-impl SemT {
-    fn sem_get(&self) {
-        let mut ts = get_clocktime();
-        ts.tv_sec += 2;
-
-        reset_errno();
-        if 0 > unsafe { sem_timedwait(self.0, &ts as *const libc::timespec) }
-            && Errno::ETIMEDOUT != get_errno()
-        {
-            pdie(errgen_sys!(Unknown));
-        }
-    }
-
-    fn sem_put(&self) {
-        if 0 > unsafe { sem_post(self.0) } {
-            pdie(errgen_sys!(Unknown));
-        }
-    }
-}
-
 #[allow(non_snake_case)]
 pub(crate) fn kill_SIGKILL(pid: PID) {
     let _ = signal::kill(
@@ -143,6 +76,28 @@ pub(crate) fn unix_dgram_socketpair() -> Result<(FD, FD)> {
     Ok(ret)
 }
 
+// 关闭 keep 与标准输入/输出/错误之外的所有描述符,
+// 供 clone 出的子进程丢弃继承自 JM 的描述符
+pub(crate) fn close_fds_except(keep: &[FD]) -> Result<()> {
+    let fds = fs::read_dir("/proc/self/fd")
+        .c(d!())?
+        .filter_map(|d| {
+            d.ok().and_then(|d| {
+                d.file_name().to_str().and_then(|n| n.parse::<FD>().ok())
+            })
+        })
+        .collect::<Vec<_>>();
+
+    // read_dir 自身所用的描述符此时已关闭, 再次关闭返回 EBADF, 忽略即可
+    fds.into_iter()
+        .filter(|fd| 2 < *fd && !keep.contains(fd))
+        .for_each(|fd| {
+            let _ = unistd::close(fd);
+        });
+
+    Ok(())
+}
+
 pub(crate) fn mountx(
     from: Option<&str>,
     to: &str,
@@ -170,46 +125,19 @@ pub fn sleep(secs: u64) {
     std::thread::sleep(std::time::Duration::from_secs(secs));
 }
 
-fn get_pidns(pid: u32) -> Result<String> {
-    fs::read_link(format!("/proc/{}/ns/pid", pid))
-        .c(d!())
-        .map(|p| p.to_string_lossy().into_owned())
-}
-
-/// 打印 error_chain
+/// 打印 error_chain, 参见 `log_init`
 #[inline(always)]
 pub fn p(e: impl ChainedError) {
-    SEM_LOG.sem_get();
-
-    let pid = std::process::id();
-    eprintln!(
-        "\n\x1b[31;01m{}[{}] {}\x1b[00m\n{}",
-        get_pidns(pid).unwrap(), /*内部不能再调用`p`,否则可能无限循环*/
-        pid,
-        time::strftime("%m-%d %H:%M:%S", &time::now()).unwrap(),
-        e.display_chain()
-    );
-
-    SEM_LOG.sem_put();
+    crate::logger::log_error(&e);
 }
 
 /// 打印 error_chain 之后 Panic
 #[inline(always)]
 pub fn pdie(e: impl ChainedError) -> ! {
-    p(e);
+    crate::logger::log_error_sync(&e);
     exit!();
 }
 
-/// peror
-pub(crate) fn perror(prompt: &str) {
-    unsafe {
-        libc::perror(
-            pnk!(CString::new(format!("\x1b[31;01m{}\x1b[00m", prompt)))
-                .as_ptr() as *const libc::c_char,
-        );
-    }
-}
-
 fn poll_any(fds: &[FD], flags: PollFlags, timeout_secs: u32) -> Result<()> {
     let fdset = &mut fds
         .iter()
@@ -0,0 +1,221 @@
+//! 启动延迟基准测试:
+//! 对比 fork()+pipe 的旧路径与 NameSpace.enter_and_run 的新路径,
+//! 在调用方常驻内存(RSS)不同的情况下, 进入 namespace 并创建 app 进程的耗时.
+//-
+//@ 用法: librocker_client_bench [迭代次数] [RSS(MB) ...]
+//@ 输出: 每个 (路径, RSS) 组合输出一行 JSON
+
+#include "io.h"
+#include "namespace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/wait.h>
+
+#define N 3
+
+#define fatal_sys_if_negative___(expr____) do {\
+    if (0 > (expr____)) {\
+        fatal_sys___();\
+    }\
+} while(0)
+
+static i___ pid_pipe[2];
+static i___ holder_pipe[2];
+
+//! 测试 app, 立即退出
+static i___
+bench_app(void *_ unused___) {
+    return 0;
+}
+
+//! 在新的 user,mnt,pid namespace 中常驻的 1 号进程
+static void
+ns_holder(void) {
+    if (0 > unshare(CLONE_NEWUSER|CLONE_NEWNS|CLONE_NEWPID)) {
+        fatal_sys___();
+    }
+
+    // PID namespace 仅对之后的子进程有效
+    pid_t pid = fork();
+    if (0 == pid) {
+        char b;
+        close(holder_pipe[1]);
+        read(holder_pipe[0], &b, 1);
+        _exit(0);
+    } else if (0 > pid) {
+        fatal_sys___();
+    }
+
+    // 把 1 号进程在外层 PID namespace 中的 PID 告知基准测试进程
+    fatal_sys_if_negative___(write(pid_pipe[1], &pid, sizeof(pid_t)));
+    _exit(0);
+}
+
+//! 创建 namespace 并打开其描述符, 顺序与服务端一致: [mnt, pid, user]
+static pid_t
+ns_setup(i___ fdset[N]) {
+    fatal_sys_if_negative___(pipe(pid_pipe));
+    fatal_sys_if_negative___(pipe(holder_pipe));
+
+    pid_t pid = fork();
+    if (0 == pid) {
+        ns_holder();
+    } else if (0 > pid) {
+        fatal_sys___();
+    }
+
+    pid_t holder = -1;
+    if (sizeof(pid_t) != read(pid_pipe[0], &holder, sizeof(pid_t))) {
+        fatal_sys___();
+    }
+    waitpid(pid, nil, 0);
+
+    close(pid_pipe[0]);
+    close(pid_pipe[1]);
+    close(holder_pipe[0]);
+
+    char path[128];
+    sprintf(path, "/proc/%d/uid_map", holder);
+    i___ fd = -1;
+    fatal_if_err___(IO.open_for_write(&fd, path));
+    write(fd, path, sprintf(path, "0 %d 1", getuid()));
+    close(fd);
+
+    char *names[N] = {"mnt", "pid", "user"};
+    for (i___ i = 0; i < N; ++i) {
+        sprintf(path, "/proc/%d/ns/%s", holder, names[i]);
+        fatal_if_err___(IO.open_for_read(fdset + i, path));
+    }
+
+    return holder;
+}
+
+//! 旧路径: fork 出调用方的完整副本, 在其中 setns 并创建兄弟进程, 经由 pipe 取回 PID
+static pid_t
+launch_fork(i___ fdset[N]) {
+    i___ read_fd = -1, write_fd = -1;
+    fatal_if_err___(IO.creat_pipe(&read_fd, &write_fd));
+
+    pid_t pid = fork();
+    if (0 == pid) {
+        pid_t app_pid = -1;
+        if (nil != NameSpace.enter_ns(fdset, N)
+                || nil != NameSpace.run_in_brother(bench_app, nil, &app_pid)) {
+            app_pid = -1;
+        }
+        write(write_fd, &app_pid, sizeof(pid_t));
+        _exit(0);
+    } else if (0 > pid) {
+        fatal_sys___();
+    }
+
+    pid_t app_pid = -1;
+    if (sizeof(pid_t) != read(read_fd, &app_pid, sizeof(pid_t))) {
+        fatal_sys___();
+    }
+    waitpid(pid, nil, 0);
+
+    close(read_fd);
+    close(write_fd);
+
+    return app_pid;
+}
+
+//! 新路径: 调用线程进入 pid namespace 之后 fork 一次, 调用方的地址空间只被复制一次
+static pid_t
+launch_enter_and_run(i___ fdset[N]) {
+    pid_t app_pid = -1;
+    bool___ ns_entered = false___;
+    fatal_if_err___(NameSpace.enter_and_run(fdset, N, -1, bench_app, nil, &app_pid, &ns_entered, nil));
+    return app_pid;
+}
+
+static i___
+cmp_ulli(const void *a, const void *b) {
+    ulli___ x = *(const ulli___ *)a, y = *(const ulli___ *)b;
+    return x < y ? -1 : x > y;
+}
+
+static ulli___
+now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ulli___)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+run(const char *name, pid_t (*launch) (i___ fdset[N]), i___ fdset[N], i___ rss_mb, i___ iters) {
+    ulli___ *lat = malloc(sizeof(ulli___) * iters);
+    if (nil == lat) {
+        fatal_sys___();
+    }
+
+    for (i___ i = 0; i < iters; ++i) {
+        ulli___ ts = now_ns();
+        pid_t app_pid = launch(fdset);
+        lat[i] = now_ns() - ts;
+
+        if (0 > app_pid) {
+            fatal___("launch failed");
+        }
+        fatal_sys_if_negative___(waitpid(app_pid, nil, 0));
+    }
+
+    qsort(lat, iters, sizeof(ulli___), cmp_ulli);
+    printf("{\"path\":\"%s\",\"rss_mb\":%d,\"iters\":%d,"
+            "\"p50_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f}\n",
+            name, rss_mb, iters,
+            lat[iters / 2] / 1000.0,
+            lat[(iters * 99) / 100] / 1000.0,
+            lat[iters - 1] / 1000.0);
+    fflush(stdout);
+
+    free(lat);
+}
+
+i___
+main(i___ argc, char **argv) {
+    i___ iters = 1 < argc ? atoi(argv[1]) : 200;
+    if (0 >= iters) {
+        fatal___("invalid iterations");
+    }
+
+    i___ default_rss[] = {0, 64, 256, 1024};
+    i___ rss_cnt = 2 < argc ? argc - 2 : (i___)(sizeof(default_rss) / sizeof(i___));
+
+    i___ fdset[N];
+    ns_setup(fdset);
+
+    char *ballast = nil;
+    size_t ballast_siz = 0;
+
+    for (i___ i = 0; i < rss_cnt; ++i) {
+        i___ rss_mb = 2 < argc ? atoi(argv[2 + i]) : default_rss[i];
+
+        // 逐页写入, 使其计入 RSS 并建立页表
+        free(ballast);
+        ballast_siz = (size_t)rss_mb * 1024 * 1024;
+        ballast = nil;
+        if (0 < ballast_siz) {
+            if (nil == (ballast = malloc(ballast_siz))) {
+                fatal_sys___();
+            }
+            memset(ballast, 1, ballast_siz);
+        }
+
+        run("fork", launch_fork, fdset, rss_mb, iters);
+        run("enter_and_run", launch_enter_and_run, fdset, rss_mb, iters);
+    }
+
+    free(ballast);
+
+    // 通知 namespace 中的 1 号进程退出
+    close(holder_pipe[1]);
+
+    return 0;
+}
@@ -23,11 +23,14 @@ static Error * creat_pipe(i___ *read_fd, i___ *write_fd);
 static Error * unix_abstract_udp_genaddr(const char *name, struct sockaddr_un *addr, socklen_t *addr_len);
 static Error * unix_abstract_udp_new(const char *name, i___ *fd);
 static Error * unix_abstract_udp_new_autobound(i___ *fd);
+static Error * unix_abstract_seqpacket_connect(const char *name, i___ *fd);
 
 static Error * sock_connect(i___ local_fd, void *sockaddr, size_t siz);
 
 static Error * fte_init(struct FdTransEnv *env, i___ fdset[], ui___ fdset_actual_num, struct iovec *vec, size_t vec_cnt);
 
+static Error * recv_msg(ui___ master_fd, struct msghdr *msg, ssize_t *len);
+static Error * recv_msg_wait(ui___ master_fd, struct msghdr *msg, ssize_t *len);
 static Error * recv_fd(ui___ master_fd, struct FdTransEnv *env);
 static Error * send_fd(ui___ master_fd, struct FdTransEnv *env, struct sockaddr_un *addr, socklen_t addr_len);
 inline___ static Error * send_fd_connected(ui___ master_fd, struct FdTransEnv *env);
@@ -52,11 +55,14 @@ struct IO IO = {
     .unix_abstract_udp_genaddr = unix_abstract_udp_genaddr,
     .unix_abstract_udp_new = unix_abstract_udp_new,
     .unix_abstract_udp_new_autobound = unix_abstract_udp_new_autobound,
+    .unix_abstract_seqpacket_connect = unix_abstract_seqpacket_connect,
 
     .sock_connect = sock_connect,
 
     .fte_init = fte_init,
 
+    .recv_msg = recv_msg,
+    .recv_msg_wait = recv_msg_wait,
     .recv_fd = recv_fd,
     .send_fd = send_fd,
     .send_fd_connected = send_fd_connected,
@@ -414,6 +420,35 @@ unix_abstract_udp_new_autobound(i___ *fd) {
     return nil;
 }
 
+//! 创建 SOCK_SEQPACKET 类型的 socket, 并连接到指定的抽象地址,
+//! 连接方式下无需绑定本地地址, 且保留消息边界
+//-
+//@ name[in]: abstract unix-socket name(exclude the beginning '\0')
+//@ fd[out]: 已连接的 socket
+static Error *
+unix_abstract_seqpacket_connect(const char *name, i___ *fd) {
+    return_err_if_param_nil___(name && fd);
+
+    struct sockaddr_un addr;
+    socklen_t addr_len = 0;
+    Error *e = nil;
+
+    return_err_if_err___(unix_abstract_udp_genaddr(name, &addr, &addr_len));
+
+    if (0 > (*fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0))) {
+        *fd = -1;
+        return err_new_sys___();
+    }
+
+    if (nil != (e = sock_connect(*fd, &addr, addr_len))) {
+        close(*fd);
+        *fd = -1;
+        return e;
+    }
+
+    return nil;
+}
+
 //@ fdset[in]: 将要发送的目标 fd 集合(vec<fd>)
 //@ fdset_actual_num[in]: 实际的 fd 数量
 //@ vec[in]:
@@ -487,14 +522,15 @@ send_fd(ui___ master_fd, struct FdTransEnv *env, struct sockaddr_un *addr, sockl
 //! 仅用作传送常规数据
 //-
 //@ master_fd[in]: 用作传输通道的域套接字
+//@ addr[in]: 对端地址, 已连接的 socket 置为 nil
 static Error *
 send_normal(ui___ master_fd, struct iovec *vec, size_t vec_cnt,
         struct sockaddr_un *addr, socklen_t addr_len) {
-    return_err_if_param_nil___(vec && vec_cnt && addr);
+    return_err_if_param_nil___(vec && vec_cnt);
 
     struct msghdr msg = {
         .msg_name = addr,
-        .msg_namelen = addr_len,
+        .msg_namelen = nil == addr ? 0 : addr_len,
         .msg_iov = vec,
         .msg_iovlen = vec_cnt,
         .msg_control = nil,
@@ -519,14 +555,19 @@ send_fd_connected(ui___ master_fd, struct FdTransEnv *env) {
     return nil;
 }
 
+//! 带超时机制的 recvmsg, 至少收到 1 字节的常规数据才视为成功
+//-
 //@ master_fd[in]: 用作传输通道的域套接字
-//@ env[in, out<env->msg.msg_name, env->msg.msg_namelen, env->msg.msg_iov, env->msg.msg_iovlen>]:
+//@ msg[in, out]: recvmsg 所需的参数
+//@ len[out]: 实际收到的常规数据长度, 可以为 nil
 static Error *
-recv_fd(ui___ master_fd, struct FdTransEnv *env) {
-    return_err_if_param_nil___(env);
+recv_msg(ui___ master_fd, struct msghdr *msg, ssize_t *len) {
+    return_err_if_param_nil___(msg);
+
+    ssize_t n;
 
     // at least 1 byte data
-    if (1 > recvmsg(master_fd, &env->msg, MSG_DONTWAIT)) {
+    if (1 > (n = recvmsg(master_fd, msg, MSG_DONTWAIT))) {
         if (EAGAIN != errno && EWOULDBLOCK != errno) {
             return err_new_sys___();
         }
@@ -540,7 +581,7 @@ recv_fd(ui___ master_fd, struct FdTransEnv *env) {
         // poll: return 0 for timeout, 1 for success, -1 for error
         // timeout 固定为 3s(3000ms)
         if (0 < poll(&ev, 1, 3 * 1000)) {
-            if (1 > recvmsg(master_fd, &env->msg, MSG_DONTWAIT)) {
+            if (1 > (n = recvmsg(master_fd, msg, MSG_DONTWAIT))) {
                 return err_new_sys___();
             }
             goto recv_success;
@@ -549,6 +590,47 @@ recv_fd(ui___ master_fd, struct FdTransEnv *env) {
     }
 
 recv_success:
+    if (nil != len) {
+        *len = n;
+    }
+
+    return nil;
+}
+
+//! 阻塞至收到一条消息, 用于已连接的 socket, 对端关闭连接时返回错误
+//-
+//@ master_fd[in]: 用作传输通道的域套接字
+//@ msg[in, out]: recvmsg 所需的参数
+//@ len[out]: 实际收到的常规数据长度, 可以为 nil
+static Error *
+recv_msg_wait(ui___ master_fd, struct msghdr *msg, ssize_t *len) {
+    return_err_if_param_nil___(msg);
+
+    ssize_t n;
+    while (0 > (n = recvmsg(master_fd, msg, MSG_CMSG_CLOEXEC))) {
+        if (EINTR != errno) {
+            return err_new_sys___();
+        }
+    }
+
+    if (0 == n) {
+        return err_new___(-1, "connection closed by peer", nil);
+    }
+
+    if (nil != len) {
+        *len = n;
+    }
+
+    return nil;
+}
+
+//@ master_fd[in]: 用作传输通道的域套接字
+//@ env[in, out<env->msg.msg_name, env->msg.msg_namelen, env->msg.msg_iov, env->msg.msg_iovlen>]:
+static Error *
+recv_fd(ui___ master_fd, struct FdTransEnv *env) {
+    return_err_if_param_nil___(env);
+    return_err_if_err___(recv_msg(master_fd, &env->msg, nil));
+
     //a success recvmsg will update env->cmsg
     if (nil == CMSG_FIRSTHDR(&env->msg)) {
         env->fdset = nil;
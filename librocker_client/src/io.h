@@ -52,11 +52,14 @@ struct IO {
     Error * (* unix_abstract_udp_genaddr) (const char *name, struct sockaddr_un *addr, socklen_t *addr_len) must_use___;
     Error * (* unix_abstract_udp_new) (const char *name, i___ *fd) must_use___;
     Error * (* unix_abstract_udp_new_autobound) (i___ *fd) must_use___;
+    Error * (* unix_abstract_seqpacket_connect) (const char *name, i___ *fd) must_use___;
 
     Error * (* sock_connect) (i___ local_fd, void *sockaddr, size_t siz) must_use___;
 
     Error * (* fte_init) (struct FdTransEnv *env, i___ fdset[], ui___ fdset_actual_num, struct iovec *vec, size_t vec_cnt) must_use___;
 
+    Error * (* recv_msg) (ui___ master_fd, struct msghdr *msg, ssize_t *len) must_use___;
+    Error * (* recv_msg_wait) (ui___ master_fd, struct msghdr *msg, ssize_t *len) must_use___;
     Error * (* recv_fd) (ui___ master_fd, struct FdTransEnv *env) must_use___;
     Error * (* send_fd) (ui___ master_fd, struct FdTransEnv *env, struct sockaddr_un *addr, socklen_t addr_len) must_use___;
     Error * (* send_fd_connected) (ui___ master_fd, struct FdTransEnv *env) must_use___;
@@ -3,8 +3,12 @@
 #include "io.h"
 #include "utils.h"
 #include "namespace.h"
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 //! 用于'ROCKER_enter_rocker'函数的工具宏
 #define ROCKER_ERR_checker___(err_no___, app___) do {\
@@ -25,6 +29,12 @@ static const i___ NARRAY[] unused___ = {
 //! 启用的namespace数量, linux当前共有8个namespace
 #define N (sizeof(NARRAY) / sizeof(i___))
 
+//! 服务端在 namespace 描述符之后附带一个生命线(lifeline)管道的写端,
+//! 由 App 进程继承并持有, 所有持有者退出后, JG 随即感知并退出;
+//! 带有资源限制的请求, 其后再附带 app 进程所属 cgroup 的目录描述符;
+//! 服务端未发送的描述符, 对应位置置为 -1
+#define FD_MAX (N + 2)
+
 //! 生成RockerResult的工厂函数
 inline___ static RockerResult
 Rocker_result_new() {
@@ -36,144 +46,1162 @@ Rocker_result_new() {
     return jr;
 }
 
-#define ROCKER_reqreal_meta_len___ (\
-        3 /*app_id,uid,gid*/\
-            + 3 /*app_pkg_path,app_exec_dir,app_data_dir*/\
-            + 16 /*app_overlay_dirs[0..15]*/)
+//! v2 请求的标识, 位于请求的首部;
+//! v1 请求的首字段为 app_id, 不会取此值
+#define ROCKER_REQ_V2_MAGIC___ (-0x524b5632)
 
-#define ROCKER_reqreal_vec_len___ (\
-        1 /*app_id+uid+gid+XXX_LEN...+XXX_LEN*/\
-            + 3 /*app_pkg_path + app_exec_dir + app_data_dir*/\
-            + 16 /*app_overlay_dirs[16]*/)
+//! 单条消息的长度上限(批量请求为所有请求之和), 与服务端的接收缓冲区一致
+#define ROCKER_REQ_SIZ_MAX___ (64 * 1024)
 
-//! 实际通过 sendmsg 发送的请求数据
-struct ReqReal {
-    int32_t meta[ROCKER_reqreal_meta_len___];
-    struct iovec vec[ROCKER_reqreal_vec_len___];
+//! v2 请求中各字段的类型, 须与 rocker_server 保持一致.
+//! 服务端跳过不认识的类型, 新增的可选字段不影响旧版服务端
+enum {
+    ROCKER_TLV_app_id = 1,
+    ROCKER_TLV_uid = 2,
+    ROCKER_TLV_gid = 3,
+    ROCKER_TLV_app_pkg_path = 4,
+    ROCKER_TLV_app_exec_dir = 5,
+    ROCKER_TLV_app_data_dir = 6,
+    ROCKER_TLV_app_overlay_dir = 7, /*可重复出现*/
+    ROCKER_TLV_memory_max = 8,      /*u64*/
+    ROCKER_TLV_memory_high = 9,     /*u64*/
+    ROCKER_TLV_cpu_max = 10,        /*两个 u32: quota, period*/
+    ROCKER_TLV_cpu_weight = 11,
+    ROCKER_TLV_io_max = 12,         /*每个设备一项, 可重复出现*/
+    ROCKER_TLV_pids_max = 13,
 };
 
-//! 将调用方提供的请求信息, 解析为可供发送的数据格式
-//! NOTE:
-//!    内部存在指向自身其它字段的指针型字段时, 不能实现为返回实体结构体的函数,
-//!    gcc 不保证返回的结果保持其生成时的内存地址(clang 下没有问题)!
-#define strlen___(str____) ({size_t len = Utils.strlen(str____); 0 < len ? (1 +len) : 0;})
-#define ROCKER_parse_request___(req____) ({ \
-        struct ReqReal rr____ = { \
-            .meta = { \
-                req____->app_id, \
-                req____->uid, \
-                req____->gid, \
-                strlen___(req____->app_pkg_path), \
-                strlen___(req____->app_exec_dir), \
-                strlen___(req____->app_data_dir), \
-            }, \
-            .vec = { \
-                { .iov_base = rr____.meta, .iov_len = sizeof(i___) * ROCKER_reqreal_meta_len___ }, \
-                { .iov_base = req____->app_pkg_path, .iov_len = rr____.meta[3] }, \
-                { .iov_base = req____->app_exec_dir, .iov_len = rr____.meta[4] }, \
-                { .iov_base = req____->app_data_dir, .iov_len = rr____.meta[5] }, \
-            } \
-        }; \
- \
-        for (i___ i = 0; i < 16; ++i) { \
-            rr____.meta[i + 6] = strlen___(req____->app_overlay_dirs[i]); \
- \
-            rr____.vec[i + 4].iov_base = req____->app_overlay_dirs[i]; \
-            rr____.vec[i + 4].iov_len = rr____.meta[i + 6]; \
-        } \
- \
-        rr____; \
-        })
-
-//! 请求创建新rocker, 并在其中运行指定函数的API.
-//! 返回RockerResult结构体(NOTE: 不是指针)
+//! 向 buf 追加一个 [type: u16][len: u16][value] 格式的字段
+//-
+//@ buf[out]: 长度为 ROCKER_REQ_SIZ_MAX___ 的缓冲区
+//@ len[in/out]: buf 中已有数据的长度
+//@ return: 成功返回 0, 超出长度上限时返回 -1
+INNER___ static i___
+req_put(char *buf, size_t *len, uint16_t type, const void *val, size_t val_len) {
+    uint16_t hdr[2] = { type, (uint16_t)val_len };
+
+    if (UINT16_MAX < val_len || ROCKER_REQ_SIZ_MAX___ - *len < sizeof(hdr) + val_len) {
+        return -1;
+    }
+
+    memcpy(buf + *len, hdr, sizeof(hdr));
+    memcpy(buf + *len + sizeof(hdr), val, val_len);
+    *len += sizeof(hdr) + val_len;
+
+    return 0;
+}
+
+//! 同 req_put, 字符串不含末尾的 '\0', 为 nil 或空串时不追加
+INNER___ static i___
+req_put_str(char *buf, size_t *len, uint16_t type, const char *str) {
+    if (nil == str || '\0' == str[0]) {
+        return 0;
+    }
+
+    return req_put(buf, len, type, str, strlen(str));
+}
+
+//! 将调用方提供的请求信息, 以 v2 格式追加到 buf 中:
+//!     [MAGIC: i32][总长度: i32] + 任意数量的字段, 格式见 req_put
+//! gid 为负时不发送, 由服务端使用默认值; 为 0 的资源限制不发送
 //-
 //@ req[in]: 创建新rocker所需的配置数据
-//@ app[in]: rocker创建成功后, 需要在其中执行的函数
-//@ app_args[in]: 传递给app函数的参数
-static RockerResult
-ROCKER_enter_rocker_inner(RockerRequest *req, int (*app) (void *), void *app_args) {
-    RockerResult jr = Rocker_result_new();
+//@ buf[out]: 长度为 ROCKER_REQ_SIZ_MAX___ 的缓冲区
+//@ len[in/out]: buf 中已有数据的长度, 返回时为追加之后的长度
+INNER___ static Error *
+req_encode(const RockerRequest *req, char *buf, size_t *len) {
+    i32___ hdr[2] = { ROCKER_REQ_V2_MAGIC___, 0 };
+    size_t start = *len;
 
-    Error *e = nil;
-    i___ master_fd = -1;
+    if (ROCKER_REQ_SIZ_MAX___ - *len < sizeof(hdr)) {
+        goto too_large;
+    }
+    *len += sizeof(hdr);
+
+    if (req_put(buf, len, ROCKER_TLV_app_id, &req->app_id, sizeof(i32___))
+            || req_put(buf, len, ROCKER_TLV_uid, &req->uid, sizeof(i32___))
+            || (0 <= req->gid && req_put(buf, len, ROCKER_TLV_gid, &req->gid, sizeof(i32___)))
+            || req_put_str(buf, len, ROCKER_TLV_app_pkg_path, req->app_pkg_path)
+            || req_put_str(buf, len, ROCKER_TLV_app_exec_dir, req->app_exec_dir)
+            || req_put_str(buf, len, ROCKER_TLV_app_data_dir, req->app_data_dir)) {
+        goto too_large;
+    }
+
+    for (i___ i = 0; i < 16; ++i) {
+        if (req_put_str(buf, len, ROCKER_TLV_app_overlay_dir, req->app_overlay_dirs[i])) {
+            goto too_large;
+        }
+    }
+
+    for (char **dir = req->app_overlay_dirs_more; nil != dir && nil != *dir; ++dir) {
+        if (req_put_str(buf, len, ROCKER_TLV_app_overlay_dir, *dir)) {
+            goto too_large;
+        }
+    }
 
+    uint32_t cpu_max[2] = { req->cpu_max_us, 0 == req->cpu_period_us ? 100000 : req->cpu_period_us };
+    if ((0 < req->memory_max && req_put(buf, len, ROCKER_TLV_memory_max, &req->memory_max, sizeof(u64___)))
+            || (0 < req->memory_high && req_put(buf, len, ROCKER_TLV_memory_high, &req->memory_high, sizeof(u64___)))
+            || (0 < req->cpu_max_us && req_put(buf, len, ROCKER_TLV_cpu_max, cpu_max, sizeof(cpu_max)))
+            || (0 < req->cpu_weight && req_put(buf, len, ROCKER_TLV_cpu_weight, &req->cpu_weight, sizeof(uint32_t)))
+            || (0 < req->pids_max && req_put(buf, len, ROCKER_TLV_pids_max, &req->pids_max, sizeof(uint32_t)))) {
+        goto too_large;
+    }
+
+    // io.max 每个设备一项, 忽略空行
+    for (const char *l = req->io_max, *e = nil; nil != l && '\0' != *l; l = '\0' == *e ? e : e + 1) {
+        e = strchrnul(l, '\n');
+        if (e > l && req_put(buf, len, ROCKER_TLV_io_max, l, e - l)) {
+            goto too_large;
+        }
+    }
+
+    hdr[1] = *len - start;
+    memcpy(buf + start, hdr, sizeof(hdr));
+
+    return nil;
+
+too_large:
+    *len = start;
+    return err_new___(-1, "request too large", nil);
+}
+
+//! 批量请求的标识, 位于批量请求的首部;
+//! 常规请求的首字段为 app_id, 不会取此值
+#define ROCKER_BATCH_MAGIC___ (-0x424b5452)
+
+//! 批量应答中, 每个 rocker 对应的常规数据长度: guard_pid + guard_pname
+#define ROCKER_BATCH_ITEM_SIZ___ (sizeof(i32___) + 16)
+
+//! 服务端 SOCK_SEQPACKET 监听地址
+#define ROCKER_SERVER_SEQ_ADDR___ (ROCKER_SERVER_UAU_ADDR "_seq")
+
+//! 服务端计时的阶段数量, 应答中的排列顺序与 ROCKER_STAGE 中的对应项一致
+#define ROCKER_TRACE_SRV_CNT___ (ROCKER_STAGE_idmap - ROCKER_STAGE_loop_attach + 1)
+
+//! 单个请求的应答中, 服务端在常规数据之后附带的各阶段耗时的长度
+#define ROCKER_TRACE_SRV_SIZ___ (ROCKER_TRACE_SRV_CNT___ * sizeof(u64___))
+
+//! 记录自 *since 至今的耗时, 并将 *since 更新为当前时刻, trace 为 nil 时不做任何操作
+//-
+//@ trace[out]: 各阶段的耗时
+//@ stage[in]: 刚刚结束的阶段
+//@ since[in, out]: 该阶段的开始时刻(Utils.now_ns)
+inline___ static void
+trace_mark(RockerTrace *trace, ROCKER_STAGE stage, u64___ *since) {
+    if (nil != trace) {
+        u64___ now = Utils.now_ns();
+        trace->ns[stage] = now - *since;
+        *since = now;
+    }
+}
+
+//! 一条应答: 常规数据及其携带的描述符
+//-
+//@ data: 单个或批量请求的应答数据, 每项为 [guard_pid, guard_pname], 批量应答之后另有各项的描述符数量
+//@ len: data 中的有效长度
+//@ fds: 应答携带的全部描述符, 由接收方负责关闭
+//@ fd_cnt: fds 中的描述符数量
+struct Resp {
+    char data[ROCKER_BATCH_MAX * (ROCKER_BATCH_ITEM_SIZ___ + 1)];
+    size_t len;
+    i___ fds[ROCKER_BATCH_MAX * FD_MAX];
+    size_t fd_cnt;
+};
+
+//! 连接方式下, 已被其它线程代为接收, 尚未被其请求方取走的应答
+struct Mail {
+    struct Mail *next;
+    uint32_t seq;
+    struct Resp resp;
+};
+
+//! 客户端会话
+//-
+//@ master_fd: 已连接至服务端的 SOCK_SEQPACKET socket, 或已绑定(autobound)的本地 SOCK_DGRAM socket
+//@ conn: master_fd 是否为 SOCK_SEQPACKET 类型
+//@ peeraddr: 服务端地址, 仅用于 SOCK_DGRAM
+//@ peeraddr_len: 服务端地址的实际长度
+//@ lk: 保护 reqbuf 及 seq, 数据报方式下同一会话上的请求/应答交互必须串行,
+//@     否则可能收到其它请求的应答
+//@ reqbuf: 编码请求所用的缓冲区
+//@ seq: 连接方式下, 最近一个请求的序号, 应答以此与请求对应
+//@ rlk: 连接方式下, 请求发出之后即释放 lk, 多个请求可同时在途;
+//@     同一时刻只有一个线程(reading)接收应答, 属于其它请求的应答存入 mailbox
+//@ rcond: 新应答到达或 reading 线程退出时通知所有等待者
+//@ broken: 连接已失效, 所有在途及后续的请求均失败
+struct RockerSession {
+    i___ master_fd;
+    bool___ conn;
     struct sockaddr_un peeraddr;
     socklen_t peeraddr_len;
+    pthread_mutex_t lk;
+    char reqbuf[ROCKER_REQ_SIZ_MAX___];
+    uint32_t seq;
 
-    // 生成 peer 端的地址, 地址固定, 以简化调用方的工作
-    ROCKER_ERR_checker___(ROCKER_ERR_server_unaddr_invalid,
-            IO.unix_abstract_udp_genaddr(ROCKER_SERVER_UAU_ADDR, &peeraddr, &peeraddr_len));
+    pthread_mutex_t rlk;
+    pthread_cond_t rcond;
+    bool___ reading;
+    bool___ broken;
+    struct Mail *mailbox;
+};
+
+//! 丢弃 socket 中残留的应答(如先前超时的请求迟到的应答),
+//! 并关闭其中携带的描述符, 以免被当作本次请求的应答
+INNER___ static void
+session_drain(RockerSession *session) {
+    char buf[64];
+    struct iovec vec = { .iov_base = buf, .iov_len = sizeof(buf) };
+    struct FdTransEnv fte;
+    struct cmsghdr *cmsg;
+
+    while (1) {
+        fatal_if_err___(IO.fte_init(&fte, nil, N, &vec, 1));
+        if (0 > recvmsg(session->master_fd, &fte.msg, MSG_DONTWAIT)) {
+            break;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&fte.msg); nil != cmsg; cmsg = CMSG_NXTHDR(&fte.msg, cmsg)) {
+            if (SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type) {
+                i___ *fds = (i___ *)CMSG_DATA(cmsg);
+                size_t cnt = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(i___);
+                for (size_t i = 0; i < cnt; ++i) {
+                    close(fds[i]);
+                }
+            }
+        }
+    }
+}
+
+//! 批量请求的格式: [MAGIC, n, len_0, ..., len_(n-1)] + n 个常规请求,
+//! 追加到 buf 中, 参数含义同 req_encode
+INNER___ static Error *
+req_encode_batch(RockerRequest *reqs, size_t n, char *buf, size_t *len) {
+    // 首部在所有请求编码完成之后回填
+    i32___ hdr[2 + ROCKER_BATCH_MAX];
+    size_t start = *len;
+
+    hdr[0] = ROCKER_BATCH_MAGIC___;
+    hdr[1] = n;
+    *len += sizeof(i32___) * (2 + n);
 
-    // 生成 master_fd
-    ROCKER_ERR_checker___(ROCKER_ERR_gen_local_addr_failed, IO.unix_abstract_udp_new_autobound(&master_fd));
+    for (size_t i = 0; i < n; ++i) {
+        size_t item_start = *len;
+        return_err_if_err___(req_encode(reqs + i, buf, len));
+        hdr[2 + i] = *len - item_start;
+    }
+
+    memcpy(buf + start, hdr, sizeof(i32___) * (2 + n));
+
+    return nil;
+}
 
-    struct ReqReal rr = ROCKER_parse_request___(req);
+//! 接收一条应答
+//-
+//@ fd[in]: 会话的 master_fd
+//@ seq[out]: 连接方式下应答首部的请求序号, 数据报方式下置为 nil
+//@ resp[out]: 应答数据及其携带的描述符
+INNER___ static Error *
+resp_recv(i___ fd, uint32_t *seq, struct Resp *resp) {
+    union {
+        char buf[CMSG_SPACE(sizeof(resp->fds))];
+        struct cmsghdr align;
+    } cmsgbuf;
+    uint32_t seq_ = 0;
+    struct iovec vec[2] = {
+        { .iov_base = &seq_, .iov_len = nil == seq ? 0 : sizeof(seq_) },
+        { .iov_base = resp->data, .iov_len = sizeof(resp->data) },
+    };
+    struct msghdr msg = {
+        .msg_name = nil,
+        .msg_namelen = 0,
+        .msg_iov = vec,
+        .msg_iovlen = 2,
+        .msg_control = cmsgbuf.buf,
+        .msg_controllen = sizeof(cmsgbuf.buf),
+        .msg_flags = 0,
+    };
+    ssize_t n = 0;
+
+    // 连接方式下, 应答的到达时间取决于在途请求的数量, 不设超时
+    return_err_if_err___(nil == seq ? IO.recv_msg(fd, &msg, &n) : IO.recv_msg_wait(fd, &msg, &n));
+
+    resp->fd_cnt = 0;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (nil != cmsg && SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type) {
+        resp->fd_cnt = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(i___);
+        memcpy(resp->fds, CMSG_DATA(cmsg), resp->fd_cnt * sizeof(i___));
+    }
+
+    if (nil != seq) {
+        if ((ssize_t)sizeof(seq_) > n) {
+            for (size_t i = 0; i < resp->fd_cnt; ++i) {
+                close(resp->fds[i]);
+            }
+            return err_new___(-1, "response too short", nil);
+        }
+        *seq = seq_;
+        n -= sizeof(seq_);
+    }
+
+    resp->len = n;
+
+    return nil;
+}
+
+//! 连接方式下, 等待序号为 seq 的请求的应答
+//-
+//@ session[in]: 客户端会话
+//@ seq[in]: 请求的序号
+//@ resp[out]: 应答数据及其携带的描述符
+INNER___ static Error *
+session_await(RockerSession *session, uint32_t seq, struct Resp *resp) {
+    Error *e = nil;
+    uint32_t got;
+
+    pthread_mutex_lock(&session->rlk);
+
+    while (1) {
+        // 已被其它线程代为接收
+        struct Mail **m = &session->mailbox;
+        while (nil != *m && seq != (*m)->seq) {
+            m = &(*m)->next;
+        }
+        if (nil != *m) {
+            struct Mail *hit = *m;
+            *m = hit->next;
+            memcpy(resp, &hit->resp, sizeof(struct Resp));
+            free(hit);
+            break;
+        }
+
+        if (session->broken) {
+            e = err_new___(-1, "session connection broken", nil);
+            break;
+        }
+
+        if (session->reading) {
+            pthread_cond_wait(&session->rcond, &session->rlk);
+            continue;
+        }
+
+        session->reading = true___;
+        pthread_mutex_unlock(&session->rlk);
+
+        e = resp_recv(session->master_fd, &got, resp);
+
+        pthread_mutex_lock(&session->rlk);
+        session->reading = false___;
+
+        if (nil == e && seq != got) {
+            struct Mail *mail = malloc(sizeof(struct Mail));
+            if (nil == mail) {
+                for (size_t i = 0; i < resp->fd_cnt; ++i) {
+                    close(resp->fds[i]);
+                }
+                e = err_new_sys___();
+            } else {
+                mail->seq = got;
+                memcpy(&mail->resp, resp, sizeof(struct Resp));
+                mail->next = session->mailbox;
+                session->mailbox = mail;
+            }
+        }
+
+        // 应答无法再与请求对应
+        if (nil != e) {
+            session->broken = true___;
+        }
+
+        pthread_cond_broadcast(&session->rcond);
+
+        if (nil != e || seq == got) {
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&session->rlk);
+
+    return e;
+}
+
+//! 编码并发送请求, 然后取得其应答.
+//! 连接方式下, 请求之前附加 4 字节的序号, 发出之后即释放 lk, 允许多个请求同时在途
+//-
+//@ session[in]: 客户端会话
+//@ reqs[in]: 创建 rocker 所需的配置数据
+//@ n[in]: 为 0 时发送单个常规请求, 否则发送含 n 项的批量请求
+//@ resp[out]: 应答数据及其携带的描述符
+//@ trace[out]: 可以为 nil, 记录发送请求及等待应答的耗时
+static RockerResult
+session_roundtrip(RockerSession *session, RockerRequest *reqs, size_t n, struct Resp *resp, RockerTrace *trace) {
+    RockerResult jr = Rocker_result_new();
+    Error *e = nil;
+    bool___ locked = true___;
+    uint32_t seq = 0;
+    struct iovec vec = { .iov_base = session->reqbuf, .iov_len = 0 };
+    u64___ ts = nil == trace ? 0 : Utils.now_ns();
+
+    pthread_mutex_lock(&session->lk);
+
+    if (session->conn) {
+        seq = ++session->seq;
+        memcpy(session->reqbuf, &seq, sizeof(seq));
+        vec.iov_len = sizeof(seq);
+    } else {
+        session_drain(session);
+    }
+
+    ROCKER_ERR_checker___(ROCKER_ERR_param_invalid, 0 == n
+            ? req_encode(reqs, session->reqbuf, &vec.iov_len)
+            : req_encode_batch(reqs, n, session->reqbuf, &vec.iov_len));
 
     // send req
     ROCKER_ERR_checker___(ROCKER_ERR_send_req_failed,
-            IO.send_normal(master_fd, rr.vec, ROCKER_reqreal_vec_len___, &peeraddr, peeraddr_len));
+            IO.send_normal(session->master_fd, &vec, 1,
+                session->conn ? nil : &session->peeraddr, session->peeraddr_len));
+    trace_mark(trace, ROCKER_STAGE_send_req, &ts);
 
-    // recv fd
-    struct iovec guard_pid_pname[2] = {
-        { .iov_base = &jr.guard_pid, .iov_len = sizeof(pid_t) },
-        { .iov_base = jr.guard_pname, .iov_len = 16 }
-    };
-    struct FdTransEnv fte;
-    fatal_if_err___(IO.fte_init(&fte, nil, N, guard_pid_pname, 2));
-    ROCKER_ERR_checker___(ROCKER_ERR_recv_resp_failed, IO.recv_fd(master_fd, &fte));
+    // recv resp
+    if (session->conn) {
+        pthread_mutex_unlock(&session->lk);
+        locked = false___;
+        ROCKER_ERR_checker___(ROCKER_ERR_recv_resp_failed, session_await(session, seq, resp));
+    } else {
+        ROCKER_ERR_checker___(ROCKER_ERR_recv_resp_failed, resp_recv(session->master_fd, nil, resp));
+    }
+    trace_mark(trace, ROCKER_STAGE_wait_resp, &ts);
+
+end:
+    if (locked) {
+        pthread_mutex_unlock(&session->lk);
+    }
+    return jr;
+}
+
+//! 解析单个请求的应答, 取得新 rocker 的 guard 信息及 namespace 描述符
+//-
+//@ resp[in]: 应答数据及其携带的描述符, 无用的描述符在此关闭
+//@ fdset[out]: namespace 描述符, 生命线及 cgroup 描述符, 成功时需由调用方关闭
+//@ trace[out]: 可以为 nil, 服务端各阶段的耗时, 旧版服务端不附带此数据
+static RockerResult
+resp_unpack(RockerResult jr, const struct Resp *resp, i___ fdset[FD_MAX], RockerTrace *trace) {
+    if (sizeof(i32___) <= resp->len) {
+        memcpy(&jr.guard_pid, resp->data, sizeof(i32___));
+    }
+    if (ROCKER_BATCH_ITEM_SIZ___ <= resp->len) {
+        memcpy(jr.guard_pname, resp->data + sizeof(i32___), 16);
+    }
+    if (nil != trace && ROCKER_BATCH_ITEM_SIZ___ + ROCKER_TRACE_SRV_SIZ___ <= resp->len) {
+        for (size_t i = 0; i < ROCKER_TRACE_SRV_CNT___; ++i) {
+            u64___ ns;
+            memcpy(&ns, resp->data + ROCKER_BATCH_ITEM_SIZ___ + i * sizeof(u64___), sizeof(u64___));
+            trace->ns[ROCKER_STAGE_loop_attach + i] = ns;
+        }
+    }
 
     // 客户端提供的参数无效, 或服务端出现严重错误.
-    if (0 > jr.guard_pid || nil == fte.fdset) {
+    if (0 > jr.guard_pid || N > resp->fd_cnt) {
+        for (size_t i = 0; i < resp->fd_cnt; ++i) {
+            close(resp->fds[i]);
+        }
         jr.err_no = ROCKER_ERR_build_rocker_failed;
-        goto end;
+        return jr;
+    }
+
+    fdset[N] = -1;
+    fdset[N + 1] = -1;
+    for (size_t i = 0; i < resp->fd_cnt; ++i) {
+        if (FD_MAX > i) {
+            fdset[i] = resp->fds[i];
+        } else {
+            close(resp->fds[i]);
+        }
+    }
+
+    return jr;
+}
+
+//! 与服务端完成一次请求/应答交互, 取得新 rocker 的 namespace 描述符
+//-
+//@ session[in]: 客户端会话
+//@ req[in]: 创建新rocker所需的配置数据
+//@ fdset[out]: 收到的 namespace 描述符, 生命线及 cgroup 描述符, 成功时需由调用方关闭
+//@ trace[out]: 可以为 nil, 记录交互过程及服务端各阶段的耗时
+static RockerResult
+session_exchange(RockerSession *session, RockerRequest *req, i___ fdset[FD_MAX], RockerTrace *trace) {
+    struct Resp resp;
+    RockerResult jr = session_roundtrip(session, req, 0, &resp, trace);
+    if (ROCKER_ERR_success != jr.err_no) {
+        return jr;
+    }
+
+    return resp_unpack(jr, &resp, fdset, trace);
+}
+
+//! 与服务端完成一次批量请求/应答交互.
+//! 批量应答的格式: n 组 [guard_pid, guard_pname] + n 字节的各项描述符数量
+//! + 所有成功项的描述符(按序排列); 旧版服务端不附带描述符数量, 每项 N 个或 N + 1 个
+//-
+//@ session[in]: 客户端会话
+//@ reqs[in]: 创建各 rocker 所需的配置数据
+//@ n[in]: 请求数量
+//@ results[out]: 各 rocker 的创建结果
+//@ fdsets[out]: 各 rocker 的 namespace 描述符, 生命线及 cgroup 描述符, 对应结果成功时需由调用方关闭
+static RockerResult
+session_exchange_batch(RockerSession *session, RockerRequest *reqs, size_t n,
+        RockerResult results[], i___ fdsets[][FD_MAX]) {
+    for (size_t i = 0; i < n; ++i) {
+        results[i] = Rocker_result_new();
+        results[i].err_no = ROCKER_ERR_build_rocker_failed;
+    }
+
+    struct Resp resp;
+    RockerResult jr = session_roundtrip(session, reqs, n, &resp, nil);
+    if (ROCKER_ERR_success != jr.err_no) {
+        return jr;
+    }
+
+    size_t item_cnt = 0, ok_cnt = 0, fd_idx = 0;
+    for (; item_cnt < n && (item_cnt + 1) * ROCKER_BATCH_ITEM_SIZ___ <= resp.len; ++item_cnt) {
+        memcpy(&results[item_cnt].guard_pid, resp.data + item_cnt * ROCKER_BATCH_ITEM_SIZ___, sizeof(i32___));
+        memcpy(results[item_cnt].guard_pname, resp.data + item_cnt * ROCKER_BATCH_ITEM_SIZ___ + sizeof(i32___), 16);
+        if (0 <= results[item_cnt].guard_pid) {
+            ++ok_cnt;
+        }
     }
 
-    // enter ns
-    ROCKER_ERR_checker___(ROCKER_ERR_enter_rocker_failed, NameSpace.enter_ns(fte.fdset, N));
+    // 旧版服务端: 据描述符总数判断其是否为每项附带了生命线描述符
+    const char *cnts = n * (ROCKER_BATCH_ITEM_SIZ___ + 1) <= resp.len ? resp.data + n * ROCKER_BATCH_ITEM_SIZ___ : nil;
+    size_t stride = (0 < ok_cnt && ok_cnt * (N + 1) <= resp.fd_cnt) ? N + 1 : N;
+
+    for (size_t i = 0; i < item_cnt; ++i) {
+        size_t cnt = nil == cnts ? stride : (uint8_t)cnts[i];
+
+        // 客户端提供的参数无效, 或服务端出现严重错误.
+        if (0 > results[i].guard_pid || N > cnt || FD_MAX < cnt || resp.fd_cnt < fd_idx + cnt) {
+            continue;
+        }
+
+        fdsets[i][N] = -1;
+        fdsets[i][N + 1] = -1;
+        memcpy(fdsets[i], resp.fds + fd_idx, cnt * sizeof(i___));
+        fd_idx += cnt;
+        results[i].err_no = ROCKER_ERR_success;
+    }
+
+    // 与应答数据不匹配的多余描述符
+    for (; fd_idx < resp.fd_cnt; ++fd_idx) {
+        close(resp.fds[fd_idx]);
+    }
+
+    return jr;
+}
+
+//! app 进程的入口参数
+//-
+//@ fdsets/cnt: 同一次交互中收到的全部描述符, 单次请求时 cnt 为 1
+//@ idx: 当前 rocker 在 fdsets 中的下标
+//@ app/app_args: 调用方提供的函数及其参数
+struct AppEntry {
+    i___ (*fdsets)[FD_MAX];
+    size_t cnt;
+    size_t idx;
+    int (*app) (void *);
+    void *app_args;
+};
+
+//! app 进程的入口: 先关闭同批次中其它 rocker 的描述符, 再执行调用方的函数.
+//! 否则 app 可经由其 namespace 描述符进入其它 rocker,
+//! 且持有其生命线, 使其 JG 在本 app 退出之前无法退出.
+//! 连接方式下收到的描述符均带有 FD_CLOEXEC, 生命线须清除此标志, 以便 app 在 exec 之后仍持有它
+INNER___ static i___
+app_entry(void *arg) {
+    struct AppEntry *ent = arg;
+
+    for (size_t i = 0; i < ent->cnt; ++i) {
+        for (size_t j = 0; i != ent->idx && j < FD_MAX; ++j) {
+            IO_drop_fd(&ent->fdsets[i][j]);
+        }
+    }
+
+    i___ lifeline = ent->fdsets[ent->idx][N];
+    i___ flags = 0 > lifeline ? -1 : fcntl(lifeline, F_GETFD);
+    if (0 <= flags && 0 > fcntl(lifeline, F_SETFD, flags & ~FD_CLOEXEC)) {
+        return 255;
+    }
+
+    return ent->app(ent->app_args);
+}
+
+//! 进入新 rocker 并在其中运行 app,
+//! 调用方进程的 namespace 不受影响.
+//! 生命线描述符经由 fd 表的副本被 app 进程继承, 调用方随后关闭自身的副本即可;
+//! 带有 cgroup 描述符时, app 进程在执行 app 函数之前迁入该 cgroup
+//-
+//@ fdsets[in]: 同一次交互中收到的全部描述符(namespace 描述符, 生命线及 cgroup 描述符), 已关闭的置为 -1
+//@ cnt[in]: fdsets 中的 rocker 数量
+//@ idx[in]: 需要进入的 rocker 在 fdsets 中的下标
+//@ app[in]: rocker创建成功后, 需要在其中执行的函数
+//@ app_args[in]: 传递给app函数的参数
+//@ trace[out]: 可以为 nil, 记录进入 namespace 及创建 app 进程的耗时
+static RockerResult
+enter_and_run(RockerResult jr, i___ fdsets[][FD_MAX], size_t cnt, size_t idx,
+        int (*app) (void *), void *app_args, RockerTrace *trace) {
+    bool___ ns_entered = false___;
+    u64___ ts = nil == trace ? 0 : Utils.now_ns();
+    u64___ entered_at = 0;
+
+    struct AppEntry ent = {
+        .fdsets = fdsets,
+        .cnt = cnt,
+        .idx = idx,
+        .app = app,
+        .app_args = app_args,
+    };
+    i___ *fdset = fdsets[idx];
 
     // exec app, 在兄弟进程中运行, 确保原始的caller可wait其app进程
-    ROCKER_ERR_checker___(ROCKER_ERR_app_exec_failed, NameSpace.run_in_brother(app, app_args, &jr.app_pid));
+    Error *e = NameSpace.enter_and_run(fdset, N, fdset[N + 1], app_entry, &ent, &jr.app_pid, &ns_entered, &entered_at);
+    if (nil != trace && ns_entered) {
+        u64___ now = Utils.now_ns();
+        trace->ns[ROCKER_STAGE_enter_ns] = entered_at - ts;
+        trace->ns[ROCKER_STAGE_app_exec] = now - entered_at;
+    }
+    if (nil != e) {
+        display_clean_errchain___(e);
+        jr.err_no = ns_entered ? ROCKER_ERR_app_exec_failed : ROCKER_ERR_enter_rocker_failed;
+    }
+
+    return jr;
+}
+
+//! 打开一个可重用的客户端会话
+//-
+//@ session[out]: 新创建的会话
+pub___ RockerResult
+ROCKER_session_open(RockerSession **session) {
+    RockerResult jr = Rocker_result_new();
+    Error *e = nil;
+
+    if (nil == session) {
+        jr.err_no = ROCKER_ERR_param_invalid;
+        goto end;
+    }
+
+    RockerSession *s = malloc(sizeof(RockerSession));
+    if (nil == s) {
+        ROCKER_ERR_checker___(ROCKER_ERR_sys, err_new_sys___());
+    }
+
+    s->master_fd = -1;
+    s->seq = 0;
+    s->reading = false___;
+    s->broken = false___;
+    s->mailbox = nil;
+
+    // 生成 peer 端的地址, 地址固定, 以简化调用方的工作
+    if (nil != (e = IO.unix_abstract_udp_genaddr(ROCKER_SERVER_UAU_ADDR, &s->peeraddr, &s->peeraddr_len))) {
+        free(s);
+        ROCKER_ERR_checker___(ROCKER_ERR_server_unaddr_invalid, e);
+    }
+
+    // 优先使用连接方式, 服务端未启用时退回到数据报方式
+    if (nil == (e = IO.unix_abstract_seqpacket_connect(ROCKER_SERVER_SEQ_ADDR___, &s->master_fd))) {
+        s->conn = true___;
+    } else {
+        Log.clean_errchain(e);
+        s->conn = false___;
+
+        // 生成 master_fd
+        if (nil != (e = IO.unix_abstract_udp_new_autobound(&s->master_fd))) {
+            free(s);
+            ROCKER_ERR_checker___(ROCKER_ERR_gen_local_addr_failed, e);
+        }
+    }
+
+    pthread_mutex_init(&s->lk, nil);
+    pthread_mutex_init(&s->rlk, nil);
+    pthread_cond_init(&s->rcond, nil);
+
+    *session = s;
 
 end:
     return jr;
 }
 
-//! 实际的操作都在ROCKER_enter_rocker_inner中, 此为wrapper函数,
-//! 用于使新创建的namespace生效, 并确保调用方进程不受干扰
+//! 关闭会话
+//-
+//@ session[in]: 由 ROCKER_session_open 创建的会话
+pub___ void
+ROCKER_session_close(RockerSession *session) {
+    if (nil == session) {
+        return;
+    }
+
+    // 无人认领的应答
+    for (struct Mail *m = session->mailbox, *next = nil; nil != m; m = next) {
+        next = m->next;
+        for (size_t i = 0; i < m->resp.fd_cnt; ++i) {
+            close(m->resp.fds[i]);
+        }
+        free(m);
+    }
+
+    IO_drop_fd(&session->master_fd);
+    pthread_mutex_destroy(&session->lk);
+    pthread_mutex_destroy(&session->rlk);
+    pthread_cond_destroy(&session->rcond);
+    free(session);
+}
+
+//! 复用会话的 socket 与服务端地址, 请求创建新rocker, 并在其中运行指定函数
+//-
+//@ trace[out]: 可以为 nil, 记录各阶段的耗时
+//@ 其余参数同 ROCKER_session_enter_rocker
+static RockerResult
+session_enter_rocker(RockerSession *session,
+        RockerRequest *req, int (*app) (void *), void *app_args, RockerTrace *trace) {
+    RockerResult jr = Rocker_result_new();
+
+    if (!(session && req && app)) {
+        jr.err_no = ROCKER_ERR_param_invalid;
+        return jr;
+    }
+
+    if (nil != trace) {
+        memset(trace, 0, sizeof(RockerTrace));
+    }
+
+    i___ fdset[FD_MAX];
+    jr = session_exchange(session, req, fdset, trace);
+    if (ROCKER_ERR_success != jr.err_no) {
+        return jr;
+    }
+
+    jr = enter_and_run(jr, &fdset, 1, 0, app, app_args, trace);
+
+    for (size_t i = 0; i < FD_MAX; ++i) {
+        IO_drop_fd(&fdset[i]);
+    }
+
+    return jr;
+}
+
+//! 复用会话的 socket 与服务端地址, 请求创建新rocker, 并在其中运行指定函数
+//-
+//@ session[in]: 由 ROCKER_session_open 创建的会话
+//@ req[in]: 创建新rocker所需的配置数据
+//@ app[in]: rocker创建成功后, 需要在其中执行的函数
+//@ app_args[in]: 传递给app函数的参数
+pub___ RockerResult
+ROCKER_session_enter_rocker(RockerSession *session,
+        RockerRequest *req, int (*app) (void *), void *app_args) {
+    return session_enter_rocker(session, req, app, app_args, nil);
+}
+
+//! 复用会话的 socket 与服务端地址, 批量创建 rocker 并在其中运行对应的 app
+//-
+//@ session[in]: 由 ROCKER_session_open 创建的会话
+//@ reqs[in]: 创建各 rocker 所需的配置数据, 最多 ROCKER_BATCH_MAX 个
+//@ n[in]: reqs 中的请求数量
+//@ apps[in]: 与 reqs 一一对应, 各 rocker 中需要执行的函数
+//@ app_args[in]: 与 reqs 一一对应, 传递给各 app 函数的参数, 可以为 NULL
+//@ results[out]: 与 reqs 一一对应, 各 rocker 的创建结果
+pub___ RockerResult
+ROCKER_session_enter_rocker_batch(RockerSession *session, RockerRequest *reqs, size_t n,
+        int (*apps[]) (void *), void *app_args[], RockerResult results[]) {
+    RockerResult jr = Rocker_result_new();
+
+    if (!(session && reqs && apps && results) || 0 == n || ROCKER_BATCH_MAX < n) {
+        jr.err_no = ROCKER_ERR_param_invalid;
+        return jr;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        if (nil == apps[i]) {
+            jr.err_no = ROCKER_ERR_param_invalid;
+            return jr;
+        }
+    }
+
+    // 未成功的项不会被写入描述符
+    i___ fdsets[ROCKER_BATCH_MAX][FD_MAX];
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < FD_MAX; ++j) {
+            fdsets[i][j] = -1;
+        }
+    }
+
+    jr = session_exchange_batch(session, reqs, n, results, fdsets);
+    if (ROCKER_ERR_success != jr.err_no) {
+        for (size_t i = 0; i < n; ++i) {
+            results[i].err_no = jr.err_no;
+        }
+        return jr;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        if (ROCKER_ERR_success != results[i].err_no) {
+            continue;
+        }
+
+        results[i] = enter_and_run(results[i], fdsets, n, i, apps[i], nil == app_args ? nil : app_args[i], nil);
+
+        // 已关闭的描述符置为 -1, 以免后续的 app 进程关闭被重用的描述符
+        for (size_t j = 0; j < FD_MAX; ++j) {
+            IO_drop_fd(&fdsets[i][j]);
+            fdsets[i][j] = -1;
+        }
+    }
+
+    return jr;
+}
+
+//! 单次调用的批量接口, 内部使用一个临时会话
+//-
+//@ reqs[in]: 创建各 rocker 所需的配置数据, 最多 ROCKER_BATCH_MAX 个
+//@ n[in]: reqs 中的请求数量
+//@ apps[in]: 与 reqs 一一对应, 各 rocker 中需要执行的函数
+//@ app_args[in]: 与 reqs 一一对应, 传递给各 app 函数的参数, 可以为 NULL
+//@ results[out]: 与 reqs 一一对应, 各 rocker 的创建结果
+pub___ RockerResult
+ROCKER_enter_rocker_batch(RockerRequest *reqs, size_t n,
+        int (*apps[]) (void *), void *app_args[], RockerResult results[]) {
+    RockerResult jr = Rocker_result_new();
+
+    RockerSession *session = nil;
+    jr = ROCKER_session_open(&session);
+    if (ROCKER_ERR_success != jr.err_no) {
+        return jr;
+    }
+
+    jr = ROCKER_session_enter_rocker_batch(session, reqs, n, apps, app_args, results);
+    ROCKER_session_close(session);
+
+    return jr;
+}
+
+//! 单次调用的简便接口, 内部使用一个临时会话,
+//! 需要频繁启动 rocker 的调用方, 应使用 ROCKER_session_* 系列接口
+//-
+//@ req[in]: 创建新rocker所需的配置数据
+//@ app[in]: rocker创建成功后, 需要在其中执行的函数
+//@ app_args[in]: 传递给app函数的参数
 pub___ RockerResult
 ROCKER_enter_rocker(RockerRequest *req, int (*app) (void *), void *app_args) {
+    return ROCKER_enter_rocker_traced(req, app, app_args, nil);
+}
+
+//! 与 ROCKER_enter_rocker 相同, 同时记录各阶段的耗时;
+//! 临时会话的创建与关闭不计入任何阶段
+//-
+//@ req[in]: 创建新rocker所需的配置数据
+//@ app[in]: rocker创建成功后, 需要在其中执行的函数
+//@ app_args[in]: 传递给app函数的参数
+//@ trace[out]: 可以为 NULL, 各阶段的耗时
+pub___ RockerResult
+ROCKER_enter_rocker_traced(RockerRequest *req, int (*app) (void *), void *app_args, RockerTrace *trace) {
+    RockerResult jr = Rocker_result_new();
+
+    if (!(req && app)) {
+        jr.err_no = ROCKER_ERR_param_invalid;
+        return jr;
+    }
+
+    RockerSession *session = nil;
+    jr = ROCKER_session_open(&session);
+    if (ROCKER_ERR_success != jr.err_no) {
+        return jr;
+    }
+
+    jr = session_enter_rocker(session, req, app, app_args, trace);
+    ROCKER_session_close(session);
+
+    return jr;
+}
+
+//! 异步启动的句柄, 每个句柄独占一个已绑定(autobound)的本地 socket,
+//! 应答到达时该 socket 变为可读
+//-
+//@ fd: 本地 SOCK_DGRAM socket, 服务端的应答发往此处
+//@ app: rocker创建成功后, 需要在其中执行的函数
+//@ app_args: 传递给app函数的参数
+struct RockerAsync {
+    i___ fd;
+    int (*app) (void *);
+    void *app_args;
+};
+
+//! 发出请求后立即返回, 不等待服务端的应答
+//-
+//@ req[in]: 创建新rocker所需的配置数据
+//@ app[in]: rocker创建成功后, 需要在其中执行的函数
+//@ app_args[in]: 传递给app函数的参数
+//@ handle[out]: 异步启动的句柄, 须由 ROCKER_complete 或 ROCKER_cancel 释放
+pub___ RockerResult
+ROCKER_enter_rocker_async(RockerRequest *req, int (*app) (void *), void *app_args, RockerAsync **handle) {
     RockerResult jr = Rocker_result_new();
     Error *e = nil;
+    RockerAsync *h = nil;
+    char *reqbuf = nil;
+    struct sockaddr_un peeraddr;
+    socklen_t peeraddr_len = 0;
+    struct iovec vec = { .iov_base = nil, .iov_len = 0 };
 
-    drop___(IO_drop_fd) i___ read_fd = -1;
-    drop___(IO_drop_fd) i___  write_fd = -1;
-    ROCKER_ERR_checker___(ROCKER_ERR_sys, IO.creat_pipe(&read_fd, &write_fd));
+    if (!(req && app && handle)) {
+        jr.err_no = ROCKER_ERR_param_invalid;
+        return jr;
+    }
 
-    if (!(req && app)) {
+    if (nil == (h = malloc(sizeof(RockerAsync)))) {
+        ROCKER_ERR_checker___(ROCKER_ERR_sys, err_new_sys___());
+    }
+    h->fd = -1;
+    h->app = app;
+    h->app_args = app_args;
+
+    if (nil == (reqbuf = malloc(ROCKER_REQ_SIZ_MAX___))) {
+        ROCKER_ERR_checker___(ROCKER_ERR_sys, err_new_sys___());
+    }
+
+    ROCKER_ERR_checker___(ROCKER_ERR_param_invalid, req_encode(req, reqbuf, &vec.iov_len));
+    vec.iov_base = reqbuf;
+
+    ROCKER_ERR_checker___(ROCKER_ERR_server_unaddr_invalid,
+            IO.unix_abstract_udp_genaddr(ROCKER_SERVER_UAU_ADDR, &peeraddr, &peeraddr_len));
+    ROCKER_ERR_checker___(ROCKER_ERR_gen_local_addr_failed, IO.unix_abstract_udp_new_autobound(&h->fd));
+    ROCKER_ERR_checker___(ROCKER_ERR_send_req_failed,
+            IO.send_normal(h->fd, &vec, 1, &peeraddr, peeraddr_len));
+
+    *handle = h;
+    h = nil;
+
+end:
+    if (nil != h) {
+        IO_drop_fd(&h->fd);
+        free(h);
+    }
+    IO_drop_mem(&reqbuf);
+    return jr;
+}
+
+//! 返回句柄的可读事件描述符, 供调用方的 poll/epoll 等待应答.
+//! 该描述符归句柄所有, 调用方不得读取或关闭
+//-
+//@ handle[in]: 由 ROCKER_enter_rocker_async 创建的句柄
+pub___ int
+ROCKER_async_fd(RockerAsync *handle) {
+    return nil == handle ? -1 : handle->fd;
+}
+
+//! 接收应答并进入新 rocker 运行 app, 之后释放句柄.
+//! 应在句柄的描述符可读之后调用, 否则至多等待 3 秒
+//-
+//@ handle[in]: 由 ROCKER_enter_rocker_async 创建的句柄
+pub___ RockerResult
+ROCKER_complete(RockerAsync *handle) {
+    RockerResult jr = Rocker_result_new();
+    Error *e = nil;
+    struct Resp resp;
+    struct iovec vec = { .iov_base = resp.data, .iov_len = sizeof(resp.data) };
+    struct FdTransEnv fte;
+    ssize_t n = 0;
+    i___ fdset[FD_MAX];
+
+    if (nil == handle) {
         jr.err_no = ROCKER_ERR_param_invalid;
+        return jr;
+    }
+
+    ROCKER_ERR_checker___(ROCKER_ERR_recv_resp_failed, IO.fte_init(&fte, nil, FD_MAX, &vec, 1));
+    ROCKER_ERR_checker___(ROCKER_ERR_recv_resp_failed, IO.recv_msg(handle->fd, &fte.msg, &n));
+
+    resp.len = n;
+    resp.fd_cnt = 0;
+    fte.cmsg = CMSG_FIRSTHDR(&fte.msg);
+    if (nil != fte.cmsg && SOL_SOCKET == fte.cmsg->cmsg_level && SCM_RIGHTS == fte.cmsg->cmsg_type) {
+        resp.fd_cnt = (fte.cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(i___);
+        memcpy(resp.fds, CMSG_DATA(fte.cmsg), resp.fd_cnt * sizeof(i___));
+    }
+
+    jr = resp_unpack(jr, &resp, fdset, nil);
+    if (ROCKER_ERR_success != jr.err_no) {
         goto end;
     }
 
-    pid_t pid = fork();
-    if (0 == pid) {
-        jr = ROCKER_enter_rocker_inner(req, app, app_args);
-        if (sizeof(RockerResult) != write(write_fd, &jr, sizeof(RockerResult))) {
-            display_clean_errchain___(err_new_sys___());
-        }
-        exit(0);
-    } else if (0 > pid) {
+    jr = enter_and_run(jr, &fdset, 1, 0, handle->app, handle->app_args, nil);
+
+    for (size_t i = 0; i < FD_MAX; ++i) {
+        IO_drop_fd(&fdset[i]);
+    }
+
+end:
+    IO_drop_fd(&handle->fd);
+    free(handle);
+    return jr;
+}
+
+//! 放弃尚未完成的异步启动, 释放句柄, 传入 NULL 时不做任何操作.
+//! 本地 socket 关闭后, 已到达或迟到的应答及其描述符均被内核丢弃,
+//! 服务端创建的 rocker 随生命线的关闭而退出
+//-
+//@ handle[in]: 由 ROCKER_enter_rocker_async 创建的句柄
+pub___ void
+ROCKER_cancel(RockerAsync *handle) {
+    if (nil == handle) {
+        return;
+    }
+
+    IO_drop_fd(&handle->fd);
+    free(handle);
+}
+
+//! stats_map 请求的标识, 须与 rocker_server 保持一致;
+//! 请求只含此 4 字节, 应答为 4 字节的状态, 成功(0)时附带状态页的只读描述符
+#define ROCKER_STATS_MAP_MAGIC___ (-0x53544d50)
+
+//! 读取 guard 记录时的重试次数上限
+#define ROCKER_STATS_RETRY___ 1024
+
+//! 状态页的映射长度, 由页头中的记录数量及长度决定
+inline___ static size_t
+stats_page_len(const RockerStatsHdr *hdr) {
+    return sizeof(RockerStatsHdr) + hdr->slot_num * hdr->slot_siz;
+}
+
+//! 映射共享内存状态页, 以临时的本地 socket 向服务端索取其只读描述符
+//-
+//@ page[out]: 只读的状态页
+pub___ RockerResult
+ROCKER_stats_map(const RockerStatsPage **page) {
+    RockerResult jr = Rocker_result_new();
+    Error *e = nil;
+    i___ fd = -1, page_fd = -1;
+    i32___ req = ROCKER_STATS_MAP_MAGIC___, status = -1;
+    struct sockaddr_un peeraddr;
+    socklen_t peeraddr_len = 0;
+    struct iovec vec = { .iov_base = &req, .iov_len = sizeof(req) };
+    struct FdTransEnv fte;
+    struct stat st;
+    ssize_t n = 0;
+
+    if (nil == page) {
+        jr.err_no = ROCKER_ERR_param_invalid;
+        return jr;
+    }
+
+    ROCKER_ERR_checker___(ROCKER_ERR_server_unaddr_invalid,
+            IO.unix_abstract_udp_genaddr(ROCKER_SERVER_UAU_ADDR, &peeraddr, &peeraddr_len));
+    ROCKER_ERR_checker___(ROCKER_ERR_gen_local_addr_failed, IO.unix_abstract_udp_new_autobound(&fd));
+    ROCKER_ERR_checker___(ROCKER_ERR_send_req_failed, IO.send_normal(fd, &vec, 1, &peeraddr, peeraddr_len));
+
+    vec.iov_base = &status;
+    vec.iov_len = sizeof(status);
+    ROCKER_ERR_checker___(ROCKER_ERR_recv_resp_failed, IO.fte_init(&fte, nil, 1, &vec, 1));
+    ROCKER_ERR_checker___(ROCKER_ERR_recv_resp_failed, IO.recv_msg(fd, &fte.msg, &n));
+
+    fte.cmsg = CMSG_FIRSTHDR(&fte.msg);
+    if (nil != fte.cmsg && SOL_SOCKET == fte.cmsg->cmsg_level && SCM_RIGHTS == fte.cmsg->cmsg_type
+            && CMSG_LEN(sizeof(i___)) <= fte.cmsg->cmsg_len) {
+        memcpy(&page_fd, CMSG_DATA(fte.cmsg), sizeof(i___));
+    }
+
+    // 非 root 的连接, 或服务端不支持 memfd
+    if ((ssize_t)sizeof(status) > n || 0 != status || 0 > page_fd) {
+        jr.err_no = ROCKER_ERR_recv_resp_failed;
+        goto end;
+    }
+
+    // 先映射页头, 校验之后再按实际长度映射
+    if (0 > fstat(page_fd, &st) || (off_t)sizeof(RockerStatsHdr) > st.st_size) {
+        ROCKER_ERR_checker___(ROCKER_ERR_recv_resp_failed, err_new___(-1, "invalid stats page", nil));
+    }
+
+    RockerStatsHdr *hdr = mmap(nil, sizeof(RockerStatsHdr), PROT_READ, MAP_SHARED, page_fd, 0);
+    if (MAP_FAILED == hdr) {
         ROCKER_ERR_checker___(ROCKER_ERR_sys, err_new_sys___());
     }
 
-    if (sizeof(RockerResult) != read(read_fd, &jr, sizeof(RockerResult))) {
+    size_t len = stats_page_len(hdr);
+    bool___ valid = ROCKER_STATS_MAGIC == hdr->magic
+        && sizeof(RockerStatsGuard) == hdr->slot_siz
+        && (off_t)len <= st.st_size;
+    munmap(hdr, sizeof(RockerStatsHdr));
+    if (!valid) {
+        ROCKER_ERR_checker___(ROCKER_ERR_recv_resp_failed, err_new___(-1, "invalid stats page", nil));
+    }
+
+    void *p = mmap(nil, len, PROT_READ, MAP_SHARED, page_fd, 0);
+    if (MAP_FAILED == p) {
         ROCKER_ERR_checker___(ROCKER_ERR_sys, err_new_sys___());
     }
+    *page = p;
 
 end:
+    IO_drop_fd(&page_fd);
+    IO_drop_fd(&fd);
     return jr;
 }
 
+//! 解除状态页的映射
+//-
+//@ page[in]: 由 ROCKER_stats_map 取得的状态页
+pub___ void
+ROCKER_stats_unmap(const RockerStatsPage *page) {
+    if (nil != page) {
+        munmap((void *)page, stats_page_len(&page->hdr));
+    }
+}
+
+//! 逐项读取页头
+//-
+//@ page[in]: 由 ROCKER_stats_map 取得的状态页
+//@ out[out]: 页头的副本
+pub___ void
+ROCKER_stats_read_hdr(const RockerStatsPage *page, RockerStatsHdr *out) {
+    const unsigned long long *src = (const unsigned long long *)&page->hdr;
+    unsigned long long *dst = (unsigned long long *)out;
+
+    for (size_t i = 0; i < sizeof(RockerStatsHdr) / sizeof(unsigned long long); ++i) {
+        dst[i] = __atomic_load_n(src + i, __ATOMIC_RELAXED);
+    }
+}
+
+//! 以 seqlock 的方式读取 guard 记录: 序号为偶数, 且读取前后未发生变化时, 副本是一致的
+//-
+//@ page[in]: 由 ROCKER_stats_map 取得的状态页
+//@ idx[in]: 记录的下标
+//@ out[out]: 记录的副本
+pub___ int
+ROCKER_stats_read_guard(const RockerStatsPage *page, size_t idx, RockerStatsGuard *out) {
+    if (page->hdr.slot_num <= idx) {
+        return 0;
+    }
+
+    const unsigned long long *src = (const unsigned long long *)(page->guards + idx);
+    unsigned long long *dst = (unsigned long long *)out;
+
+    for (i___ retry = 0; retry < ROCKER_STATS_RETRY___; ++retry) {
+        unsigned long long seq = __atomic_load_n(src, __ATOMIC_ACQUIRE);
+        if (1 == (seq & 1)) {
+            continue;
+        }
+
+        dst[0] = seq;
+        for (size_t i = 1; i < sizeof(RockerStatsGuard) / sizeof(unsigned long long); ++i) {
+            dst[i] = __atomic_load_n(src + i, __ATOMIC_RELAXED);
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (seq == __atomic_load_n(src, __ATOMIC_RELAXED)) {
+            return 0 == out->pid ? 0 : 1;
+        }
+    }
+
+    return -1;
+}
+
 //! 获取指定进程的名称, 取自'/proc/<PID>/stat'
 //! 客户端给guard进程发信号之前, 需要与创建rocker时返回的原始名称进行对比,
 //! 确认PID没有被重用, 以避免误操作
@@ -204,12 +1232,26 @@ ROCKER_request_new() {
         .app_exec_dir = NULL,
         .app_data_dir = NULL,
         .app_overlay_dirs = { NULL },
+        .app_overlay_dirs_more = NULL,
+        .memory_max = 0,
+        .memory_high = 0,
+        .cpu_max_us = 0,
+        .cpu_period_us = 0,
+        .cpu_weight = 0,
+        .pids_max = 0,
+        .io_max = NULL,
     };
 
     return req;
 }
 
-#undef strlen___
-#undef ROCKER_reqreal_vec_len___
-#undef ROCKER_reqreal_meta_len___
+#undef ROCKER_STATS_RETRY___
+#undef ROCKER_STATS_MAP_MAGIC___
+#undef ROCKER_TRACE_SRV_SIZ___
+#undef ROCKER_TRACE_SRV_CNT___
+#undef ROCKER_SERVER_SEQ_ADDR___
+#undef ROCKER_BATCH_ITEM_SIZ___
+#undef ROCKER_BATCH_MAGIC___
+#undef ROCKER_REQ_SIZ_MAX___
+#undef ROCKER_REQ_V2_MAGIC___
 #undef ROCKER_ERR_checker___
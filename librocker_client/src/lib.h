@@ -30,7 +30,17 @@ typedef struct {
 //@ app_pkg_path: App 源文件的路径, 如 /apps/xx.squashfs
 //@ app_exec_dir: App 的执行路径, 即 app_pkg_path 的挂载路径
 //@ app_data_dir: App 写出的所有数据的存储位置(最上层路径)
-//@ app_overlay_dirs[16]: 需要为 App 做 overlay 层的顶层目录, 如 /var 等, 最多 16 个
+//@ app_overlay_dirs[16]: 需要为 App 做 overlay 层的顶层目录, 如 /var 等
+//@ app_overlay_dirs_more: 超出 16 个的 overlay 目录, 以 NULL 结尾的数组, 不需要时置为 NULL
+//@ memory_max: cgroup memory.max, 单位: 字节, 为 0 时不限制
+//@ memory_high: cgroup memory.high, 单位: 字节, 为 0 时不限制
+//@ cpu_max_us: cgroup cpu.max 中每个周期内可用的 CPU 时间, 单位: 微秒, 为 0 时不限制
+//@ cpu_period_us: cgroup cpu.max 中的周期, 单位: 微秒, 为 0 时取 100000
+//@ cpu_weight: cgroup cpu.weight, 取值 1..10000, 为 0 时使用默认值
+//@ pids_max: cgroup pids.max, 为 0 时不限制
+//@ io_max: cgroup io.max, 如 "8:0 rbps=1048576 wiops=120", 多个设备以 '\n' 分隔, 为 NULL 时不限制
+//@
+//@ 设置任一资源限制时, 服务端为新 rocker 创建独立的 cgroup, app 进程同样创建于其中
 typedef struct {
     int app_id;
     int uid;
@@ -40,10 +50,48 @@ typedef struct {
     char *app_exec_dir;
     char *app_data_dir;
     char *app_overlay_dirs[16];
+    char **app_overlay_dirs_more;
+
+    unsigned long long memory_max;
+    unsigned long long memory_high;
+    unsigned int cpu_max_us;
+    unsigned int cpu_period_us;
+    unsigned int cpu_weight;
+    unsigned int pids_max;
+    char *io_max;
 } RockerRequest;
 
+//! 单次批量请求可包含的最大 rocker 数量
+#define ROCKER_BATCH_MAX 32
+
+//! 启动过程中的各阶段, 用作 RockerTrace.ns 的下标.
+//! 服务端阶段(loop_attach 至 idmap)由服务端计时, 随应答一并返回,
+//! 均包含于 wait_resp 之中; 未经历的阶段(如 App 包已被挂载, 或认领了预热池中的 JG)为 0
+typedef enum {
+    ROCKER_STAGE_send_req = 0,   /*编码并发送请求*/
+    ROCKER_STAGE_loop_attach,    /*服务端: 将 App 包绑定到 loop 设备*/
+    ROCKER_STAGE_squashfs_mount, /*服务端: 将 loop 设备挂载为 squashfs*/
+    ROCKER_STAGE_guard_clone,    /*服务端: clone 出 rocker 内的 1 号进程*/
+    ROCKER_STAGE_overlay_mount,  /*服务端: App 包的 bind 挂载及各目录的 overlay 挂载*/
+    ROCKER_STAGE_idmap,          /*服务端: 写入 uid/gid 映射*/
+    ROCKER_STAGE_wait_resp,      /*请求发出至收到应答*/
+    ROCKER_STAGE_enter_ns,       /*进入 rocker 的 mnt/pid namespace*/
+    ROCKER_STAGE_app_exec,       /*创建 app 进程并进入 user namespace, 至 app 开始执行*/
+    ROCKER_STAGE_MAX,
+} ROCKER_STAGE;
+
+//! 一次启动过程中各阶段的耗时, 单位: 纳秒
+typedef struct {
+    unsigned long long ns[ROCKER_STAGE_MAX];
+} RockerTrace;
+
+//! 客户端会话, 持有一个已绑定的本地 socket 及已解析的服务端地址,
+//! 可被任意多次的 ROCKER_session_enter_rocker 调用重用, 多线程共享安全
+typedef struct RockerSession RockerSession;
+
 //! 请求创建新rocker, 并在其中运行指定函数的API.
 //! 返回RockerResult结构体(NOTE: 不是指针)
+//! app 运行于调用方 fork 出的子进程中, pthread_atfork 注册的回调均被执行
 //-
 //@ req[in]: 创建新rocker所需的配置数据
 //@ app[in]: rocker创建成功后, 需要在其中执行的函数
@@ -52,6 +100,192 @@ RockerResult
 ROCKER_enter_rocker(RockerRequest *req, int (*app) (void *), void *app_args)
 __attribute__ ((visibility("default")));
 
+//! 与 ROCKER_enter_rocker 相同, 同时记录启动过程中各阶段的耗时, 用于性能分析
+//-
+//@ req[in]: 创建新rocker所需的配置数据
+//@ app[in]: rocker创建成功后, 需要在其中执行的函数
+//@ app_args[in]: 传递给app函数的参数
+//@ trace[out]: 各阶段的耗时, 出错时只有已完成的阶段有效
+RockerResult
+ROCKER_enter_rocker_traced(RockerRequest *req, int (*app) (void *), void *app_args, RockerTrace *trace)
+__attribute__ ((visibility("default")));
+
+//! 打开一个可重用的客户端会话, 避免每次启动 rocker 时重复创建及绑定 socket
+//-
+//@ session[out]: 新创建的会话, 使用完毕后须调用 ROCKER_session_close 释放
+RockerResult
+ROCKER_session_open(RockerSession **session)
+__attribute__ ((visibility("default")));
+
+//! 关闭会话, 释放其持有的 socket 等资源, 传入 NULL 时不做任何操作
+//-
+//@ session[in]: 由 ROCKER_session_open 创建的会话
+void
+ROCKER_session_close(RockerSession *session)
+__attribute__ ((visibility("default")));
+
+//! 与 ROCKER_enter_rocker 相同, 但复用指定会话的 socket 与服务端地址
+//-
+//@ session[in]: 由 ROCKER_session_open 创建的会话
+//@ req[in]: 创建新rocker所需的配置数据
+//@ app[in]: rocker创建成功后, 需要在其中执行的函数
+//@ app_args[in]: 传递给app函数的参数
+RockerResult
+ROCKER_session_enter_rocker(RockerSession *session,
+        RockerRequest *req, int (*app) (void *), void *app_args)
+__attribute__ ((visibility("default")));
+
+//! 批量创建 rocker, 所有请求在一次 client/server 交互中完成,
+//! 之后依次进入各 rocker 运行对应的 app.
+//! 返回值仅表示批量交互本身是否成功, 各 rocker 的结果存放于 results 中
+//-
+//@ reqs[in]: 创建各 rocker 所需的配置数据, 最多 ROCKER_BATCH_MAX 个
+//@ n[in]: reqs 中的请求数量
+//@ apps[in]: 与 reqs 一一对应, 各 rocker 中需要执行的函数
+//@ app_args[in]: 与 reqs 一一对应, 传递给各 app 函数的参数, 可以为 NULL
+//@ results[out]: 与 reqs 一一对应, 各 rocker 的创建结果
+RockerResult
+ROCKER_enter_rocker_batch(RockerRequest *reqs, size_t n,
+        int (*apps[]) (void *), void *app_args[], RockerResult results[])
+__attribute__ ((visibility("default")));
+
+//! 与 ROCKER_enter_rocker_batch 相同, 但复用指定会话的 socket 与服务端地址
+RockerResult
+ROCKER_session_enter_rocker_batch(RockerSession *session, RockerRequest *reqs, size_t n,
+        int (*apps[]) (void *), void *app_args[], RockerResult results[])
+__attribute__ ((visibility("default")));
+
+//! 异步启动的句柄, 由 ROCKER_enter_rocker_async 创建
+typedef struct RockerAsync RockerAsync;
+
+//! 与 ROCKER_enter_rocker 相同, 但发出请求后立即返回, 不等待服务端的应答,
+//! 单个线程可借助 poll/epoll 同时驱动任意多个启动过程
+//-
+//@ req[in]: 创建新rocker所需的配置数据
+//@ app[in]: rocker创建成功后, 需要在其中执行的函数
+//@ app_args[in]: 传递给app函数的参数
+//@ handle[out]: 异步启动的句柄, 须由 ROCKER_complete 或 ROCKER_cancel 释放
+RockerResult
+ROCKER_enter_rocker_async(RockerRequest *req, int (*app) (void *), void *app_args, RockerAsync **handle)
+__attribute__ ((visibility("default")));
+
+//! 返回句柄的描述符, 服务端的应答到达时变为可读(POLLIN/EPOLLIN).
+//! 该描述符归句柄所有, 调用方不得读取或关闭
+//-
+//@ handle[in]: 由 ROCKER_enter_rocker_async 创建的句柄
+int
+ROCKER_async_fd(RockerAsync *handle)
+__attribute__ ((visibility("default")));
+
+//! 接收应答并进入新 rocker 运行 app, 返回最终结果, 之后句柄被释放.
+//! 应在句柄的描述符可读之后调用, 否则至多等待 3 秒
+//-
+//@ handle[in]: 由 ROCKER_enter_rocker_async 创建的句柄
+RockerResult
+ROCKER_complete(RockerAsync *handle)
+__attribute__ ((visibility("default")));
+
+//! 放弃尚未完成的异步启动并释放句柄, 传入 NULL 时不做任何操作
+//-
+//@ handle[in]: 由 ROCKER_enter_rocker_async 创建的句柄
+void
+ROCKER_cancel(RockerAsync *handle)
+__attribute__ ((visibility("default")));
+
+//! 共享内存状态页的标识, 即 "RKSTATS1"
+#define ROCKER_STATS_MAGIC 0x524b535441545331ULL
+
+//! RockerStatsGuard.flags 中的位: guard 已被激活, 预热池中尚未被认领的 guard 不含此位
+#define ROCKER_STATS_GUARD_activated 0x1ULL
+
+//! 共享内存状态页的页头, 由 rocker_server 维护, 布局与服务端保持一致;
+//! 各计数器由服务端以原子操作各自更新, 应经 ROCKER_stats_read_hdr 读取
+//-
+//@ magic: 固定为 ROCKER_STATS_MAGIC
+//@ version: 布局的版本号
+//@ slot_num: guards 中的记录数量
+//@ slot_siz: 单个记录的长度
+//@ launched: 创建成功的 rocker 数量
+//@ failed: 创建失败的 rocker 数量
+//@ rejected: 格式错误或校验失败的请求数量
+//@ reaped: 已回收并释放资源的 guard 数量
+//@ live: 当前存活的 guard 数量, 含预热池中尚未被认领的部分
+//@ overflow: 存活但未能记入 guards 的 guard 数量
+typedef struct {
+    unsigned long long magic;
+    unsigned long long version;
+    unsigned long long slot_num;
+    unsigned long long slot_siz;
+    unsigned long long launched;
+    unsigned long long failed;
+    unsigned long long rejected;
+    unsigned long long reaped;
+    unsigned long long live;
+    unsigned long long overflow;
+    unsigned long long reserved[6];
+} RockerStatsHdr;
+
+//! 状态页中一个 guard 的记录, 服务端随时可能改写, 应经 ROCKER_stats_read_guard 读取
+//-
+//@ seq: 记录的序号, 为奇数时服务端正在写入
+//@ pid: guard_pid, 为 0 表示空闲
+//@ app_id: APP uuid
+//@ uid: App 进程的 euid
+//@ gid: App 进程的 egid, 使用默认值时为 ~0ULL
+//@ loop_id: App 包绑定的 loop 设备编号, 不存在时为 ~0ULL
+//@ born_ns: guard 的创建时刻, 取自 CLOCK_MONOTONIC, 单位: 纳秒
+//@ flags: ROCKER_STATS_GUARD_* 的组合
+typedef struct {
+    unsigned long long seq;
+    unsigned long long pid;
+    unsigned long long app_id;
+    unsigned long long uid;
+    unsigned long long gid;
+    unsigned long long loop_id;
+    unsigned long long born_ns;
+    unsigned long long flags;
+} RockerStatsGuard;
+
+//! 只读映射的共享内存状态页
+typedef struct {
+    RockerStatsHdr hdr;
+    RockerStatsGuard guards[];
+} RockerStatsPage;
+
+//! 映射 rocker_server 的共享内存状态页, 只需与服务端交互一次,
+//! 此后读取各项计数及 guard 记录均不涉及任何系统调用
+//-
+//@ page[out]: 只读的状态页, 使用完毕后须调用 ROCKER_stats_unmap 释放
+RockerResult
+ROCKER_stats_map(const RockerStatsPage **page)
+__attribute__ ((visibility("default")));
+
+//! 解除状态页的映射, 传入 NULL 时不做任何操作
+//-
+//@ page[in]: 由 ROCKER_stats_map 取得的状态页
+void
+ROCKER_stats_unmap(const RockerStatsPage *page)
+__attribute__ ((visibility("default")));
+
+//! 读取页头中的各项计数; 各计数器相互独立, 不保证彼此之间的一致性
+//-
+//@ page[in]: 由 ROCKER_stats_map 取得的状态页
+//@ out[out]: 页头的副本
+void
+ROCKER_stats_read_hdr(const RockerStatsPage *page, RockerStatsHdr *out)
+__attribute__ ((visibility("default")));
+
+//! 读取第 idx 个 guard 记录的一致副本
+//-
+//@ page[in]: 由 ROCKER_stats_map 取得的状态页
+//@ idx[in]: 记录的下标, 小于 page->hdr.slot_num
+//@ out[out]: 记录的副本
+//@ return: 1 表示记录有效; 0 表示记录空闲或 idx 越界;
+//@     -1 表示服务端持续改写该记录, 多次重试仍未取得一致的副本, 稍后重试即可
+int
+ROCKER_stats_read_guard(const RockerStatsPage *page, size_t idx, RockerStatsGuard *out)
+__attribute__ ((visibility("default")));
+
 //! 获取指定进程的名称, 取自'/proc/<PID>/stat'
 //! 客户端给guard进程发信号之前, 需要与创建rocker时返回的原始名称进行对比,
 //! 确认PID没有被重用, 以避免误操作
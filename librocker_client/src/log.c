@@ -6,17 +6,67 @@
 
 #include <time.h>
 #include <pthread.h>
+#include <sched.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdarg.h>
 
 #define DEBUG_TUPLE___    const char *const dbg_file, i___ dbg_line, const char *const dbg_func
 #define DEBUG_INFO___     __FILE__, __LINE__, __func__
 
+//! 每个线程的日志缓冲区大小, 单条日志超出时被截断
+#define LOG_BUF_SIZ___ (16 * 1024)
+
+//! 缓冲区中的数据最多保留的时长(秒), 超时后由下一条日志触发写出
+#define LOG_FLUSH_SECS___ 1
+
+//! 日志级别, 由环境变量 ROCKER_LOG_LEVEL(info/error/fatal) 指定, 低于此级别的日志被丢弃
+enum {
+    LOG_LEVEL_info = 0,
+    LOG_LEVEL_error,
+    LOG_LEVEL_fatal,
+};
+
+//! 线程私有的日志缓冲区.
+//! 日志先写入所属线程的缓冲区, 写出时只需一次 write, 线程之间无需加锁;
+//! 缓冲区在线程退出后被标记为空闲, 由新线程复用, 永不释放,
+//! 进程退出时据 LogBufs 链表写出所有缓冲区中的残留数据
+//-
+//@ next: LogBufs 链表中的下一项
+//@ used: 是否已被某个线程占用
+//@ busy: 所属线程正在写入, 或进程退出时正在被写出
+//@ pid: 写入数据的进程, fork 产生的子进程不应重复写出父进程的数据
+//@ born: 缓冲区中最早一条数据的时间(秒)
+//@ ts_sec/ts: 缓存的时间戳及其格式化结果, 每秒至多调用一次 localtime_r
+//@ ns_pid/ns: 缓存的 pid namespace 名称, 进程变化时重新读取
+struct LogBuf {
+    struct LogBuf *next;
+    bool___ used;
+    bool___ busy;
+
+    pid_t pid;
+    time_t born;
+    size_t len;
+    char data[LOG_BUF_SIZ___];
+
+    time_t ts_sec;
+    char ts[80];
+
+    pid_t ns_pid;
+    char ns[64];
+};
+
 static i___ LogFd;
+static i___ LogLevel = LOG_LEVEL_info;
 static ui___ LogCnter = 1;
 static ui___ MaxLogPerFile = 10000;
-static pthread_mutex_t LogLk = PTHREAD_MUTEX_INITIALIZER;
 
+static struct LogBuf *LogBufs = nil;
+static __thread struct LogBuf *ThreadBuf = nil;
+static pthread_key_t LogBufKey;
+
+static Error * new_err(int code, const char *desc, Error *cause,
+        const char *const dbg_file, i___ dbg_line, const char *const dbg_func);
 static void print_time(i___ fd);
 static void info(const char *msg,
         const char *const dbg_file, i___ dbg_line, const char *const dbg_func);
@@ -28,6 +78,7 @@ static void clean_errchain(Error *e);
 
 //! Public Interfaces
 struct Log Log = {
+    .new_err = new_err,
     .print_time = print_time,
     .info = info,
     .fatal = fatal,
@@ -38,6 +89,7 @@ struct Log Log = {
 //! 若调用方未设置环境变量 ROCKER_LOG_ROOT_DIR,
 //! 则直接使用 stderr
 //! 日志文件命名格式: librocker_client_log_pid [年-月-日 小时:分钟:秒]
+//! 同一秒内重名时, 追加 ".序号" 后缀, 不再等待
 static i___
 open_logfd(void) {
     char *logdir;
@@ -48,77 +100,367 @@ open_logfd(void) {
     char path[256 + strlen(logdir)];
 
     time_t ts = time(nil);
-    struct tm *now = localtime(&ts);
-    sprintf(path, "%s/librocker_client_log_%d [%d-%d-%d %d:%d:%d]", logdir,
+    struct tm now;
+    localtime_r(&ts, &now);
+    i___ n = sprintf(path, "%s/librocker_client_log_%d [%d-%d-%d %d:%d:%d]", logdir,
             getpid(),
-            now->tm_year + 1900,
-            now->tm_mon + 1, /* Month (0-11) */
-            now->tm_mday,
-            now->tm_hour,
-            now->tm_min,
-            now->tm_sec);
+            now.tm_year + 1900,
+            now.tm_mon + 1, /* Month (0-11) */
+            now.tm_mday,
+            now.tm_hour,
+            now.tm_min,
+            now.tm_sec);
+
+    i___ fd = -1;
+    for (i___ i = 1; i < 100; ++i) {
+        if (0 <= (fd = open(path, O_WRONLY|O_CREAT|O_EXCL|O_APPEND|O_CLOEXEC, 0600)) || EEXIST != errno) {
+            break;
+        }
+        sprintf(path + n, ".%d", i);
+    }
+
+    return fd;
+}
+
+//! 日志级别的默认值为 info, 即输出全部日志
+INNER___ static void
+loglevel_init(void) {
+    char *level = getenv("ROCKER_LOG_LEVEL");
+    if (nil == level) {
+        return;
+    }
 
-    return open(path, O_WRONLY|O_CREAT|O_EXCL, 0600);
+    if (0 == strcmp("error", level)) {
+        LogLevel = LOG_LEVEL_error;
+    } else if (0 == strcmp("fatal", level)) {
+        LogLevel = LOG_LEVEL_fatal;
+    }
 }
 
-//! 失败时重试一次, 防止日志文件重名的问题
+INNER___ static void logbuf_release(void *buf);
+
 init___ static void
 logfd_init(void) {
     if (0 > (LogFd = open_logfd())) {
-        sleep(1);
-        if (0 > (LogFd = open_logfd())) {
-            print_time(STDERR_FILENO);
-            fprintf(stderr, "[%s:%d <%s>]\n%s", DEBUG_INFO___, strerror(LogFd));
-            exit(255);
+        print_time(STDERR_FILENO);
+        fprintf(stderr, "[%s:%d <%s>]\n%s", DEBUG_INFO___, strerror(errno));
+        exit(255);
+    }
+
+    loglevel_init();
+    pthread_key_create(&LogBufKey, logbuf_release);
+}
+
+//! 每个日志文件, 最多存储约 MaxLogPerFile 条日志.
+//! 新文件经由 dup2 原子地替换 LogFd 所指向的文件, 其它线程无需感知
+INNER___ static void
+logrotate(void) {
+    if (STDERR_FILENO == LogFd
+            || 0 != __atomic_add_fetch(&LogCnter, 1, __ATOMIC_RELAXED) % MaxLogPerFile) {
+        return;
+    }
+
+    i___ fd = open_logfd();
+    if (0 <= fd) {
+        dup3(fd, LogFd, O_CLOEXEC);
+        close(fd);
+    }
+}
+
+//! 将缓冲区中的数据一次性写出, 调用方须持有 busy 标记
+INNER___ static void
+logbuf_flush(struct LogBuf *b) {
+    size_t off = 0;
+    ssize_t n = 0;
+
+    // fork 之后的子进程持有父进程缓冲区的副本, 丢弃之
+    if (b->pid == getpid()) {
+        while (off < b->len) {
+            if (0 > (n = write(LogFd, b->data + off, b->len - off))) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                break;
+            }
+            off += n;
         }
     }
+
+    b->len = 0;
 }
 
-//! 进程退出之前, 自动关闭日志文件
+//! 取得当前线程的缓冲区, 并标记为 busy.
+//! 优先复用已退出线程的缓冲区; 取不到时新建, 以无锁方式插入 LogBufs 链表
+INNER___ static struct LogBuf *
+logbuf_acquire(void) {
+    struct LogBuf *b = ThreadBuf;
+
+    if (nil == b) {
+        for (b = __atomic_load_n(&LogBufs, __ATOMIC_ACQUIRE); nil != b; b = b->next) {
+            bool___ expected = false___;
+            if (__atomic_compare_exchange_n(&b->used, &expected, true___,
+                        0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+
+        if (nil == b) {
+            if (nil == (b = calloc(1, sizeof(struct LogBuf)))) {
+                return nil;
+            }
+            b->used = true___;
+            b->next = __atomic_load_n(&LogBufs, __ATOMIC_RELAXED);
+            while (!__atomic_compare_exchange_n(&LogBufs, &b->next, b,
+                        0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            }
+        }
+
+        ThreadBuf = b;
+        pthread_setspecific(LogBufKey, b);
+    }
+
+    // 只有进程退出时的写出操作会与所属线程竞争
+    while (__atomic_exchange_n(&b->busy, true___, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+
+    if (b->pid != getpid()) {
+        b->pid = getpid();
+        b->len = 0;
+    }
+
+    return b;
+}
+
+INNER___ static void
+logbuf_drop(struct LogBuf *b) {
+    __atomic_store_n(&b->busy, false___, __ATOMIC_RELEASE);
+}
+
+//! 线程退出时写出其残留的数据, 并将缓冲区交还给 LogBufs
+INNER___ static void
+logbuf_release(void *buf) {
+    struct LogBuf *b = buf;
+
+    while (__atomic_exchange_n(&b->busy, true___, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+    logbuf_flush(b);
+    logbuf_drop(b);
+
+    ThreadBuf = nil;
+    __atomic_store_n(&b->used, false___, __ATOMIC_RELEASE);
+}
+
+//! 进程退出之前, 写出所有缓冲区中的残留数据, 并关闭日志文件;
+//! 正在写入的缓冲区被跳过, 不等待其所属线程
 final___ static void
 logfd_destroy(void) {
-    close(LogFd);
-}
+    for (struct LogBuf *b = __atomic_load_n(&LogBufs, __ATOMIC_ACQUIRE); nil != b; b = b->next) {
+        if (!__atomic_exchange_n(&b->busy, true___, __ATOMIC_ACQUIRE)) {
+            logbuf_flush(b);
+            logbuf_drop(b);
+        }
+    }
 
-//! 调用方必须确保: 在此之前, 已取得 LogLk 锁
-//! 每个日志文件, 最多存储 MaxLogPerFile 条日志
-static void
-logrotate() {
-    if (0 == LogCnter % MaxLogPerFile) {
+    if (STDERR_FILENO != LogFd) {
         close(LogFd);
-        logfd_init();
-        LogCnter = 1;
     }
 }
 
+//! 以 printf 的格式追加到缓冲区, 空间不足时先写出已有的数据
+INNER___ static void
+logbuf_printf(struct LogBuf *b, const char *fmt, ...) {
+    va_list ap;
+    size_t room;
+    i___ n;
+
+    for (i___ i = 0; i < 2; ++i) {
+        room = LOG_BUF_SIZ___ - b->len;
+
+        va_start(ap, fmt);
+        n = vsnprintf(b->data + b->len, room, fmt, ap);
+        va_end(ap);
+
+        if (0 > n) {
+            return;
+        }
+
+        if ((size_t)n < room) {
+            b->len += n;
+            return;
+        }
+
+        if (0 == b->len) {
+            break;
+        }
+
+        // 超出剩余空间: 丢弃本次写入的部分, 写出之后重试
+        logbuf_flush(b);
+    }
+
+    // 单条日志超出整个缓冲区, 截断
+    b->len = LOG_BUF_SIZ___ - 1;
+}
+
+//! 当前时间的格式化结果, 缓存于线程的缓冲区中, 每秒更新一次;
+//! CLOCK_REALTIME_COARSE 经由 vDSO 读取, 不产生系统调用
+INNER___ static const char *
+logbuf_time(struct LogBuf *b, time_t *sec) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    *sec = ts.tv_sec;
+
+    if (ts.tv_sec != b->ts_sec || '\0' == b->ts[0]) {
+        struct tm now;
+        localtime_r(&ts.tv_sec, &now);
+        snprintf(b->ts, sizeof(b->ts), "[ %d-%d-%d %d:%d:%d ]",
+                now.tm_year + 1900,
+                now.tm_mon + 1, /* Month (0-11) */
+                now.tm_mday,
+                now.tm_hour,
+                now.tm_min,
+                now.tm_sec);
+        b->ts_sec = ts.tv_sec;
+    }
+
+    return b->ts;
+}
+
+//! 追加一条日志的首行, 即时间戳
+INNER___ static void
+logbuf_begin(struct LogBuf *b) {
+    time_t sec;
+    const char *ts = logbuf_time(b, &sec);
+
+    if (0 == b->len) {
+        b->born = sec;
+    }
+
+    logbuf_printf(b, "\n%s\n", ts);
+}
+
+//! 一条日志追加完毕; 数据积压过多, 积压过久或日志级别较高时立即写出
+INNER___ static void
+logbuf_end(struct LogBuf *b, i___ level) {
+    logrotate();
+
+    if (LOG_LEVEL_info < level
+            || LOG_BUF_SIZ___ / 2 < b->len
+            || LOG_FLUSH_SECS___ <= b->ts_sec - b->born) {
+        logbuf_flush(b);
+    }
+
+    logbuf_drop(b);
+}
+
 //! 打印当前时间到指定的 fd
 //@ fd[in]: 信息将被输出到此 fd 中
 static void
 print_time(i___ fd) {
     time_t ts = time(nil);
-    struct tm *now = localtime(&ts);
+    struct tm now;
+    localtime_r(&ts, &now);
     dprintf(fd, "\n[ %d-%d-%d %d:%d:%d ]\n",
-            now->tm_year + 1900,
-            now->tm_mon + 1, /* Month (0-11) */\
-            now->tm_mday,
-            now->tm_hour,
-            now->tm_min,
-            now->tm_sec);
+            now.tm_year + 1900,
+            now.tm_mon + 1, /* Month (0-11) */\
+            now.tm_mday,
+            now.tm_hour,
+            now.tm_min,
+            now.tm_sec);
 }
 
+//! 线程私有的 Error 节点池, 分配与释放均无锁且不使用堆内存.
+//! 节点可由其它线程释放, 故 used 以原子操作更新
+//-
+//@ used: 各节点是否已被占用的位图
+//@ nodes: 节点本身
+struct ErrArena {
+    u64___ used;
+    Error nodes[64];
+};
+
+static __thread struct ErrArena ErrArena;
+
+//! arena 耗尽且没有可依附的下层节点时返回此节点, 其为静态节点, 无需释放
+static __thread Error ErrArenaFull = {
+    .code = EARENA_FULL___,
+    .desc = EARENA_FULL_DESC___,
+    .cause = nil,
+    .file = __FILE__,
+    .line = __LINE__,
+    .func = "new_err",
+    .truncated = 0,
+    .arena = nil,
+};
+
+//! 从当前线程的 arena 中取一个节点.
+//! arena 耗尽时不中止进程: 有下层节点(cause)时丢弃本层并在下层记录丢弃的数量,
+//! 否则返回静态的 ErrArenaFull 节点
+//-
+//@ code[in]: 错误码
+//@ desc[in]: 错误描述, 不会被复制
+//@ cause[in]: 下层节点, 可以为 nil
+//@ {dbg_file, dbg_line, dbg_func}[in]: DEBUG 信息
+static Error *
+new_err(int code, const char *desc, Error *cause, DEBUG_TUPLE___) {
+    struct ErrArena *a = &ErrArena;
+    u64___ used = __atomic_load_n(&a->used, __ATOMIC_ACQUIRE);
+
+    if (unlikely___(UINT64_MAX == used)) {
+        if (nil == cause) {
+            return &ErrArenaFull;
+        }
+        ++cause->truncated;
+        return cause;
+    }
+
+    // 只有所属线程会占用节点, 其它线程至多释放节点, 因此空闲的位不会被抢占
+    i___ idx = __builtin_ctzll(~used);
+    __atomic_fetch_or(&a->used, (u64___)1 << idx, __ATOMIC_ACQ_REL);
+
+    Error *e = &a->nodes[idx];
+    e->code = code;
+    e->desc = desc;
+    e->cause = cause;
+    e->file = dbg_file;
+    e->line = dbg_line;
+    e->func = dbg_func;
+    e->truncated = 0;
+    e->arena = a;
+
+    return e;
+}
+
+//! 将节点交还给其所属的 arena, 静态节点不做任何操作
+INNER___ static void
+err_free(Error *e) {
+    struct ErrArena *a = e->arena;
+    if (nil == a) {
+        e->truncated = 0;
+        return;
+    }
+
+    __atomic_fetch_and(&a->used, ~((u64___)1 << (e - a->nodes)), __ATOMIC_ACQ_REL);
+}
+
+//@ level[in]: 日志级别
 //@ prefix[in]: 信息类别标识, 以及对应的颜色设置
 //@ msg[in]: 信息正文
 //@ {dbg_file, dbg_line, dbg_func}[in]: DEBUG 信息
 static void
-do_info(const char *const prefix, const char *const msg, DEBUG_TUPLE___) {
-    pthread_mutex_lock(&LogLk);
+do_info(i___ level, const char *const prefix, const char *const msg, DEBUG_TUPLE___) {
+    if (level < LogLevel) {
+        return;
+    }
 
-    if (STDERR_FILENO != LogFd) {
-        logrotate();
+    struct LogBuf *b = logbuf_acquire();
+    if (nil == b) {
+        return;
     }
 
-    print_time(LogFd);
-    dprintf(LogFd, "%s %s\n"
+    logbuf_begin(b);
+    logbuf_printf(b, "%s %s\n"
             "   ├── file: %s\n"
             "   ├── line: %d\n"
             "   └── func: %s\n",
@@ -127,51 +469,60 @@ do_info(const char *const prefix, const char *const msg, DEBUG_TUPLE___) {
             dbg_file,
             dbg_line,
             dbg_func);
-
-    LogCnter += 1;
-    pthread_mutex_unlock(&LogLk);
+    logbuf_end(b, level);
 }
 
 //@ msg[in]: 信息正文
 //@ {dbg_file, dbg_line, dbg_func}[in]: DEBUG 信息
 static void
 info(const char *const msg, DEBUG_TUPLE___) {
-    do_info("\x1b[01mINFO:\x1b[00m", msg, dbg_file, dbg_line, dbg_func);
+    do_info(LOG_LEVEL_info, "\x1b[01mINFO:\x1b[00m", msg, dbg_file, dbg_line, dbg_func);
 }
 
 //@ msg[in]: 信息正文
 //@ {dbg_file, dbg_line, dbg_func}[in]: DEBUG 信息
 static void
 fatal(const char *msg, DEBUG_TUPLE___) {
-    do_info("\x1b[31;01mFATAL:\x1b[00m", msg, dbg_file, dbg_line, dbg_func);
+    do_info(LOG_LEVEL_fatal, "\x1b[31;01mFATAL:\x1b[00m", msg, dbg_file, dbg_line, dbg_func);
     exit(255);
 }
 
+//! 当前进程所在的 pid namespace, 同一进程内只读取一次
+INNER___ static const char *
+logbuf_pidns(struct LogBuf *b) {
+    pid_t pid = getpid();
+
+    if (pid != b->ns_pid) {
+        char path[64] = {'\0'};
+        snprintf(path, sizeof(path), "/proc/%d/ns/pid", pid);
+
+        ssize_t n = readlink(path, b->ns, sizeof(b->ns) - 1);
+        b->ns[0 > n ? 0 : n] = '\0';
+        b->ns_pid = pid;
+    }
+
+    return b->ns;
+}
+
 //@ e[in]: 最上层的 errchain 指针
 //@ {dbg_file, dbg_line, dbg_func}[in]: DEBUG 信息
 static void
 display_errchain(Error *e, DEBUG_TUPLE___) {
-    time_t ts = time(nil);
-    struct tm *now = localtime(&ts);
-
-    char nsbuf[64] = {'\0'};
-    char nsbuf_[64] = {'\0'};
-    snprintf(nsbuf, 63, "/proc/%d/ns/pid", getpid());
-    readlink(nsbuf, nsbuf_, 63);
+    if (LOG_LEVEL_error < LogLevel) {
+        return;
+    }
 
-    pthread_mutex_lock(&LogLk);
+    struct LogBuf *b = logbuf_acquire();
+    if (nil == b) {
+        return;
+    }
 
-    dprintf(LogFd, "\n[ %d-%d-%d %d:%d:%d ]\n\x1b[31;01m** ERROR ** %s[%d]\x1b[00m\n"
+    logbuf_begin(b);
+    logbuf_printf(b, "\x1b[31;01m** ERROR ** %s[%d]\x1b[00m\n"
             "   ├── file: %s\n"
             "   ├── line: %d\n"
             "   └── func: %s\n",
-            now->tm_year + 1900,
-            now->tm_mon + 1, /* Month (0-11) */
-            now->tm_mday,
-            now->tm_hour,
-            now->tm_min,
-            now->tm_sec,
-            nsbuf_,
+            logbuf_pidns(b),
             getpid(),
             dbg_file,
             dbg_line,
@@ -182,7 +533,7 @@ display_errchain(Error *e, DEBUG_TUPLE___) {
             e->desc = "";
         }
 
-        dprintf(LogFd, "\x1b[01m   caused by: \x1b[00m%s (error code: %d)\n"
+        logbuf_printf(b, "\x1b[01m   caused by: \x1b[00m%s (error code: %d)\n"
             "   ├── file: %s\n"
             "   ├── line: %d\n"
             "   └── func: %s\n",
@@ -192,10 +543,14 @@ display_errchain(Error *e, DEBUG_TUPLE___) {
             e->line,
             e->func);
 
+        if (0 < e->truncated) {
+            logbuf_printf(b, "   ... %d frame(s) truncated, error arena exhausted\n", e->truncated);
+        }
+
         e = e->cause;
     };
 
-    pthread_mutex_unlock(&LogLk);
+    logbuf_end(b, LOG_LEVEL_error);
 }
 
 //@ e[in]: 最上层的 errchain 指针
@@ -205,8 +560,10 @@ clean_errchain(Error *e) {
     while (nil != e) {
         err = e;
         e = e->cause;
-        free(err->desc);
-        free(err);
+        err_free(err);
     };
 }
 
+
+#undef LOG_FLUSH_SECS___
+#undef LOG_BUF_SIZ___
@@ -10,18 +10,29 @@ extern struct Log Log;
  */
 
 // designed for error chain
+// 节点取自所在线程的固定大小的 arena, 不使用堆内存;
+// desc 不再被复制, 须为字符串常量或 strerror 的返回值等生存期足够长的字符串.
+// NOTE: 错误链不能在创建它的线程退出之后使用
+//-
+//@ truncated: arena 耗尽时, 丢弃的外层节点数量
+//@ arena: 所属的 arena, 为 nil 时表示静态节点, 无需释放
 typedef struct Error {
     int        code;
-    char      *desc;
+    const char    *desc;
     struct Error *cause;
 
     const char    *file;
     int        line;
     const char    *func;
+
+    int        truncated;
+    void      *arena;
 } Error;
 
 //! 调用对应的宏, 不要直接使用此处的函数!
 struct Log {
+    Error * (* new_err) (int code, const char *desc, Error *cause,
+            const char *const file_path, i___ line_num, const char *const func_name);
     void (* print_time) (i___ fd);
     void (* info) (const char *msg, const char *const file_path, i___ line_num, const char *const func_name);
     void (* fatal) (const char *msg, const char *const file_path, i___ line_num, const char *const func_name);
@@ -35,18 +46,8 @@ struct Log {
 #include <string.h>
 #include <errno.h>
 
-#define err_new___(code____/*int*/, desc____/*str*/, cause____/*prev Error ptr*/) ({\
-    Error *const new = malloc(sizeof(Error));\
-    if (nil == new) {\
-        fatal_sys___();\
-    }\
-    new->code = (code____);\
-    new->desc = strdup(desc____);\
-    new->cause = (cause____);\
-    new->file = __FILE__;\
-    new->line = __LINE__;\
-    new->func = __func__;\
-    new;\
+#define err_new___(code____/*int*/, desc____/*static str*/, cause____/*prev Error ptr*/) ({\
+    Log.new_err((code____), (desc____), (cause____), __FILE__, __LINE__, __func__);\
 })
 
 #define err_new_sys___() ({\
@@ -130,5 +131,8 @@ struct Log {
 #define ECHAIN_MARKER___          -103
 #define ECHAIN_MARKER_DESC___     "***"
 
+#define EARENA_FULL___            -104
+#define EARENA_FULL_DESC___       "error arena exhausted"
+
 
 #endif // LOG_H___
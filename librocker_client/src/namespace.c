@@ -1,21 +1,119 @@
 #include "namespace.h"
 #include "io.h"
+#include "utils.h"
+#include <fcntl.h>
 #include <sched.h>
 #include <signal.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <pthread.h>
 
+// `man ioctl_ns(2)`, 部分交叉工具链未提供 linux/nsfs.h
+#ifndef NS_GET_NSTYPE
+#define NS_GET_NSTYPE _IO(0xb7, 0x3)
+#endif
+
+static Error * stack_get(size_t stack_size, struct Stack *stack);
+static void stack_put(struct Stack *stack);
 static Error * enter_ns(i___ fdset[], i___ set_siz);
 static Error * run_in_brother(i___ (*ops) (void *), void *ops_args, i___ *brother_pid);
+static Error * run_in_brotherx(i___ (*ops) (void *), void *ops_args, size_t stack_size, i___ *brother_pid);
 static Error * proc_new(i___ (*ops) (void *), void *ops_args, pid_t *newpid);
 static Error * proc_newx(i___ (*ops) (void *), void *ops_args, size_t stack_size, pid_t *newpid);
+static Error * enter_and_run(i___ fdset[], i___ set_siz, i___ cgroup_fd, i___ (*ops) (void *), void *ops_args,
+        pid_t *newpid, bool___ *ns_entered, u64___ *entered_at);
 
 struct NameSpace NameSpace = {
+    .stack_get = stack_get,
+    .stack_put = stack_put,
     .enter_ns = enter_ns,
     .run_in_brother = run_in_brother,
+    .run_in_brotherx = run_in_brotherx,
     .proc_new = proc_new,
     .proc_newx = proc_newx,
+    .enter_and_run = enter_and_run,
+};
+
+//! 缓存的空闲栈空间的最大数量, 超出的部分直接 munmap
+#define STACK_POOL_MAX___ 8
+
+//! 空闲栈空间的缓存, 按长度精确匹配复用.
+//! clone 返回之后, 新进程(CLONE_VM 除外)持有栈空间的副本, 原栈空间即可被再次使用
+static struct {
+    pthread_mutex_t lk;
+    size_t cnt;
+    struct Stack stacks[STACK_POOL_MAX___];
+} stack_pool = {
+    .lk = PTHREAD_MUTEX_INITIALIZER,
+    .cnt = 0,
 };
 
+//! 取得一块可用作 clone 栈的空间, 优先复用 stack_put 归还的空间.
+//! MAP_NORESERVE: 不预先占用 swap/overcommit 额度, 只有实际写入的页才计入内存用量
+//-
+//@ stack_size[in]: 可用的栈空间大小, 向上对齐到页大小, 不含保护页
+//@ stack[out]: 分配结果, 使用完毕后以 stack_put 归还
+static Error *
+stack_get(size_t stack_size, struct Stack *stack) {
+    return_err_if_param_nil___(stack_size && stack);
+
+    size_t pagesiz = sysconf(_SC_PAGESIZE);
+    size_t len = (stack_size + pagesiz - 1) / pagesiz * pagesiz + pagesiz;
+
+    pthread_mutex_lock(&stack_pool.lk);
+    for (size_t i = stack_pool.cnt; i > 0; --i) {
+        if (len == stack_pool.stacks[i - 1].len) {
+            *stack = stack_pool.stacks[i - 1];
+            stack_pool.stacks[i - 1] = stack_pool.stacks[--stack_pool.cnt];
+            pthread_mutex_unlock(&stack_pool.lk);
+            return nil;
+        }
+    }
+    pthread_mutex_unlock(&stack_pool.lk);
+
+    char *addr = mmap(nil, len, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_ANONYMOUS|MAP_STACK|MAP_NORESERVE, -1, 0);
+    if (MAP_FAILED == addr) {
+        return err_new_sys___();
+    }
+
+    if (0 > mprotect(addr, pagesiz, PROT_NONE)) {
+        Error *e = err_new_sys___();
+        munmap(addr, len);
+        return e;
+    }
+
+    stack->addr = addr;
+    stack->len = len;
+
+    return nil;
+}
+
+//! 归还 stack_get 分配的栈空间, 缓存已满时释放;
+//! 可用作 drop___ 的回调, addr 为 nil 时不做任何操作
+//-
+//@ stack[in, out]: 归还之后置为空
+static void
+stack_put(struct Stack *stack) {
+    if (nil == stack || nil == stack->addr) {
+        return;
+    }
+
+    pthread_mutex_lock(&stack_pool.lk);
+    if (STACK_POOL_MAX___ > stack_pool.cnt) {
+        stack_pool.stacks[stack_pool.cnt++] = *stack;
+        stack->addr = nil;
+    }
+    pthread_mutex_unlock(&stack_pool.lk);
+
+    if (nil != stack->addr) {
+        munmap(stack->addr, stack->len);
+        stack->addr = nil;
+    }
+}
+
 //! 执行进程须具备 CAP_SYS_ADMIN
 //! 操作成功的关联 fd 会被改写为 -1
 //! 若返回错误,则 fdset 中第一个非 -1 的值,即为出错的 fd
@@ -50,14 +148,12 @@ clone_raw(i___ flags, char *child_stack, i___ (*ops) (void *), void *ops_args) {
 //@ newpid[out]: 新进程的PID
 static Error *
 proc_newx(i___ (*ops) (void *), void *ops_args, size_t stack_size, pid_t *newpid) {
-    drop___(IO_drop_mem) char *stack = malloc(stack_size);
-    if (nil == stack) {
-        fatal_sys___();
-    }
+    drop___(stack_put) struct Stack stack = { .addr = nil };
+    return_err_if_err___(stack_get(stack_size, &stack));
 
     // 与中间临时进程共享尽可能多的内核设施, 避免不必要的copy
-    // 不能设置CLONE_VM, 否则临时进程退出后, 栈空间将被释放
-    pid_t pid = clone_raw(CLONE_PARENT|CLONE_FS|CLONE_FILES|SIGCHLD, stack + stack_size, ops, ops_args);
+    // 不能设置CLONE_VM, 否则栈空间被归还之后, 可能被其它调用方复用
+    pid_t pid = clone_raw(CLONE_PARENT|CLONE_FS|CLONE_FILES|SIGCHLD, stack.addr + stack.len, ops, ops_args);
     if (0 > pid) {
         return err_new_sys___();
     }
@@ -83,20 +179,260 @@ proc_new(i___ (*ops) (void *), void *ops_args, pid_t *newpid) {
 
 //! 子进程结束时, 将向祖父进程发送SIGCHLD信号,
 //! 相当于调用方创建了一个兄弟进程
+//@ ops[in]: 新进程的执行函数
+//@ ops_args[in]: 执行函数的参数
+//@ stack_size[in]: 新进程的栈空间大小
+//@ brother_pid[out]: 新进程的PID
 static Error *
-run_in_brother(i___ (*ops) (void *), void *ops_args, i___ *brother_pid) {
+run_in_brotherx(i___ (*ops) (void *), void *ops_args, size_t stack_size, i___ *brother_pid) {
     return_err_if_param_nil___(ops && brother_pid);
 
-    static const i___ stack_size = 4 * 1024 * 1024;
-    drop___(IO_drop_mem) char *stack = malloc(stack_size);
-    if (nil == stack) {
+    drop___(stack_put) struct Stack stack = { .addr = nil };
+    return_err_if_err___(stack_get(stack_size, &stack));
+
+    if (0 > (*brother_pid = clone_raw(CLONE_PARENT|SIGCHLD, stack.addr + stack.len, ops, ops_args))) {
+        return err_new_sys___();
+    }
+
+    return nil;
+}
+
+//! 'run_in_brotherx'的wrapper, 栈空间大小固定为4MB
+static Error *
+run_in_brother(i___ (*ops) (void *), void *ops_args, i___ *brother_pid) {
+    static const size_t stack_size = 4 * 1024 * 1024;
+    return_err_if_err___(run_in_brotherx(ops, ops_args, stack_size, brother_pid));
+    return nil;
+}
+
+
+//! 调用方自身的 pid namespace, 创建 app 进程之后据此恢复调用线程的 pid_for_children
+static i___ self_pidns_fd = -1;
+static pthread_once_t self_pidns_once = PTHREAD_ONCE_INIT;
+
+INNER___ static void
+self_pidns_open(void) {
+    self_pidns_fd = open("/proc/self/ns/pid", O_RDONLY|O_CLOEXEC);
+}
+
+//! enter_and_run 中调用方与新进程共享的上下文, 新进程持有其创建时刻的副本
+//-
+//@ fdset/set_siz: 需要进入的 namespace 描述符
+//@ user_idx: fdset 中 user namespace 的下标, 不存在时为 -1
+//@ pid_idx: fdset 中 pid namespace 的下标, 不存在时为 -1, 已由调用线程进入
+//@ cgroup_fd: 新进程所属 cgroup 的目录描述符, 不需要时为 -1
+//@ ops/ops_args: 需要在新进程中执行的函数及其参数
+//@ sigmask: 调用方原始的信号掩码, 新进程执行 ops 之前恢复
+//@ status_fd: 新进程通过此描述符回报进入 namespace 及迁入 cgroup 的结果
+struct EnterRunCtx {
+    i___ *fdset;
+    i___ set_siz;
+    i___ user_idx;
+    i___ pid_idx;
+    i___ cgroup_fd;
+
+    i___ (*ops) (void *);
+    void *ops_args;
+
+    sigset_t sigmask;
+    i___ status_fd;
+};
+
+//! 将调用进程迁入 cgroup_fd 所指的 cgroup
+INNER___ static i___
+cgroup_attach_self(i___ cgroup_fd) {
+    i___ fd = openat(cgroup_fd, "cgroup.procs", O_WRONLY|O_CLOEXEC);
+    if (0 > fd) {
+        return -1;
+    }
+
+    // 写入 "0" 表示调用进程自身
+    i___ ret = 1 == write(fd, "0", 1) ? 0 : -1;
+    i___ err = errno;
+    close(fd);
+    errno = err;
+
+    return ret;
+}
+
+//! 新进程: 迁入 cgroup, 进入 pid 与 user 以外的 namespace, 最后进入 user namespace, 之后执行 ops.
+//! 进入 mnt/user namespace 要求调用进程不与其它线程共享 fs 及地址空间,
+//! 故这些步骤不能由调用线程完成
+INNER___ static i___
+enter_run_child(struct EnterRunCtx *ctx) {
+    i___ err = 0;
+    if (0 <= ctx->cgroup_fd && 0 > cgroup_attach_self(ctx->cgroup_fd)) {
+        err = errno;
+    }
+
+    for (i___ i = 0; 0 == err && i < ctx->set_siz; ++i) {
+        if (i != ctx->user_idx && i != ctx->pid_idx && 0 > setns(ctx->fdset[i], 0)) {
+            err = errno;
+        }
+    }
+
+    if (0 == err && 0 <= ctx->user_idx && 0 > setns(ctx->fdset[ctx->user_idx], 0)) {
+        err = errno;
+    }
+
+    // ops 不需要继承 cgroup 的描述符
+    if (0 <= ctx->cgroup_fd) {
+        close(ctx->cgroup_fd);
+    }
+
+    if (sizeof(i___) != write(ctx->status_fd, &err, sizeof(i___))) {
+        _exit(255);
+    }
+    close(ctx->status_fd);
+
+    if (0 != err) {
+        _exit(255);
+    }
+
+    sigprocmask(SIG_SETMASK, &ctx->sigmask, nil);
+    return ctx->ops(ctx->ops_args);
+}
+
+//! 调用线程进入 pid namespace, 只影响其此后创建的子进程(pid_for_children).
+//! 内核不支持 NS_GET_NSTYPE 时 pid_idx 为 -2, 以 setns 的 nstype 参数逐个试探
+INNER___ static i___
+enter_pidns(struct EnterRunCtx *ctx) {
+    if (-2 != ctx->pid_idx) {
+        return 0 > ctx->pid_idx ? 0 : setns(ctx->fdset[ctx->pid_idx], CLONE_NEWPID);
+    }
+
+    ctx->pid_idx = -1;
+    for (i___ i = 0; i < ctx->set_siz; ++i) {
+        if (i != ctx->user_idx && 0 == setns(ctx->fdset[i], CLONE_NEWPID)) {
+            ctx->pid_idx = i;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+//! 进入 fdset 指定的 namespace, 并在其中的新进程里执行 ops,
+//! 新进程是调用方的子进程, 调用方自身的 namespace 不受影响.
+//! 与 fork 出一个完整的副本再 setns, 再创建兄弟进程的方式相比, 调用方的地址空间只被复制一次,
+//! 对于映射了大量内存的调用方, 可显著降低启动延迟.
+//! 新进程由 fork 创建, 多线程的调用方中, malloc/stdio 等的锁及 pthread_atfork 注册的回调均按 fork 的语义处理,
+//! ops 不受'只能调用异步信号安全函数'的限制
+//-
+//@ fdset[in]: namespace 描述符, user namespace 可位于任意位置, 最后进入
+//@ set_siz[in]: fdset 中的 fd 数量
+//@ cgroup_fd[in]: 新进程所属 cgroup 的目录描述符, 为 -1 时与调用方相同
+//@ ops[in]: 新进程的执行函数
+//@ ops_args[in]: 执行函数的参数
+//@ newpid[out]: 新进程的PID
+//@ ns_entered[out]: 出错时, 用于区分是进入 namespace 失败, 还是创建进程失败
+//@ entered_at[out]: 可以为 nil, 调用线程进入 pid namespace 的时刻(Utils.now_ns),
+//@     用于区分进入 namespace 与创建新进程各自的耗时
+static Error *
+enter_and_run(i___ fdset[], i___ set_siz, i___ cgroup_fd, i___ (*ops) (void *), void *ops_args,
+        pid_t *newpid, bool___ *ns_entered, u64___ *entered_at) {
+    return_err_if_param_nil___(fdset && set_siz && ops && newpid && ns_entered);
+
+    *ns_entered = false___;
+
+    struct EnterRunCtx ctx = {
+        .fdset = fdset,
+        .set_siz = set_siz,
+        .user_idx = -1,
+        .pid_idx = -1,
+        .cgroup_fd = cgroup_fd,
+        .ops = ops,
+        .ops_args = ops_args,
+        .status_fd = -1,
+    };
+
+    bool___ typed = false___;
+    for (i___ i = 0; i < set_siz; ++i) {
+        i___ nstype = ioctl(fdset[i], NS_GET_NSTYPE);
+        if (CLONE_NEWUSER == nstype) {
+            ctx.user_idx = i;
+        } else if (CLONE_NEWPID == nstype) {
+            ctx.pid_idx = i;
+        }
+        typed = typed || 0 <= nstype;
+    }
+
+    // 内核不支持 NS_GET_NSTYPE(Linux 4.11 之前): user namespace 约定位于最后
+    if (!typed) {
+        ctx.user_idx = set_siz - 1;
+        ctx.pid_idx = -2;
+    }
+
+    pthread_once(&self_pidns_once, self_pidns_open);
+    if (0 > self_pidns_fd) {
         return err_new_sys___();
     }
 
-    if (0 > (*brother_pid = clone_raw(CLONE_PARENT|SIGCHLD, stack + stack_size, ops, ops_args))) {
+    drop___(IO_drop_fd) i___ read_fd = -1;
+    drop___(IO_drop_fd) i___ write_fd = -1;
+    return_err_if_err___(IO.creat_pipe(&read_fd, &write_fd));
+    ctx.status_fd = write_fd;
+
+    // 调用线程处于目标 pid namespace 期间屏蔽所有信号,
+    // 以免信号处理函数在此期间创建的子进程落入其中
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &ctx.sigmask);
+
+    if (0 > enter_pidns(&ctx)) {
+        Error *e = err_new_sys___();
+        pthread_sigmask(SIG_SETMASK, &ctx.sigmask, nil);
+        return e;
+    }
+
+    *ns_entered = true___;
+    if (nil != entered_at) {
+        *entered_at = Utils.now_ns();
+    }
+
+    pid_t pid = fork();
+    if (0 == pid) {
+        _exit(enter_run_child(&ctx));
+    }
+    i___ fork_errno = errno;
+
+    // 恢复调用线程的 pid_for_children, 否则其后续创建的子进程均落入该 rocker 中
+    i___ restored = 0 > ctx.pid_idx ? 0 : setns(self_pidns_fd, CLONE_NEWPID);
+    i___ restore_errno = errno;
+
+    pthread_sigmask(SIG_SETMASK, &ctx.sigmask, nil);
+
+    if (0 > pid) {
+        errno = fork_errno;
+        return err_new_sys___();
+    }
+
+    if (0 > restored) {
+        kill(pid, SIGKILL);
+        waitpid(pid, nil, 0);
+        errno = restore_errno;
+        return err_new_sys___();
+    }
+
+    // 等待新进程回报进入 namespace 及迁入 cgroup 的结果
+    IO_drop_fd(&write_fd);
+    write_fd = -1;
+
+    i___ err = 0;
+    errno = 0;
+    if (sizeof(i___) != read(read_fd, &err, sizeof(i___))) {
+        err = 0 == errno ? EIO : errno;
+    }
+
+    if (0 != err) {
+        *ns_entered = false___;
+        waitpid(pid, nil, 0);
+        errno = err;
         return err_new_sys___();
     }
 
+    *newpid = pid;
     return nil;
 }
 
+#undef STACK_POOL_MAX___
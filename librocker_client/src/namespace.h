@@ -3,11 +3,26 @@
 
 #include "log.h"
 
+//! 由 mmap 分配的 clone 栈空间, 最低处为一个不可访问的保护页,
+//! 栈溢出时触发 SIGSEGV, 而不是静默地改写相邻内存
+//-
+//@ addr: 映射区的起始地址, 即保护页
+//@ len: 映射区的总长度, 含保护页; 栈顶为 addr + len
+struct Stack {
+    char *addr;
+    size_t len;
+};
+
 struct NameSpace {
+    Error * (*stack_get) (size_t stack_size, struct Stack *stack) must_use___;
+    void (*stack_put) (struct Stack *stack);
     Error * (*enter_ns) (i___ fdset[], i___ set_siz) must_use___;
     Error * (*run_in_brother) (i___ (*ops) (void *), void *ops_args, i___ *brother_pid) must_use___;
+    Error * (*run_in_brotherx) (i___ (*ops) (void *), void *ops_args, size_t stack_size, i___ *brother_pid) must_use___;
     Error * (*proc_new) (i___ (*ops) (void *), void *ops_args, pid_t *newpid) must_use___;
     Error * (*proc_newx) (i___ (*ops) (void *), void *ops_args, size_t stack_size, pid_t *newpid) must_use___;
+    Error * (*enter_and_run) (i___ fdset[], i___ set_siz, i___ cgroup_fd, i___ (*ops) (void *), void *ops_args,
+            pid_t *newpid, bool___ *ns_entered, u64___ *entered_at) must_use___;
 };
 
 extern struct NameSpace NameSpace;
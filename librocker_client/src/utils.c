@@ -3,6 +3,7 @@
 
 #include <unistd.h>
 #include <stdio.h>
+#include <time.h>
 #include <sys/prctl.h>
 #include <sys/wait.h>
 
@@ -12,6 +13,7 @@ static size_t strlen_(const char *s);
 static Error * get_process_name(pid_t pid, char buf[16]);
 static Error * get_self_process_name(char buf[16]);
 static Error * set_self_process_name(char newname[16]);
+static u64___ now_ns();
 
 struct Utils Utils = {
     .ncpu = ncpu,
@@ -20,6 +22,7 @@ struct Utils Utils = {
     .get_process_name = get_process_name,
     .get_self_process_name = get_self_process_name,
     .set_self_process_name = set_self_process_name,
+    .now_ns = now_ns,
 };
 
 //@ newname[out]:
@@ -85,6 +88,14 @@ proc_exit_num(pid_t pid) {
     return -1;
 }
 
+//! CLOCK_MONOTONIC 时间, 单位: 纳秒; 与服务端的计时基准相同
+static u64___
+now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64___)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 static size_t
 strlen_(const char *s) {
     if (nil == s) {
@@ -12,6 +12,7 @@ struct Utils {
     Error * (*get_process_name) (pid_t pid, char buf[16]) must_use___;
     Error * (*get_self_process_name) (char buf[16]) must_use___;
     Error * (*set_self_process_name) (char newname[16]) must_use___;
+    u64___ (*now_ns) ();
 };
 
 
@@ -4,11 +4,16 @@
 #include "namespace.h"
 #include "test_utils.h"
 
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <sched.h>
 #include <sys/mount.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <dirent.h>
 
 #define PARENT_ADDR "parent_un"
 #define CHILD_ADDR "child_un"
@@ -37,6 +42,43 @@ getns_path(char *nsname) {
 
 static i___ info_pipe[2];
 
+//! 与 lib.c 中的 v2 请求格式保持一致
+#define REQ_V2_MAGIC (-0x524b5632)
+#define TLV_app_id 1
+#define TLV_uid 2
+#define TLV_gid 3
+#define TLV_app_overlay_dir 7
+#define TLV_memory_max 8
+#define TLV_cpu_max 10
+#define TLV_io_max 12
+#define TLV_pids_max 13
+
+//! 在 v2 请求中查找第 nth 个(从 0 开始计数)类型为 type 的字段
+//-
+//@ len[out]: 字段值的长度
+//@ return: 字段值的地址, 不存在时返回 nil
+const char *
+tlv_find(const char *req, size_t req_len, uint16_t type, i___ nth, uint16_t *len) {
+    uint16_t hdr[2];
+    for (size_t off = 2 * sizeof(i32___); off + sizeof(hdr) <= req_len; off += hdr[1]) {
+        memcpy(hdr, req + off, sizeof(hdr));
+        off += sizeof(hdr);
+        if (type == hdr[0] && 0 == nth--) {
+            *len = hdr[1];
+            return req + off;
+        }
+    }
+    return nil;
+}
+
+//! 第 nth 个类型为 type 的字段存在, 且其值与 val 相同时返回 1
+i___
+tlv_eq(const char *req, size_t req_len, uint16_t type, i___ nth, const void *val, size_t val_len) {
+    uint16_t len = 0;
+    const char *v = tlv_find(req, req_len, type, nth, &len);
+    return nil != v && val_len == len && 0 == memcmp(v, val, len);
+}
+
 Error *
 read_nsname(char *nsname, char namebuf[], socklen_t namebuf_len) {
     if (0 > readlink(getns_path(nsname).path, namebuf, namebuf_len)) {
@@ -162,7 +204,7 @@ test_ns_child1_child(void) {
     char user_ns[64] = {0};
     char mnt_ns[64] = {0};
     char pid_ns[64] = {0};
-    i___ fdset[3];
+    i___ fdset[4];
 
     fatal_if_err___(read_nsname("user", user_ns, 64));
     fatal_if_err___(IO.open_for_read(fdset, getns_path("user").path));
@@ -174,42 +216,72 @@ test_ns_child1_child(void) {
     fatal_if_err___(IO.open_for_read(fdset + 2, getns_path("pid").path));
 
     //recv req
-    char buf[sizeof(i___) * 22 + sizeof("a") + sizeof("aa")];
-    i___ *res = (i___ *)buf, n = -1;
+    char buf[4096];
+    i32___ hdr[2], minus_one = -1;
+    uint16_t len;
+    i___ n = -1;
 
-    if (0 > (n = recvfrom(maste_fd, buf, 256, 0, (struct sockaddr *)&un, &un_len))) {
+    if (0 > (n = recvfrom(maste_fd, buf, sizeof(buf), 0, (struct sockaddr *)&un, &un_len))) {
         fatal_sys___();
     }
 
-    So(sizeof(i___) * 22 + sizeof("a") + sizeof("aa"), n);
-
-    So(-1, res[0]);
-    So(-1, res[1]);
-    So(-1, res[2]);
-    So(0, res[3]);
-    So(0, res[4]);
-    So(0, res[5]);
-    So(2, res[6]);
-    So(0, res[7]);
-    //...
-    So(0, res[20]);
-    So(3, res[21]);
-    So(0, strcmp("a", (char *)(res + 22)));
-    So(0, strcmp("aa", (char *)(res + 22) + res[6]));
-
-    //send fd
+    memcpy(hdr, buf, sizeof(hdr));
+    So(REQ_V2_MAGIC, hdr[0]);
+    So(n, hdr[1]);
+
+    So(1, tlv_eq(buf, n, TLV_app_id, 0, &minus_one, sizeof(i32___)));
+    So(1, tlv_eq(buf, n, TLV_uid, 0, &minus_one, sizeof(i32___)));
+
+    // gid 为负时不发送
+    So(nil, tlv_find(buf, n, TLV_gid, 0, &len));
+
+    // app_overlay_dirs 中的空项被跳过, app_overlay_dirs_more 紧随其后
+    So(1, tlv_eq(buf, n, TLV_app_overlay_dir, 0, "a", 1));
+    So(1, tlv_eq(buf, n, TLV_app_overlay_dir, 1, "aa", 2));
+    So(1, tlv_eq(buf, n, TLV_app_overlay_dir, 2, "ccc", 3));
+    So(nil, tlv_find(buf, n, TLV_app_overlay_dir, 3, &len));
+
+    // 资源限制: 为 0 的项不发送, cpu.max 的周期缺省为 100000, io.max 每个设备一项
+    u64___ memory_max = 64 << 20;
+    uint32_t cpu_max[2] = { 20000, 100000 }, pids_max = 32;
+    So(1, tlv_eq(buf, n, TLV_memory_max, 0, &memory_max, sizeof(u64___)));
+    So(1, tlv_eq(buf, n, TLV_cpu_max, 0, cpu_max, sizeof(cpu_max)));
+    So(1, tlv_eq(buf, n, TLV_pids_max, 0, &pids_max, sizeof(uint32_t)));
+    So(1, tlv_eq(buf, n, TLV_io_max, 0, "8:0 rbps=1", 10));
+    So(1, tlv_eq(buf, n, TLV_io_max, 1, "8:16 wiops=2", 12));
+    So(nil, tlv_find(buf, n, TLV_io_max, 2, &len));
+
+    //send fd: [guard_pid, guard_pname] + 服务端 5 个阶段的耗时, 取值 1..5
+    char resp[sizeof(i___) + 16 + 5 * sizeof(u64___)] = {0};
     i___ fake_guard_pid = 666;
+    memcpy(resp, &fake_guard_pid, sizeof(i___));
+    for (u64___ i = 0; i < 5; ++i) {
+        u64___ ns = i + 1;
+        memcpy(resp + sizeof(i___) + 16 + i * sizeof(u64___), &ns, sizeof(u64___));
+    }
     struct iovec vec = {
-        .iov_base = &fake_guard_pid,
-        .iov_len = sizeof(i___),
+        .iov_base = resp,
+        .iov_len = sizeof(resp),
     };
+    // 第 4 个为生命线管道的写端, app 退出且客户端关闭其副本之后, 读端收到 EOF
+    i___ lifeline[2];
+    fatal_sys_if_negative___(pipe(lifeline));
+    fdset[3] = lifeline[1];
+
     struct FdTransEnv fte;
-    fatal_if_err___(IO.fte_init(&fte, fdset, 3, &vec, 1));
+    fatal_if_err___(IO.fte_init(&fte, fdset, 4, &vec, 1));
+    // 与服务端一致, 只发送实际的描述符, 其后的位置留给 cgroup 描述符
+    fte.cmsg->cmsg_len = CMSG_LEN(4 * sizeof(i___));
+    fte.msg.msg_controllen = CMSG_SPACE(4 * sizeof(i___));
     fatal_if_err___(IO.send_fd(maste_fd, &fte, &un, un_len));
+    close(lifeline[1]);
+
+    char b;
+    So(0, read(lifeline[0], &b, 1));
+    close(lifeline[0]);
 
     // 新PID namespace的1号进程若退出,
     // 后续新加入的进程将不能fork
-    char b;
     fatal_sys_if_negative___(read(info_pipe[0], &b, 1));
 }
 
@@ -272,7 +344,7 @@ test_ns(void) {
     printf("[test_ns]: 子进程unshare进user,mnt,pid三个新的namespace中,\n"
             "打开其/proc/$$/ns/下的对应文件, 一次性把所有fd发送至父进程,\n"
             "父进程调用rocker_client库的接口进入这三个namespace,\n"
-            "验证是否与先前的namespace ID不同.\n\n");
+            "验证是否与先前的namespace ID不同, 以及各阶段的耗时是否被记录.\n\n");
 
     pid_t pid = fork();
     if (0 == pid) {
@@ -301,7 +373,15 @@ test_ns(void) {
     RockerRequest req = ROCKER_request_new();
     req.app_overlay_dirs[0] = "a";
     req.app_overlay_dirs[15] = "aa";
-    RockerResult res = ROCKER_enter_rocker(&req, test_ns_child2, &old);
+    char *overlay_dirs_more[] = { "ccc", nil };
+    req.app_overlay_dirs_more = overlay_dirs_more;
+    req.memory_max = 64 << 20;
+    req.cpu_max_us = 20000;
+    req.pids_max = 32;
+    req.io_max = "8:0 rbps=1\n\n8:16 wiops=2\n";
+    RockerTrace trace;
+    memset(&trace, 0xff, sizeof(trace));
+    RockerResult res = ROCKER_enter_rocker_traced(&req, test_ns_child2, &old, &trace);
     switch (res.err_no) {
         case ROCKER_ERR_success:
             break;
@@ -339,6 +419,21 @@ test_ns(void) {
             fatal___("ROCKER_ERR_unknown");
     }
 
+    // 服务端阶段取自应答, 客户端阶段由本地计时
+    for (i___ i = ROCKER_STAGE_loop_attach; i <= ROCKER_STAGE_idmap; ++i) {
+        So((ulli___)(i - ROCKER_STAGE_loop_attach + 1), trace.ns[i]);
+    }
+    SoGt(trace.ns[ROCKER_STAGE_send_req], 0);
+    SoGt(trace.ns[ROCKER_STAGE_wait_resp], 0);
+    SoGt(trace.ns[ROCKER_STAGE_enter_ns], 0);
+    SoGt(trace.ns[ROCKER_STAGE_app_exec], 0);
+    So(ROCKER_ERR_param_invalid, ROCKER_enter_rocker_traced(nil, test_ns_child2, nil, &trace).err_no);
+
+    // 调用线程此后创建的子进程仍位于原 pid namespace 中
+    char pid_for_children[64] = {0};
+    fatal_if_err___(read_nsname("pid_for_children", pid_for_children, 64));
+    So(0, strcmp(pid_ns, pid_for_children));
+
     // 父进程继续往下执行后续的测试用例
     fatal_sys_if_negative___(waitpid(res.app_pid, nil, 0));
     printf("[%s]: parent-process return normally.\n\n", __func__);
@@ -350,10 +445,1042 @@ test_ns(void) {
     fatal_sys_if_negative___(write(info_pipe[1], "", 1));
 }
 
+void
+test_session(void) {
+    printf("[test_session]: 会话可被重复打开/关闭, 无效参数被正确拒绝.\n\n");
+
+    RockerSession *session = nil;
+    RockerResult res = ROCKER_session_open(&session);
+    So(ROCKER_ERR_success, res.err_no);
+    SoN(nil, session);
+
+    res = ROCKER_session_enter_rocker(session, nil, test_ns_child2, nil);
+    So(ROCKER_ERR_param_invalid, res.err_no);
+
+    res = ROCKER_session_enter_rocker(nil, nil, test_ns_child2, nil);
+    So(ROCKER_ERR_param_invalid, res.err_no);
+
+    // 超出单条消息的长度上限, 在发送之前即被拒绝
+    static char long_path[70 * 1024];
+    memset(long_path, 'x', sizeof(long_path) - 1);
+    RockerRequest req = ROCKER_request_new();
+    req.app_pkg_path = long_path;
+    res = ROCKER_session_enter_rocker(session, &req, test_ns_child2, nil);
+    So(ROCKER_ERR_param_invalid, res.err_no);
+
+    ROCKER_session_close(session);
+    ROCKER_session_close(nil);
+
+    So(ROCKER_ERR_param_invalid, ROCKER_session_open(nil).err_no);
+
+    fprintf(stderr, "\x1b[32;01m[test_session] passed!\x1b[00m\n");
+}
+
+i___
+test_batch_app(void *_ unused___) {
+    return 0;
+}
+
+//! 模拟 rocker_server: 校验批量请求的格式, 回送一个失败项与一个成功项
+void
+test_batch_child(void) {
+    i___ maste_fd = -1;
+    Error *e = nil;
+    // 前一个用例中持有同一地址的进程可能尚未完全退出, 短暂重试
+    for (i___ i = 0; i < 50; ++i) {
+        if (nil == (e = IO.unix_abstract_udp_new(CHILD_ADDR2, &maste_fd))) {
+            break;
+        }
+        Log.clean_errchain(e);
+        usleep(10 * 1000);
+    }
+    fatal_if_err___(e);
+
+    struct sockaddr_un un;
+    socklen_t un_len = sizeof(un);
+
+    char buf[4096];
+    i___ *res = (i___ *)buf, n = -1;
+    if (0 > (n = recvfrom(maste_fd, buf, sizeof(buf), 0, (struct sockaddr *)&un, &un_len))) {
+        fatal_sys___();
+    }
+
+    So(2, res[1]);
+    So((i___)(sizeof(i___) * 4) + res[2] + res[3], n);
+
+    char *req0 = buf + sizeof(i___) * 4;
+    char *req1 = req0 + res[2];
+    i32___ app_id[2] = { 1, 2 };
+    So(REQ_V2_MAGIC, *(i32___ *)req0);
+    So(REQ_V2_MAGIC, *(i32___ *)req1);
+    So(res[2], ((i32___ *)req0)[1]);
+    So(res[3], ((i32___ *)req1)[1]);
+    So(1, tlv_eq(req0, res[2], TLV_app_id, 0, app_id, sizeof(i32___)));
+    So(1, tlv_eq(req1, res[3], TLV_app_id, 0, app_id + 1, sizeof(i32___)));
+    So(1, tlv_eq(req0, res[2], TLV_app_overlay_dir, 0, "a", 1));
+    So(1, tlv_eq(req1, res[3], TLV_app_overlay_dir, 0, "bb", 2));
+
+    // [-1, pname] + [666, pname] + 3 fds
+    char resp[2 * (sizeof(i___) + 16)] = {0};
+    i___ failed_pid = -1, fake_guard_pid = 666;
+    memcpy(resp, &failed_pid, sizeof(i___));
+    memcpy(resp + sizeof(i___) + 16, &fake_guard_pid, sizeof(i___));
+
+    i___ fdset[3];
+    for (i___ i = 0; i < 3; ++i) {
+        fatal_if_err___(IO.open_for_read(fdset + i, "/dev/null"));
+    }
+
+    struct iovec vec = {
+        .iov_base = resp,
+        .iov_len = sizeof(resp),
+    };
+    struct FdTransEnv fte;
+    fatal_if_err___(IO.fte_init(&fte, fdset, 3, &vec, 1));
+    fte.cmsg->cmsg_len = CMSG_LEN(3 * sizeof(i___));
+    fte.msg.msg_controllen = CMSG_SPACE(3 * sizeof(i___));
+    fatal_if_err___(IO.send_fd(maste_fd, &fte, &un, un_len));
+}
+
+void
+test_batch(void) {
+    printf("[test_batch]: 批量请求在一次交互中完成,\n"
+            "失败项与成功项均被正确地对应到各自的结果中.\n\n");
+
+    pid_t pid = fork();
+    if (0 == pid) {
+        test_batch_child();
+        exit(0);
+    } else if (0 > pid) {
+        fatal_sys___();
+    }
+
+    sleep(1);
+
+    RockerRequest reqs[2] = { ROCKER_request_new(), ROCKER_request_new() };
+    reqs[0].app_id = 1;
+    reqs[0].app_overlay_dirs[0] = "a";
+    reqs[1].app_id = 2;
+    reqs[1].app_overlay_dirs[0] = "bb";
+
+    i___ (*apps[2]) (void *) = { test_batch_app, test_batch_app };
+    RockerResult results[2];
+
+    RockerResult res = ROCKER_enter_rocker_batch(reqs, 2, apps, nil, results);
+    So(ROCKER_ERR_success, res.err_no);
+    So(ROCKER_ERR_build_rocker_failed, results[0].err_no);
+    So(-1, results[0].guard_pid);
+    So(666, results[1].guard_pid);
+
+    // /dev/null 不是 namespace 描述符
+    So(ROCKER_ERR_enter_rocker_failed, results[1].err_no);
+
+    So(ROCKER_ERR_param_invalid, ROCKER_enter_rocker_batch(reqs, 0, apps, nil, results).err_no);
+    So(ROCKER_ERR_param_invalid, ROCKER_enter_rocker_batch(reqs, ROCKER_BATCH_MAX + 1, apps, nil, results).err_no);
+
+    fatal_sys_if_negative___(waitpid(pid, nil, 0));
+
+    fprintf(stderr, "\x1b[32;01m[test_batch] passed!\x1b[00m\n");
+}
+
+//! 统计自身打开的描述符数量, 经由 app_args 所指的管道回报
+i___
+test_batch_fds_app(void *report_fd) {
+    i___ cnt = 0;
+    DIR *dir = opendir("/proc/self/fd");
+    if (nil == dir) {
+        return 255;
+    }
+    while (nil != readdir(dir)) {
+        ++cnt;
+    }
+    closedir(dir);
+
+    return sizeof(i___) == write(*(i___ *)report_fd, &cnt, sizeof(i___)) ? 0 : 255;
+}
+
+//! 模拟 rocker_server: 回送两个成功项, 各附带自身的 mnt, pid, uts namespace 描述符及一个生命线
+void
+test_batch_fds_child(void) {
+    i___ maste_fd = -1;
+    Error *e = nil;
+    for (i___ i = 0; i < 50; ++i) {
+        if (nil == (e = IO.unix_abstract_udp_new(CHILD_ADDR2, &maste_fd))) {
+            break;
+        }
+        Log.clean_errchain(e);
+        usleep(10 * 1000);
+    }
+    fatal_if_err___(e);
+
+    struct sockaddr_un un;
+    socklen_t un_len = sizeof(un);
+
+    char buf[4096];
+    fatal_sys_if_negative___(recvfrom(maste_fd, buf, sizeof(buf), 0, (struct sockaddr *)&un, &un_len));
+
+    // [pid, pname] x 2 + 每项的描述符数量
+    char resp[2 * (sizeof(i___) + 16) + 2] = {0};
+    i___ fake_guard_pid[2] = { 777, 778 };
+    memcpy(resp, &fake_guard_pid[0], sizeof(i___));
+    memcpy(resp + sizeof(i___) + 16, &fake_guard_pid[1], sizeof(i___));
+    resp[2 * (sizeof(i___) + 16)] = 4;
+    resp[2 * (sizeof(i___) + 16) + 1] = 4;
+
+    i___ fdset[8];
+    char *nsname[3] = { "mnt", "pid", "uts" };
+    for (i___ i = 0; i < 2; ++i) {
+        for (i___ j = 0; j < 3; ++j) {
+            fatal_if_err___(IO.open_for_read(fdset + 4 * i + j, getns_path(nsname[j]).path));
+        }
+        i___ lifeline[2];
+        fatal_sys_if_negative___(pipe(lifeline));
+        fdset[4 * i + 3] = lifeline[1];
+    }
+
+    struct iovec vec = {
+        .iov_base = resp,
+        .iov_len = sizeof(resp),
+    };
+    struct FdTransEnv fte;
+    fatal_if_err___(IO.fte_init(&fte, fdset, 8, &vec, 1));
+    fatal_if_err___(IO.send_fd(maste_fd, &fte, &un, un_len));
+}
+
+void
+test_batch_fds(void) {
+    printf("[test_batch_fds]: 批量启动时, 每个 app 进程只持有自身 rocker 的描述符,\n"
+            "无法经由其它 rocker 的描述符进入其中, 也不会拖住其它 rocker 的生命线.\n\n");
+
+    pid_t pid = fork();
+    if (0 == pid) {
+        test_batch_fds_child();
+        exit(0);
+    } else if (0 > pid) {
+        fatal_sys___();
+    }
+
+    sleep(1);
+
+    i___ report[2];
+    fatal_sys_if_negative___(pipe(report));
+
+    RockerRequest reqs[2] = { ROCKER_request_new(), ROCKER_request_new() };
+    i___ (*apps[2]) (void *) = { test_batch_fds_app, test_batch_fds_app };
+    void *app_args[2] = { &report[1], &report[1] };
+    RockerResult results[2];
+
+    RockerResult res = ROCKER_enter_rocker_batch(reqs, 2, apps, app_args, results);
+    So(ROCKER_ERR_success, res.err_no);
+    So(ROCKER_ERR_success, results[0].err_no);
+    So(ROCKER_ERR_success, results[1].err_no);
+
+    i___ cnt[2];
+    for (i___ i = 0; i < 2; ++i) {
+        i___ status = -1;
+        fatal_sys_if_negative___(waitpid(results[i].app_pid, &status, 0));
+        So(0, status);
+        So(sizeof(i___), read(report[0], &cnt[i], sizeof(i___)));
+    }
+
+    // 先启动的 app 不持有后续各项的描述符
+    So(cnt[0], cnt[1]);
+
+    close(report[0]);
+    close(report[1]);
+    fatal_sys_if_negative___(waitpid(pid, nil, 0));
+
+    fprintf(stderr, "\x1b[32;01m[test_batch_fds] passed!\x1b[00m\n");
+}
+
+//! 模拟以 SOCK_SEQPACKET 方式监听的 rocker_server:
+//! 收齐两个在途的请求之后, 以相反的顺序回送应答, guard_pid 取请求中的 app_id
+void
+test_seqpacket_child(i___ listen_fd) {
+    i___ conn_fd = accept(listen_fd, nil, nil);
+    fatal_sys_if_negative___(conn_fd);
+
+    uint32_t seq[2];
+    i32___ app_id[2];
+    for (i___ i = 0; i < 2; ++i) {
+        char buf[4096];
+        uint16_t len;
+        i___ n = recv(conn_fd, buf, sizeof(buf), 0);
+        fatal_sys_if_negative___(n);
+
+        // [seq] + v2 请求
+        SoGt(n, (i___)(sizeof(uint32_t) + 2 * sizeof(i32___)));
+        memcpy(&seq[i], buf, sizeof(uint32_t));
+        So(REQ_V2_MAGIC, *(i32___ *)(buf + sizeof(uint32_t)));
+
+        const char *v = tlv_find(buf + sizeof(uint32_t), n - sizeof(uint32_t), TLV_app_id, 0, &len);
+        SoN(nil, v);
+        memcpy(&app_id[i], v, sizeof(i32___));
+    }
+    SoN(seq[0], seq[1]);
+
+    for (i___ i = 1; i >= 0; --i) {
+        char resp[sizeof(uint32_t) + sizeof(i32___) + 16] = {0};
+        memcpy(resp, &seq[i], sizeof(uint32_t));
+        memcpy(resp + sizeof(uint32_t), &app_id[i], sizeof(i32___));
+        fatal_sys_if_negative___(send(conn_fd, resp, sizeof(resp), 0));
+    }
+
+    char b;
+    So(0, recv(conn_fd, &b, 1, 0));
+    close(conn_fd);
+}
+
+struct SeqpacketArg {
+    RockerSession *session;
+    i___ app_id;
+    RockerResult res;
+};
+
+void *
+test_seqpacket_thread(void *arg) {
+    struct SeqpacketArg *a = arg;
+    RockerRequest req = ROCKER_request_new();
+    req.app_id = a->app_id;
+    a->res = ROCKER_session_enter_rocker(a->session, &req, test_ns_child2, nil);
+    return nil;
+}
+
+void
+test_seqpacket(void) {
+    printf("[test_seqpacket]: 服务端以 SOCK_SEQPACKET 方式监听时, 会话使用连接方式,\n"
+            "同一连接上的多个请求可同时在途, 乱序到达的应答被正确地对应到各自的请求.\n\n");
+
+    struct sockaddr_un un;
+    socklen_t un_len;
+    fatal_if_err___(IO.unix_abstract_udp_genaddr(ROCKER_SERVER_UAU_ADDR "_seq", &un, &un_len));
+
+    i___ listen_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    fatal_sys_if_negative___(listen_fd);
+    fatal_sys_if_negative___(bind(listen_fd, (struct sockaddr *)&un, un_len));
+    fatal_sys_if_negative___(listen(listen_fd, 8));
+
+    pid_t pid = fork();
+    if (0 == pid) {
+        test_seqpacket_child(listen_fd);
+        exit(0);
+    } else if (0 > pid) {
+        fatal_sys___();
+    }
+    close(listen_fd);
+
+    RockerSession *session = nil;
+    So(ROCKER_ERR_success, ROCKER_session_open(&session).err_no);
+
+    struct SeqpacketArg args[2] = {
+        { .session = session, .app_id = 1 },
+        { .session = session, .app_id = 2 },
+    };
+    pthread_t tids[2];
+    for (i___ i = 0; i < 2; ++i) {
+        So(0, pthread_create(&tids[i], nil, test_seqpacket_thread, &args[i]));
+    }
+    for (i___ i = 0; i < 2; ++i) {
+        So(0, pthread_join(tids[i], nil));
+
+        // 应答不含描述符
+        So(ROCKER_ERR_build_rocker_failed, args[i].res.err_no);
+        So(args[i].app_id, args[i].res.guard_pid);
+    }
+
+    ROCKER_session_close(session);
+
+    i___ status = -1;
+    fatal_sys_if_negative___(waitpid(pid, &status, 0));
+    So(0, status);
+
+    fprintf(stderr, "\x1b[32;01m[test_seqpacket] passed!\x1b[00m\n");
+}
+
+//! app 执行 exec, 之后的进程仍应持有生命线
+i___
+test_lifeline_exec_app(void *_ unused___) {
+    execl("/bin/sh", "sh", "-c", "sleep 1", (char *)nil);
+    return 255;
+}
+
+//! 模拟以 SOCK_SEQPACKET 方式监听的 rocker_server: 回送一个成功项,
+//! 附带自身的 mnt, pid, uts namespace 描述符及生命线, 经由 status 回报生命线的持有时长(毫秒)
+void
+test_lifeline_exec_child(i___ listen_fd, i___ status) {
+    i___ conn_fd = accept(listen_fd, nil, nil);
+    fatal_sys_if_negative___(conn_fd);
+
+    char buf[4096];
+    fatal_sys_if_negative___(recv(conn_fd, buf, sizeof(buf), 0));
+
+    // [seq] + [pid, pname]
+    char resp[sizeof(uint32_t) + sizeof(i32___) + 16] = {0};
+    i32___ fake_guard_pid = 888;
+    memcpy(resp, buf, sizeof(uint32_t));
+    memcpy(resp + sizeof(uint32_t), &fake_guard_pid, sizeof(i32___));
+
+    i___ lifeline[2];
+    fatal_sys_if_negative___(pipe(lifeline));
+
+    i___ fdset[4];
+    char *nsname[3] = { "mnt", "pid", "uts" };
+    for (i___ i = 0; i < 3; ++i) {
+        fatal_if_err___(IO.open_for_read(fdset + i, getns_path(nsname[i]).path));
+    }
+    fdset[3] = lifeline[1];
+
+    struct iovec vec = {
+        .iov_base = resp,
+        .iov_len = sizeof(resp),
+    };
+    struct FdTransEnv fte;
+    fatal_if_err___(IO.fte_init(&fte, fdset, 4, &vec, 1));
+    fte.cmsg->cmsg_len = CMSG_LEN(4 * sizeof(i___));
+    fte.msg.msg_controllen = CMSG_SPACE(4 * sizeof(i___));
+    fatal_sys_if_negative___(sendmsg(conn_fd, &fte.msg, 0));
+    close(lifeline[1]);
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    char b;
+    So(0, read(lifeline[0], &b, 1));
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    i___ ms = (t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_nsec - t0.tv_nsec) / 1000000;
+    fatal_sys_if_negative___(write(status, &ms, sizeof(i___)));
+    close(conn_fd);
+}
+
+void
+test_lifeline_exec(void) {
+    printf("[test_lifeline_exec]: 连接方式下收到的生命线被 app 进程继承,\n"
+            "app 执行 exec 之后仍持有, 直至其退出.\n\n");
+
+    struct sockaddr_un un;
+    socklen_t un_len;
+    fatal_if_err___(IO.unix_abstract_udp_genaddr(ROCKER_SERVER_UAU_ADDR "_seq", &un, &un_len));
+
+    i___ listen_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    fatal_sys_if_negative___(listen_fd);
+    fatal_sys_if_negative___(bind(listen_fd, (struct sockaddr *)&un, un_len));
+    fatal_sys_if_negative___(listen(listen_fd, 8));
+
+    i___ status[2];
+    fatal_sys_if_negative___(pipe(status));
+
+    pid_t pid = fork();
+    if (0 == pid) {
+        close(status[0]);
+        test_lifeline_exec_child(listen_fd, status[1]);
+        exit(0);
+    } else if (0 > pid) {
+        fatal_sys___();
+    }
+    close(listen_fd);
+    close(status[1]);
+
+    RockerRequest req = ROCKER_request_new();
+    RockerResult res = ROCKER_enter_rocker(&req, test_lifeline_exec_app, nil);
+    So(ROCKER_ERR_success, res.err_no);
+    So(888, res.guard_pid);
+
+    // 客户端已关闭自身的副本, 生命线只由 exec 之后的 app 持有
+    i___ ms = -1;
+    So(sizeof(i___), read(status[0], &ms, sizeof(i___)));
+    SoGt(ms, 500);
+    close(status[0]);
+
+    i___ st = -1;
+    fatal_sys_if_negative___(waitpid(res.app_pid, &st, 0));
+    So(0, st);
+    fatal_sys_if_negative___(waitpid(pid, &st, 0));
+    So(0, st);
+
+    fprintf(stderr, "\x1b[32;01m[test_lifeline_exec] passed!\x1b[00m\n");
+}
+
+//! 模拟 rocker_server: 收齐三个异步请求之后, 以相反的顺序回送应答,
+//! guard_pid 取请求中的 app_id; 已被取消的请求, 其应答无法送达
+void
+test_async_child(void) {
+    i___ maste_fd = -1;
+    Error *e = nil;
+    for (i___ i = 0; i < 50; ++i) {
+        if (nil == (e = IO.unix_abstract_udp_new(CHILD_ADDR2, &maste_fd))) {
+            break;
+        }
+        Log.clean_errchain(e);
+        usleep(10 * 1000);
+    }
+    fatal_if_err___(e);
+
+    struct sockaddr_un un[3];
+    socklen_t un_len[3];
+    i32___ app_id[3];
+    for (i___ i = 0; i < 3; ++i) {
+        char buf[4096];
+        uint16_t len;
+        un_len[i] = sizeof(un[i]);
+        i___ n = recvfrom(maste_fd, buf, sizeof(buf), 0, (struct sockaddr *)&un[i], &un_len[i]);
+        fatal_sys_if_negative___(n);
+
+        So(REQ_V2_MAGIC, *(i32___ *)buf);
+        const char *v = tlv_find(buf, n, TLV_app_id, 0, &len);
+        SoN(nil, v);
+        memcpy(&app_id[i], v, sizeof(i32___));
+    }
+
+    for (i___ i = 2; i >= 0; --i) {
+        char resp[sizeof(i32___) + 16] = {0};
+        memcpy(resp, &app_id[i], sizeof(i32___));
+        if (0 > sendto(maste_fd, resp, sizeof(resp), 0, (struct sockaddr *)&un[i], un_len[i])) {
+            So(2, app_id[i]);
+        }
+    }
+}
+
+void
+test_async(void) {
+    printf("[test_async]: 异步启动立即返回, 应答到达时句柄的描述符变为可读,\n"
+            "各句柄的结果相互独立, 已取消的句柄不影响其它句柄.\n\n");
+
+    RockerAsync *h[3] = { nil };
+    RockerRequest req = ROCKER_request_new();
+
+    So(ROCKER_ERR_param_invalid, ROCKER_enter_rocker_async(nil, test_ns_child2, nil, &h[0]).err_no);
+    So(ROCKER_ERR_param_invalid, ROCKER_enter_rocker_async(&req, test_ns_child2, nil, nil).err_no);
+    So(ROCKER_ERR_param_invalid, ROCKER_complete(nil).err_no);
+    So(-1, ROCKER_async_fd(nil));
+    ROCKER_cancel(nil);
+
+    pid_t pid = fork();
+    if (0 == pid) {
+        test_async_child();
+        exit(0);
+    } else if (0 > pid) {
+        fatal_sys___();
+    }
+
+    sleep(1);
+
+    for (i___ i = 0; i < 3; ++i) {
+        req.app_id = i + 1;
+        So(ROCKER_ERR_success, ROCKER_enter_rocker_async(&req, test_ns_child2, nil, &h[i]).err_no);
+        SoGt(ROCKER_async_fd(h[i]), -1);
+
+        // 服务端收齐三个请求之前不会应答
+        if (0 == i) {
+            struct pollfd ev = { .fd = ROCKER_async_fd(h[0]), .events = POLLIN };
+            So(0, poll(&ev, 1, 0));
+        }
+    }
+
+    ROCKER_cancel(h[1]);
+
+    struct pollfd evs[2] = {
+        { .fd = ROCKER_async_fd(h[0]), .events = POLLIN },
+        { .fd = ROCKER_async_fd(h[2]), .events = POLLIN },
+    };
+    for (i___ ready = 0; 2 > ready;) {
+        SoGt(poll(evs, 2, 3000), 0);
+        for (i___ i = 0; i < 2; ++i) {
+            if (POLLIN & evs[i].revents) {
+                evs[i].fd = -1;
+                ++ready;
+            }
+        }
+    }
+
+    // 应答不含描述符
+    RockerResult res = ROCKER_complete(h[0]);
+    So(ROCKER_ERR_build_rocker_failed, res.err_no);
+    So(1, res.guard_pid);
+
+    res = ROCKER_complete(h[2]);
+    So(ROCKER_ERR_build_rocker_failed, res.err_no);
+    So(3, res.guard_pid);
+
+    i___ status = -1;
+    fatal_sys_if_negative___(waitpid(pid, &status, 0));
+    So(0, status);
+
+    fprintf(stderr, "\x1b[32;01m[test_async] passed!\x1b[00m\n");
+}
+
+//! 与 lib.c 中的 stats_map 请求保持一致
+#define STATS_MAP_MAGIC (-0x53544d50)
+
+//! 模拟 rocker_server: 以 memfd 构造一个含 4 个记录的状态页, 回送其只读描述符;
+//! 1 号记录有效, 2 号记录停留在写入过程中(序号为奇数)
+void
+test_stats_child(void) {
+    i___ maste_fd = -1;
+    Error *e = nil;
+    for (i___ i = 0; i < 50; ++i) {
+        if (nil == (e = IO.unix_abstract_udp_new(CHILD_ADDR2, &maste_fd))) {
+            break;
+        }
+        Log.clean_errchain(e);
+        usleep(10 * 1000);
+    }
+    fatal_if_err___(e);
+
+    struct sockaddr_un un;
+    socklen_t un_len = sizeof(un);
+    i32___ req = 0;
+    fatal_sys_if_negative___(recvfrom(maste_fd, &req, sizeof(req), 0, (struct sockaddr *)&un, &un_len));
+    So(STATS_MAP_MAGIC, req);
+
+    size_t len = sizeof(RockerStatsHdr) + 4 * sizeof(RockerStatsGuard);
+    i___ fd = memfd_create("test_stats", MFD_CLOEXEC);
+    fatal_sys_if_negative___(fd);
+    fatal_sys_if_negative___(ftruncate(fd, len));
+    RockerStatsPage *page = mmap(nil, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    SoN(MAP_FAILED, page);
+
+    page->hdr.magic = ROCKER_STATS_MAGIC;
+    page->hdr.version = 1;
+    page->hdr.slot_num = 4;
+    page->hdr.slot_siz = sizeof(RockerStatsGuard);
+    page->hdr.launched = 5;
+    page->hdr.live = 1;
+    page->guards[1] = (RockerStatsGuard) {
+        .seq = 2, .pid = 42, .app_id = 7, .uid = 1, .gid = ~0ULL, .loop_id = 3,
+        .born_ns = 9, .flags = ROCKER_STATS_GUARD_activated,
+    };
+    page->guards[2] = (RockerStatsGuard) { .seq = 1, .pid = 43 };
+
+    // 与服务端相同, 经由 /proc 以只读方式重新打开
+    char path[64];
+    sprintf(path, "/proc/self/fd/%d", fd);
+    i___ ro_fd = open(path, O_RDONLY | O_CLOEXEC);
+    fatal_sys_if_negative___(ro_fd);
+
+    i32___ status = 0;
+    struct iovec vec = { .iov_base = &status, .iov_len = sizeof(status) };
+    struct FdTransEnv fte;
+    fatal_if_err___(IO.fte_init(&fte, &ro_fd, 1, &vec, 1));
+    fte.cmsg->cmsg_len = CMSG_LEN(sizeof(i___));
+    fte.msg.msg_controllen = CMSG_SPACE(sizeof(i___));
+    fatal_if_err___(IO.send_fd(maste_fd, &fte, &un, un_len));
+
+    munmap(page, len);
+    close(ro_fd);
+    close(fd);
+}
+
+void
+test_stats(void) {
+    printf("[test_stats]: 映射服务端的共享内存状态页, 只读,\n"
+            "读取计数及 guard 记录无需任何交互, 写入过程中的记录不被读出.\n\n");
+
+    So(ROCKER_ERR_param_invalid, ROCKER_stats_map(nil).err_no);
+    ROCKER_stats_unmap(nil);
+
+    pid_t pid = fork();
+    if (0 == pid) {
+        test_stats_child();
+        exit(0);
+    } else if (0 > pid) {
+        fatal_sys___();
+    }
+
+    sleep(1);
+
+    const RockerStatsPage *page = nil;
+    So(ROCKER_ERR_success, ROCKER_stats_map(&page).err_no);
+    SoN(nil, page);
+
+    i___ status = -1;
+    fatal_sys_if_negative___(waitpid(pid, &status, 0));
+    So(0, status);
+
+    // 服务端退出之后, 映射依然有效
+    RockerStatsHdr hdr;
+    ROCKER_stats_read_hdr(page, &hdr);
+    So(ROCKER_STATS_MAGIC, hdr.magic);
+    So(4, hdr.slot_num);
+    So(5, hdr.launched);
+    So(1, hdr.live);
+
+    RockerStatsGuard g;
+    So(0, ROCKER_stats_read_guard(page, 0, &g));
+    So(1, ROCKER_stats_read_guard(page, 1, &g));
+    So(42, g.pid);
+    So(7, g.app_id);
+    So(~0ULL, g.gid);
+    So(3, g.loop_id);
+    So(ROCKER_STATS_GUARD_activated, g.flags);
+    So(-1, ROCKER_stats_read_guard(page, 2, &g));
+    So(0, ROCKER_stats_read_guard(page, 4, &g));
+
+    // 只读映射, 不能被改为可写
+    So(-1, mprotect((void *)page, sizeof(RockerStatsHdr), PROT_READ | PROT_WRITE));
+
+    ROCKER_stats_unmap(page);
+
+    fprintf(stderr, "\x1b[32;01m[test_stats] passed!\x1b[00m\n");
+}
+
+//! 逐层占用 4KB 栈空间, 共 depth 层
+i___
+test_stack_use(i___ depth) {
+    volatile char buf[4096];
+    buf[0] = (char)depth;
+    buf[sizeof(buf) - 1] = (char)depth;
+    return 0 == depth ? buf[0] : test_stack_use(depth - 1) + buf[sizeof(buf) - 1];
+}
+
+i___
+test_stack_brother(void *depth) {
+    test_stack_use(*(i___ *)depth);
+    return 0;
+}
+
+//! 以 64KB 的栈空间创建兄弟进程, 其栈上的用量为 depth x 4KB, 返回其退出状态
+i___
+test_stack_brother_status(i___ depth) {
+    i___ pid_pipe[2];
+    fatal_sys_if_negative___(pipe(pid_pipe));
+
+    // 兄弟进程的父进程即为当前进程
+    pid_t pid = fork();
+    if (0 == pid) {
+        i___ brother_pid = -1;
+        fatal_if_err___(NameSpace.run_in_brotherx(test_stack_brother, &depth, 64 * 1024, &brother_pid));
+        fatal_sys_if_negative___(write(pid_pipe[1], &brother_pid, sizeof(i___)));
+        exit(0);
+    } else if (0 > pid) {
+        fatal_sys___();
+    }
+
+    i___ brother_pid = -1, status = -1;
+    So(sizeof(i___), read(pid_pipe[0], &brother_pid, sizeof(i___)));
+    fatal_sys_if_negative___(waitpid(pid, nil, 0));
+    fatal_sys_if_negative___(waitpid(brother_pid, &status, 0));
+    close(pid_pipe[0]);
+    close(pid_pipe[1]);
+
+    return status;
+}
+
+void
+test_stack(void) {
+    printf("[test_stack]: clone 栈空间被归还之后可被复用,\n"
+            "长度对齐到页大小, 最低处的保护页不可访问, 兄弟进程的栈空间大小可由调用方指定.\n\n");
+
+    Error *e = NameSpace.stack_get(0, &(struct Stack){ .addr = nil });
+    SoN(nil, e);
+    Log.clean_errchain(e);
+
+    size_t pagesiz = sysconf(_SC_PAGESIZE);
+    struct Stack s1 = { .addr = nil }, s2 = { .addr = nil };
+
+    fatal_if_err___(NameSpace.stack_get(64 * 1024 - 1, &s1));
+    So(64 * 1024 + pagesiz, s1.len);
+
+    // 栈空间可写
+    memset(s1.addr + pagesiz, 1, s1.len - pagesiz);
+
+    char *addr = s1.addr;
+    NameSpace.stack_put(&s1);
+    So(nil, s1.addr);
+
+    fatal_if_err___(NameSpace.stack_get(64 * 1024, &s1));
+    So(addr, s1.addr);
+
+    // 长度不同, 不复用
+    fatal_if_err___(NameSpace.stack_get(128 * 1024, &s2));
+    SoN(addr, s2.addr);
+
+    pid_t pid = fork();
+    if (0 == pid) {
+        *(volatile char *)s2.addr = 1;
+        exit(0);
+    } else if (0 > pid) {
+        fatal_sys___();
+    }
+
+    i___ status = -1;
+    fatal_sys_if_negative___(waitpid(pid, &status, 0));
+    So(1, WIFSIGNALED(status));
+    So(SIGSEGV, WTERMSIG(status));
+
+    // 兄弟进程的栈空间大小由调用方指定, 超出时触及保护页
+    So(0, test_stack_brother_status(8));
+    status = test_stack_brother_status(64);
+    So(1, WIFSIGNALED(status));
+    So(SIGSEGV, WTERMSIG(status));
+
+    NameSpace.stack_put(&s1);
+    NameSpace.stack_put(&s2);
+    NameSpace.stack_put(&s2);
+
+    fprintf(stderr, "\x1b[32;01m[test_stack] passed!\x1b[00m\n");
+}
+
+//! cgroup v2 的挂载点, 依次尝试纯 v2 及混合模式的布局
+static const char *cgroup_mnts[] = { "/sys/fs/cgroup", "/sys/fs/cgroup/unified" };
+
+//! 校验自身位于名为 arg 的 cgroup 中
+i___
+test_cgroup_app(void *arg) {
+    char buf[4096] = {0};
+    i___ fd = open("/proc/self/cgroup", O_RDONLY);
+    if (0 > fd || 0 >= read(fd, buf, sizeof(buf) - 1)) {
+        return 1;
+    }
+    close(fd);
+
+    // cgroup v2 的记录为 "0::<路径>"
+    char *v2 = strstr(buf, "0::");
+    return nil != v2 && nil != strstr(v2, arg) ? 0 : 2;
+}
+
+void
+test_cgroup(void) {
+    printf("[test_cgroup]: 带有 cgroup 描述符时, app 进程在执行 app 函数之前迁入该 cgroup,\n"
+            "app 退出之后 cgroup.events 中的 populated 复位.\n\n");
+
+    char path[256], name[64];
+    const char *mnt = nil;
+    for (size_t i = 0; i < sizeof(cgroup_mnts) / sizeof(cgroup_mnts[0]); ++i) {
+        sprintf(path, "%s/cgroup.procs", cgroup_mnts[i]);
+        if (0 == access(path, W_OK)) {
+            mnt = cgroup_mnts[i];
+            break;
+        }
+    }
+    if (nil == mnt) {
+        fprintf(stderr, "\x1b[33;01m[test_cgroup] cgroup v2 unavailable, skipped!\x1b[00m\n");
+        return;
+    }
+
+    sprintf(name, "rocker_client_test_%d", getpid());
+    sprintf(path, "%s/%s", mnt, name);
+    fatal_sys_if_negative___(mkdir(path, 0755));
+
+    i___ cgfd = open(path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    fatal_sys_if_negative___(cgfd);
+
+    // 只进入自身的 mnt namespace, 不涉及 user namespace
+    i___ fdset[1];
+    fatal_if_err___(IO.open_for_read(fdset, getns_path("mnt").path));
+
+    pid_t pid = -1;
+    bool___ ns_entered = false___;
+    fatal_if_err___(NameSpace.enter_and_run(fdset, 1, cgfd, test_cgroup_app, name, &pid, &ns_entered, nil));
+    So(true___, ns_entered);
+
+    i___ status = -1;
+    fatal_sys_if_negative___(waitpid(pid, &status, 0));
+    So(1, WIFEXITED(status));
+    So(0, WEXITSTATUS(status));
+
+    char events[256] = {0};
+    i___ evfd = openat(cgfd, "cgroup.events", O_RDONLY);
+    fatal_sys_if_negative___(evfd);
+    fatal_sys_if_negative___(read(evfd, events, sizeof(events) - 1));
+    SoN(nil, strstr(events, "populated 0"));
+    close(evfd);
+
+    close(fdset[0]);
+    close(cgfd);
+    fatal_sys_if_negative___(rmdir(path));
+
+    fprintf(stderr, "\x1b[32;01m[test_cgroup] passed!\x1b[00m\n");
+}
+
+static volatile i___ atfork_child_ran = 0;
+
+void
+test_atfork_child(void) {
+    atfork_child_ran = 1;
+}
+
+//! 在 app 进程中分配内存并格式化输出, 经由退出码回报 pthread_atfork 的子进程回调是否执行
+i___
+test_atfork_app(void *_ unused___) {
+    char *buf = malloc(4096);
+    if (nil == buf) {
+        return 2;
+    }
+    snprintf(buf, 4096, "[test_atfork]: app pid %d\n", getpid());
+    free(buf);
+
+    return 1 == atfork_child_ran ? 0 : 1;
+}
+
+//! 与 app 进程的创建并发地持有 malloc/stdio 的锁
+void *
+test_atfork_thread(void *stop) {
+    while (!*(volatile i___ *)stop) {
+        char *p = malloc(128);
+        snprintf(p, 128, "%p", (void *)p);
+        free(p);
+    }
+    return nil;
+}
+
+void
+test_atfork(void) {
+    printf("[test_atfork]: app 进程以 fork 的语义创建, pthread_atfork 注册的回调被执行,\n"
+            "其它线程并发使用 malloc 时, app 进程中的 malloc/stdio 可正常使用.\n\n");
+
+    fatal_sys_if_negative___(pthread_atfork(nil, nil, test_atfork_child));
+
+    i___ stop = 0;
+    pthread_t tid;
+    So(0, pthread_create(&tid, nil, test_atfork_thread, &stop));
+
+    // 进入自身的 mnt, pid namespace, 不涉及 user namespace
+    i___ fdset[2];
+    fatal_if_err___(IO.open_for_read(&fdset[0], getns_path("mnt").path));
+    fatal_if_err___(IO.open_for_read(&fdset[1], getns_path("pid").path));
+
+    for (i___ i = 0; i < 20; ++i) {
+        pid_t pid = -1;
+        bool___ ns_entered = false___;
+        fatal_if_err___(NameSpace.enter_and_run(fdset, 2, -1, test_atfork_app, nil, &pid, &ns_entered, nil));
+        So(true___, ns_entered);
+
+        i___ status = -1;
+        fatal_sys_if_negative___(waitpid(pid, &status, 0));
+        So(1, WIFEXITED(status));
+        So(0, WEXITSTATUS(status));
+    }
+
+    stop = 1;
+    So(0, pthread_join(tid, nil));
+    close(fdset[0]);
+    close(fdset[1]);
+
+    fprintf(stderr, "\x1b[32;01m[test_atfork] passed!\x1b[00m\n");
+}
+
+#define LOG_THREADS 4
+#define LOG_PER_THREAD 200
+
+void *
+test_log_thread(void *_ unused___) {
+    for (i___ i = 0; i < LOG_PER_THREAD; ++i) {
+        info___("test_log");
+    }
+    return nil;
+}
+
+//! 统计 buf 中 pattern 出现的次数
+i___
+count_of(const char *buf, const char *pattern) {
+    i___ cnt = 0;
+    for (const char *p = buf; nil != (p = strstr(p, pattern)); p += strlen(pattern)) {
+        ++cnt;
+    }
+    return cnt;
+}
+
+void
+test_log(void) {
+    printf("[test_log]: 多个线程并发写日志, 每条日志完整且不丢失;\n"
+            "错误链立即写出, 常规日志在线程退出时写出.\n\n");
+
+    char path[] = "/tmp/librocker_client_test_log_XXXXXX";
+    i___ fd = mkstemp(path);
+    fatal_sys_if_negative___(fd);
+    unlink(path);
+
+    i___ saved_stderr = dup(STDERR_FILENO);
+    fatal_sys_if_negative___(saved_stderr);
+    fatal_sys_if_negative___(dup2(fd, STDERR_FILENO));
+
+    pthread_t tids[LOG_THREADS];
+    for (i___ i = 0; i < LOG_THREADS; ++i) {
+        So(0, pthread_create(&tids[i], nil, test_log_thread, nil));
+    }
+    for (i___ i = 0; i < LOG_THREADS; ++i) {
+        So(0, pthread_join(tids[i], nil));
+    }
+
+    Error *e = err_new___(-1, "test_log_err", nil);
+    display_clean_errchain___(e);
+
+    fatal_sys_if_negative___(dup2(saved_stderr, STDERR_FILENO));
+    close(saved_stderr);
+
+    static char buf[LOG_THREADS * LOG_PER_THREAD * 256];
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    fatal_sys_if_negative___(n);
+    buf[n] = '\0';
+    close(fd);
+
+    So(LOG_THREADS * LOG_PER_THREAD, count_of(buf, "INFO:\x1b[00m test_log\n"));
+    // 错误链: 首行及一个 cause
+    So(LOG_THREADS * LOG_PER_THREAD + 2, count_of(buf, "   └── func: "));
+    So(1, count_of(buf, "test_log_err (error code: -1)"));
+
+    fprintf(stderr, "\x1b[32;01m[test_log] passed!\x1b[00m\n");
+}
+
+void
+test_errchain(void) {
+    printf("[test_errchain]: 错误链的节点取自线程私有的 arena, 释放后可被复用;\n"
+            "arena 耗尽时丢弃外层节点并记录数量, 不中止进程.\n\n");
+
+    Error *e = err_new___(-1, "root", nil);
+    Error *root = e;
+    for (i___ i = 1; i < 100; ++i) {
+        e = err_new___(ECHAIN_MARKER___, ECHAIN_MARKER_DESC___, e);
+    }
+
+    // arena 共 64 个节点
+    So(100 - 64, e->truncated);
+    So(ECHAIN_MARKER___, e->code);
+
+    i___ depth = 1;
+    Error *bottom = e;
+    for (; nil != bottom->cause; bottom = bottom->cause) {
+        ++depth;
+    }
+    So(64, depth);
+    So(root, bottom);
+
+    // 已无空闲节点, 返回静态节点
+    Error *full = err_new___(-1, "no room", nil);
+    So(EARENA_FULL___, full->code);
+    Log.clean_errchain(full);
+
+    Log.clean_errchain(e);
+
+    // 节点全部归还之后, 可再次取得 64 个
+    Error *es[64];
+    for (i___ i = 0; i < 64; ++i) {
+        es[i] = err_new___(-1, "again", nil);
+        SoN(EARENA_FULL___, es[i]->code);
+    }
+    for (i___ i = 0; i < 64; ++i) {
+        Log.clean_errchain(es[i]);
+    }
+
+    fprintf(stderr, "\x1b[32;01m[test_errchain] passed!\x1b[00m\n");
+}
+
 i___
 main(void) {
     test_pressure();
     test_ns();
+    test_session();
+    test_batch();
+    test_batch_fds();
+    test_seqpacket();
+    test_lifeline_exec();
+    test_async();
+    test_stats();
+    test_stack();
+    test_cgroup();
+    test_atfork();
+    test_log();
+    test_errchain();
 
     return 0;
 }
@@ -1,3 +1,444 @@
-//! TODO
+//! 并发启动压力测试.
+//!
+//! 以指定的速率与并发度, 经由 `RockerRequest::enter_rocker` 连续启动 rocker,
+//! 每个 App 在 rocker 中停留指定的时长后退出; 用于评估设备在开机时
+//! 能够同时启动多少个 App, 以及启动延迟在何种负载下开始恶化.
+//!
+//! 运行期间每隔一段时间输出一行采样记录(JSON), 包括累计的启动/成功/失败数量,
+//! 区间吞吐量, 存活的 App 数量, 以及 rocker_server 与其全部子进程(JG 等)的 RSS;
+//! 结束时输出汇总记录: 吞吐量, 延迟的百分位数与直方图, 按 ROCKER_ERR 分类的失败数量.
+//!
+//! 须以 root 身份运行, 且 rocker_server 已启动.
+//!
+//! 用法: rocker_client_bench_with_postgres [--选项=值 ...]
+//!
+//!   --launches=N     启动总次数, 默认 1000
+//!   --concurrency=N  同时发起请求的线程数量, 默认 8
+//!   --rate=N         每秒发起的启动次数上限, 0 表示不限, 默认 0
+//!   --pkgs=N         不同 App 包的数量, 各次启动轮流使用, 1 表示全部相同, 默认 1
+//!   --pkg-mb=N       每个 App 包中随机数据的大小(MB), 默认 1
+//!   --lifetime-ms=N  App 在 rocker 中停留的时长, 默认 1000
+//!   --sample-ms=N    采样间隔, 默认 1000
 
-fn main() {}
+use core::{alt, d, p, pnk};
+use librocker_client_wrapper::*;
+use nix::{
+    sys::wait::{waitpid, WaitPidFlag, WaitStatus},
+    unistd::Pid,
+};
+use std::{
+    collections::{HashMap, HashSet},
+    env, fs,
+    io::{Read, Write},
+    process::{self, Command, Stdio},
+    sync::{
+        atomic::{AtomicBool, AtomicUsize, Ordering},
+        Arc, Mutex,
+    },
+    thread,
+    time::{Duration, Instant},
+};
+
+// 测试用的 App 包及 rocker 目录均位于此处, 结束后删除
+const WORK_DIR: &str = "/tmp/.rocker_load____";
+
+const SERVER_NAME: &str = "rocker_server";
+
+// 检查 App 进程是否退出的间隔
+const REAP_INTERVAL: Duration = Duration::from_millis(20);
+
+struct Cfg {
+    launches: usize,
+    concurrency: usize,
+    rate: usize,
+    pkgs: usize,
+    pkg_mb: usize,
+    lifetime: Duration,
+    sample: Duration,
+}
+
+impl Cfg {
+    fn parse() -> Cfg {
+        let mut cfg = Cfg {
+            launches: 1000,
+            concurrency: 8,
+            rate: 0,
+            pkgs: 1,
+            pkg_mb: 1,
+            lifetime: Duration::from_millis(1000),
+            sample: Duration::from_millis(1000),
+        };
+
+        for arg in env::args().skip(1) {
+            let mut kv = arg.splitn(2, '=');
+            let (k, v) = (kv.next().unwrap_or(""), kv.next().unwrap_or(""));
+            let v = v.parse::<usize>().unwrap_or_else(|_| usage(&arg));
+            match k {
+                "--launches" => cfg.launches = v,
+                "--concurrency" => cfg.concurrency = v.max(1),
+                "--rate" => cfg.rate = v,
+                "--pkgs" => cfg.pkgs = v.max(1),
+                "--pkg-mb" => cfg.pkg_mb = v,
+                "--lifetime-ms" => {
+                    cfg.lifetime = Duration::from_millis(v as u64)
+                }
+                "--sample-ms" => {
+                    cfg.sample = Duration::from_millis(v.max(10) as u64)
+                }
+                _ => usage(&arg),
+            }
+        }
+
+        cfg
+    }
+}
+
+fn usage(arg: &str) -> ! {
+    eprintln!(
+        "invalid argument: {}\nusage: rocker_client_bench_with_postgres [--launches=N] [--concurrency=N] [--rate=N] [--pkgs=N] [--pkg-mb=N] [--lifetime-ms=N] [--sample-ms=N]",
+        arg
+    );
+    process::exit(1);
+}
+
+// 各线程共享的统计数据
+#[derive(Default)]
+struct Stats {
+    // 已领取的启动序号
+    next: AtomicUsize,
+    ok: AtomicUsize,
+    failed: AtomicUsize,
+    // 成功启动的延迟, 单位: 纳秒
+    latency: Mutex<Vec<u64>>,
+    // 以 ROCKER_ERR 名称分类的失败数量
+    errors: Mutex<HashMap<&'static str, usize>>,
+    // 尚未退出的 App 进程
+    apps: Mutex<Vec<Pid>>,
+    // 所有启动请求均已完成
+    done: AtomicBool,
+}
+
+fn main() {
+    let cfg = Arc::new(Cfg::parse());
+    let stats = Arc::new(Stats::default());
+
+    let _ = fs::remove_dir_all(WORK_DIR);
+    let pkgs = Arc::new(
+        (0..cfg.pkgs)
+            .map(|i| gen_pkg(i, cfg.pkg_mb))
+            .collect::<Vec<_>>(),
+    );
+
+    let start = Instant::now();
+
+    let reaper = {
+        let stats = Arc::clone(&stats);
+        thread::spawn(move || reap(&stats))
+    };
+    let sampler = {
+        let (cfg, stats) = (Arc::clone(&cfg), Arc::clone(&stats));
+        thread::spawn(move || sample(&cfg, &stats, start))
+    };
+
+    let workers = (0..cfg.concurrency)
+        .map(|_| {
+            let (cfg, stats, pkgs) =
+                (Arc::clone(&cfg), Arc::clone(&stats), Arc::clone(&pkgs));
+            thread::spawn(move || launch(&cfg, &stats, &pkgs, start))
+        })
+        .collect::<Vec<_>>();
+
+    workers.into_iter().for_each(|w| w.join().unwrap());
+    let elapsed = start.elapsed();
+    stats.done.store(true, Ordering::Release);
+
+    reaper.join().unwrap();
+    sampler.join().unwrap();
+
+    report(&cfg, &stats, elapsed);
+
+    let _ = fs::remove_dir_all(WORK_DIR);
+}
+
+// 生成第 idx 个 squashfs 包, 其中含一个 mb MB 的随机数据文件;
+// 各包的内容均不相同, 因而各自占用一个 loop 设备
+fn gen_pkg(idx: usize, mb: usize) -> String {
+    let src = format!("{}/src_{}", WORK_DIR, idx);
+    let pkg = format!("{}/pkg_{}.squashfs", WORK_DIR, idx);
+    pnk!(fs::create_dir_all(&src));
+
+    pnk!(fs::write(format!("{}/id", src), idx.to_string()));
+
+    let mut rand = pnk!(fs::File::open("/dev/urandom"));
+    let mut f = pnk!(fs::File::create(format!("{}/data", src)));
+    let mut buf = vec![0u8; 1024 * 1024];
+    (0..mb).for_each(|_| {
+        pnk!(rand.read_exact(&mut buf));
+        pnk!(f.write_all(&buf));
+    });
+
+    let status = pnk!(Command::new("mksquashfs")
+        .arg(&src)
+        .arg(&pkg)
+        .arg("-noappend")
+        .stdout(Stdio::null())
+        .status());
+    assert!(status.success());
+
+    pkg
+}
+
+// 工作线程: 依次领取启动序号, 按 rate 指定的时刻发起请求
+fn launch(cfg: &Cfg, stats: &Stats, pkgs: &[String], start: Instant) {
+    let lifetime = cfg.lifetime;
+
+    loop {
+        let i = stats.next.fetch_add(1, Ordering::Relaxed);
+        if i >= cfg.launches {
+            return;
+        }
+
+        if 0 < cfg.rate {
+            let at = start
+                + Duration::from_nanos(
+                    i as u64 * 1_000_000_000 / cfg.rate as u64,
+                );
+            let now = Instant::now();
+            if at > now {
+                thread::sleep(at - now);
+            }
+        }
+
+        // 每个 rocker 使用独立的数据目录, 同一 App 包共用挂载路径
+        let pkg_idx = i % pkgs.len();
+        let exec_dir = format!("{}/exec_{}", WORK_DIR, pkg_idx);
+        let data_dir = format!("{}/data/{}", WORK_DIR, i);
+
+        let mut req = RockerRequest::new();
+        req.app_id = 10000 + i as u32;
+        req.uid = 1;
+        req.gid = Some(1);
+        req.app_pkg_path = &pkgs[pkg_idx];
+        req.app_exec_dir = &exec_dir;
+        req.app_data_dir = &data_dir;
+        req.app_overlay_dirs = &["/usr", "/etc", "/var"];
+
+        let ts = Instant::now();
+        match req.enter_rocker(Box::new(move || {
+            thread::sleep(lifetime);
+            0
+        })) {
+            Ok(res) => {
+                let ns = ts.elapsed().as_nanos() as u64;
+                stats.latency.lock().unwrap().push(ns);
+                stats
+                    .apps
+                    .lock()
+                    .unwrap()
+                    .push(Pid::from_raw(res.app_pid as libc::pid_t));
+                stats.ok.fetch_add(1, Ordering::Relaxed);
+            }
+            Err(e) => {
+                *stats
+                    .errors
+                    .lock()
+                    .unwrap()
+                    .entry(err_name(&e))
+                    .or_insert(0) += 1;
+                stats.failed.fetch_add(1, Ordering::Relaxed);
+                p(e);
+            }
+        }
+    }
+}
+
+// 错误对应的 ROCKER_ERR 名称
+fn err_name(e: &Error) -> &'static str {
+    e.iter()
+        .filter_map(|c| c.downcast_ref::<Error>())
+        .find_map(|e| match e.kind() {
+            ErrorKind::RockerSys => Some("sys"),
+            ErrorKind::RockerParam => Some("param_invalid"),
+            ErrorKind::RockerServerUnaddr => Some("server_unaddr_invalid"),
+            ErrorKind::RockerGenLocalAddr => Some("gen_local_addr_failed"),
+            ErrorKind::RockerSendReq => Some("send_req_failed"),
+            ErrorKind::RockerRecvResp => Some("recv_resp_failed"),
+            ErrorKind::RockerBuildRocker => Some("build_rocker_failed"),
+            ErrorKind::RockerEnterRocker => Some("enter_rocker_failed"),
+            ErrorKind::RockerAppExec => Some("app_exec_failed"),
+            ErrorKind::RockerGetGuardname => Some("get_guardname_failed"),
+            _ => None,
+        })
+        .unwrap_or("unknown")
+}
+
+// 回收已退出的 App 进程, 所有请求完成且 App 全部退出后返回;
+// 只等待已知的 PID, 以免抢先回收客户端库内部的临时进程
+fn reap(stats: &Stats) {
+    loop {
+        let done = stats.done.load(Ordering::Acquire);
+
+        let mut apps = stats.apps.lock().unwrap();
+        apps.retain(|&pid| match waitpid(pid, Some(WaitPidFlag::WNOHANG)) {
+            Ok(WaitStatus::StillAlive) => true,
+            _ => false,
+        });
+        if done && apps.is_empty() {
+            return;
+        }
+        drop(apps);
+
+        thread::sleep(REAP_INTERVAL);
+    }
+}
+
+// 定时输出采样记录, 回收线程结束后输出最后一条并返回
+fn sample(cfg: &Cfg, stats: &Stats, start: Instant) {
+    let mut last = (Instant::now(), 0);
+
+    loop {
+        thread::sleep(cfg.sample);
+
+        let now = Instant::now();
+        let ok = stats.ok.load(Ordering::Relaxed);
+        let live = stats.apps.lock().unwrap().len();
+        let (server_rss, guard_rss, guards) = server_rss();
+
+        println!(
+            "{{\"type\":\"sample\",\"t_ms\":{},\"launched\":{},\"ok\":{},\"failed\":{},\"ok_per_s\":{:.1},\"live\":{},\"server_rss_kb\":{},\"guards\":{},\"guard_rss_kb\":{}}}",
+            now.duration_since(start).as_millis(),
+            stats.next.load(Ordering::Relaxed).min(cfg.launches),
+            ok,
+            stats.failed.load(Ordering::Relaxed),
+            (ok - last.1) as f64 / now.duration_since(last.0).as_secs_f64(),
+            live,
+            server_rss,
+            guards,
+            guard_rss
+        );
+        last = (now, ok);
+
+        if stats.done.load(Ordering::Acquire) && 0 == live {
+            return;
+        }
+    }
+}
+
+// 返回 (rocker_server 进程的 RSS, 其全部子孙进程的 RSS 之和, 子孙进程数量), 单位: KB
+fn server_rss() -> (u64, u64, usize) {
+    // (pid, ppid, 进程名称)
+    let procs = pnk!(fs::read_dir("/proc"))
+        .filter_map(|ent| ent.ok()?.file_name().to_str()?.parse::<u32>().ok())
+        .filter_map(|pid| {
+            let stat =
+                fs::read_to_string(format!("/proc/{}/stat", pid)).ok()?;
+            // 进程名称中可能含有空格及括号
+            let l = stat.find('(')?;
+            let r = stat.rfind(')')?;
+            let ppid =
+                stat[r + 1..].split_whitespace().nth(1)?.parse().ok()?;
+            Some((pid, ppid, stat[l + 1..r].to_owned()))
+        })
+        .collect::<Vec<(u32, u32, String)>>();
+
+    let servers = procs
+        .iter()
+        .filter(|(_, _, name)| SERVER_NAME == name)
+        .map(|(pid, _, _)| *pid)
+        .collect::<HashSet<_>>();
+
+    // 逐层向下查找子孙进程, 进程树的深度有限
+    let mut family = servers.clone();
+    loop {
+        let n = family.len();
+        procs.iter().for_each(|(pid, ppid, _)| {
+            if family.contains(ppid) {
+                family.insert(*pid);
+            }
+        });
+        if n == family.len() {
+            break;
+        }
+    }
+
+    let server_rss = servers.iter().map(|&pid| rss(pid)).sum();
+    let guard_rss = family
+        .iter()
+        .filter(|pid| !servers.contains(pid))
+        .map(|&pid| rss(pid))
+        .sum();
+
+    (server_rss, guard_rss, family.len() - servers.len())
+}
+
+// 取自 /proc/<PID>/status 中的 VmRSS, 单位: KB; 进程已退出时为 0
+fn rss(pid: u32) -> u64 {
+    fs::read_to_string(format!("/proc/{}/status", pid))
+        .ok()
+        .and_then(|s| {
+            s.lines()
+                .find(|l| l.starts_with("VmRSS:"))
+                .and_then(|l| l.split_whitespace().nth(1))
+                .and_then(|v| v.parse().ok())
+        })
+        .unwrap_or(0)
+}
+
+// 输出汇总记录: 吞吐量, 延迟(微秒)的百分位数与直方图, 失败原因
+fn report(cfg: &Cfg, stats: &Stats, elapsed: Duration) {
+    let mut latency = stats.latency.lock().unwrap().clone();
+    latency.sort_unstable();
+
+    let pct = |q: usize| -> f64 {
+        alt!(
+            latency.is_empty(),
+            0.0,
+            latency[(latency.len() * q / 100).min(latency.len() - 1)] as f64
+                / 1000.0
+        )
+    };
+
+    // 第 k 个桶统计 [2^k, 2^(k+1)) 微秒内的样本, 只输出非空的桶
+    let mut buckets = [0usize; 64];
+    latency.iter().for_each(|&ns| {
+        buckets[63 - (ns / 1000).max(1).leading_zeros() as usize] += 1;
+    });
+    let hist = buckets
+        .iter()
+        .enumerate()
+        .filter(|(_, &n)| 0 < n)
+        .map(|(k, n)| format!("[{},{}]", 1u64 << (k + 1), n))
+        .collect::<Vec<_>>()
+        .join(",");
+
+    let errors = stats
+        .errors
+        .lock()
+        .unwrap()
+        .iter()
+        .map(|(name, n)| format!("\"{}\":{}", name, n))
+        .collect::<Vec<_>>()
+        .join(",");
+
+    let ok = stats.ok.load(Ordering::Relaxed);
+    println!(
+        "{{\"type\":\"summary\",\"version\":\"{}\",\"launches\":{},\"concurrency\":{},\"rate\":{},\"pkgs\":{},\"pkg_mb\":{},\"lifetime_ms\":{},\"elapsed_ms\":{},\"ok\":{},\"failed\":{},\"ok_per_s\":{:.1},\"p50_us\":{:.1},\"p90_us\":{:.1},\"p99_us\":{:.1},\"max_us\":{:.1},\"histogram_le_us\":[{}],\"errors\":{{{}}}}}",
+        env!("CARGO_PKG_VERSION"),
+        cfg.launches,
+        cfg.concurrency,
+        cfg.rate,
+        cfg.pkgs,
+        cfg.pkg_mb,
+        cfg.lifetime.as_millis(),
+        elapsed.as_millis(),
+        ok,
+        stats.failed.load(Ordering::Relaxed),
+        ok as f64 / elapsed.as_secs_f64(),
+        pct(50),
+        pct(90),
+        pct(99),
+        pct(100),
+        hist,
+        errors
+    );
+}
@@ -0,0 +1,151 @@
+//! 启动延迟基准测试.
+//!
+//! 以不同大小的 squashfs 包反复调用 `ROCKER_enter_rocker`, 统计端到端耗时
+//! 及各阶段耗时的 p50/p90/p99/max; 每个 (包大小, 阶段) 组合输出一行 JSON,
+//! 附带版本号, 以便在各版本之间比较.
+//!
+//! 各阶段只统计实际经历过的样本, 如 App 包已被其它 rocker 挂载时,
+//! loop_attach/squashfs_mount 不计入, count 字段为参与统计的样本数量.
+//!
+//! 须以 root 身份运行, 且 rocker_server 已启动.
+//!
+//! 用法: rocker_launch_bench [迭代次数] [包大小(MB) ...]
+
+use core::{alt, d, p, pnk};
+use librocker_client_wrapper::*;
+use nix::{sys::wait::waitpid, unistd::Pid};
+use std::{
+    env, fs,
+    io::{Read, Write},
+    process::{Command, Stdio},
+    time::Instant,
+};
+
+// 测试用的 App 包及 rocker 目录均位于此处, 结束后删除
+const WORK_DIR: &str = "/tmp/.rocker_bench____";
+
+const DEFAULT_ITERS: usize = 200;
+const DEFAULT_PKG_MB: [usize; 3] = [1, 16, 128];
+
+fn main() {
+    let args = env::args().skip(1).collect::<Vec<_>>();
+
+    let iters = args
+        .get(0)
+        .map(|i| pnk!(i.parse::<usize>()))
+        .unwrap_or(DEFAULT_ITERS)
+        .max(1);
+    let sizes = alt!(
+        1 < args.len(),
+        args[1..]
+            .iter()
+            .map(|s| pnk!(s.parse::<usize>()))
+            .collect::<Vec<_>>(),
+        DEFAULT_PKG_MB.to_vec()
+    );
+
+    sizes.iter().for_each(|&mb| bench(mb, iters));
+
+    let _ = fs::remove_dir_all(WORK_DIR);
+}
+
+// 生成一个 squashfs 包, 其中含一个 mb MB 的随机数据文件;
+// 随机数据无法压缩, 包的大小与之相近
+fn gen_pkg(mb: usize) -> String {
+    let src = format!("{}/src_{}", WORK_DIR, mb);
+    let pkg = format!("{}/pkg_{}.squashfs", WORK_DIR, mb);
+
+    let _ = fs::remove_dir_all(&src);
+    let _ = fs::remove_file(&pkg);
+    pnk!(fs::create_dir_all(&src));
+
+    let mut rand = pnk!(fs::File::open("/dev/urandom"));
+    let mut f = pnk!(fs::File::create(format!("{}/data", src)));
+    let mut buf = vec![0u8; 1024 * 1024];
+    (0..mb).for_each(|_| {
+        pnk!(rand.read_exact(&mut buf));
+        pnk!(f.write_all(&buf));
+    });
+
+    let status = pnk!(Command::new("mksquashfs")
+        .arg(&src)
+        .arg(&pkg)
+        .arg("-noappend")
+        .stdout(Stdio::null())
+        .status());
+    assert!(status.success());
+
+    pkg
+}
+
+// 以大小为 mb MB 的 App 包连续启动 iters 次, app 立即退出
+fn bench(mb: usize, iters: usize) {
+    let pkg = gen_pkg(mb);
+    let exec_dir = format!("{}/exec_{}", WORK_DIR, mb);
+    let data_dir = format!("{}/data_{}", WORK_DIR, mb);
+
+    let mut req = RockerRequest::new();
+    req.app_id = 1000 + mb as u32;
+    req.uid = 1;
+    req.gid = Some(1);
+    req.app_pkg_path = &pkg;
+    req.app_exec_dir = &exec_dir;
+    req.app_data_dir = &data_dir;
+    req.app_overlay_dirs = &["/usr", "/etc", "/var"];
+
+    let mut total = Vec::with_capacity(iters);
+    let mut stages = vec![Vec::with_capacity(iters); STAGES.len()];
+    let mut failed = 0;
+
+    for _ in 0..iters {
+        let ts = Instant::now();
+        match req.enter_rocker_traced(Box::new(|| 0)) {
+            Ok((res, trace)) => {
+                total.push(ts.elapsed().as_nanos() as u64);
+                stages
+                    .iter_mut()
+                    .zip(trace.iter())
+                    .filter(|(_, &ns)| 0 < ns)
+                    .for_each(|(s, &ns)| s.push(ns));
+                pnk!(waitpid(Pid::from_raw(res.app_pid as libc::pid_t), None));
+            }
+            Err(e) => {
+                failed += 1;
+                p(e);
+            }
+        }
+    }
+
+    report(mb, "total", total, failed);
+    STAGES
+        .iter()
+        .zip(stages.into_iter())
+        .for_each(|(name, s)| report(mb, name, s, 0));
+}
+
+// 输出一行统计结果, 单位: 微秒
+fn report(mb: usize, stage: &str, mut samples: Vec<u64>, failed: usize) {
+    samples.sort_unstable();
+
+    let pct = |q: usize| -> f64 {
+        alt!(
+            samples.is_empty(),
+            0.0,
+            samples[(samples.len() * q / 100).min(samples.len() - 1)] as f64
+                / 1000.0
+        )
+    };
+
+    println!(
+        "{{\"version\":\"{}\",\"pkg_mb\":{},\"stage\":\"{}\",\"count\":{},\"failed\":{},\"p50_us\":{:.1},\"p90_us\":{:.1},\"p99_us\":{:.1},\"max_us\":{:.1}}}",
+        env!("CARGO_PKG_VERSION"),
+        mb,
+        stage,
+        samples.len(),
+        failed,
+        pct(50),
+        pct(90),
+        pct(99),
+        pct(100)
+    );
+}
@@ -17,6 +17,8 @@ pub(super) const ROCKER_ERR_enter_rocker_failed: ROCKER_ERR = 8;
 pub(super) const ROCKER_ERR_app_exec_failed: ROCKER_ERR = 9;
 pub(super) const ROCKER_ERR_get_guardname_failed: ROCKER_ERR = 10;
 
+pub(super) const ROCKER_STAGE_MAX: usize = 9;
+
 #[repr(C)]
 #[derive(Debug)]
 pub(super) struct RockerRequest {
@@ -27,6 +29,14 @@ pub(super) struct RockerRequest {
     pub(super) app_exec_dir: *const raw::c_char,
     pub(super) app_data_dir: *const raw::c_char,
     pub(super) app_overlay_dirs: [*const raw::c_char; 16usize],
+    pub(super) app_overlay_dirs_more: *const *const raw::c_char,
+    pub(super) memory_max: raw::c_ulonglong,
+    pub(super) memory_high: raw::c_ulonglong,
+    pub(super) cpu_max_us: raw::c_uint,
+    pub(super) cpu_period_us: raw::c_uint,
+    pub(super) cpu_weight: raw::c_uint,
+    pub(super) pids_max: raw::c_uint,
+    pub(super) io_max: *const raw::c_char,
 }
 
 #[repr(C)]
@@ -37,6 +47,11 @@ pub(super) struct RockerResult {
     pub(super) guard_pname: [raw::c_char; 16usize],
 }
 
+#[repr(C)]
+pub(super) struct RockerTrace {
+    pub(super) ns: [raw::c_ulonglong; ROCKER_STAGE_MAX],
+}
+
 #[link(name = "rocker_client", kind = "static")]
 extern "C" {
     pub(super) fn ROCKER_enter_rocker(
@@ -45,5 +60,12 @@ extern "C" {
         app_args: *const raw::c_void,
     ) -> RockerResult;
 
+    pub(super) fn ROCKER_enter_rocker_traced(
+        req: *const RockerRequest,
+        app: unsafe extern "C" fn(arg: *const raw::c_void) -> raw::c_int,
+        app_args: *const raw::c_void,
+        trace: *mut RockerTrace,
+    ) -> RockerResult;
+
     pub(super) fn ROCKER_get_guardname(pid: raw::c_int) -> RockerResult;
 }
@@ -16,7 +16,9 @@ macro_rules! res_convert {
         match res.err_no {
             v if v == metal::ROCKER_ERR_success => Ok(res),
             v if v == metal::ROCKER_ERR_sys => Err(errgen!(RockerSys)),
-            v if v == metal::ROCKER_ERR_param_invalid => Err(errgen!(RockerParam)),
+            v if v == metal::ROCKER_ERR_param_invalid => {
+                Err(errgen!(RockerParam))
+            }
             v if v == metal::ROCKER_ERR_server_unaddr_invalid => {
                 Err(errgen!(RockerServerUnaddr))
             }
@@ -46,6 +48,23 @@ macro_rules! res_convert {
     }};
 }
 
+/// 启动过程中各阶段的名称, 与 librocker_client 中的 ROCKER_STAGE 一一对应;
+/// 服务端阶段(loop_attach 至 idmap)均包含于 wait_resp 之中
+pub const STAGES: [&str; metal::ROCKER_STAGE_MAX] = [
+    "send_req",
+    "loop_attach",
+    "squashfs_mount",
+    "guard_clone",
+    "overlay_mount",
+    "idmap",
+    "wait_resp",
+    "enter_ns",
+    "app_exec",
+];
+
+/// 各阶段的耗时, 单位: 纳秒, 下标与 STAGES 一致, 未经历的阶段为 0
+pub type RockerTrace = [u64; metal::ROCKER_STAGE_MAX];
+
 #[derive(Debug)]
 pub struct RockerResult {
     pub app_pid: u32,
@@ -80,6 +99,26 @@ impl<'a> RockerRequest<'a> {
     pub fn enter_rocker(
         &self,
         app_cb: Box<dyn Fn() -> i32>,
+    ) -> Result<RockerResult> {
+        self.enter(app_cb, ptr::null_mut())
+    }
+
+    /// 与 enter_rocker 相同, 同时返回启动过程中各阶段的耗时
+    pub fn enter_rocker_traced(
+        &self,
+        app_cb: Box<dyn Fn() -> i32>,
+    ) -> Result<(RockerResult, RockerTrace)> {
+        let mut trace = metal::RockerTrace {
+            ns: [0; metal::ROCKER_STAGE_MAX],
+        };
+        self.enter(app_cb, &mut trace).map(|res| (res, trace.ns))
+    }
+
+    // trace 为空指针时不记录各阶段的耗时
+    fn enter(
+        &self,
+        app_cb: Box<dyn Fn() -> i32>,
+        trace: *mut metal::RockerTrace,
     ) -> Result<RockerResult> {
         extern "C" fn callback(cb: *const c_void) -> c_int {
             let cb: &dyn Fn() -> i32 = unsafe {
@@ -96,6 +135,14 @@ impl<'a> RockerRequest<'a> {
             app_exec_dir: CString::new(self.app_exec_dir).c(d!())?.into_raw(),
             app_data_dir: CString::new(self.app_data_dir).c(d!())?.into_raw(),
             app_overlay_dirs: [ptr::null(); 16],
+            app_overlay_dirs_more: ptr::null(),
+            memory_max: 0,
+            memory_high: 0,
+            cpu_max_us: 0,
+            cpu_period_us: 0,
+            cpu_weight: 0,
+            pids_max: 0,
+            io_max: ptr::null(),
         };
 
         let mut overlaydirs = vec![];
@@ -108,11 +155,13 @@ impl<'a> RockerRequest<'a> {
             .zip(overlaydirs.iter().map(|d| d.as_ptr()))
             .for_each(|(a, b)| *a = b);
 
-        res_convert!(metal::ROCKER_enter_rocker(
-            &rq as *const metal::RockerRequest,
-            callback,
-            &app_cb as *const _ as *const c_void,
-        ))
+        let rq = &rq as *const metal::RockerRequest;
+        let app_args = &app_cb as *const _ as *const c_void;
+        res_convert!(if trace.is_null() {
+            metal::ROCKER_enter_rocker(rq, callback, app_args)
+        } else {
+            metal::ROCKER_enter_rocker_traced(rq, callback, app_args, trace)
+        })
         .and_then(|res| {
             Ok(RockerResult {
                 app_pid: res.app_pid as u32,
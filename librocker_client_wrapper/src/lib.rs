@@ -4,3 +4,4 @@ mod client_ffi;
 mod err;
 
 pub use client_ffi::*;
+pub use err::*;
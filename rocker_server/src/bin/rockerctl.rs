@@ -0,0 +1,101 @@
+//! rocker_server 状态查询工具.
+//!
+//! 向 rocker_server 发送 stats 请求, 将应答(单行 JSON)输出到标准输出,
+//! 各字段的含义参见 rocker_server 的 stats 模块; 可配合 jq 等工具筛选.
+//!
+//! 用法: rockerctl [stats] [-w 间隔秒数]
+//!
+//!   -w N  每隔 N 秒查询一次, 持续输出, 便于观察队列深度, loop 设备等随时间的变化
+
+use core::*;
+use nix::sys::{
+    socket::{
+        bind, recv, sendto, setsockopt, socket, sockopt, AddressFamily,
+        MsgFlags, SockAddr, SockFlag, SockType, UnixAddr,
+    },
+    time::{TimeVal, TimeValLike},
+};
+use std::{env, os::unix::io::RawFd, process};
+
+// stats 请求的标识, 须与 rocker_server 保持一致
+const STATS_MAGIC: i32 = -0x5354_4154;
+
+// 应答的长度上限, 与 rocker_server 单条消息的上限一致
+const RESP_SIZ: usize = 64 * 1024;
+
+// 等待应答的时长, 单位: 秒
+const RECV_TIMEOUT: i64 = 3;
+
+fn main() {
+    let args = env::args().skip(1).collect::<Vec<_>>();
+
+    let mut interval = None;
+    let mut i = 0;
+    while i < args.len() {
+        match args[i].as_str() {
+            "stats" => {}
+            "-w" => {
+                i += 1;
+                interval = args
+                    .get(i)
+                    .and_then(|v| v.parse::<u64>().ok())
+                    .filter(|&v| 0 < v)
+                    .or_else(|| usage());
+            }
+            _ => usage(),
+        }
+        i += 1;
+    }
+
+    let fd = pnk!(client_socket());
+    loop {
+        println!("{}", pnk!(query(fd)));
+        match interval {
+            Some(secs) => sleep(secs),
+            None => break,
+        }
+    }
+}
+
+fn usage() -> ! {
+    eprintln!("usage: rockerctl [stats] [-w SECS]");
+    process::exit(1);
+}
+
+// 以抽象地址绑定的数据报 socket, 地址中含本进程的 PID, 以免与其它实例冲突
+fn client_socket() -> Result<RawFd> {
+    let fd = socket(
+        AddressFamily::Unix,
+        SockType::Datagram,
+        SockFlag::SOCK_CLOEXEC,
+        None,
+    )
+    .c(d!())?;
+
+    let name = format!("rockerctl_{}", process::id());
+    bind(
+        fd,
+        &SockAddr::Unix(UnixAddr::new_abstract(name.as_bytes()).c(d!())?),
+    )
+    .c(d!())?;
+
+    setsockopt(fd, sockopt::ReceiveTimeout, &TimeVal::seconds(RECV_TIMEOUT))
+        .c(d!())?;
+
+    Ok(fd)
+}
+
+fn query(fd: RawFd) -> Result<String> {
+    let server = SockAddr::Unix(
+        UnixAddr::new_abstract(include_bytes!(
+            "../rocker_server_uau_addr_cfg"
+        ))
+        .c(d!())?,
+    );
+    sendto(fd, &STATS_MAGIC.to_ne_bytes(), &server, MsgFlags::empty())
+        .c(d!())?;
+
+    let mut buf = vec![0u8; RESP_SIZ];
+    let n = recv(fd, &mut buf, MsgFlags::empty()).c(d!())?;
+    Ok(String::from_utf8_lossy(&buf[..n]).into_owned())
+}
@@ -1,255 +1,693 @@
 #![cfg(target_os = "linux")]
 
 mod err;
+mod peer;
+mod proto;
+mod sched;
+mod stats;
 
-use core::{_info, alt, d, errgen, pdie, pnk};
+use core::{_info, alt, d, errgen, p, pdie, pnk};
 use err::*;
 use lazy_static::lazy_static;
 use nix::{
+    errno::Errno,
     sys::{
+        epoll::{
+            epoll_create1, epoll_ctl, epoll_wait, EpollCreateFlags,
+            EpollEvent, EpollFlags, EpollOp,
+        },
+        signal::{SigSet, Signal},
+        signalfd::{SfdFlags, SignalFd},
         socket::{
-            bind, recvfrom, sendmsg, setsockopt, socket, sockopt,
-            AddressFamily, ControlMessage, MsgFlags, SockAddr, SockFlag,
-            SockType, UnixAddr,
+            accept4, bind, listen, setsockopt, socket, sockopt, AddressFamily,
+            SockAddr, SockFlag, SockType, UnixAddr,
         },
-        uio::IoVec,
-        wait::wait,
     },
     unistd::close,
 };
+use peer::{Conn, Peer};
+use proto::{i32_at, req_decode, Req, INT_SIZ};
+use sched::Sched;
+use stats::StatsServer;
 use std::{
     collections::HashMap,
-    ffi::CStr,
-    os::unix::io::RawFd,
+    env, mem,
+    os::unix::io::{AsRawFd, RawFd},
+    ptr,
     sync::{Arc, Mutex},
+    thread,
 };
-use threadpool::ThreadPool;
 
 lazy_static! {
-    static ref RESOURCE: core::ResourceHdr =
-        Arc::new(Mutex::new(HashMap::new()));
+    static ref RESOURCE: core::ResourceHdr = Arc::new(core::Registry::new());
+
+    // 由环境变量 ROCKER_WARM_POOL_SIZE/ROCKER_WARM_POOL_TTL 启用
+    static ref WARM_POOL: Option<Arc<core::WarmPool>> =
+        core::WarmPool::from_env(Arc::clone(&RESOURCE));
 }
 
-const INT_SIZ: usize = std::mem::size_of::<i32>();
+// 批量请求的标识, 位于批量请求的首部, 须与 librocker_client 保持一致
+const BATCH_MAGIC: i32 = -0x424b_5452;
+
+// 单次批量请求可包含的最大 rocker 数量, 须与 librocker_client 保持一致
+const BATCH_MAX: usize = 32;
+
+// recvmmsg 单次最多接收的消息数量
+const RECV_BATCH: usize = 16;
+
+// 单条 UDP 消息的长度上限, 以容纳批量请求
+const MSG_SIZ: usize = 64 * 1024;
+
+// 设置为 1 时, 额外启用 SOCK_SEQPACKET 类型的监听 socket
+const ENV_SEQPACKET: &str = "ROCKER_SEQPACKET";
+
+// SOCK_SEQPACKET 监听地址的后缀, 须与 librocker_client 保持一致
+const SEQ_ADDR_SUFFIX: &[u8] = b"_seq";
+
+// 单次 epoll_wait 最多处理的事件数量
+const EVENT_BATCH: usize = 64;
+
+// 每条消息的控制数据缓冲区(u64 以满足 cmsghdr 的对齐要求),
+// 足以容纳 SCM_CREDENTIALS; 客户端附带的描述符随即关闭
+const CTRL_WORDS: usize = 8;
 
 fn main() -> Result<()> {
-    uau_serve(pnk!(gen_server_socket())).c(d!())?;
+    // 须在创建任何线程之前完成
+    pnk!(core::pkg_cache_init());
+    core::stats_page_init();
+
+    let listen_fd = alt!(
+        env::var(ENV_SEQPACKET)
+            .map(|v| "1" == v.trim())
+            .unwrap_or(false),
+        Some(pnk!(gen_server_socket(SockType::SeqPacket))),
+        None
+    );
+
+    uau_serve(pnk!(gen_server_socket(SockType::Datagram)), listen_fd)
+        .c(d!())?;
     Ok(())
 }
 
-// 启动服务
-// NOTE: 单条 UDP 消息的长度长限为 512Bytes
-fn uau_serve(serv_fd: RawFd) -> Result<()> {
-    let pool = ThreadPool::new(4);
+// 启动服务: 单线程的事件循环, 以 recvmmsg 成批接收请求并就地解析,
+// 之后交由可伸缩的线程池处理; 收到 SIGUSR1 时向标准错误输出调度统计.
+// listen_fd 不为 None 时, 同时接受 SOCK_SEQPACKET 连接, 连接上的请求同样成批接收.
+fn uau_serve(serv_fd: RawFd, listen_fd: Option<RawFd>) -> Result<()> {
+    // 连接方式下, 客户端提前退出时 send 返回 EPIPE 即可
+    unsafe {
+        libc::signal(libc::SIGPIPE, libc::SIG_IGN);
+    }
 
-    pool.execute(|| {
-        resource_worker();
-    });
+    // 须在创建任何线程之前屏蔽, 以使所有线程继承
+    let mut mask = SigSet::empty();
+    mask.add(Signal::SIGUSR1);
+    mask.thread_block().c(d!())?;
+    let mut sfd = SignalFd::with_flags(
+        &mask,
+        SfdFlags::SFD_NONBLOCK | SfdFlags::SFD_CLOEXEC,
+    )
+    .c(d!())?;
+
+    // 错误日志的写出线程, 同样须继承上述信号掩码
+    core::log_init();
+
+    let sched = Sched::from_env();
+    let stats = StatsServer::new(sched.clone(), Arc::clone(&RESOURCE));
+
+    // 尽早启动预热池的维护线程
+    lazy_static::initialize(&WARM_POOL);
+
+    // 回收线程常驻, 不占用处理请求的线程
+    thread::spawn(resource_worker);
 
-    let mut buf = Box::new([0u8; 512]);
-    let mut recvd; // (usize, SockAddr)
-    let mut req;
+    let epfd = epoll_create1(EpollCreateFlags::EPOLL_CLOEXEC).c(d!())?;
+    for &fd in [serv_fd, sfd.as_raw_fd()].iter().chain(listen_fd.iter()) {
+        let mut ev = EpollEvent::new(EpollFlags::EPOLLIN, fd as u64);
+        epoll_ctl(epfd, EpollOp::EpollCtlAdd, fd, &mut ev).c(d!())?;
+    }
+
+    let mut conns = HashMap::new();
+    let mut slots = RecvSlots::new();
+    let mut events = [EpollEvent::empty(); EVENT_BATCH];
     loop {
-        recvd = recvfrom(serv_fd, buf.as_mut()).c(d!())?;
-        req = buf[..recvd.0].to_vec().into_boxed_slice();
-        pool.execute(move || {
-            worker(req, serv_fd, recvd.1);
-        });
+        let n = match epoll_wait(epfd, &mut events, -1) {
+            Ok(n) => n,
+            Err(nix::Error::Sys(Errno::EINTR)) => continue,
+            Err(e) => return Err(e).c(d!()),
+        };
+
+        for ev in &events[..n] {
+            let fd = ev.data() as RawFd;
+            if sfd.as_raw_fd() == fd {
+                while let Ok(Some(_)) = sfd.read_signal() {}
+                eprintln!("{}", sched.snapshot().to_json());
+            } else if serv_fd == fd {
+                // 排空接收队列, 收满一批说明可能还有剩余
+                loop {
+                    let cnt = slots.recv(serv_fd).c(d!())?;
+                    (0..cnt).for_each(|i| {
+                        let (req, peeraddr) = slots.msg(i);
+                        let peer =
+                            Peer::Dgram(serv_fd, peeraddr, slots.uid(i));
+                        dispatch(&sched, &stats, req, peer);
+                    });
+                    if RECV_BATCH > cnt {
+                        break;
+                    }
+                }
+            } else if Some(fd) == listen_fd {
+                conn_accept(epfd, fd, &mut conns);
+            } else if let Some(conn) = conns.get(&fd).cloned() {
+                if !conn_serve(&sched, &stats, &mut slots, &conn) {
+                    _info!(epoll_ctl(epfd, EpollOp::EpollCtlDel, fd, None));
+                    conns.remove(&fd);
+                }
+            }
+        }
     }
 }
 
-// 创建 ROCKER, 并回送 ROCKER 入口.
-// -
-// @ req[in]: 原始的证求数据
-// @ serv_fd[in]: rocker_server 的服务 socket
-// @ peeraddr[in]: 客户端的地址
-fn worker(req: Box<[u8]>, serv_fd: RawFd, peeraddr: SockAddr) {
-    let send_back = |gpid, gpname, fds| {
-        pnk!(Resp {
-            guard_pid: gpid,
-            guard_pname: gpname,
-            namespace_fds: fds,
-        }
-        .send_resq(serv_fd, peeraddr))
-    };
+// 接受所有排队的连接, 并加入事件循环
+fn conn_accept(
+    epfd: RawFd,
+    listen_fd: RawFd,
+    conns: &mut HashMap<RawFd, Arc<Conn>>,
+) {
+    loop {
+        let fd = match accept4(listen_fd, SockFlag::SOCK_CLOEXEC) {
+            Ok(fd) => fd,
+            Err(nix::Error::Sys(Errno::EAGAIN)) => return,
+            Err(nix::Error::Sys(Errno::EINTR))
+            | Err(nix::Error::Sys(Errno::ECONNABORTED)) => continue,
+            ret => {
+                _info!(ret);
+                return;
+            }
+        };
 
-    macro_rules! check {
-        ($ops: expr) => {
-            $ops.c(d!())
-                .map_err(|e| {
-                    send_back(-1, 0, &[]);
-                    pdie(e)
-                })
-                .unwrap()
+        let conn = match Conn::new(fd).c(d!()) {
+            Ok(conn) => Arc::new(conn),
+            Err(e) => {
+                p(e);
+                _info!(close(fd));
+                continue;
+            }
         };
+
+        let mut ev = EpollEvent::new(EpollFlags::EPOLLIN, fd as u64);
+        match epoll_ctl(epfd, EpollOp::EpollCtlAdd, fd, &mut ev).c(d!()) {
+            Ok(_) => {
+                conns.insert(fd, conn);
+            }
+            Err(e) => p(e),
+        }
     }
+}
+
+// 排空连接上的请求, 每条消息为 [seq: u32] + 常规或批量请求;
+// 连接已关闭或出错时返回 false, 在途请求持有的连接在其应答发出之后关闭
+fn conn_serve(
+    sched: &Sched,
+    stats: &StatsServer,
+    slots: &mut RecvSlots,
+    conn: &Arc<Conn>,
+) -> bool {
+    loop {
+        let cnt = match slots.recv(conn.fd()).c(d!()) {
+            Ok(cnt) => cnt,
+            Err(e) => {
+                p(e);
+                return false;
+            }
+        };
 
-    let mut cfg = check!(req_parse(&req));
-    check!(cfg.init());
+        for i in 0..cnt {
+            let (msg, _) = slots.msg(i);
 
-    let guard_pid = check!(cfg.get_guard_pid()) as libc::pid_t;
-    let guard_pname = cfg.get_guard_pname();
-    let fds = check!(cfg.get_namespace_fds());
+            // 对端已关闭连接
+            if msg.is_empty() {
+                return false;
+            }
 
-    check!(cfg.registe_resource(&RESOURCE, guard_pid));
+            let seq = match i32_at(msg, 0) {
+                Some(seq) => seq as u32,
+                None => {
+                    p(errgen!(Unknown, "request without seq!"));
+                    return false;
+                }
+            };
+
+            dispatch(
+                sched,
+                stats,
+                &msg[INT_SIZ..],
+                Peer::Conn(Arc::clone(conn), seq),
+            );
+        }
 
-    send_back(guard_pid, guard_pname, &fds);
+        if RECV_BATCH > cnt {
+            return true;
+        }
+    }
+}
 
-    fds.iter().for_each(|&fd| {
-        _info!(close(fd));
-    });
+// recvmmsg 所用的接收缓冲区, 在堆上创建之后地址固定,
+// 各字段之间的指针始终有效
+struct RecvSlots {
+    bufs: Vec<u8>,
+    addrs: [libc::sockaddr_un; RECV_BATCH],
+    iovs: [libc::iovec; RECV_BATCH],
+    hdrs: [libc::mmsghdr; RECV_BATCH],
+    ctrls: [[u64; CTRL_WORDS]; RECV_BATCH],
+    // 各消息附带的发送方 euid, 仅服务 socket(SO_PASSCRED)上的消息带有
+    uids: [Option<u32>; RECV_BATCH],
 }
 
-// 释放已停止的 JG 进程的资源
-fn resource_worker() {
-    let mut ret;
-    loop {
-        ret = wait().map(|s| {
-            s.pid().map(|pid| {
-                if let Some(cfg) =
-                    RESOURCE.lock().unwrap().remove(&pid.as_raw())
-                {
-                    cfg.release_resource();
-                }
-            })
+impl RecvSlots {
+    fn new() -> Box<RecvSlots> {
+        let mut slots = Box::new(RecvSlots {
+            bufs: vec![0u8; RECV_BATCH * MSG_SIZ],
+            addrs: unsafe { mem::zeroed() },
+            iovs: unsafe { mem::zeroed() },
+            hdrs: unsafe { mem::zeroed() },
+            ctrls: [[0; CTRL_WORDS]; RECV_BATCH],
+            uids: [None; RECV_BATCH],
         });
 
-        match ret {
-            // 不存在子进程
-            Err(nix::Error::Sys(e)) if e == nix::errno::Errno::ECHILD => {
-                core::sleep(2);
-                continue;
-            }
-            // 存在子进程且出错
-            _ => {
-                _info!(ret);
+        for i in 0..RECV_BATCH {
+            slots.iovs[i].iov_base =
+                slots.bufs[i * MSG_SIZ..].as_mut_ptr() as *mut libc::c_void;
+            slots.iovs[i].iov_len = MSG_SIZ;
+            slots.hdrs[i].msg_hdr.msg_name =
+                &mut slots.addrs[i] as *mut _ as *mut libc::c_void;
+            slots.hdrs[i].msg_hdr.msg_iov = &mut slots.iovs[i];
+            slots.hdrs[i].msg_hdr.msg_iovlen = 1;
+            slots.hdrs[i].msg_hdr.msg_control =
+                slots.ctrls[i].as_mut_ptr() as *mut libc::c_void;
+        }
+
+        slots
+    }
+
+    // 非阻塞地接收一批消息, 返回收到的数量, 没有消息时返回 0;
+    // 已关闭的连接上收到的消息长度为 0
+    fn recv(&mut self, fd: RawFd) -> Result<usize> {
+        self.hdrs.iter_mut().for_each(|h| {
+            h.msg_hdr.msg_namelen =
+                mem::size_of::<libc::sockaddr_un>() as libc::socklen_t;
+            h.msg_hdr.msg_controllen =
+                mem::size_of::<[u64; CTRL_WORDS]>() as _;
+            h.msg_len = 0;
+        });
+
+        let n = unsafe {
+            libc::recvmmsg(
+                fd,
+                self.hdrs.as_mut_ptr(),
+                RECV_BATCH as libc::c_uint,
+                libc::MSG_DONTWAIT | libc::MSG_CMSG_CLOEXEC,
+                ptr::null_mut(),
+            )
+        };
+
+        if 0 > n {
+            return match Errno::last() {
+                Errno::EAGAIN | Errno::EINTR => Ok(0),
+                e => Err(nix::Error::Sys(e)).c(d!()),
+            };
+        }
+
+        for i in 0..n as usize {
+            self.uids[i] = self.ctrl_take(i);
+        }
+
+        Ok(n as usize)
+    }
+
+    // 解析第 i 条消息的控制数据: 返回 SCM_CREDENTIALS 中的 euid,
+    // 并关闭客户端经由 SCM_RIGHTS 附带的描述符
+    fn ctrl_take(&self, i: usize) -> Option<u32> {
+        let hdr = &self.hdrs[i].msg_hdr;
+        let mut uid = None;
+        let mut cmsg = unsafe { libc::CMSG_FIRSTHDR(hdr) };
+        while !cmsg.is_null() {
+            let c = unsafe { &*cmsg };
+            let data = unsafe { libc::CMSG_DATA(cmsg) };
+            let len =
+                c.cmsg_len as usize - unsafe { libc::CMSG_LEN(0) } as usize;
+            match (c.cmsg_level, c.cmsg_type) {
+                (libc::SOL_SOCKET, libc::SCM_CREDENTIALS) => {
+                    let cred = unsafe {
+                        ptr::read_unaligned(data as *const libc::ucred)
+                    };
+                    uid = Some(cred.uid as u32);
+                }
+                (libc::SOL_SOCKET, libc::SCM_RIGHTS) => {
+                    (0..len / mem::size_of::<RawFd>()).for_each(|k| {
+                        let fd = unsafe {
+                            ptr::read_unaligned((data as *const RawFd).add(k))
+                        };
+                        _info!(close(fd));
+                    });
+                }
+                _ => {}
             }
+            cmsg = unsafe { libc::CMSG_NXTHDR(hdr, cmsg) };
         }
+        uid
+    }
+
+    // 第 i 条消息附带的发送方 euid
+    fn uid(&self, i: usize) -> Option<u32> {
+        self.uids[i]
+    }
+
+    // 第 i 条消息的内容及发送方地址
+    fn msg(&self, i: usize) -> (&[u8], SockAddr) {
+        let len = self.hdrs[i].msg_len as usize;
+        let path_len = (self.hdrs[i].msg_hdr.msg_namelen as usize)
+            .saturating_sub(mem::size_of::<libc::sa_family_t>());
+
+        (
+            &self.bufs[i * MSG_SIZ..i * MSG_SIZ + len],
+            SockAddr::Unix(UnixAddr(self.addrs[i], path_len)),
+        )
     }
 }
 
-// 将原始请求解析为一个 core::RockerCfg.
-//     22 == 3 /*app_id,uid,gid*/
-//         + 3 /*app_pkg_path,app_exec_dir,app_data_dir*/
-//         + 16 /*app_overlay_dirs[0..15]*/
-fn req_parse(req: &[u8]) -> Result<core::RockerCfg> {
-    const REQ_META_SIZ: usize = INT_SIZ * 22;
+// 就地解析请求, 然后提交给线程池;
+// 格式错误或 uid 校验失败的请求直接回送失败应答;
+// stats 请求交由其专用线程处理
+fn dispatch(sched: &Sched, stats: &StatsServer, req: &[u8], peer: Peer) {
+    let recv_at = core::trace_now();
 
-    if req.len() < REQ_META_SIZ {
-        return Err(errgen!(Unknown));
+    if stats::is_stats(req) {
+        stats.submit(peer);
+        return;
+    }
+    if stats::is_stats_map(req) {
+        stats::serve_map(&peer);
+        return;
     }
 
-    let mut metas = [0; 22];
-    let mut bytes = [0u8; INT_SIZ];
-    for i in 0..22 {
-        bytes
-            .iter_mut()
-            .enumerate()
-            .for_each(|(idx, b)| *b = req[i * INT_SIZ + idx]);
-
-        metas[i] = i32::from_ne_bytes(bytes);
-        if 0 > metas[i] {
-            metas[i] = 0;
+    let reject = |e: Error| {
+        core::stats_count_reject();
+        p(e);
+        _info!(Resp {
+            guard_pid: -1,
+            guard_pname: 0,
+            namespace_fds: &[],
+            trace: &core::Trace::default(),
         }
+        .send(&peer));
+    };
+
+    match batch_split(req) {
+        None => match req_check(req, &peer).c(d!()) {
+            Ok(req) => sched.execute(move || {
+                worker(req, peer, recv_at);
+            }),
+            Err(e) => reject(e),
+        },
+        Some(Ok(reqs)) => {
+            batch_dispatch(sched, reqs, peer);
+        }
+        Some(Err(e)) => reject(e),
     }
+}
 
-    if req.len() - REQ_META_SIZ
-        < metas[3..].iter().map(|&i| i as usize).sum::<usize>()
-    {
-        return Err(errgen!(Unknown, "request size invalid!"));
+// 解析请求, 并以对端凭证校验其 uid
+fn req_check(req: &[u8], peer: &Peer) -> Result<Req> {
+    let req = req_decode(req).c(d!())?;
+    peer.check_uid(req.uid).c(d!())?;
+    Ok(req)
+}
+
+// 创建 ROCKER, 返回 guard 的 PID, 进程名称, namespace 描述符及各阶段的耗时,
+// 描述符需要调用方显式关闭.
+// -
+// @ req[in]: 解析之后的请求数据
+fn build_rocker(
+    req: Req,
+) -> Result<(libc::pid_t, u128, Vec<RawFd>, core::Trace)> {
+    let mut cfg = req.into_cfg().c(d!())?;
+
+    // 优先认领预热池中已就绪的 JG, 失败时退回到完整的创建流程
+    if let Some(pool) = WARM_POOL.as_ref() {
+        match pool.claim(&cfg).c(d!()) {
+            Ok(Some(ret)) => return Ok(ret),
+            Ok(None) => {}
+            Err(e) => p(e),
+        }
     }
 
-    for &i in metas.iter().take(6) {
-        if 0 == i {
-            return Err(errgen!(Unknown));
+    cfg.init().c(d!())?;
+
+    let guard_pid = cfg.get_guard_pid().c(d!())? as libc::pid_t;
+    let guard_pname = cfg.get_guard_pname();
+    let fds = cfg.get_namespace_fds().c(d!())?;
+    let trace = cfg.get_trace();
+
+    cfg.registe_resource(&RESOURCE, guard_pid)
+        .c(d!())
+        .map_err(|e| {
+            fds.iter().for_each(|&fd| {
+                _info!(close(fd));
+            });
+            e
+        })?;
+
+    Ok((guard_pid, guard_pname, fds, trace))
+}
+
+// 创建 ROCKER, 并回送 ROCKER 入口;
+// 应答发出之后, 将排队及处理请求的时段加入时间线并导出.
+// -
+// @ req[in]: 解析之后的请求数据
+// @ peer[in]: 应答的发送目标
+// @ recv_at[in]: 收到请求的时刻
+fn worker(req: Req, peer: Peer, recv_at: u64) {
+    let send_back = |gpid, gpname, fds, trace: &core::Trace| {
+        pnk!(Resp {
+            guard_pid: gpid,
+            guard_pname: gpname,
+            namespace_fds: fds,
+            trace,
         }
+        .send(&peer))
+    };
+
+    let start_at = core::trace_now();
+    let app_id = req.app_id;
+    let (guard_pid, guard_pname, fds, mut trace) =
+        build_rocker(req).c(d!()).unwrap_or_else(|e| {
+            core::stats_count_launch(false);
+            send_back(-1, 0, &[], &core::Trace::default());
+            pdie(e)
+        });
+    core::stats_count_launch(true);
+
+    send_back(guard_pid, guard_pname, &fds, &trace);
+
+    fds.iter().for_each(|&fd| {
+        _info!(close(fd));
+    });
+
+    trace.span("queue", recv_at, start_at);
+    trace.span("request", recv_at, core::trace_now());
+    trace.export(guard_pid, app_id);
+}
+
+// 批量请求的共享状态, 由最后一个完成的子任务统一回送应答
+struct Batch {
+    peer: Peer,
+    remaining: usize,
+    items: Vec<Option<(libc::pid_t, u128, Vec<RawFd>)>>,
+}
+
+// 拆分批量请求:
+//     [BATCH_MAGIC, n, len_0, ..., len_(n-1)] + n 个常规请求
+// 返回指向各常规请求的切片, 非批量请求返回 None
+fn batch_split(req: &[u8]) -> Option<Result<Vec<&[u8]>>> {
+    let int_at = |i: usize| i32_at(req, i * INT_SIZ).unwrap_or(0);
+
+    if req.len() < 2 * INT_SIZ || BATCH_MAGIC != int_at(0) {
+        return None;
     }
 
-    let app_id = metas[0] as u32;
-    let uid = metas[1] as u32;
-    let gid = alt!(0 > metas[2], None, Some(metas[2] as u32));
+    let n = int_at(1);
+    if 1 > n
+        || BATCH_MAX < n as usize
+        || req.len() < (2 + n as usize) * INT_SIZ
+    {
+        return Some(Err(errgen!(Unknown, "batch size invalid!")));
+    }
 
-    let mut paths = vec![];
+    let n = n as usize;
+    let mut reqs = Vec::with_capacity(n);
     let mut l_idx;
-    let mut u_idx = REQ_META_SIZ;
-    for &i in metas.iter().skip(3) {
+    let mut u_idx = (2 + n) * INT_SIZ;
+    for i in 0..n {
+        let len = int_at(2 + i);
         l_idx = u_idx;
-        u_idx += i as usize;
-        if 0 == i {
-            continue;
+        u_idx += len.max(0) as usize;
+        if 0 > len || req.len() < u_idx {
+            return Some(Err(errgen!(Unknown, "batch request size invalid!")));
         }
-        paths.push(
-            CStr::from_bytes_with_nul(&req[l_idx..u_idx])
-                .c(d!())?
-                .to_str()
-                .c(d!())?
-                .to_owned(),
-        );
+        reqs.push(&req[l_idx..u_idx]);
     }
 
-    let overlay_dirs = paths.split_off(3);
-    let app_data_dir = paths.pop().unwrap();
-    let app_exec_dir = paths.pop().unwrap();
-    let app_pkg_path = paths.pop().unwrap();
-    let cfg = core::RockerCfg::new(
-        app_id,
-        uid,
-        gid,
-        app_pkg_path,
-        app_exec_dir,
-        app_data_dir,
-        overlay_dirs,
-    )
-    .c(d!())?;
+    Some(Ok(reqs))
+}
 
-    Ok(cfg)
+// 将批量请求中的每个 ROCKER 分发给线程池并发创建,
+// 全部完成之后, 在一条消息中回送所有结果.
+// 格式错误的单项同样经由线程池, 以免提前回送应答.
+fn batch_dispatch(sched: &Sched, reqs: Vec<&[u8]>, peer: Peer) {
+    let batch = Arc::new(Mutex::new(Batch {
+        peer: peer.clone(),
+        remaining: reqs.len(),
+        items: (0..reqs.len()).map(|_| None).collect(),
+    }));
+
+    for (idx, req) in reqs.into_iter().enumerate() {
+        let batch = Arc::clone(&batch);
+        let req = req_check(req, &peer).c(d!());
+        sched.execute(move || {
+            batch_worker(idx, req, batch);
+        });
+    }
 }
 
-fn gen_server_socket() -> Result<RawFd> {
+// 批量请求中单个 ROCKER 的创建任务, 出错时只影响对应的结果项
+fn batch_worker(idx: usize, req: Result<Req>, batch: Arc<Mutex<Batch>>) {
+    let item = req
+        .and_then(|r| build_rocker(r).c(d!()))
+        .map(|(gpid, gpname, fds, _)| (gpid, gpname, fds))
+        .map_err(p)
+        .ok();
+    core::stats_count_launch(item.is_some());
+
+    let mut b = batch.lock().unwrap();
+    b.items[idx] = item;
+    b.remaining -= 1;
+    if 0 < b.remaining {
+        return;
+    }
+
+    let items = mem::replace(&mut b.items, vec![]);
+    _info!(BatchResp { items: &items }.send(&b.peer));
+
+    items
+        .iter()
+        .filter_map(|i| i.as_ref())
+        .for_each(|(_, _, fds)| {
+            fds.iter().for_each(|&fd| {
+                _info!(close(fd));
+            });
+        });
+}
+
+// 释放已停止的 JG 进程的资源
+fn resource_worker() {
+    core::reaper_run(&RESOURCE);
+}
+
+// 将原始请求解析为一个 core::RockerCfg.
+#[cfg(test)]
+fn req_parse(req: &[u8]) -> Result<core::RockerCfg> {
+    req_decode(req).c(d!())?.into_cfg().c(d!())
+}
+
+// 创建服务 socket:
+//     SOCK_DGRAM 绑定于固定的抽象地址;
+//     SOCK_SEQPACKET 绑定于固定地址加 SEQ_ADDR_SUFFIX 后缀, 以非阻塞方式监听.
+fn gen_server_socket(ty: SockType) -> Result<RawFd> {
+    let seq = SockType::SeqPacket == ty;
     let fd = socket(
         AddressFamily::Unix,
-        SockType::Datagram,
-        SockFlag::empty(),
+        ty,
+        alt!(
+            seq,
+            SockFlag::SOCK_NONBLOCK | SockFlag::SOCK_CLOEXEC,
+            SockFlag::empty()
+        ),
         None,
     )
     .c(d!())?;
 
-    setsockopt(fd, sockopt::ReuseAddr, &true).c(d!())?;
-    setsockopt(fd, sockopt::ReusePort, &true).c(d!())?;
+    // 数据报方式下, 由内核为每条消息附带发送方的凭证(SCM_CREDENTIALS)
+    if !seq {
+        setsockopt(fd, sockopt::ReuseAddr, &true).c(d!())?;
+        setsockopt(fd, sockopt::ReusePort, &true).c(d!())?;
+        setsockopt(fd, sockopt::PassCred, &true).c(d!())?;
+    }
 
-    bind(
-        fd,
-        &SockAddr::Unix(
-            UnixAddr::new_abstract(include_bytes!("rocker_server_uau_addr_cfg"))
-                .c(d!())?,
-        ),
-    )
-    .c(d!())?;
+    let mut name = include_bytes!("rocker_server_uau_addr_cfg").to_vec();
+    if seq {
+        name.extend_from_slice(SEQ_ADDR_SUFFIX);
+    }
+
+    bind(fd, &SockAddr::Unix(UnixAddr::new_abstract(&name).c(d!())?))
+        .c(d!())?;
+
+    if seq {
+        listen(fd, libc::SOMAXCONN as usize).c(d!())?;
+    }
 
     Ok(fd)
 }
 
+// 应答格式: [guard_pid, guard_pname] + 各阶段的耗时(纳秒, u64),
+// 旧版客户端只读取前两项
 struct Resp<'a> {
     guard_pid: libc::pid_t,
     guard_pname: u128,
-    namespace_fds: &'a [i32], // MNT | USER | PID
+    namespace_fds: &'a [i32], // MNT | PID | USER | LIFELINE [| CGROUP]
+    trace: &'a core::Trace,
 }
 
 impl Resp<'_> {
-    fn send_resq(&self, serv_fd: RawFd, peeraddr: SockAddr) -> Result<()> {
-        sendmsg(
-            serv_fd,
+    fn send(&self, peer: &Peer) -> Result<()> {
+        peer.send(
             &[
-                IoVec::from_slice(&self.guard_pid.to_ne_bytes()),
-                IoVec::from_slice(&self.guard_pname.to_ne_bytes()),
+                &self.guard_pid.to_ne_bytes()[..],
+                &self.guard_pname.to_ne_bytes()[..],
+                &self.trace.to_ne_bytes()[..],
             ],
-            &[ControlMessage::ScmRights(&self.namespace_fds)],
-            MsgFlags::MSG_CMSG_CLOEXEC,
-            Some(&peeraddr),
+            self.namespace_fds,
         )
-        .c(d!())?;
+        .c(d!())
+    }
+}
+
+struct BatchResp<'a> {
+    items: &'a [Option<(libc::pid_t, u128, Vec<RawFd>)>],
+}
+
+impl BatchResp<'_> {
+    // 应答格式: n 组 [guard_pid, guard_pname] + n 字节的各项描述符数量
+    // + 所有成功项的 namespace 描述符;
+    // 带有 cgroup 的项多一个描述符, 客户端据描述符数量逐项拆分
+    fn send(&self, peer: &Peer) -> Result<()> {
+        let mut data = Vec::with_capacity(self.items.len() * (INT_SIZ + 17));
+        let mut cnts = Vec::with_capacity(self.items.len());
+        let mut fds = vec![];
+        for item in self.items {
+            if let Some((guard_pid, guard_pname, namespace_fds)) = item {
+                data.extend_from_slice(&guard_pid.to_ne_bytes());
+                data.extend_from_slice(&guard_pname.to_ne_bytes());
+                cnts.push(namespace_fds.len() as u8);
+                fds.extend_from_slice(namespace_fds);
+            } else {
+                data.extend_from_slice(&(-1 as libc::pid_t).to_ne_bytes());
+                data.extend_from_slice(&0u128.to_ne_bytes());
+                cnts.push(0);
+            }
+        }
+        data.extend_from_slice(&cnts);
 
-        Ok(())
+        peer.send(&[&data[..]], &fds).c(d!())
     }
 }
 
@@ -257,7 +695,7 @@ impl Resp<'_> {
 #[cfg(test)]
 mod tests {
     use super::*;
-    use nix::unistd::close;
+    use nix::{sys::socket::MsgFlags, unistd::close};
     use std::ffi::CString;
 
     #[test]
@@ -329,30 +767,205 @@ mod tests {
         );
     }
 
+    #[test]
+    fn TEST_batch_split() {
+        let reqs: [&[u8]; 2] = [&[1, 2, 3, 4, 5], &[6, 7, 8]];
+
+        let mut batch = vec![];
+        batch.extend_from_slice(&BATCH_MAGIC.to_ne_bytes());
+        batch.extend_from_slice(&(reqs.len() as i32).to_ne_bytes());
+        reqs.iter().for_each(|r| {
+            batch.extend_from_slice(&(r.len() as i32).to_ne_bytes())
+        });
+        reqs.iter().for_each(|r| batch.extend_from_slice(r));
+
+        let splited = pnk!(batch_split(&batch).unwrap());
+        assert_eq!(splited.len(), reqs.len());
+        splited
+            .iter()
+            .zip(reqs.iter())
+            .for_each(|(a, b)| assert_eq!(&a[..], *b));
+
+        assert!(batch_split(&batch[..batch.len() - 1]).unwrap().is_err());
+        assert!(batch_split(&0xffffu32.to_ne_bytes()).is_none());
+        assert!(batch_split(&[0u8; INT_SIZ * 22]).is_none());
+    }
+
     #[test]
     fn TEST_gen_server_socket() {
-        let fd = pnk!(gen_server_socket());
+        let fd = pnk!(gen_server_socket(SockType::Datagram));
         pnk!(close(fd));
     }
 
     #[test]
     fn TEST_send_resp() {
-        let fd = pnk!(gen_server_socket());
+        let fd = pnk!(gen_server_socket(SockType::Datagram));
 
         let resp = Resp {
             guard_pid: 11,
             guard_pname: 11,
             namespace_fds: &[0, 1, 2],
+            trace: &core::Trace::default(),
         };
 
         let peeraddr = SockAddr::Unix(pnk!(UnixAddr::new_abstract(
             include_bytes!("rocker_server_uau_addr_cfg")
         )));
-        pnk!(resp.send_resq(fd, peeraddr));
+        pnk!(resp.send(&Peer::Dgram(fd, peeraddr, None)));
 
         let peeraddr = SockAddr::Unix(pnk!(UnixAddr::new_abstract(&[0; 20])));
-        assert!(resp.send_resq(fd, peeraddr).is_err());
+        assert!(resp.send(&Peer::Dgram(fd, peeraddr, None)).is_err());
 
         pnk!(close(fd));
     }
+
+    #[test]
+    fn TEST_seqpacket_conn() {
+        let listen_fd = pnk!(gen_server_socket(SockType::SeqPacket));
+
+        let mut name = include_bytes!("rocker_server_uau_addr_cfg").to_vec();
+        name.extend_from_slice(SEQ_ADDR_SUFFIX);
+        let cli_fd = pnk!(socket(
+            AddressFamily::Unix,
+            SockType::SeqPacket,
+            SockFlag::empty(),
+            None
+        ));
+        pnk!(nix::sys::socket::connect(
+            cli_fd,
+            &SockAddr::Unix(pnk!(UnixAddr::new_abstract(&name)))
+        ));
+
+        let conn = Arc::new(pnk!(Conn::new(pnk!(accept4(
+            listen_fd,
+            SockFlag::SOCK_CLOEXEC
+        )))));
+
+        // 对端凭证即当前进程的 euid
+        let euid = nix::unistd::geteuid().as_raw() as u32;
+        let peer = Peer::Conn(Arc::clone(&conn), 9);
+        pnk!(peer.check_uid(euid));
+        if 0 != euid {
+            assert!(peer.check_uid(euid + 1).is_err());
+        }
+        assert_eq!(0 == euid, peer.check_root().is_ok());
+
+        // 应答以请求的序号开头, 且保留消息边界
+        pnk!(peer.send(&[b"ab", b"c"], &[]));
+        pnk!(Peer::Conn(Arc::clone(&conn), 10).send(&[b"d"], &[]));
+
+        let mut buf = [0u8; 64];
+        let n =
+            pnk!(nix::sys::socket::recv(cli_fd, &mut buf, MsgFlags::empty()));
+        assert_eq!(&buf[..n], &[&9u32.to_ne_bytes()[..], b"abc"].concat()[..]);
+        let n =
+            pnk!(nix::sys::socket::recv(cli_fd, &mut buf, MsgFlags::empty()));
+        assert_eq!(&buf[..n], &[&10u32.to_ne_bytes()[..], b"d"].concat()[..]);
+
+        drop(peer);
+        drop(conn);
+        pnk!(close(cli_fd));
+        pnk!(close(listen_fd));
+    }
+
+    #[test]
+    fn TEST_recv_creds() {
+        let (serv_fd, cli_fd) = pnk!(nix::sys::socket::socketpair(
+            AddressFamily::Unix,
+            SockType::Datagram,
+            None,
+            SockFlag::SOCK_CLOEXEC
+        ));
+        pnk!(setsockopt(serv_fd, sockopt::PassCred, &true));
+
+        // 客户端附带的描述符在服务端随即关闭: 两端均关闭之后管道读端可读到 EOF
+        let (rd, wr) = pnk!(nix::unistd::pipe());
+        let iov = [nix::sys::uio::IoVec::from_slice(b"abcd")];
+        let fds = [wr];
+        pnk!(nix::sys::socket::sendmsg(
+            cli_fd,
+            &iov,
+            &[nix::sys::socket::ControlMessage::ScmRights(&fds)],
+            MsgFlags::empty(),
+            None
+        ));
+        pnk!(close(wr));
+
+        let mut slots = RecvSlots::new();
+        assert_eq!(1, pnk!(slots.recv(serv_fd)));
+        assert_eq!(&b"abcd"[..], slots.msg(0).0);
+
+        // 消息附带的凭证即当前进程的 euid
+        let euid = nix::unistd::geteuid().as_raw() as u32;
+        assert_eq!(Some(euid), slots.uid(0));
+
+        let mut b = [0u8; 1];
+        assert_eq!(0, pnk!(nix::unistd::read(rd, &mut b)));
+
+        pnk!(close(rd));
+        pnk!(close(cli_fd));
+        pnk!(close(serv_fd));
+    }
+
+    #[test]
+    fn TEST_dgram_uid_check() {
+        let (serv_fd, cli_fd) = pnk!(nix::sys::socket::socketpair(
+            AddressFamily::Unix,
+            SockType::Datagram,
+            None,
+            SockFlag::SOCK_CLOEXEC
+        ));
+        pnk!(setsockopt(serv_fd, sockopt::PassCred, &true));
+
+        // 以 root 身份运行时, 在 SCM_CREDENTIALS 中指定其它 uid, 模拟非 root 的发送方
+        let euid = nix::unistd::geteuid().as_raw() as u32;
+        let uid = alt!(0 == euid, 1000, euid);
+        let cred = libc::ucred {
+            pid: nix::unistd::getpid().as_raw(),
+            uid,
+            gid: nix::unistd::getegid().as_raw(),
+        };
+
+        let mut data = *b"abcd";
+        let mut iov = libc::iovec {
+            iov_base: data.as_mut_ptr() as *mut libc::c_void,
+            iov_len: data.len(),
+        };
+        let mut ctrl = [0u64; CTRL_WORDS];
+        let mut hdr: libc::msghdr = unsafe { mem::zeroed() };
+        hdr.msg_iov = &mut iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = ctrl.as_mut_ptr() as *mut libc::c_void;
+        unsafe {
+            let len = mem::size_of::<libc::ucred>() as libc::c_uint;
+            hdr.msg_controllen = libc::CMSG_SPACE(len) as _;
+            let cmsg = libc::CMSG_FIRSTHDR(&hdr);
+            (*cmsg).cmsg_level = libc::SOL_SOCKET;
+            (*cmsg).cmsg_type = libc::SCM_CREDENTIALS;
+            (*cmsg).cmsg_len = libc::CMSG_LEN(len) as _;
+            ptr::write_unaligned(
+                libc::CMSG_DATA(cmsg) as *mut libc::ucred,
+                cred,
+            );
+            assert_eq!(4, libc::sendmsg(cli_fd, &hdr, 0));
+        }
+
+        let mut slots = RecvSlots::new();
+        assert_eq!(1, pnk!(slots.recv(serv_fd)));
+        assert_eq!(Some(uid), slots.uid(0));
+
+        // 非 root 的发送方只能以自身的 uid 创建 ROCKER
+        let peeraddr = slots.msg(0).1;
+        let peer = Peer::Dgram(serv_fd, peeraddr, slots.uid(0));
+        pnk!(peer.check_uid(uid));
+        assert!(peer.check_uid(0).is_err());
+        assert!(peer.check_uid(uid + 1).is_err());
+        assert!(peer.check_root().is_err());
+
+        // 未附带凭证的数据报一律拒绝
+        assert!(Peer::Dgram(serv_fd, peeraddr, None).check_uid(uid).is_err());
+
+        pnk!(close(cli_fd));
+        pnk!(close(serv_fd));
+    }
 }
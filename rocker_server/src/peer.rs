@@ -0,0 +1,121 @@
+//! 应答的发送目标.
+//!
+//! 数据报方式下, 应答经由服务 socket 发往客户端的地址;
+//! 连接方式(SOCK_SEQPACKET)下, 每个请求之前附带 4 字节的序号, 应答以相同的序号开头,
+//! 同一连接上的多个请求可同时在途, 应答的顺序与请求无关.
+//! 连接方式下, 内核在 connect 时记录的对端凭证(SO_PEERCRED)用于校验请求中的 uid;
+//! 数据报方式下, 服务 socket 设置了 SO_PASSCRED, 每条消息附带发送方的凭证, 同样用于校验.
+
+use crate::err::*;
+use core::{_info, alt, d, errgen};
+use nix::{
+    sys::{
+        socket::{
+            getsockopt, sendmsg, sockopt, ControlMessage, MsgFlags, SockAddr,
+        },
+        uio::IoVec,
+    },
+    unistd::close,
+};
+use std::{os::unix::io::RawFd, sync::Arc};
+
+/// 客户端的持久连接, 由事件循环及其所有在途请求共同持有,
+/// 最后一个持有者释放时关闭
+pub(crate) struct Conn {
+    fd: RawFd,
+    // 对端进程的 euid
+    uid: u32,
+}
+
+impl Conn {
+    /// 取得对端凭证, 失败时由调用方关闭 fd
+    pub(crate) fn new(fd: RawFd) -> Result<Conn> {
+        let cred = getsockopt(fd, sockopt::PeerCredentials).c(d!())?;
+        Ok(Conn {
+            fd,
+            uid: cred.uid() as u32,
+        })
+    }
+
+    pub(crate) fn fd(&self) -> RawFd {
+        self.fd
+    }
+}
+
+impl Drop for Conn {
+    fn drop(&mut self) {
+        _info!(close(self.fd));
+    }
+}
+
+/// 应答的发送目标
+#[derive(Clone)]
+pub(crate) enum Peer {
+    // 服务 socket, 客户端地址及消息附带的发送方 euid
+    Dgram(RawFd, SockAddr, Option<u32>),
+    // 客户端连接及请求的序号
+    Conn(Arc<Conn>, u32),
+}
+
+impl Peer {
+    /// 非 root 的调用方只能以自身的 uid 创建 ROCKER;
+    /// 数据报未附带凭证时一律拒绝
+    pub(crate) fn check_uid(&self, uid: u32) -> Result<()> {
+        match self.uid() {
+            Some(0) => Ok(()),
+            Some(peer_uid) if uid == peer_uid => Ok(()),
+            _ => Err(errgen!(Unknown, "uid mismatch with peer credentials!")),
+        }
+    }
+
+    /// 状态查询只接受 root; 数据报未附带凭证时一律拒绝
+    pub(crate) fn check_root(&self) -> Result<()> {
+        alt!(
+            Some(0) == self.uid(),
+            Ok(()),
+            Err(errgen!(Unknown, "permission denied!"))
+        )
+    }
+
+    // 对端进程的 euid: 连接方式下取自 SO_PEERCRED,
+    // 数据报方式下取自消息附带的 SCM_CREDENTIALS
+    fn uid(&self) -> Option<u32> {
+        match self {
+            Peer::Dgram(_, _, uid) => *uid,
+            Peer::Conn(conn, _) => Some(conn.uid),
+        }
+    }
+
+    /// 发送应答, fds 为空时不附带控制消息
+    pub(crate) fn send(&self, data: &[&[u8]], fds: &[RawFd]) -> Result<()> {
+        let scm = [ControlMessage::ScmRights(fds)];
+        let cmsgs: &[ControlMessage] = alt!(fds.is_empty(), &[], &scm);
+
+        match self {
+            Peer::Dgram(serv_fd, peeraddr, _) => {
+                let iov = data
+                    .iter()
+                    .map(|d| IoVec::from_slice(d))
+                    .collect::<Vec<_>>();
+                sendmsg(
+                    *serv_fd,
+                    &iov,
+                    cmsgs,
+                    MsgFlags::empty(),
+                    Some(peeraddr),
+                )
+            }
+            Peer::Conn(conn, seq) => {
+                let seq = seq.to_ne_bytes();
+                let iov = Some(&seq[..])
+                    .into_iter()
+                    .chain(data.iter().copied())
+                    .map(IoVec::from_slice)
+                    .collect::<Vec<_>>();
+                sendmsg(conn.fd, &iov, cmsgs, MsgFlags::empty(), None)
+            }
+        }
+        .c(d!())
+        .map(|_| ())
+    }
+}
@@ -0,0 +1,453 @@
+//! 请求的格式及解析, 须与 librocker_client 保持一致.
+//!
+//! v1: 22 个 i32(app_id, uid, gid, 3 个路径及 16 个 overlay 目录的长度,
+//!     长度均含末尾的 '\0') + 依次排列的字符串, overlay 目录最多 16 个.
+//!
+//! v2: [V2_MAGIC: i32][总长度: i32] + 任意数量的 [type: u16][len: u16][value],
+//!     整数字段为 i32(资源限制中的字节数为 u64, cpu.max 为两个 u32), 字符串字段不含末尾的 '\0';
+//!     overlay 目录字段可重复出现, 数量不限; 不认识的字段直接跳过,
+//!     新增的可选字段无需改变版本.
+//!
+//! 两种格式均在接收缓冲区上就地解析, 字符串以切片形式借用,
+//! 提交给处理线程时才复制为 `Req`.
+
+use crate::err::*;
+use core::{alt, d, errgen};
+use std::{ffi::CStr, str};
+
+pub(crate) const INT_SIZ: usize = std::mem::size_of::<i32>();
+
+// v2 请求的标识, 位于请求的首部; v1 请求的首字段为 app_id, 不会取此值
+pub(crate) const V2_MAGIC: i32 = -0x524b_5632;
+
+// v2 请求中各字段的类型
+const TLV_APP_ID: u16 = 1;
+const TLV_UID: u16 = 2;
+const TLV_GID: u16 = 3;
+const TLV_APP_PKG_PATH: u16 = 4;
+const TLV_APP_EXEC_DIR: u16 = 5;
+const TLV_APP_DATA_DIR: u16 = 6;
+const TLV_APP_OVERLAY_DIR: u16 = 7;
+// cgroup 资源限制, 均为可选字段
+const TLV_MEMORY_MAX: u16 = 8;
+const TLV_MEMORY_HIGH: u16 = 9;
+const TLV_CPU_MAX: u16 = 10;
+const TLV_CPU_WEIGHT: u16 = 11;
+const TLV_IO_MAX: u16 = 12;
+const TLV_PIDS_MAX: u16 = 13;
+
+const TLV_HDR_SIZ: usize = 2 * std::mem::size_of::<u16>();
+
+// v1 请求首部的整数个数:
+//     22 == 3 /*app_id,uid,gid*/
+//         + 3 /*app_pkg_path,app_exec_dir,app_data_dir*/
+//         + 16 /*app_overlay_dirs[0..15]*/
+const V1_META_CNT: usize = 22;
+
+/// 解析之后的请求, 尚未做合法性检查
+pub(crate) struct Req {
+    pub(crate) app_id: u32,
+    pub(crate) uid: u32,
+    pub(crate) gid: Option<u32>,
+    pub(crate) app_pkg_path: String,
+    pub(crate) app_exec_dir: String,
+    pub(crate) app_data_dir: String,
+    pub(crate) overlay_dirs: Vec<String>,
+    pub(crate) cgroup_limits: core::CgroupLimits,
+}
+
+impl Req {
+    /// 检查 uid/gid 及路径等的合法性, 涉及文件系统操作, 须在处理线程中调用
+    pub(crate) fn into_cfg(self) -> Result<core::RockerCfg> {
+        core::RockerCfg::new(
+            self.app_id,
+            self.uid,
+            self.gid,
+            self.app_pkg_path,
+            self.app_exec_dir,
+            self.app_data_dir,
+            self.overlay_dirs,
+        )
+        .c(d!())
+        .map(|mut cfg| {
+            cfg.cgroup_limits = self.cgroup_limits;
+            cfg
+        })
+    }
+}
+
+/// 就地解析的请求, 字符串均借用自接收缓冲区
+pub(crate) struct ReqView<'a> {
+    pub(crate) app_id: u32,
+    pub(crate) uid: u32,
+    pub(crate) gid: Option<u32>,
+    pub(crate) app_pkg_path: &'a str,
+    pub(crate) app_exec_dir: &'a str,
+    pub(crate) app_data_dir: &'a str,
+    pub(crate) overlay_dirs: Vec<&'a str>,
+    // io.max 之外的各项资源限制
+    pub(crate) cgroup_limits: core::CgroupLimits,
+    pub(crate) io_max: Vec<&'a str>,
+}
+
+impl ReqView<'_> {
+    /// 复制其中的字符串, 以便移交给处理线程
+    pub(crate) fn to_req(&self) -> Req {
+        Req {
+            app_id: self.app_id,
+            uid: self.uid,
+            gid: self.gid,
+            app_pkg_path: self.app_pkg_path.to_owned(),
+            app_exec_dir: self.app_exec_dir.to_owned(),
+            app_data_dir: self.app_data_dir.to_owned(),
+            overlay_dirs: self
+                .overlay_dirs
+                .iter()
+                .map(|&d| d.to_owned())
+                .collect(),
+            cgroup_limits: core::CgroupLimits {
+                io_max: self.io_max.iter().map(|&l| l.to_owned()).collect(),
+                ..self.cgroup_limits.clone()
+            },
+        }
+    }
+}
+
+/// 解析原始请求, 只复制其中的字符串
+pub(crate) fn req_decode(req: &[u8]) -> Result<Req> {
+    req_view(req).c(d!()).map(|v| v.to_req())
+}
+
+/// 就地解析原始请求, 按首字段区分 v1/v2 格式
+pub(crate) fn req_view(req: &[u8]) -> Result<ReqView<'_>> {
+    alt!(
+        Some(V2_MAGIC) == i32_at(req, 0),
+        req_view_v2(req).c(d!()),
+        req_view_v1(req).c(d!())
+    )
+}
+
+fn req_view_v1(req: &[u8]) -> Result<ReqView<'_>> {
+    const META_SIZ: usize = INT_SIZ * V1_META_CNT;
+
+    if req.len() < META_SIZ {
+        return Err(errgen!(Unknown));
+    }
+
+    let mut metas = [0; V1_META_CNT];
+    req[..META_SIZ]
+        .chunks(INT_SIZ)
+        .zip(metas.iter_mut())
+        .for_each(|(b, m)| *m = ne_i32(b).max(0));
+
+    if req.len() - META_SIZ
+        < metas[3..].iter().map(|&i| i as usize).sum::<usize>()
+    {
+        return Err(errgen!(Unknown, "request size invalid!"));
+    }
+
+    for &i in metas.iter().take(6) {
+        if 0 == i {
+            return Err(errgen!(Unknown));
+        }
+    }
+
+    let mut paths = Vec::with_capacity(V1_META_CNT - 3);
+    let mut l_idx;
+    let mut u_idx = META_SIZ;
+    for &i in metas.iter().skip(3) {
+        l_idx = u_idx;
+        u_idx += i as usize;
+        if 0 == i {
+            continue;
+        }
+        paths.push(
+            CStr::from_bytes_with_nul(&req[l_idx..u_idx])
+                .c(d!())?
+                .to_str()
+                .c(d!())?,
+        );
+    }
+
+    let overlay_dirs = paths.split_off(3);
+
+    Ok(ReqView {
+        app_id: metas[0] as u32,
+        uid: metas[1] as u32,
+        gid: alt!(0 > metas[2], None, Some(metas[2] as u32)),
+        app_pkg_path: paths[0],
+        app_exec_dir: paths[1],
+        app_data_dir: paths[2],
+        overlay_dirs,
+        cgroup_limits: core::CgroupLimits::default(),
+        io_max: vec![],
+    })
+}
+
+fn req_view_v2(req: &[u8]) -> Result<ReqView<'_>> {
+    let len = i32_at(req, INT_SIZ)
+        .ok_or_else(|| errgen!(Unknown, "request size invalid!"))?
+        as usize;
+    if len < 2 * INT_SIZ || req.len() < len {
+        return Err(errgen!(Unknown, "request size invalid!"));
+    }
+
+    let (mut app_id, mut uid, mut gid) = (0, 0, None);
+    let (mut app_pkg_path, mut app_exec_dir, mut app_data_dir) = ("", "", "");
+    let mut overlay_dirs = vec![];
+    let mut cgroup_limits = core::CgroupLimits::default();
+    let mut io_max = vec![];
+
+    let mut body = &req[2 * INT_SIZ..len];
+    while !body.is_empty() {
+        if body.len() < TLV_HDR_SIZ {
+            return Err(errgen!(Unknown, "field size invalid!"));
+        }
+
+        let typ = ne_u16(&body[..2]);
+        let siz = TLV_HDR_SIZ + ne_u16(&body[2..TLV_HDR_SIZ]) as usize;
+        if body.len() < siz {
+            return Err(errgen!(Unknown, "field size invalid!"));
+        }
+
+        let val = &body[TLV_HDR_SIZ..siz];
+        body = &body[siz..];
+
+        match typ {
+            TLV_APP_ID => app_id = tlv_i32(val).c(d!())?.max(0) as u32,
+            TLV_UID => uid = tlv_i32(val).c(d!())?.max(0) as u32,
+            TLV_GID => {
+                let g = tlv_i32(val).c(d!())?;
+                gid = alt!(0 > g, None, Some(g as u32));
+            }
+            TLV_APP_PKG_PATH => app_pkg_path = tlv_str(val).c(d!())?,
+            TLV_APP_EXEC_DIR => app_exec_dir = tlv_str(val).c(d!())?,
+            TLV_APP_DATA_DIR => app_data_dir = tlv_str(val).c(d!())?,
+            TLV_APP_OVERLAY_DIR => overlay_dirs.push(tlv_str(val).c(d!())?),
+            TLV_MEMORY_MAX => {
+                cgroup_limits.memory_max = Some(tlv_u64(val).c(d!())?)
+            }
+            TLV_MEMORY_HIGH => {
+                cgroup_limits.memory_high = Some(tlv_u64(val).c(d!())?)
+            }
+            TLV_CPU_MAX => {
+                cgroup_limits.cpu_max = Some(tlv_u32_pair(val).c(d!())?)
+            }
+            TLV_CPU_WEIGHT => {
+                cgroup_limits.cpu_weight = Some(tlv_i32(val).c(d!())? as u32)
+            }
+            TLV_IO_MAX => io_max.push(tlv_str(val).c(d!())?),
+            TLV_PIDS_MAX => {
+                cgroup_limits.pids_max = Some(tlv_i32(val).c(d!())? as u32)
+            }
+            // 新版客户端附带的可选字段
+            _ => {}
+        }
+    }
+
+    // 与 v1 相同, 必选字段均不能为 0 或空
+    if 0 == app_id
+        || 0 == uid
+        || app_pkg_path.is_empty()
+        || app_exec_dir.is_empty()
+        || app_data_dir.is_empty()
+    {
+        return Err(errgen!(Unknown, "required field missing!"));
+    }
+
+    Ok(ReqView {
+        app_id,
+        uid,
+        gid,
+        app_pkg_path,
+        app_exec_dir,
+        app_data_dir,
+        overlay_dirs,
+        cgroup_limits,
+        io_max,
+    })
+}
+
+/// 读取 offset 处的 i32, 越界时返回 None
+pub(crate) fn i32_at(buf: &[u8], offset: usize) -> Option<i32> {
+    buf.get(offset..offset + INT_SIZ).map(ne_i32)
+}
+
+#[inline(always)]
+fn ne_i32(b: &[u8]) -> i32 {
+    let mut bytes = [0u8; INT_SIZ];
+    bytes.copy_from_slice(b);
+    i32::from_ne_bytes(bytes)
+}
+
+#[inline(always)]
+fn ne_u32(b: &[u8]) -> u32 {
+    let mut bytes = [0u8; INT_SIZ];
+    bytes.copy_from_slice(b);
+    u32::from_ne_bytes(bytes)
+}
+
+#[inline(always)]
+fn ne_u16(b: &[u8]) -> u16 {
+    let mut bytes = [0u8; 2];
+    bytes.copy_from_slice(b);
+    u16::from_ne_bytes(bytes)
+}
+
+fn tlv_i32(val: &[u8]) -> Result<i32> {
+    alt!(
+        INT_SIZ == val.len(),
+        Ok(ne_i32(val)),
+        Err(errgen!(Unknown, "integer field invalid!"))
+    )
+}
+
+fn tlv_u64(val: &[u8]) -> Result<u64> {
+    let mut bytes = [0u8; 8];
+    alt!(
+        bytes.len() == val.len(),
+        {
+            bytes.copy_from_slice(val);
+            Ok(u64::from_ne_bytes(bytes))
+        },
+        { Err(errgen!(Unknown, "integer field invalid!")) }
+    )
+}
+
+// 两个相邻的 u32, 如 cpu.max 中的 (quota, period)
+fn tlv_u32_pair(val: &[u8]) -> Result<(u32, u32)> {
+    alt!(
+        2 * INT_SIZ == val.len(),
+        Ok((ne_u32(&val[..INT_SIZ]), ne_u32(&val[INT_SIZ..]))),
+        Err(errgen!(Unknown, "integer field invalid!"))
+    )
+}
+
+fn tlv_str(val: &[u8]) -> Result<&str> {
+    if val.contains(&0) {
+        return Err(errgen!(Unknown, "string field contains NUL!"));
+    }
+    str::from_utf8(val).c(d!())
+}
+
+#[allow(non_snake_case)]
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use core::pnk;
+
+    // 按 v2 格式编码, 与 librocker_client 中的 req_encode 一致
+    fn encode_v2(fields: &[(u16, &[u8])]) -> Vec<u8> {
+        let mut req = vec![];
+        req.extend_from_slice(&V2_MAGIC.to_ne_bytes());
+        req.extend_from_slice(&0i32.to_ne_bytes());
+        fields.iter().for_each(|(typ, val)| {
+            req.extend_from_slice(&typ.to_ne_bytes());
+            req.extend_from_slice(&(val.len() as u16).to_ne_bytes());
+            req.extend_from_slice(val);
+        });
+
+        let len = (req.len() as i32).to_ne_bytes();
+        req[INT_SIZ..2 * INT_SIZ].copy_from_slice(&len);
+        req
+    }
+
+    #[test]
+    fn TEST_req_view_v2() {
+        let app_id = 0xffffi32.to_ne_bytes();
+        let uid = 1000i32.to_ne_bytes();
+        let overlay_dirs =
+            (0..40).map(|i| format!("/ov{}", i)).collect::<Vec<_>>();
+
+        let mut fields: Vec<(u16, &[u8])> = vec![
+            (TLV_APP_ID, &app_id[..]),
+            (TLV_UID, &uid[..]),
+            (TLV_APP_PKG_PATH, &b"/etc/passwd"[..]),
+            // 不认识的字段被跳过
+            (0xff00, &b"unknown"[..]),
+            (TLV_APP_EXEC_DIR, &b"/tmp"[..]),
+            (TLV_APP_DATA_DIR, &b"/tmp"[..]),
+        ];
+        overlay_dirs
+            .iter()
+            .for_each(|d| fields.push((TLV_APP_OVERLAY_DIR, d.as_bytes())));
+
+        let mut req = encode_v2(&fields);
+        // 接收缓冲区中, 总长度之后的数据不属于本请求
+        let len = req.len();
+        req.extend_from_slice(&[0xffu8; 7]);
+
+        let v = pnk!(req_view(&req));
+        assert_eq!(0xffff, v.app_id);
+        assert_eq!(1000, v.uid);
+        assert_eq!(None, v.gid);
+        assert_eq!("/etc/passwd", v.app_pkg_path);
+        assert_eq!("/tmp", v.app_exec_dir);
+        assert_eq!("/tmp", v.app_data_dir);
+        assert_eq!(overlay_dirs, v.overlay_dirs);
+
+        // 字符串借用自接收缓冲区
+        let range = req.as_ptr() as usize..req.as_ptr() as usize + len;
+        assert!(range.contains(&(v.app_pkg_path.as_ptr() as usize)));
+
+        let r = pnk!(req_decode(&req));
+        assert_eq!(overlay_dirs, r.overlay_dirs);
+
+        // 截断的请求
+        assert!(req_view(&req[..len - 1]).is_err());
+
+        // 缺少必选字段
+        assert!(req_view(&encode_v2(&fields[1..])).is_err());
+
+        // 字段长度越界
+        let mut bad = encode_v2(&fields[..1]);
+        bad[2 * INT_SIZ + 2] = 0xff;
+        assert!(req_view(&bad).is_err());
+    }
+
+    #[test]
+    fn TEST_req_view_v2_cgroup() {
+        let app_id = 1i32.to_ne_bytes();
+        let memory_max = (256u64 << 20).to_ne_bytes();
+        let mut cpu_max = 50_000u32.to_ne_bytes().to_vec();
+        cpu_max.extend_from_slice(&100_000u32.to_ne_bytes());
+        let pids_max = 64i32.to_ne_bytes();
+
+        let mut fields: Vec<(u16, &[u8])> = vec![
+            (TLV_APP_ID, &app_id[..]),
+            (TLV_UID, &app_id[..]),
+            (TLV_APP_PKG_PATH, &b"/etc/passwd"[..]),
+            (TLV_APP_EXEC_DIR, &b"/tmp"[..]),
+            (TLV_APP_DATA_DIR, &b"/tmp"[..]),
+        ];
+
+        // 不带资源限制
+        let r = pnk!(req_decode(&encode_v2(&fields)));
+        assert!(r.cgroup_limits.is_empty());
+
+        fields.push((TLV_MEMORY_MAX, &memory_max[..]));
+        fields.push((TLV_CPU_MAX, &cpu_max[..]));
+        fields.push((TLV_IO_MAX, &b"8:0 rbps=1048576"[..]));
+        fields.push((TLV_IO_MAX, &b"8:16 wiops=120"[..]));
+        fields.push((TLV_PIDS_MAX, &pids_max[..]));
+
+        let r = pnk!(req_decode(&encode_v2(&fields)));
+        assert_eq!(
+            core::CgroupLimits {
+                memory_max: Some(256 << 20),
+                cpu_max: Some((50_000, 100_000)),
+                io_max: vec![
+                    "8:0 rbps=1048576".to_owned(),
+                    "8:16 wiops=120".to_owned()
+                ],
+                pids_max: Some(64),
+                ..Default::default()
+            },
+            r.cgroup_limits
+        );
+
+        // 长度不符的整数字段
+        fields.push((TLV_MEMORY_HIGH, &pids_max[..]));
+        assert!(req_view(&encode_v2(&fields)).is_err());
+    }
+}
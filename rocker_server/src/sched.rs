@@ -0,0 +1,373 @@
+//! 请求处理线程的调度.
+//!
+//! 线程数量随队列深度在 [min, max] 之间伸缩: 排队的任务多于空闲线程时新增线程,
+//! 空闲超时的线程在数量多于 min 时退出.
+//! 同时统计队列深度, 任务从入队到开始执行的延迟(dispatch), 以及从入队到执行完毕,
+//! 即应答已发出的延迟(launch), 供 SIGUSR1 触发时及 stats 请求输出.
+//! 两项延迟除最近的样本之外, 另以对数直方图累计全部样本.
+
+use std::{
+    collections::VecDeque,
+    env,
+    panic::{self, AssertUnwindSafe},
+    sync::{Arc, Condvar, Mutex},
+    thread,
+    time::{Duration, Instant},
+};
+
+type Job = Box<dyn FnOnce() + Send + 'static>;
+
+// 处理线程数量的上限, 未设置时按 CPU 数量计算
+const ENV_WORKERS_MAX: &str = "ROCKER_WORKERS_MAX";
+
+// 常驻的处理线程数量
+const WORKERS_MIN: usize = 2;
+
+// 空闲线程的存活时间
+const IDLE_TIMEOUT: Duration = Duration::from_secs(10);
+
+// 每项延迟指标保留的最近样本数量
+const SAMPLE_CAP: usize = 4096;
+
+// 延迟直方图的桶数量: 第 k 个桶统计 [2^k, 2^(k+1)) 微秒内的样本,
+// 不足 1 微秒的计入首个桶, 超出范围(约 16 秒)的计入最后一个桶
+const HIST_BUCKETS: usize = 24;
+
+/// 可伸缩的线程池
+#[derive(Clone)]
+pub(crate) struct Sched {
+    inner: Arc<Inner>,
+}
+
+struct Inner {
+    min: usize,
+    max: usize,
+    idle_timeout: Duration,
+    born: Instant,
+    state: Mutex<State>,
+    cond: Condvar,
+    stats: Mutex<Stats>,
+}
+
+struct State {
+    jobs: VecDeque<(Instant, Job)>,
+    workers: usize,
+    idle: usize,
+}
+
+#[derive(Default)]
+struct Stats {
+    done: u64,
+    queue_peak: usize,
+    workers_peak: usize,
+    // 各线程执行任务的累计时长
+    busy_us: u64,
+    dispatch_us: VecDeque<u64>,
+    launch_us: VecDeque<u64>,
+    dispatch_hist: [u64; HIST_BUCKETS],
+    launch_hist: [u64; HIST_BUCKETS],
+}
+
+/// 调度状态的快照
+#[derive(Debug)]
+pub(crate) struct Snapshot {
+    pub(crate) queue_depth: usize,
+    pub(crate) queue_peak: usize,
+    pub(crate) workers: usize,
+    pub(crate) workers_peak: usize,
+    // 正在执行任务的线程数量
+    pub(crate) busy: usize,
+    // 线程池创建至今的时长, 及各线程执行任务的累计时长, 二者之比即平均繁忙线程数
+    pub(crate) uptime_us: u64,
+    pub(crate) busy_us: u64,
+    pub(crate) done: u64,
+    pub(crate) dispatch_p50_us: u64,
+    pub(crate) dispatch_p99_us: u64,
+    pub(crate) launch_p50_us: u64,
+    pub(crate) launch_p99_us: u64,
+    pub(crate) dispatch_hist: [u64; HIST_BUCKETS],
+    pub(crate) launch_hist: [u64; HIST_BUCKETS],
+}
+
+impl Sched {
+    /// 创建线程池, 并启动 min 个常驻线程
+    pub(crate) fn new(
+        min: usize,
+        max: usize,
+        idle_timeout: Duration,
+    ) -> Sched {
+        let min = min.max(1);
+        let sched = Sched {
+            inner: Arc::new(Inner {
+                min,
+                max: max.max(min),
+                idle_timeout,
+                born: Instant::now(),
+                state: Mutex::new(State {
+                    jobs: VecDeque::new(),
+                    workers: min,
+                    idle: 0,
+                }),
+                cond: Condvar::new(),
+                stats: Mutex::new(Stats {
+                    workers_peak: min,
+                    ..Default::default()
+                }),
+            }),
+        };
+
+        (0..min).for_each(|_| sched.spawn());
+
+        sched
+    }
+
+    /// 上限取自环境变量 `ROCKER_WORKERS_MAX`, 默认为 CPU 数量的 4 倍:
+    /// 创建 ROCKER 的大部分时间耗费在挂载等阻塞型系统调用上
+    pub(crate) fn from_env() -> Sched {
+        let max = env::var(ENV_WORKERS_MAX)
+            .ok()
+            .and_then(|v| v.trim().parse::<usize>().ok())
+            .unwrap_or_else(|| 4 * ncpu());
+
+        Sched::new(WORKERS_MIN, max, IDLE_TIMEOUT)
+    }
+
+    /// 提交任务, 排队的任务多于空闲线程时新增线程
+    pub(crate) fn execute<F>(&self, job: F)
+    where
+        F: FnOnce() + Send + 'static,
+    {
+        let mut state = self.inner.state.lock().unwrap();
+        state.jobs.push_back((Instant::now(), Box::new(job)));
+
+        let depth = state.jobs.len();
+        let grow = depth > state.idle && state.workers < self.inner.max;
+        if grow {
+            state.workers += 1;
+        }
+        let workers = state.workers;
+        drop(state);
+
+        self.inner.cond.notify_one();
+        if grow {
+            self.spawn();
+        }
+
+        let mut stats = self.inner.stats.lock().unwrap();
+        stats.queue_peak = stats.queue_peak.max(depth);
+        stats.workers_peak = stats.workers_peak.max(workers);
+    }
+
+    /// 返回当前的调度状态
+    pub(crate) fn snapshot(&self) -> Snapshot {
+        let (queue_depth, workers, idle) = {
+            let state = self.inner.state.lock().unwrap();
+            (state.jobs.len(), state.workers, state.idle)
+        };
+
+        let stats = self.inner.stats.lock().unwrap();
+        let (dispatch_p50_us, dispatch_p99_us) =
+            percentiles(&stats.dispatch_us);
+        let (launch_p50_us, launch_p99_us) = percentiles(&stats.launch_us);
+
+        Snapshot {
+            queue_depth,
+            queue_peak: stats.queue_peak,
+            workers,
+            workers_peak: stats.workers_peak,
+            busy: workers.saturating_sub(idle),
+            uptime_us: self.inner.born.elapsed().as_micros() as u64,
+            busy_us: stats.busy_us,
+            done: stats.done,
+            dispatch_p50_us,
+            dispatch_p99_us,
+            launch_p50_us,
+            launch_p99_us,
+            dispatch_hist: stats.dispatch_hist,
+            launch_hist: stats.launch_hist,
+        }
+    }
+
+    // 线程数量已由调用方计入 workers
+    fn spawn(&self) {
+        let inner = Arc::clone(&self.inner);
+        thread::spawn(move || inner.work());
+    }
+}
+
+impl Inner {
+    fn work(&self) {
+        loop {
+            let (enqueued, job) = match self.next() {
+                Some(j) => j,
+                None => return,
+            };
+
+            let started = Instant::now();
+
+            // 单个任务 panic 不影响线程继续服务
+            let _ = panic::catch_unwind(AssertUnwindSafe(job));
+
+            let busy = started.elapsed();
+            let dispatch = started.duration_since(enqueued);
+            let launch = enqueued.elapsed();
+
+            let mut stats = self.stats.lock().unwrap();
+            let stats = &mut *stats;
+            stats.done += 1;
+            stats.busy_us += busy.as_micros() as u64;
+            sample(&mut stats.dispatch_us, &mut stats.dispatch_hist, dispatch);
+            sample(&mut stats.launch_us, &mut stats.launch_hist, launch);
+        }
+    }
+
+    // 取出下一个任务; 空闲超时且线程数量多于 min 时返回 None, 线程随之退出
+    fn next(&self) -> Option<(Instant, Job)> {
+        let mut state = self.state.lock().unwrap();
+        loop {
+            if let Some(j) = state.jobs.pop_front() {
+                return Some(j);
+            }
+
+            state.idle += 1;
+            let (s, timeout) =
+                self.cond.wait_timeout(state, self.idle_timeout).unwrap();
+            state = s;
+            state.idle -= 1;
+
+            if timeout.timed_out()
+                && state.jobs.is_empty()
+                && state.workers > self.min
+            {
+                state.workers -= 1;
+                return None;
+            }
+        }
+    }
+}
+
+impl Snapshot {
+    /// 以单行 JSON 格式输出
+    pub(crate) fn to_json(&self) -> String {
+        let hist = |h: &[u64]| {
+            h.iter()
+                .map(|n| n.to_string())
+                .collect::<Vec<_>>()
+                .join(",")
+        };
+
+        format!(
+            "{{\"queue_depth\":{},\"queue_peak\":{},\"workers\":{},\"workers_peak\":{},\"busy\":{},\"uptime_us\":{},\"busy_us\":{},\"done\":{},\"dispatch_p50_us\":{},\"dispatch_p99_us\":{},\"launch_p50_us\":{},\"launch_p99_us\":{},\"dispatch_hist_log2_us\":[{}],\"launch_hist_log2_us\":[{}]}}",
+            self.queue_depth,
+            self.queue_peak,
+            self.workers,
+            self.workers_peak,
+            self.busy,
+            self.uptime_us,
+            self.busy_us,
+            self.done,
+            self.dispatch_p50_us,
+            self.dispatch_p99_us,
+            self.launch_p50_us,
+            self.launch_p99_us,
+            hist(&self.dispatch_hist),
+            hist(&self.launch_hist)
+        )
+    }
+}
+
+fn sample(
+    samples: &mut VecDeque<u64>,
+    hist: &mut [u64; HIST_BUCKETS],
+    d: Duration,
+) {
+    let us = d.as_micros() as u64;
+    if SAMPLE_CAP == samples.len() {
+        samples.pop_front();
+    }
+    samples.push_back(us);
+
+    let k = 63 - us.max(1).leading_zeros() as usize;
+    hist[k.min(HIST_BUCKETS - 1)] += 1;
+}
+
+// (p50, p99), 没有样本时均为 0
+fn percentiles(samples: &VecDeque<u64>) -> (u64, u64) {
+    if samples.is_empty() {
+        return (0, 0);
+    }
+
+    let mut s = samples.iter().copied().collect::<Vec<_>>();
+    s.sort_unstable();
+    let at = |p: usize| s[(s.len() - 1) * p / 100];
+
+    (at(50), at(99))
+}
+
+fn ncpu() -> usize {
+    let n = unsafe { libc::sysconf(libc::_SC_NPROCESSORS_ONLN) };
+    if 0 < n {
+        n as usize
+    } else {
+        1
+    }
+}
+
+#[allow(non_snake_case)]
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::atomic::{AtomicUsize, Ordering};
+
+    // 模拟 200 个并发请求的突发
+    #[test]
+    fn TEST_sched_burst() {
+        let sched = Sched::new(2, 32, Duration::from_millis(200));
+        let cnt = Arc::new(AtomicUsize::new(0));
+
+        (0..200).for_each(|_| {
+            let cnt = Arc::clone(&cnt);
+            sched.execute(move || {
+                thread::sleep(Duration::from_millis(5));
+                cnt.fetch_add(1, Ordering::Relaxed);
+            })
+        });
+
+        while 200 > sched.snapshot().done {
+            thread::sleep(Duration::from_millis(10));
+        }
+
+        let s = sched.snapshot();
+        assert_eq!(200, cnt.load(Ordering::Relaxed));
+        assert_eq!(0, s.queue_depth);
+        assert!(2 < s.workers_peak && 32 >= s.workers_peak);
+        assert!(0 < s.queue_peak);
+        assert!(s.dispatch_p99_us <= s.launch_p99_us);
+        assert!(5000 <= s.launch_p50_us);
+        assert_eq!(200, s.launch_hist.iter().sum::<u64>());
+        // 每个任务至少耗时 5ms, 即不早于 [4096, 8192) 微秒所在的桶
+        assert_eq!(0, s.launch_hist[..12].iter().sum::<u64>());
+        assert!(200 * 5000 <= s.busy_us);
+
+        // 空闲线程超时退出, 回落到 min
+        thread::sleep(Duration::from_millis(600));
+        assert_eq!(2, sched.snapshot().workers);
+    }
+
+    #[test]
+    fn TEST_sched_panic() {
+        let sched = Sched::new(1, 1, Duration::from_secs(1));
+        sched.execute(|| panic!("expected"));
+
+        let cnt = Arc::new(AtomicUsize::new(0));
+        let c = Arc::clone(&cnt);
+        sched.execute(move || {
+            c.fetch_add(1, Ordering::Relaxed);
+        });
+
+        while 2 > sched.snapshot().done {
+            thread::sleep(Duration::from_millis(10));
+        }
+        assert_eq!(1, cnt.load(Ordering::Relaxed));
+    }
+}
@@ -0,0 +1,229 @@
+//! 服务端状态查询.
+//!
+//! stats 请求只含 4 字节的 STATS_MAGIC, 应答为一条 JSON 文本, 包括:
+//! 各项计数(创建成功/失败, 被拒绝的请求, 已回收的 JG), 调度状态(队列深度, 线程利用率, 延迟直方图),
+//! 使用中的 loop 设备及 loop 设备池的统计, 以及存活的 JG 及其 app_id, uid, App 包, loop 设备, 存活时长.
+//! 应答由一个专用线程生成, 不受请求队列积压的影响; 其队列有界,
+//! 已满时直接回送 busy, 查询洪泛不会导致线程或内存无限增长.
+//!
+//! stats_map 请求只含 4 字节的 STATS_MAP_MAGIC, 应答为共享内存状态页的只读描述符,
+//! 客户端映射之后可随时读取各项计数及 JG 记录, 无需再发送请求, 参见 core 中的 stats_page 模块.
+//!
+//! 两种方式下均只接受 root 的查询: 连接方式下依据 SO_PEERCRED,
+//! 数据报方式下依据消息附带的 SCM_CREDENTIALS.
+
+use crate::{
+    err::*,
+    peer::Peer,
+    proto::{i32_at, INT_SIZ},
+    sched::Sched,
+};
+use core::{_info, d, json_escape};
+use std::{
+    sync::mpsc::{sync_channel, SyncSender, TrySendError},
+    thread,
+};
+
+// stats 请求的标识, 须与 rockerctl 保持一致
+pub(crate) const STATS_MAGIC: i32 = -0x5354_4154;
+
+// stats_map 请求的标识, 须与 librocker_client 保持一致
+pub(crate) const STATS_MAP_MAGIC: i32 = -0x5354_4d50;
+
+// 应答中最多列出的 JG 数量, 以免超出单条消息的长度上限
+const GUARDS_MAX: usize = 256;
+
+// 等待生成应答的 stats 请求数量上限
+const QUEUE_CAP: usize = 16;
+
+const DENIED: &str = "{\"error\":\"permission denied\"}";
+const BUSY: &str = "{\"error\":\"busy\"}";
+
+/// stats 请求的专用处理线程及其有界队列
+pub(crate) struct StatsServer {
+    tx: SyncSender<Peer>,
+}
+
+impl StatsServer {
+    /// 启动处理线程, 须在屏蔽信号之后调用, 以使其继承信号掩码
+    pub(crate) fn new(
+        sched: Sched,
+        resource: core::ResourceHdr,
+    ) -> StatsServer {
+        let (tx, rx) = sync_channel::<Peer>(QUEUE_CAP);
+        thread::spawn(move || {
+            rx.iter().for_each(|peer| serve(&sched, &resource, &peer))
+        });
+        StatsServer { tx }
+    }
+
+    /// 校验调用方之后入队, 不阻塞事件循环;
+    /// 非 root 的调用方收到 permission denied, 队列已满时收到 busy
+    pub(crate) fn submit(&self, peer: Peer) {
+        if peer.check_root().is_err() {
+            _info!(peer.send(&[DENIED.as_bytes()], &[]));
+            return;
+        }
+        if let Err(e) = self.tx.try_send(peer) {
+            let peer = match e {
+                TrySendError::Full(p) | TrySendError::Disconnected(p) => p,
+            };
+            _info!(peer.send(&[BUSY.as_bytes()], &[]));
+        }
+    }
+}
+
+/// 是否为 stats 请求
+pub(crate) fn is_stats(req: &[u8]) -> bool {
+    INT_SIZ == req.len() && Some(STATS_MAGIC) == i32_at(req, 0)
+}
+
+/// 是否为 stats_map 请求
+pub(crate) fn is_stats_map(req: &[u8]) -> bool {
+    INT_SIZ == req.len() && Some(STATS_MAP_MAGIC) == i32_at(req, 0)
+}
+
+/// 回送状态页的只读描述符: 应答为 4 字节的 0, 附带描述符;
+/// 非 root 的调用方或不支持 memfd 时, 应答为 -1, 不附带描述符
+pub(crate) fn serve_map(peer: &Peer) {
+    let fd = peer.check_root().ok().and_then(|_| core::stats_page_fd());
+    _info!(match fd {
+        Some(fd) => peer.send(&[&0i32.to_ne_bytes()], &[fd]),
+        None => peer.send(&[&(-1i32).to_ne_bytes()], &[]),
+    });
+}
+
+// 生成并回送状态数据, 调用方已由 submit 校验
+fn serve(sched: &Sched, resource: &core::Registry, peer: &Peer) {
+    let json = to_json(sched, resource);
+    _info!(peer.send(&[json.as_bytes()], &[]));
+}
+
+fn to_json(sched: &Sched, resource: &core::Registry) -> String {
+    let mut guards = Vec::with_capacity(GUARDS_MAX);
+    let mut guards_total = 0;
+    resource.for_each(|pid, cfg| {
+        guards_total += 1;
+        if GUARDS_MAX > guards.len() {
+            guards.push(format!(
+                "{{\"pid\":{},\"app_id\":{},\"uid\":{},\"gid\":{},\"pkg\":\"{}\",\"loop_id\":{},\"age_ms\":{},\"activated\":{}}}",
+                pid,
+                cfg.app_id,
+                cfg.uid,
+                cfg.gid.map_or("null".to_owned(), |g| g.to_string()),
+                json_escape(&cfg.app_pkg_path),
+                cfg.get_loop_id()
+                    .map_or("null".to_owned(), |l| l.to_string()),
+                cfg.get_age().as_millis(),
+                cfg.is_activated()
+            ));
+        }
+    });
+
+    let loops = core::pkg_cache_loops()
+        .iter()
+        .map(|(id, refs)| {
+            format!("{{\"loop_id\":{},\"guards\":{}}}", id, refs)
+        })
+        .collect::<Vec<_>>();
+    let pool = core::loop_stats();
+    let cnt = core::stats_counters();
+
+    format!(
+        "{{\"counters\":{{\"launched\":{},\"failed\":{},\"rejected\":{},\"reaped\":{}}},\"sched\":{},\"loops\":{{\"in_use\":[{}],\"pool\":{{\"hits\":{},\"misses\":{},\"recycled\":{},\"destroyed\":{},\"deferred\":{},\"idle\":{}}}}},\"guards_total\":{},\"guards\":[{}]}}",
+        cnt.launched,
+        cnt.failed,
+        cnt.rejected,
+        cnt.reaped,
+        sched.snapshot().to_json(),
+        loops.join(","),
+        pool.hits,
+        pool.misses,
+        pool.recycled,
+        pool.destroyed,
+        pool.deferred,
+        pool.idle,
+        guards_total,
+        guards.join(",")
+    )
+}
+
+#[allow(non_snake_case)]
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use core::pnk;
+    use nix::{
+        sys::socket::{
+            bind, recv, socket, AddressFamily, MsgFlags, SockAddr, SockFlag,
+            SockType, UnixAddr,
+        },
+        unistd::{close, getpid},
+    };
+    use std::{sync::mpsc::sync_channel, time::Duration};
+
+    #[test]
+    fn TEST_is_stats() {
+        assert!(is_stats(&STATS_MAGIC.to_ne_bytes()));
+        assert!(!is_stats(&0i32.to_ne_bytes()));
+        assert!(!is_stats(&[0u8; 2 * INT_SIZ]));
+        assert!(!is_stats(&STATS_MAP_MAGIC.to_ne_bytes()));
+        assert!(is_stats_map(&STATS_MAP_MAGIC.to_ne_bytes()));
+    }
+
+    #[test]
+    fn TEST_to_json() {
+        let sched = Sched::new(1, 1, Duration::from_secs(1));
+        let json = to_json(&sched, &core::Registry::new());
+        assert!(json.starts_with("{\"counters\":{\"launched\":"));
+        assert!(json.ends_with("\"guards_total\":0,\"guards\":[]}"));
+    }
+
+    #[test]
+    fn TEST_submit() {
+        let dgram = || {
+            pnk!(socket(
+                AddressFamily::Unix,
+                SockType::Datagram,
+                SockFlag::SOCK_CLOEXEC,
+                None
+            ))
+        };
+        let (fd, cli_fd) = (dgram(), dgram());
+        let addr = SockAddr::Unix(pnk!(UnixAddr::new_abstract(
+            format!("rocker_stats_test_{}", getpid()).as_bytes()
+        )));
+        pnk!(bind(cli_fd, &addr));
+
+        let resp = || {
+            let mut buf = [0u8; 4096];
+            let n = pnk!(recv(cli_fd, &mut buf, MsgFlags::empty()));
+            String::from_utf8_lossy(&buf[..n]).into_owned()
+        };
+
+        // 未附带凭证或非 root 的查询被拒绝
+        let sched = Sched::new(1, 1, Duration::from_secs(1));
+        let stats = StatsServer::new(
+            sched,
+            std::sync::Arc::new(core::Registry::new()),
+        );
+        stats.submit(Peer::Dgram(fd, addr, None));
+        assert_eq!(DENIED, resp());
+        stats.submit(Peer::Dgram(fd, addr, Some(1000)));
+        assert_eq!(DENIED, resp());
+
+        stats.submit(Peer::Dgram(fd, addr, Some(0)));
+        assert!(resp().starts_with("{\"counters\":"));
+
+        // 队列已满时直接回送 busy
+        let (tx, _rx) = sync_channel(QUEUE_CAP);
+        let stats = StatsServer { tx };
+        (0..QUEUE_CAP)
+            .for_each(|_| stats.submit(Peer::Dgram(fd, addr, Some(0))));
+        stats.submit(Peer::Dgram(fd, addr, Some(0)));
+        assert_eq!(BUSY, resp());
+
+        pnk!(close(fd));
+        pnk!(close(cli_fd));
+    }
+}